@@ -21,11 +21,13 @@
 #include <linux/interrupt.h>
 #include <linux/spinlock.h>
 #include <linux/completion.h>
+#include <linux/proc_fs.h>
 
 #include <asm/types.h>
 #include <asm/io.h>
 #include <asm/irq.h>
 #include <asm/pgtable.h>
+#include <asm/div64.h>
 #include <asm/ps2/irq.h>
 #include <asm/ps2/dma.h>
 
@@ -39,6 +41,32 @@ struct dma_channel ps2dma_channels[] = {
     { IRQ_DMAC_9, KSEG1ADDR(0x1000d400), DMA_SENDCH, 1, "toSPR DMA", },
 };
 
+#define CYCLES_PER_SEC	294912000	/* R5900 count register */
+
+/*
+ * Charge the time since the last call to busy or idle, depending on
+ * whether a request is being processed. Call with ch->lock held and
+ * before ch->tail changes.
+ */
+void ps2dma_account(struct dma_channel *ch)
+{
+    cycles_t now = get_cycles();
+    unsigned long long delta;
+
+    /* the count register wraps in about 14 seconds */
+    if (jiffies - ch->stamp_jiffies < 10 * HZ)
+	delta = (cycles_t)(now - ch->stamp);
+    else
+	delta = (unsigned long long)(jiffies - ch->stamp_jiffies) * (CYCLES_PER_SEC / HZ);
+
+    if (ch->tail != NULL)
+	ch->busy_cycles += delta;
+    else
+	ch->idle_cycles += delta;
+    ch->stamp = now;
+    ch->stamp_jiffies = jiffies;
+}
+
 void ps2dma_intr_handler(int irq, void *dev_id, struct pt_regs *regs)
 {
     unsigned long flags;
@@ -64,8 +92,12 @@ void ps2dma_intr_handler(int irq, void *dev_id, struct pt_regs *regs)
 	}
     }
 
-    if ((ch->tail = next_req) != NULL)
+    if (next_req == NULL)
+	ps2dma_account(ch);
+    if ((ch->tail = next_req) != NULL) {
+	ch->nstart++;
 	next_req->ops->start(next_req, ch);
+    }
 
     cur_req->ops->free(cur_req, ch);
 
@@ -73,15 +105,30 @@ void ps2dma_intr_handler(int irq, void *dev_id, struct pt_regs *regs)
 }
 
 void ps2dma_add_queue(struct dma_request *req, struct dma_channel *ch)
+{
+    ps2dma_add_queue_seq(req, ch, NULL);
+}
+
+/*
+ * Like ps2dma_add_queue(), and if seq is given, advance it under the
+ * queue lock and return its new value, so that the numbers handed out
+ * follow the order of the requests on the channel.
+ */
+int ps2dma_add_queue_seq(struct dma_request *req, struct dma_channel *ch, int *seq)
 {
     unsigned long flags;
+    int n = 0;
 
     flush_cache_all();
 
     spin_lock_irqsave(&ch->lock, flags);
 
+    if (seq)
+	n = ++*seq;
     if (ch->tail == NULL) {
+	ps2dma_account(ch);
 	ch->tail = ch->head = req;
+	ch->nstart++;
 	req->ops->start(req, ch);
     } else {
 	ch->head->next = req;
@@ -89,6 +136,7 @@ void ps2dma_add_queue(struct dma_request *req, struct dma_channel *ch)
     }
 
     spin_unlock_irqrestore(&ch->lock, flags);
+    return n;
 }
 
 /*
@@ -241,6 +289,56 @@ int ps2sdma_send(int chno, void *ptr, int len)
     return 0;
 }
 
+#ifdef CONFIG_PROC_FS
+static int ps2dma_read_proc(char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+    unsigned long flags;
+    struct dma_channel *ch;
+    unsigned long long busy, idle;
+    unsigned long busyms, idlems, total;
+    int i, len;
+    char *p = page;
+
+    p += sprintf(p, "channel        busy(ms)    idle(ms) busy%%    requests\n");
+    for (i = 0; i < sizeof(ps2dma_channels) / sizeof(ps2dma_channels[0]); i++) {
+	ch = &ps2dma_channels[i];
+	spin_lock_irqsave(&ch->lock, flags);
+	ps2dma_account(ch);
+	busy = ch->busy_cycles;
+	idle = ch->idle_cycles;
+	spin_unlock_irqrestore(&ch->lock, flags);
+
+	do_div(busy, CYCLES_PER_SEC / 1000);
+	do_div(idle, CYCLES_PER_SEC / 1000);
+	busyms = busy;
+	idlems = idle;
+	total = busyms + idlems;
+	p += sprintf(p, "%-12s %10lu  %10lu  %3lu %11lu\n", ch->device,
+		     busyms, idlems, total >= 100 ? busyms / (total / 100) : 0,
+		     ch->nstart);
+    }
+
+    len = p - page;
+    if (len <= off + count)
+	*eof = 1;
+    *start = page + off;
+    len -= off;
+    if (len > count)
+	len = count;
+    if (len < 0)
+	len = 0;
+    return len;
+}
+
+static int __init ps2dma_proc_init(void)
+{
+    create_proc_read_entry("ps2dma", 0, NULL, ps2dma_read_proc, NULL);
+    return 0;
+}
+
+__initcall(ps2dma_proc_init);
+#endif
+
 /*
  * Initialize DMA handlers
  */
@@ -251,6 +349,8 @@ void __init ps2dma_init(void)
 
     for (i = 0; i < sizeof(ps2dma_channels) / sizeof(ps2dma_channels[0]); i++) {
     	spin_lock_init(&ps2dma_channels[i].lock);
+	ps2dma_channels[i].stamp = get_cycles();
+	ps2dma_channels[i].stamp_jiffies = jiffies;
 	if (request_irq(ps2dma_channels[i].irq, ps2dma_intr_handler,
 			SA_INTERRUPT, ps2dma_channels[i].device,
 			&ps2dma_channels[i]))
@@ -261,6 +361,8 @@ void __init ps2dma_init(void)
 EXPORT_SYMBOL(ps2dma_channels);
 EXPORT_SYMBOL(ps2dma_intr_handler);
 EXPORT_SYMBOL(ps2dma_add_queue);
+EXPORT_SYMBOL(ps2dma_add_queue_seq);
+EXPORT_SYMBOL(ps2dma_account);
 EXPORT_SYMBOL(ps2dma_complete);
 EXPORT_SYMBOL(ps2dma_init_completion);
 EXPORT_SYMBOL(ps2dma_intr_safe_wait_for_completion);
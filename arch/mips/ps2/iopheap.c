@@ -14,6 +14,10 @@
 #include <linux/types.h>
 #include <linux/module.h>
 #include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/bitops.h>
+#include <linux/proc_fs.h>
 #include <asm/semaphore.h>
 #include <asm/ps2/sifdefs.h>
 #include <asm/ps2/sbcall.h>
@@ -26,12 +30,314 @@ EXPORT_SYMBOL(ps2sif_freeiopheap);
 EXPORT_SYMBOL(ps2sif_virttobus);
 EXPORT_SYMBOL(ps2sif_bustovirt);
 
+/*
+ * EE side IOP heap cache
+ *
+ * Every SBR_IOPH_ALLOC/SBR_IOPH_FREE is a synchronous round trip to the
+ * IOP, and small buffers scattered over the 2MB of IOP RAM fragment it
+ * badly over time.  Requests up to IOPHEAP_MAXOBJSIZE are therefore
+ * carved out of IOPHEAP_CHUNKSIZE chunks that are obtained from the IOP
+ * once and kept per power-of-two size class.  Larger requests still go
+ * straight to the IOP but are recorded so that /proc/ps2sif/iopheap can
+ * account for them too.  Object offsets within a chunk are multiples of
+ * the class size, so the alignment the IOP gave the chunk is preserved.
+ * Each class caches at most one empty slab, and all of them are given
+ * back when the IOP runs out of memory.
+ */
+#define IOPHEAP_MINSHIFT	6		/* 64 bytes */
+#define IOPHEAP_MAXSHIFT	12		/* 4K bytes */
+#define IOPHEAP_NCLASSES	(IOPHEAP_MAXSHIFT - IOPHEAP_MINSHIFT + 1)
+#define IOPHEAP_MAXOBJSIZE	(1 << IOPHEAP_MAXSHIFT)
+#define IOPHEAP_CHUNKSIZE	(16 * 1024)
+#define IOPHEAP_MAXOBJS		(IOPHEAP_CHUNKSIZE >> IOPHEAP_MINSHIFT)
+#define IOPHEAP_MAPWORDS	(IOPHEAP_MAXOBJS / 32)
+#define IOPHEAP_NCALLERS	32
+#define IOPHEAP_NOCALLER	0xff
+
+struct iopheap_slab {
+    struct list_head list;
+    unsigned long addr;			/* IOP address of the chunk */
+    int nfree;
+    u_int32_t freemap[IOPHEAP_MAPWORDS];	/* 1 = free */
+    unsigned char owner[IOPHEAP_MAXOBJS];	/* index to iopheap_callers */
+    unsigned short reqsize[IOPHEAP_MAXOBJS];
+};
+
+struct iopheap_class {
+    struct list_head slabs;
+    int objsize;
+    int nobjs;				/* objects per slab */
+    int nslabs;
+    int nempty;				/* slabs with no object in use */
+    int inuse;				/* objects in use */
+    unsigned long requested;		/* bytes requested by callers */
+    unsigned long hits;			/* served without an RPC */
+};
+
+struct iopheap_block {
+    struct list_head list;
+    unsigned long addr;
+    int size;
+    int owner;
+};
+
+struct iopheap_caller {
+    void *caller;
+    unsigned long nalloc;
+    unsigned long nfree;
+    unsigned long nfail;
+    long inuse;				/* bytes granted, not freed */
+    long peak;
+};
+
+static struct iopheap_class iopheap_classes[IOPHEAP_NCLASSES];
+static struct list_head iopheap_blocks = LIST_HEAD_INIT(iopheap_blocks);
+static struct iopheap_caller iopheap_callers[IOPHEAP_NCALLERS];
+static int iopheap_ncallers;
+static unsigned long iopheap_nrpc_alloc, iopheap_nrpc_free;
+static unsigned long iopheap_nunknown;
+static long iopheap_chunkbytes, iopheap_blockbytes;
+
+static void *iopheap_rpc_alloc(int size)
+{
+    struct sbr_ioph_alloc_arg arg;
+    int result;
+
+    arg.size = size;
+    iopheap_nrpc_alloc++;
+    if (sbios_rpc(SBR_IOPH_ALLOC, &arg, &result) < 0)
+	return NULL;
+    return (void *)result;
+}
+
+static int iopheap_rpc_free(void *addr)
+{
+    struct sbr_ioph_free_arg arg;
+    int result;
+
+    arg.addr = addr;
+    iopheap_nrpc_free++;
+    if (sbios_rpc(SBR_IOPH_FREE, &arg, &result) < 0)
+	return -1;
+    return result;
+}
+
+static int iopheap_caller_index(void *caller)
+{
+    int i;
+
+    for (i = 0; i < iopheap_ncallers; i++)
+	if (iopheap_callers[i].caller == caller)
+	    return i;
+    if (iopheap_ncallers < IOPHEAP_NCALLERS) {
+	iopheap_callers[i].caller = caller;
+	return iopheap_ncallers++;
+    }
+    return IOPHEAP_NOCALLER;
+}
+
+static void iopheap_account(int owner, long bytes)
+{
+    struct iopheap_caller *c;
+
+    if (owner == IOPHEAP_NOCALLER)
+	return;
+    c = &iopheap_callers[owner];
+    c->inuse += bytes;
+    if (0 < bytes) {
+	c->nalloc++;
+	if (c->peak < c->inuse)
+	    c->peak = c->inuse;
+    } else {
+	c->nfree++;
+    }
+}
+
+static int iopheap_size_class(int size)
+{
+    int cls = 0;
+
+    while ((1 << (cls + IOPHEAP_MINSHIFT)) < size)
+	cls++;
+    return cls;
+}
+
+static struct iopheap_slab *iopheap_slab_grow(struct iopheap_class *ic)
+{
+    struct iopheap_slab *slab;
+    int i;
+
+    slab = kmalloc(sizeof(*slab), GFP_KERNEL);
+    if (slab == NULL)
+	return NULL;
+    slab->addr = (unsigned long)iopheap_rpc_alloc(IOPHEAP_CHUNKSIZE);
+    if (slab->addr == 0) {
+	kfree(slab);
+	return NULL;
+    }
+    memset(slab->freemap, 0, sizeof(slab->freemap));
+    for (i = 0; i < ic->nobjs; i++)
+	slab->freemap[i / 32] |= (1 << (i % 32));
+    slab->nfree = ic->nobjs;
+    list_add_tail(&slab->list, &ic->slabs);
+    ic->nslabs++;
+    ic->nempty++;
+    iopheap_chunkbytes += IOPHEAP_CHUNKSIZE;
+
+    return slab;
+}
+
+/* give the empty slabs of a class beyond the first keep back to the IOP */
+static void iopheap_slab_trim(struct iopheap_class *ic, int keep)
+{
+    struct iopheap_slab *slab;
+    struct list_head *p, *n;
+
+    list_for_each_safe(p, n, &ic->slabs) {
+	slab = list_entry(p, struct iopheap_slab, list);
+	if (slab->nfree != ic->nobjs)
+	    continue;
+	if (0 < keep) {
+	    keep--;		/* the oldest empty slabs are kept */
+	    continue;
+	}
+	list_del(&slab->list);
+	iopheap_rpc_free((void *)slab->addr);
+	kfree(slab);
+	ic->nslabs--;
+	ic->nempty--;
+	iopheap_chunkbytes -= IOPHEAP_CHUNKSIZE;
+    }
+}
+
+static void *iopheap_slab_alloc(int size, int owner)
+{
+    struct iopheap_class *ic = &iopheap_classes[iopheap_size_class(size)];
+    struct iopheap_slab *slab = NULL;
+    struct list_head *p;
+    int i, obj;
+
+    /* older slabs first, so that the newer ones can drain and be freed */
+    list_for_each(p, &ic->slabs) {
+	slab = list_entry(p, struct iopheap_slab, list);
+	if (slab->nfree != 0)
+	    break;
+	slab = NULL;
+    }
+    if (slab == NULL) {
+	if ((slab = iopheap_slab_grow(ic)) == NULL)
+	    return NULL;
+    } else {
+	ic->hits++;
+    }
+
+    for (i = 0; slab->freemap[i] == 0; i++)
+	;
+    obj = i * 32 + ffs(slab->freemap[i]) - 1;
+    slab->freemap[i] &= ~(1 << (obj % 32));
+    slab->owner[obj] = owner;
+    slab->reqsize[obj] = size;
+    if (slab->nfree-- == ic->nobjs)
+	ic->nempty--;
+    ic->inuse++;
+    ic->requested += size;
+    iopheap_account(owner, ic->objsize);
+
+    return (void *)(slab->addr + obj * ic->objsize);
+}
+
+/* returns 1 if addr belonged to a slab, 0 otherwise */
+static int iopheap_slab_free(unsigned long addr)
+{
+    struct iopheap_class *ic;
+    struct iopheap_slab *slab;
+    struct list_head *p;
+    int cls, obj;
+
+    for (cls = 0; cls < IOPHEAP_NCLASSES; cls++) {
+	ic = &iopheap_classes[cls];
+	list_for_each(p, &ic->slabs) {
+	    slab = list_entry(p, struct iopheap_slab, list);
+	    if (addr < slab->addr || slab->addr + IOPHEAP_CHUNKSIZE <= addr)
+		continue;
+	    obj = (addr - slab->addr) / ic->objsize;
+	    if (slab->addr + obj * ic->objsize != addr ||
+		(slab->freemap[obj / 32] & (1 << (obj % 32)))) {
+		printk(KERN_ERR "ps2sif_freeiopheap: bad free 0x%08lx\n",
+		       addr);
+		return 1;
+	    }
+	    slab->freemap[obj / 32] |= (1 << (obj % 32));
+	    ic->inuse--;
+	    ic->requested -= slab->reqsize[obj];
+	    iopheap_account(slab->owner[obj], -ic->objsize);
+	    if (++slab->nfree == ic->nobjs &&
+		1 < ++ic->nempty)
+		iopheap_slab_trim(ic, 1);	/* keep one per class */
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+static void *iopheap_block_alloc(int size, int owner)
+{
+    struct iopheap_block *blk;
+
+    blk = kmalloc(sizeof(*blk), GFP_KERNEL);
+    if (blk == NULL)
+	return NULL;
+    blk->addr = (unsigned long)iopheap_rpc_alloc(size);
+    if (blk->addr == 0) {
+	kfree(blk);
+	return NULL;
+    }
+    blk->size = size;
+    blk->owner = owner;
+    list_add(&blk->list, &iopheap_blocks);
+    iopheap_blockbytes += size;
+    iopheap_account(owner, size);
+
+    return (void *)blk->addr;
+}
+
+static int iopheap_block_free(unsigned long addr)
+{
+    struct iopheap_block *blk;
+    struct list_head *p;
+
+    list_for_each(p, &iopheap_blocks) {
+	blk = list_entry(p, struct iopheap_block, list);
+	if (blk->addr == addr) {
+	    list_del(&blk->list);
+	    iopheap_blockbytes -= blk->size;
+	    iopheap_account(blk->owner, -blk->size);
+	    kfree(blk);
+	    break;
+	}
+    }
+    if (p == &iopheap_blocks)
+	iopheap_nunknown++;
+
+    return iopheap_rpc_free((void *)addr);
+}
+
+#ifdef CONFIG_PROC_FS
+static int iopheap_read_proc(char *, char **, off_t, int, int *, void *);
+#endif
+
 int __init ps2sif_initiopheap(void)
 {
     int i;
     int result;
     int err;
 
+    for (i = 0; i < IOPHEAP_NCLASSES; i++) {
+	INIT_LIST_HEAD(&iopheap_classes[i].slabs);
+	iopheap_classes[i].objsize = 1 << (i + IOPHEAP_MINSHIFT);
+	iopheap_classes[i].nobjs = IOPHEAP_CHUNKSIZE >> (i + IOPHEAP_MINSHIFT);
+    }
+
     while (1) {
 	down(&iopheap_sem);
 	err = sbios_rpc(SBR_IOPH_INIT, NULL, &result);
@@ -45,43 +351,96 @@ int __init ps2sif_initiopheap(void)
 	while (i--)
 	    ;
     }
+
+#ifdef CONFIG_PROC_FS
+    if (ps2sif_proc_mkdir() != NULL)
+	create_proc_read_entry("iopheap", 0, ps2sif_proc_dir,
+			       iopheap_read_proc, NULL);
+#endif
     return 0;
 }
 
 void *ps2sif_allociopheap(int size)
 {
-    struct sbr_ioph_alloc_arg arg;
-    int result;
-    int err;
-    
-    arg.size = size;
+    void *addr;
+    int i, owner, retry;
 
     down(&iopheap_sem);
-    err = sbios_rpc(SBR_IOPH_ALLOC, &arg, &result);
+    owner = iopheap_caller_index(__builtin_return_address(0));
+    for (retry = 0; ; retry++) {
+	if (0 < size && size <= IOPHEAP_MAXOBJSIZE)
+	    addr = iopheap_slab_alloc(size, owner);
+	else
+	    addr = iopheap_block_alloc(size, owner);
+	if (addr != NULL || retry)
+	    break;
+	/* the IOP may be short of memory, give the cached slabs back */
+	for (i = 0; i < IOPHEAP_NCLASSES; i++)
+	    iopheap_slab_trim(&iopheap_classes[i], 0);
+    }
+    if (addr == NULL && owner != IOPHEAP_NOCALLER)
+	iopheap_callers[owner].nfail++;
     up(&iopheap_sem);
 
-    if (err < 0)
-	return NULL;
-    return (void *)result;
+    return addr;
 }
 
 int ps2sif_freeiopheap(void *addr)
 {
-    struct sbr_ioph_free_arg arg;
-    int result;
-    int err;
-    
-    arg.addr = addr;
+    int result = 0;
 
     down(&iopheap_sem);
-    err = sbios_rpc(SBR_IOPH_FREE, &arg, &result);
+    if (!iopheap_slab_free((unsigned long)addr))
+	result = iopheap_block_free((unsigned long)addr);
     up(&iopheap_sem);
 
-    if (err < 0)
-	return -1;
     return result;
 }
 
+#ifdef CONFIG_PROC_FS
+static int
+iopheap_read_proc(char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+    int i, len;
+    char *p = page;
+    struct iopheap_class *ic;
+    struct iopheap_caller *c;
+
+    down(&iopheap_sem);
+    p += sprintf(p, "chunks %ld bytes, blocks %ld bytes, "
+		 "rpc alloc %lu free %lu, unknown free %lu\n",
+		 iopheap_chunkbytes, iopheap_blockbytes,
+		 iopheap_nrpc_alloc, iopheap_nrpc_free, iopheap_nunknown);
+    p += sprintf(p, "class  slabs empty  inuse/total  requested  waste      hits\n");
+    for (i = 0; i < IOPHEAP_NCLASSES; i++) {
+	ic = &iopheap_classes[i];
+	p += sprintf(p, "%5d %6d %5d %6d/%-6d %9lu %6lu %9lu\n",
+		     ic->objsize, ic->nslabs, ic->nempty,
+		     ic->inuse, ic->nslabs * ic->nobjs, ic->requested,
+		     ic->inuse * ic->objsize - ic->requested, ic->hits);
+    }
+    p += sprintf(p, "caller         alloc     free   fail      inuse       peak\n");
+    for (i = 0; i < iopheap_ncallers; i++) {
+	c = &iopheap_callers[i];
+	p += sprintf(p, "%p %8lu %8lu %6lu %10ld %10ld\n",
+		     c->caller, c->nalloc, c->nfree, c->nfail,
+		     c->inuse, c->peak);
+    }
+    up(&iopheap_sem);
+
+    len = p - page;
+    if (len <= off + count)
+	*eof = 1;
+    *start = page + off;
+    len -= off;
+    if (len > count)
+	len = count;
+    if (len < 0)
+	len = 0;
+    return (len);
+}
+#endif
+
 unsigned long ps2sif_virttobus(volatile void *a)
 {
 	return((unsigned long)a - 0xbc000000);
@@ -51,7 +51,7 @@ unsigned long ps2_rtc_get_time(void)
 		goto out;
 	}
 
-	ps2sif_lock(ps2rtc_lock, "read rtc");
+	ps2sif_lock_prio(ps2rtc_lock, "read rtc", PS2SIF_LOCK_PRIO_HIGH);
 	ok = ps2cdvdcall_readrtc(&rtc_arg);
 	ps2sif_unlock(ps2rtc_lock);
 
@@ -108,7 +108,7 @@ int ps2_rtc_set_time(unsigned long t)
 	rtc_arg.month = bin_to_bcd(tm.tm_mon + 1);
 	rtc_arg.year = bin_to_bcd(tm.tm_year - 2000);
 
-	ps2sif_lock(ps2rtc_lock, "write rtc");
+	ps2sif_lock_prio(ps2rtc_lock, "write rtc", PS2SIF_LOCK_PRIO_HIGH);
 	res = ps2cdvdcall_writertc(&rtc_arg);
 	ps2sif_unlock(ps2rtc_lock);
 	if (res != 1)
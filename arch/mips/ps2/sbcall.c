@@ -25,6 +25,10 @@ static wait_queue_head_t ps2sif_dma_waitq;
 static spinlock_t ps2sif_dma_lock = SPIN_LOCK_UNLOCKED;
 
 EXPORT_SYMBOL(sbios_rpc);
+EXPORT_SYMBOL(sbios_rpc_queue_init);
+EXPORT_SYMBOL(sbios_rpc_submit);
+EXPORT_SYMBOL(sbios_rpc_reap);
+EXPORT_SYMBOL(sbios_rpc_flush);
 EXPORT_SYMBOL(ps2sif_setdma);
 EXPORT_SYMBOL(ps2sif_dmastat);
 EXPORT_SYMBOL(__ps2sif_setdma_wait);
@@ -218,46 +222,76 @@ void ps2sif_execrequest(ps2sif_servedata_t *rdp)
 
 
 /*
- *  SBIOS blocking RPC function
+ *  SBIOS asynchronous RPC functions
  */
 
-struct rpc_wait_queue {
-    wait_queue_head_t wq;
-    volatile int woken;
-    spinlock_t lock;
-};
+void sbios_rpc_queue_init(struct sbios_rpc_queue *q, int window)
+{
+    spin_lock_init(&q->lock);
+    init_waitqueue_head(&q->wq);
+    INIT_LIST_HEAD(&q->done);
+    q->inflight = 0;
+    q->window = (window < 1) ? 1 : window;
+    q->tag = 0;
+}
 
-static void rpc_wakeup(void *p, int result)
+static void rpc_async_done(void *p, int result)
 {
-    struct rpc_wait_queue *rwq = (struct rpc_wait_queue *)p;
+    struct sbios_rpc_req *req = (struct sbios_rpc_req *)p;
+    struct sbios_rpc_queue *q = req->queue;
+    unsigned long flags;
 
-    spin_lock(&rwq->lock);
-    rwq->woken = 1;
-    wake_up(&rwq->wq);
-    spin_unlock(&rwq->lock);
+    spin_lock_irqsave(&q->lock, flags);
+    req->result = req->carg.result;
+    list_add_tail(&req->list, &q->done);
+    q->inflight--;
+    wake_up(&q->wq);
+    spin_unlock_irqrestore(&q->lock, flags);
 }
 
-int sbios_rpc(int func, void *arg, int *result)
+#define WAIT_QUEUE(q, cond)						\
+    do {								\
+	DECLARE_WAITQUEUE(wait, current);				\
+									\
+	add_wait_queue(&(q)->wq, &wait);				\
+	while (cond) {							\
+	    set_current_state(TASK_UNINTERRUPTIBLE);			\
+	    spin_unlock_irq(&(q)->lock);				\
+	    schedule();							\
+	    spin_lock_irq(&(q)->lock);					\
+	}								\
+	remove_wait_queue(&(q)->wq, &wait);				\
+    } while (0)
+
+/*
+ * Issue an RPC without waiting for its result. Sleeps while the queue's
+ * window is full. Returns 0 on success; req->tag identifies the call.
+ * Anything else is a failure, and -SIF_RPCE_GETP is positive, so callers
+ * must test for != 0, not < 0.
+ */
+int sbios_rpc_submit(struct sbios_rpc_queue *q, struct sbios_rpc_req *req, int func, void *arg)
 {
     int ret;
     unsigned long flags;
-    struct rpc_wait_queue rwq;
-    struct sbr_common_arg carg;
-    DECLARE_WAITQUEUE(wait, current);
 
-    carg.arg = arg;
-    carg.func = rpc_wakeup;
-    carg.para = &rwq;
+    spin_lock_irqsave(&q->lock, flags);
+    WAIT_QUEUE(q, q->window <= q->inflight);
+    q->inflight++;
+    req->tag = ++q->tag;
+    spin_unlock_irqrestore(&q->lock, flags);
 
-    init_waitqueue_head(&rwq.wq);
-    rwq.woken = 0;
-    spin_lock_init(&rwq.lock);
+    req->queue = q;
+    req->func = func;
+    req->result = 0;
+    req->carg.arg = arg;
+    req->carg.func = rpc_async_done;
+    req->carg.para = req;
 
     /*
      * invoke RPC
      */
     do {
-	ret = sbios(func, &carg);
+	ret = sbios(func, &req->carg);
 	switch (ret) {
 	case 0:
 	    break;
@@ -266,27 +300,76 @@ int sbios_rpc(int func, void *arg, int *result)
 	    break;
 	default:
 	    /* ret == -SIF_PRCE_GETP (=1) */
-	    *result = ret;
 	    printk("sbios_rpc: RPC failed, func=%d result=%d\n", func, ret);
+	    spin_lock_irqsave(&q->lock, flags);
+	    q->inflight--;
+	    wake_up(&q->wq);
+	    spin_unlock_irqrestore(&q->lock, flags);
 	    return ret;
 	}
     } while (ret < 0);
 
+    return 0;
+}
+
+/*
+ * Take the oldest completed request off the queue. Unless nonblock is
+ * set, waits for one while requests are in flight. Returns NULL if
+ * nothing is (or will be) completed.
+ */
+struct sbios_rpc_req *sbios_rpc_reap(struct sbios_rpc_queue *q, int nonblock)
+{
+    struct sbios_rpc_req *req = NULL;
+    unsigned long flags;
+
+    spin_lock_irqsave(&q->lock, flags);
+    if (!nonblock)
+	WAIT_QUEUE(q, list_empty(&q->done) && 0 < q->inflight);
+    if (!list_empty(&q->done)) {
+	req = list_entry(q->done.next, struct sbios_rpc_req, list);
+	list_del(&req->list);
+    }
+    spin_unlock_irqrestore(&q->lock, flags);
+
+    return req;
+}
+
+/*
+ * Wait until no request of the queue is in flight. Completed requests
+ * stay on the queue for sbios_rpc_reap().
+ */
+void sbios_rpc_flush(struct sbios_rpc_queue *q)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&q->lock, flags);
+    WAIT_QUEUE(q, 0 < q->inflight);
+    spin_unlock_irqrestore(&q->lock, flags);
+}
+
+
+/*
+ *  SBIOS blocking RPC function
+ */
+
+int sbios_rpc(int func, void *arg, int *result)
+{
+    int ret;
+    struct sbios_rpc_queue q;
+    struct sbios_rpc_req req;
+
+    sbios_rpc_queue_init(&q, 1);
+    ret = sbios_rpc_submit(&q, &req, func, arg);
+    if (ret != 0) {
+	*result = ret;
+	return ret;
+    }
+
     /*
      * wait for result
      */
-    spin_lock_irqsave(&rwq.lock, flags);
-    add_wait_queue(&rwq.wq, &wait);
-    while (!rwq.woken) {
-	set_current_state(TASK_UNINTERRUPTIBLE);
-	spin_unlock_irq(&rwq.lock);
-	schedule();
-	spin_lock_irq(&rwq.lock);
-    }
-    remove_wait_queue(&ps2sif_dma_waitq, &wait);
-    spin_unlock_irqrestore(&rwq.lock, flags);
-
-    *result = carg.result;
+    sbios_rpc_reap(&q, 0);
+    *result = req.result;
 
     return 0;
 }
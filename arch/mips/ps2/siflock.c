@@ -15,7 +15,9 @@
 #include <linux/types.h>
 #include <linux/sched.h>
 #include <linux/interrupt.h>
+#include <linux/proc_fs.h>
 
+#include <asm/timex.h>
 #include <asm/ps2/siflock.h>
 #include "ps2.h"
 
@@ -42,6 +44,7 @@
 EXPORT_SYMBOL(ps2sif_lockinit);
 EXPORT_SYMBOL(ps2sif_lockqueueinit);
 EXPORT_SYMBOL(__ps2sif_lock);
+EXPORT_SYMBOL(__ps2sif_lock_prio);
 EXPORT_SYMBOL(ps2sif_unlock);
 EXPORT_SYMBOL(ps2sif_unlock_interruptible);
 EXPORT_SYMBOL(ps2sif_lowlevel_lock);
@@ -58,6 +61,13 @@ static ps2sif_lock_t lock_pad;
 static ps2sif_lock_t lock_mc;
 static ps2sif_lock_t lock_remocon;
 
+/*
+ * hold/wait time histogram, bucket n counts 2^n..2^(n+1)-1 usec
+ * (bucket 0 also counts < 1 usec, the last bucket everything above)
+ */
+#define HISTSIZE	16
+#define CYCLES_PER_USEC	295	/* R5900 count register, 294.912MHz */
+
 struct ps2siflock {
 	volatile int locked;
 	volatile pid_t owner;
@@ -68,6 +78,14 @@ struct ps2siflock {
 	wait_queue_head_t waitq;
 	spinlock_t spinlock;
 	int flags;
+
+	int waiting_prio[PS2SIF_LOCK_NPRIO];
+	cycles_t acquired;
+	unsigned long acquired_jiffies;
+	unsigned long nacquire;
+	unsigned long ncontended;
+	unsigned long hold_hist[HISTSIZE];
+	unsigned long wait_hist[HISTSIZE];
 };
 
 static ps2sif_lock_t *locks[] = {
@@ -81,17 +99,36 @@ static ps2sif_lock_t *locks[] = {
   [PS2LOCK_SYSCONF]	= &lock_cdvd,
 };
 
+#ifdef CONFIG_PROC_FS
+static struct {
+	char *name;
+	ps2sif_lock_t *lock;
+} lock_names[] = {
+	{ "cdvd",	&lock_cdvd },
+	{ "sound",	&lock_sound },
+	{ "pad",	&lock_pad },
+	{ "mc",		&lock_mc },
+	{ "remocon",	&lock_remocon },
+};
+#endif
+
 /*
  * utility functions
  */
+
+/* insert behind the last entry whose priority is not lower than i's */
 static inline void
 qadd(ps2sif_lock_queue_t *q, ps2sif_lock_queue_t *i)
 {
-	if (q->prev)
-		q->prev->next = i;
-	i->prev = q->prev;
-	q->prev = i;
-	i->next = q;
+	ps2sif_lock_queue_t *p;
+
+	for (p = q->prev; p != q; p = p->prev)
+		if (i->prio <= p->prio)
+			break;
+	i->prev = p;
+	i->next = p->next;
+	p->next->prev = i;
+	p->next = i;
 }
 
 static inline ps2sif_lock_queue_t *
@@ -110,6 +147,45 @@ qpop(ps2sif_lock_queue_t *q)
 	return (i);
 }
 
+/* usec since (cycles, j); the count register wraps in about 14 seconds */
+static inline unsigned long
+elapsed_usec(cycles_t cycles, unsigned long j)
+{
+	if (jiffies - j < 10 * HZ)
+		return (cycles_t)(get_cycles() - cycles) / CYCLES_PER_USEC;
+	return (jiffies - j) * (1000000 / HZ);
+}
+
+static inline void
+hist_add(unsigned long *hist, unsigned long usec)
+{
+	int i;
+
+	for (i = 0; 1 < usec && i < HISTSIZE - 1; i++)
+		usec >>= 1;
+	hist[i]++;
+}
+
+static inline int
+higher_waiting(ps2sif_lock_t *l, int prio)
+{
+	int i;
+
+	for (i = prio + 1; i < PS2SIF_LOCK_NPRIO; i++)
+		if (l->waiting_prio[i])
+			return (1);
+	return (0);
+}
+
+/* the lock has just been taken (l->locked 0 -> 1) */
+static inline void
+set_acquired(ps2sif_lock_t *l)
+{
+	l->acquired = get_cycles();
+	l->acquired_jiffies = jiffies;
+	l->nacquire++;
+}
+
 /*
  * functions
  */
@@ -135,6 +211,7 @@ ps2sif_getlock(int lockid)
 void
 ps2sif_lockinit(ps2sif_lock_t *l)
 {
+	memset(l, 0, sizeof(*l));
 	l->locked = 0;
 	l->owner = 0;
 	l->lowlevel_owner = NULL;
@@ -152,25 +229,58 @@ ps2sif_lockqueueinit(ps2sif_lock_queue_t *q)
 	q->prev = NULL;
 	q->next = NULL;
 	q->routine = NULL;
+	q->prio = PS2SIF_LOCK_PRIO_NORMAL;
 }
 
 int
 __ps2sif_lock(ps2sif_lock_t *l, char *name, long state)
 {
-	int res;
-	unsigned long flags;
+	return __ps2sif_lock_prio(l, name, state, PS2SIF_LOCK_PRIO_NORMAL);
+}
+
+int
+__ps2sif_lock_prio(ps2sif_lock_t *l, char *name, long state, int prio)
+{
+	int res, slept;
+	unsigned long flags, start_jiffies;
+	cycles_t start;
 	DECLARE_WAITQUEUE(wait, current);
 
+	if (prio < 0)
+		prio = 0;
+	if (PS2SIF_LOCK_NPRIO <= prio)
+		prio = PS2SIF_LOCK_NPRIO - 1;
+
 	spin_lock_irqsave(&l->spinlock, flags);
+
+	/* fast path: free and nobody waiting */
+	if (!l->locked && !l->waiting) {
+		l->locked = 1;
+		l->owner = current->pid;
+		l->ownername = name;
+		set_acquired(l);
+		hist_add(l->wait_hist, 0);
+		DPRINT(l, "  LOCK: pid=%d\n", current->pid);
+		spin_unlock_irqrestore(&l->spinlock, flags);
+		return (0);
+	}
+
+	start = get_cycles();
+	start_jiffies = jiffies;
+	slept = 0;
 	add_wait_queue(&l->waitq, &wait);
 	res = -ERESTARTSYS;
 	for ( ; ; ) {
-		if (!l->locked || l->owner == current->pid) {
+		if ((!l->locked && !higher_waiting(l, prio)) ||
+		    l->owner == current->pid) {
 			if (l->locked++ == 0) {
 				DPRINT(l, "  LOCK: pid=%d\n",
 				       current->pid);
 				l->owner = current->pid;
 				l->ownername = name;
+				set_acquired(l);
+				hist_add(l->wait_hist,
+					 elapsed_usec(start, start_jiffies));
 			} else {
 				DPRINT(l, "  lock: pid=%d count=%d\n",
 				       current->pid, l->locked);
@@ -178,16 +288,23 @@ __ps2sif_lock(ps2sif_lock_t *l, char *name, long state)
 			res = 0;
 			break;
 		}
+		if (!slept++)
+			l->ncontended++;
 		l->waiting++;
+		l->waiting_prio[prio]++;
 		DPRINT(l, "sleep: pid=%d\n", current->pid);
 		set_current_state(state);
 		spin_unlock_irq(&l->spinlock);
 		schedule();
 		spin_lock_irq(&l->spinlock);
 		DPRINT(l, "waken up: pid=%d\n", current->pid);
+		l->waiting_prio[prio]--;
 		l->waiting--;
 		if(state == TASK_INTERRUPTIBLE && signal_pending(current)) {
 			res = -ERESTARTSYS;
+			/* lower priority waiters may have deferred to us */
+			if (!l->locked && l->waiting)
+				wake_up(&l->waitq);
 			break;
 		}
 	}
@@ -213,6 +330,7 @@ ps2sif_havelock(ps2sif_lock_t *l)
 static inline void
 clear_lock(ps2sif_lock_t *l)
 {
+	hist_add(l->hold_hist, elapsed_usec(l->acquired, l->acquired_jiffies));
 	l->locked = 0;
 	l->owner = 0;
 	l->ownername = NULL;
@@ -226,6 +344,7 @@ give_lowlevel_lock(ps2sif_lock_t *l, ps2sif_lock_queue_t *q, unsigned long flags
 
 	if (l->locked++ == 0) {
 		DPRINT(l, "  LOCK: qi=%p\n", q);
+		set_acquired(l);
 	} else {
 		DPRINT(l, "  lock: qi=%p  count=%d\n", q, l->locked);
 	}
@@ -366,14 +485,74 @@ ps2sif_getlockflags(ps2sif_lock_t *l)
 	return (l->flags);
 }
 
+#ifdef CONFIG_PROC_FS
+static int
+ps2sif_lock_read_proc(char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	int i, j, len;
+	char *p = page;
+	ps2sif_lock_t *l;
+
+	p += sprintf(p, "histogram bucket n: 2^n usec\n");
+	for (i = 0; i < sizeof(lock_names)/sizeof(*lock_names); i++) {
+		l = lock_names[i].lock;
+		p += sprintf(p, "%-8s acquired %lu contended %lu %s%s\n",
+			     lock_names[i].name, l->nacquire, l->ncontended,
+			     l->locked ? "locked by " : "free",
+			     (l->locked && l->ownername) ? l->ownername : "");
+		p += sprintf(p, "  wait:");
+		for (j = 0; j < HISTSIZE; j++)
+			p += sprintf(p, " %lu", l->wait_hist[j]);
+		p += sprintf(p, "\n  hold:");
+		for (j = 0; j < HISTSIZE; j++)
+			p += sprintf(p, " %lu", l->hold_hist[j]);
+		p += sprintf(p, "\n");
+	}
+
+	len = p - page;
+	if (len <= off + count)
+		*eof = 1;
+	*start = page + off;
+	len -= off;
+	if (len > count)
+		len = count;
+	if (len < 0)
+		len = 0;
+	return (len);
+}
+
+struct proc_dir_entry *ps2sif_proc_dir;	/* /proc/ps2sif, shared with iopheap.c */
+
+/* the first of siflock.c and iopheap.c to get here creates /proc/ps2sif */
+struct proc_dir_entry *
+ps2sif_proc_mkdir(void)
+{
+	if (ps2sif_proc_dir == NULL)
+		ps2sif_proc_dir = proc_mkdir("ps2sif", NULL);
+	return (ps2sif_proc_dir);
+}
+#endif
+
 int __init ps2sif_lock_init(void)
 {
+	(void)ps2sif_getlock(PS2LOCK_CDVD);	/* initialize locks */
+#ifdef CONFIG_PROC_FS
+	if (ps2sif_proc_mkdir() != NULL)
+		create_proc_read_entry("lock", 0, ps2sif_proc_dir,
+				       ps2sif_lock_read_proc, NULL);
+#endif
 	return (0);
 }
 
 void
 ps2sif_lock_cleanup(void)
 {
+#ifdef CONFIG_PROC_FS
+	if (ps2sif_proc_dir != NULL) {
+		remove_proc_entry("lock", ps2sif_proc_dir);
+		remove_proc_entry("ps2sif", NULL);
+	}
+#endif
 }
 
 module_init(ps2sif_lock_init);
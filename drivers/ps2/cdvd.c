@@ -14,6 +14,8 @@
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/proc_fs.h>
 #include <linux/iso_fs.h>
 #include <linux/interrupt.h>
 #include <linux/major.h>
@@ -39,6 +41,8 @@
 
 #define BUFFER_ALIGNMENT	64
 
+#define QUEUE_HEAD	(&blk_dev[MAJOR_NR].request_queue.queue_head)
+
 /* return values of checkdisc */
 #define DISC_ERROR	-1
 #define DISC_OK		0
@@ -66,20 +70,24 @@ static int spindown(void);
 /*
  * variables
  */
+int ps2cdvd_cache_segments = 8;
 int ps2cdvd_check_interval = 2;
 int ps2cdvd_databuf_size = 16;
 unsigned long ps2cdvd_debug = DBG_DEFAULT_FLAGS;
 int ps2cdvd_immediate_ioerr = 0;
 int ps2cdvd_major = PS2CDVD_MAJOR;
+int ps2cdvd_ra_min = 4;
 int ps2cdvd_read_ahead = 32;
 int ps2cdvd_spindown = 0;
 int ps2cdvd_wrong_disc_retry = 0;
 
+MODULE_PARM(ps2cdvd_cache_segments, "i");
 MODULE_PARM(ps2cdvd_check_interval, "1-30i");
-MODULE_PARM(ps2cdvd_databuf_size, "1-256i");
+MODULE_PARM(ps2cdvd_databuf_size, "i");
 MODULE_PARM(ps2cdvd_debug, "i");
 MODULE_PARM(ps2cdvd_immediate_ioerr, "0-1i");
 MODULE_PARM(ps2cdvd_major, "0-255i");
+MODULE_PARM(ps2cdvd_ra_min, "i");
 MODULE_PARM(ps2cdvd_read_ahead, "1-256i");
 MODULE_PARM(ps2cdvd_spindown, "0-3600i");
 MODULE_PARM(ps2cdvd_wrong_disc_retry, "0-1i");
@@ -111,6 +119,28 @@ struct ps2cdvd_ctx ps2cdvd = {
 /*
  * function bodies
  */
+static void
+ps2cdvd_cache_drop(struct ps2cdvd_cacheseg *seg)
+{
+	if (seg->nsects != 0)
+		ps2cdvd.cache_stats.ra_waste += seg->nunused;
+	seg->nsects = 0;
+	seg->nunused = 0;
+	memset(seg->unused, 0, sizeof(seg->unused));
+}
+
+static void
+ps2cdvd_cache_invalidate(void)
+{
+	int i;
+
+	for (i = 0; i < ps2cdvd.cache_nsegs; i++)
+		ps2cdvd_cache_drop(&ps2cdvd.cache[i]);
+	ps2cdvd.ra_next = -1;
+	ps2cdvd.ra_window = ps2cdvd_ra_min;
+	ps2cdvd.ra_armed = 0;
+}
+
 static void
 ps2cdvd_invalidate_discinfo(void)
 {
@@ -122,6 +152,7 @@ ps2cdvd_invalidate_discinfo(void)
 		DPRINT(DBG_VERBOSE, "toc gets invalid\n");
 	ps2cdvd.toc_valid = 0;
 	ps2cdvd.databuf_nsects = 0;
+	ps2cdvd_cache_invalidate();
 	ps2cdvd.disc_changed++;
 }
 
@@ -142,7 +173,7 @@ void
 ps2cdvd_lock(char *msg)
 {
     DPRINT(DBG_LOCK, "lock '%s' pid=%d\n", msg, current->pid);
-    ps2sif_lock(ps2cdvd.lock, msg);
+    ps2sif_lock_prio(ps2cdvd.lock, msg, PS2SIF_LOCK_PRIO_LOW);
     DPRINT(DBG_LOCK, "locked pid=%d\n", current->pid);
 }
 
@@ -152,7 +183,8 @@ ps2cdvd_lock_interruptible(char *msg)
     int res;
 
     DPRINT(DBG_LOCK, "interruptible lock '%s' pid=%d\n", msg, current->pid);
-    res = ps2sif_lock_interruptible(ps2cdvd.lock, msg);
+    res = ps2sif_lock_prio_interruptible(ps2cdvd.lock, msg,
+					 PS2SIF_LOCK_PRIO_LOW);
     DPRINT(DBG_LOCK, "interruptible locked pid=%d res=%d\n",current->pid,res);
 
     return (res);
@@ -277,20 +309,184 @@ ps2cdvd_getevent(int timeout)
     return (ev);
 }
 
+static struct ps2cdvd_cacheseg *
+ps2cdvd_cache_lookup(long sn)
+{
+    int i;
+    struct ps2cdvd_cacheseg *seg;
+
+    for (i = 0; i < ps2cdvd.cache_nsegs; i++) {
+	seg = &ps2cdvd.cache[i];
+	if (seg->addr <= sn && sn < seg->addr + seg->nsects)
+	    return (seg);
+    }
+
+    return (NULL);
+}
+
+/*
+ * take an empty segment or the least recently used one
+ */
+static struct ps2cdvd_cacheseg *
+ps2cdvd_cache_victim(void)
+{
+    int i;
+    struct ps2cdvd_cacheseg *seg, *victim;
+
+    victim = &ps2cdvd.cache[0];
+    for (i = 0; i < ps2cdvd.cache_nsegs; i++) {
+	seg = &ps2cdvd.cache[i];
+	if (seg->nsects == 0) {
+	    victim = seg;
+	    break;
+	}
+	if (seg->lru < victim->lru)
+	    victim = seg;
+    }
+    if (victim->nsects != 0)
+	ps2cdvd.cache_stats.evictions++;
+    ps2cdvd_cache_drop(victim);
+
+    return (victim);
+}
+
+/*
+ * the first `nreq' sectors have been asked for, the rest is read ahead
+ */
+static void
+ps2cdvd_cache_fill(struct ps2cdvd_cacheseg *seg, long sn, int nsects, int nreq)
+{
+    int i;
+
+    seg->addr = sn;
+    seg->nsects = nsects;
+    seg->lru = ++ps2cdvd.cache_clock;
+    for (i = nreq; i < nsects; i++) {
+	seg->unused[i / 32] |= (1 << (i % 32));
+	seg->nunused++;
+    }
+    ps2cdvd.cache_stats.ra_sects += seg->nunused;
+}
+
+/*
+ * move a queued request which can be served from the cache to the head
+ */
+static int
+ps2cdvd_pick_cached(void)
+{
+    unsigned long flags;
+    struct list_head *p;
+    struct request *req;
+    int res = 0;
+
+    spin_lock_irqsave(&io_request_lock, flags);
+    list_for_each(p, QUEUE_HEAD) {
+	req = blkdev_entry_to_request(p);
+	if (ps2cdvd_cache_lookup(req->sector/4) != NULL) {
+	    list_del(&req->queue);
+	    list_add(&req->queue, QUEUE_HEAD);
+	    res = 1;
+	    break;
+	}
+    }
+    spin_unlock_irqrestore(&io_request_lock, flags);
+
+    return (res);
+}
+
+/*
+ * C-SCAN: serve the nearest request at or after the current head
+ * position first, wrap around to the lowest sector when there is none.
+ */
+static void
+ps2cdvd_elevator(long pos)
+{
+    unsigned long flags;
+    struct list_head *p;
+    struct request *req, *next, *lowest;
+
+    spin_lock_irqsave(&io_request_lock, flags);
+    next = lowest = NULL;
+    list_for_each(p, QUEUE_HEAD) {
+	req = blkdev_entry_to_request(p);
+	if (pos <= req->sector/4 &&
+	    (next == NULL || req->sector < next->sector))
+	    next = req;
+	if (lowest == NULL || req->sector < lowest->sector)
+	    lowest = req;
+    }
+    if (next == NULL)
+	next = lowest;
+    if (next != NULL && next != CURRENT) {
+	list_del(&next->queue);
+	list_add(&next->queue, QUEUE_HEAD);
+    }
+    spin_unlock_irqrestore(&io_request_lock, flags);
+}
+
+/*
+ * number of sectors from sn which are wanted by contiguous queued
+ * requests, up to the size of a cache segment
+ */
+static int
+ps2cdvd_contiguous(long sn, int nsects)
+{
+    unsigned long flags;
+    struct list_head *p;
+    struct request *req;
+    long end = sn + nsects, rsn;
+    int found;
+
+    spin_lock_irqsave(&io_request_lock, flags);
+    do {
+	found = 0;
+	list_for_each(p, QUEUE_HEAD) {
+	    if (sn + ps2cdvd_databuf_size <= end)
+		break;
+	    req = blkdev_entry_to_request(p);
+	    rsn = req->sector/4;
+	    if (rsn <= end && end < rsn + (long)(req->nr_sectors + 3) / 4) {
+		end = rsn + (req->nr_sectors + 3) / 4;
+		ps2cdvd.cache_stats.merged++;
+		found = 1;
+	    }
+	}
+    } while (found);
+    spin_unlock_irqrestore(&io_request_lock, flags);
+
+    return (MIN(end - sn, ps2cdvd_databuf_size));
+}
+
 static int
 ps2cdvd_check_cache(void)
 {
     unsigned long flags;
+    struct ps2cdvd_cacheseg *seg;
+    long sn;
+    int i;
 
-    while (!QUEUE_EMPTY &&
-	   ps2cdvd.databuf_addr <= CURRENT->sector/4 &&
-	   CURRENT->sector/4 < ps2cdvd.databuf_addr + ps2cdvd.databuf_nsects) {
+    while (!QUEUE_EMPTY) {
+	if ((seg = ps2cdvd_cache_lookup(CURRENT->sector/4)) == NULL) {
+	    if (!ps2cdvd_pick_cached())
+		break;
+	    continue;
+	}
 	DPRINT(DBG_READ, "REQ %p: sec=%ld  n=%ld  buf=%p\n",
 	       CURRENT, CURRENT->sector,
 	       CURRENT->current_nr_sectors, CURRENT->buffer);
-	memcpy(CURRENT->buffer,
-	       ps2cdvd.databuf + DATA_SECT_SIZE * (CURRENT->sector/4 - ps2cdvd.databuf_addr),
-	       DATA_SECT_SIZE);
+	sn = CURRENT->sector/4;
+	i = sn - seg->addr;
+	seg->lru = ++ps2cdvd.cache_clock;
+	ps2cdvd.cache_stats.hits++;
+	if (seg->unused[i / 32] & (1 << (i % 32))) {
+	    seg->unused[i / 32] &= ~(1 << (i % 32));
+	    seg->nunused--;
+	    ps2cdvd.cache_stats.ra_hits++;
+	    /* the stream has reached the last read ahead, keep going */
+	    if (seg->addr + seg->nsects == ps2cdvd.ra_next)
+		ps2cdvd.ra_armed = 1;
+	}
+	memcpy(CURRENT->buffer, seg->buf + DATA_SECT_SIZE * i, DATA_SECT_SIZE);
 	spin_lock_irqsave(&io_request_lock, flags);
 	end_request(1);
 	spin_unlock_irqrestore(&io_request_lock, flags);
@@ -299,6 +495,38 @@ ps2cdvd_check_cache(void)
     return (QUEUE_EMPTY);
 }
 
+/*
+ * read the next window of a sequential stream while the queue is empty
+ * so that the drive keeps streaming instead of seeking back later.
+ * returns non-zero if the drive could not be accessed at all.
+ */
+static int
+ps2cdvd_prefetch(void)
+{
+    struct ps2cdvd_cacheseg *seg;
+    long sn = ps2cdvd.ra_next;
+    int nsects = ps2cdvd.ra_window;
+
+    ps2cdvd.ra_armed = 0;
+    if (sn < 0 || ps2cdvd.cache_nsegs < 2 || ps2cdvd_cache_lookup(sn))
+	return (0);
+
+    DPRINT(DBG_READ, "prefetch: sec=%ld  n=%d\n", sn * 4, nsects);
+    seg = ps2cdvd_cache_victim();
+    if (ps2cdvdcall_read(sn, nsects, seg->buf, &ps2cdvd.data_mode) != 0)
+	return (-1);
+    if (ps2cdvdcall_geterror() != SCECdErNO) {
+	/* probably the end of the disc, stop here */
+	ps2cdvd.ra_next = -1;
+	return (0);
+    }
+    ps2cdvd.cache_stats.prefetches++;
+    ps2cdvd_cache_fill(seg, sn, nsects, 0);
+    ps2cdvd.ra_next = sn + nsects;
+
+    return (0);
+}
+
 static int
 ps2cdvd_thread(void *arg)
 {
@@ -306,7 +534,8 @@ ps2cdvd_thread(void *arg)
     int sum, traycount, ev;
     unsigned long flags;
     long sn;
-    int nsects;
+    int nsects, nreq;
+    struct ps2cdvd_cacheseg *seg;
 
     lock_kernel();
     /* get rid of all our resources related to user space */
@@ -406,6 +635,11 @@ ps2cdvd_thread(void *arg)
 
     case STAT_READY:
 	if (QUEUE_EMPTY) {
+	    if (ps2cdvd.ra_armed) {
+		if (ps2cdvd_prefetch() != 0)
+		    NEW_STATE(STAT_CHECK_DISC);
+		NEW_STATE(STAT_READY);
+	    }
 	    ps2cdvd_unlock();
 	    ev = ps2cdvd_getevent(ps2cdvd_check_interval * HZ);
 	    if (ps2cdvd_lock_interruptible("cdvd thread") != 0)
@@ -444,22 +678,37 @@ ps2cdvd_thread(void *arg)
 	if (ps2cdvd_check_cache())
 	    NEW_STATE(STAT_READY);
 
+	/*
+	 * adaptive read ahead: a miss right behind the previous read
+	 * doubles the window, anything else shrinks it to the minimum.
+	 */
+	ps2cdvd_elevator(ps2cdvd.ra_next < 0 ? 0 : ps2cdvd.ra_next);
 	sn = CURRENT->sector/4;
-	nsects = ps2cdvd_databuf_size;
+	nreq = ps2cdvd_contiguous(sn, (CURRENT->nr_sectors + 3) / 4);
+	if (sn == ps2cdvd.ra_next) {
+	    ps2cdvd.ra_window = MIN(ps2cdvd.ra_window * 2, ps2cdvd_databuf_size);
+	    ps2cdvd.ra_armed = 1;
+	} else {
+	    ps2cdvd.ra_window = ps2cdvd_ra_min;
+	    ps2cdvd.ra_armed = 0;
+	}
+	nsects = MIN(nreq < ps2cdvd.ra_window ? ps2cdvd.ra_window : nreq,
+		     ps2cdvd_databuf_size);
+	ps2cdvd.cache_stats.misses++;
 
     retry:
+	seg = ps2cdvd_cache_victim();
 	DPRINT(DBG_READ, "read: sec=%ld  n=%d  buf=%p %s\n",
-	       sn * 4, ps2cdvd_databuf_size, ps2cdvd.databuf,
-	       nsects != ps2cdvd_databuf_size ? "(retry)" : "");
-	ps2cdvd.databuf_nsects = 0;
-	if (ps2cdvdcall_read(sn, nsects, ps2cdvd.databuf,
+	       sn * 4, nsects, seg->buf,
+	       nsects == 1 ? "(retry)" : "");
+	if (ps2cdvdcall_read(sn, nsects, seg->buf,
 			     &ps2cdvd.data_mode) != 0) {
 	    NEW_STATE(STAT_CHECK_DISC);
 	}
 	res = ps2cdvdcall_geterror();
 	if (res == SCECdErNO) {
-	    ps2cdvd.databuf_addr = sn;
-	    ps2cdvd.databuf_nsects = nsects;
+	    ps2cdvd_cache_fill(seg, sn, nsects, nreq);
+	    ps2cdvd.ra_next = sn + nsects;
 	    ps2cdvd_check_cache();
 
 	    if (ps2sif_iswaiting(ps2cdvd.lock)) {
@@ -483,6 +732,7 @@ ps2cdvd_thread(void *arg)
 		   ps2cdvd_geterrorstr(res), res);
 	    sn = CURRENT->sector/4;
 	    nsects = 1;
+	    ps2cdvd.ra_armed = 0;
 	    goto retry;
 	}
 	DPRINT(DBG_DIAG, "error: %s, code=0x%02x\n",
@@ -821,6 +1071,46 @@ ps2cdvd_common_open(struct inode *inode, struct file *filp)
 	return 0;
 }
 
+#ifdef CONFIG_PROC_FS
+static int
+ps2cdvd_read_proc(char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	int i, len;
+	char *p = page;
+	struct ps2cdvd_cachestats *st = &ps2cdvd.cache_stats;
+	struct ps2cdvd_cacheseg *seg;
+
+	p += sprintf(p, "cache: %d segments of %d sectors\n",
+		     ps2cdvd.cache_nsegs, ps2cdvd_databuf_size);
+	p += sprintf(p, "hits %lu misses %lu prefetches %lu evictions %lu\n",
+		     st->hits, st->misses, st->prefetches, st->evictions);
+	p += sprintf(p, "merged requests %lu\n", st->merged);
+	p += sprintf(p, "read ahead: sectors %lu used %lu wasted %lu "
+		     "window %d next %ld\n",
+		     st->ra_sects, st->ra_hits, st->ra_waste,
+		     ps2cdvd.ra_window, ps2cdvd.ra_next);
+	for (i = 0; i < ps2cdvd.cache_nsegs; i++) {
+		seg = &ps2cdvd.cache[i];
+		if (seg->nsects == 0)
+			continue;
+		p += sprintf(p, "  %2d: sector %ld-%ld unused %d\n", i,
+			     seg->addr, seg->addr + seg->nsects - 1,
+			     seg->nunused);
+	}
+
+	len = p - page;
+	if (len <= off + count)
+		*eof = 1;
+	*start = page + off;
+	len -= off;
+	if (len > count)
+		len = count;
+	if (len < 0)
+		len = 0;
+	return (len);
+}
+#endif
+
 static int ps2cdvd_initialized;
 #define PS2CDVD_INIT_BLKDEV	0x0001
 #define PS2CDVD_INIT_CDROM	0x0002
@@ -828,6 +1118,8 @@ static int ps2cdvd_initialized;
 #define PS2CDVD_INIT_LABELBUF	0x0008
 #define PS2CDVD_INIT_DATABUF	0x0010
 #define PS2CDVD_INIT_THREAD	0x0020
+#define PS2CDVD_INIT_CACHE	0x0040
+#define PS2CDVD_INIT_PROC	0x0080
 
 int __init ps2cdvd_init(void)
 {
@@ -847,6 +1139,23 @@ int __init ps2cdvd_init(void)
 	ps2cdvd.event = EV_NONE;
 	spin_lock_init(&ps2cdvd.ievent_lock);
 
+	/*
+	 * MODULE_PARM can't range check these; the per-segment `unused'
+	 * bitmap only has room for CACHE_MAX_SEGSECTS sectors
+	 */
+	if (ps2cdvd_databuf_size < 1)
+		ps2cdvd_databuf_size = 1;
+	if (ps2cdvd_databuf_size > CACHE_MAX_SEGSECTS)
+		ps2cdvd_databuf_size = CACHE_MAX_SEGSECTS;
+	if (ps2cdvd_ra_min < 1)
+		ps2cdvd_ra_min = 1;
+	if (ps2cdvd_ra_min > ps2cdvd_databuf_size)
+		ps2cdvd_ra_min = ps2cdvd_databuf_size;
+	if (ps2cdvd_cache_segments < 1)
+		ps2cdvd_cache_segments = 1;
+	if (ps2cdvd_cache_segments > CACHE_MAX_SEGMENTS)
+		ps2cdvd_cache_segments = CACHE_MAX_SEGMENTS;
+
 	/*
 	 * CD/DVD SBIOS lock
 	 */
@@ -879,6 +1188,37 @@ int __init ps2cdvd_init(void)
 	ps2cdvd.databuf = ALIGN(ps2cdvd.databufx, BUFFER_ALIGNMENT);
 	ps2cdvd_initialized |= PS2CDVD_INIT_DATABUF;
 
+	DPRINT(DBG_VERBOSE, "allocate cache\n");
+	ps2cdvd.cache = kmalloc(sizeof(struct ps2cdvd_cacheseg) *
+				ps2cdvd_cache_segments, GFP_KERNEL);
+	if (ps2cdvd.cache == NULL) {
+		printk(KERN_ERR "ps2cdvd: Can't allocate cache\n");
+		ps2cdvd_cleanup();
+		return (-1);
+	}
+	memset(ps2cdvd.cache, 0,
+	       sizeof(struct ps2cdvd_cacheseg) * ps2cdvd_cache_segments);
+	ps2cdvd_initialized |= PS2CDVD_INIT_CACHE;
+	for (ps2cdvd.cache_nsegs = 0;
+	     ps2cdvd.cache_nsegs < ps2cdvd_cache_segments;
+	     ps2cdvd.cache_nsegs++) {
+		ps2cdvd.cache[ps2cdvd.cache_nsegs].buf = (unsigned char *)
+		    __get_free_pages(GFP_KERNEL,
+				     get_order(ps2cdvd_databuf_size *
+					       DATA_SECT_SIZE));
+		if (ps2cdvd.cache[ps2cdvd.cache_nsegs].buf == NULL)
+			break;
+	}
+	if (ps2cdvd.cache_nsegs == 0) {
+		printk(KERN_ERR "ps2cdvd: Can't allocate cache\n");
+		ps2cdvd_cleanup();
+		return (-1);
+	}
+	if (ps2cdvd.cache_nsegs < ps2cdvd_cache_segments)
+		printk(KERN_WARNING "ps2cdvd: only %d cache segments\n",
+		       ps2cdvd.cache_nsegs);
+	ps2cdvd_cache_invalidate();
+
 	/*
 	 * initialize CD/DVD SBIOS
 	 */
@@ -947,6 +1287,12 @@ int __init ps2cdvd_init(void)
         }
 	ps2cdvd_initialized |= PS2CDVD_INIT_CDROM;
 
+#ifdef CONFIG_PROC_FS
+	if (create_proc_read_entry("ps2cdvd", 0, NULL,
+				   ps2cdvd_read_proc, NULL) != NULL)
+		ps2cdvd_initialized |= PS2CDVD_INIT_PROC;
+#endif
+
 	printk(KERN_INFO "PlayStation 2 CD/DVD-ROM driver\n");
 DPRINT(DBG_READ, "DBG_READ\n");
 
@@ -956,6 +1302,7 @@ DPRINT(DBG_READ, "DBG_READ\n");
 void
 ps2cdvd_cleanup()
 {
+	int i;
 
 	DPRINT(DBG_VERBOSE, "cleanup\n");
 
@@ -983,6 +1330,21 @@ ps2cdvd_cleanup()
 		kfree(ps2cdvd.databufx);
 	}
 
+	if (ps2cdvd_initialized & PS2CDVD_INIT_CACHE) {
+		DPRINT(DBG_VERBOSE, "free cache\n");
+		for (i = 0; i < ps2cdvd.cache_nsegs; i++)
+			free_pages((unsigned long)ps2cdvd.cache[i].buf,
+				   get_order(ps2cdvd_databuf_size *
+					     DATA_SECT_SIZE));
+		ps2cdvd.cache_nsegs = 0;
+		kfree(ps2cdvd.cache);
+	}
+
+#ifdef CONFIG_PROC_FS
+	if (ps2cdvd_initialized & PS2CDVD_INIT_PROC)
+		remove_proc_entry("ps2cdvd", NULL);
+#endif
+
 	if (ps2cdvd_initialized & PS2CDVD_INIT_BLKDEV) {
 		DPRINT(DBG_VERBOSE, "unregister block device\n");
 		unregister_blkdev(MAJOR_NR, "ps2cdvd");
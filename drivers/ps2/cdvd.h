@@ -57,6 +57,9 @@
 #define AUDIO_SECT_SIZE	2352
 #define MAX_AUDIO_SECT_SIZE	2448
 
+#define CACHE_MAX_SEGSECTS	256	/* upper limit of ps2cdvd_databuf_size */
+#define CACHE_MAX_SEGMENTS	64	/* upper limit of ps2cdvd_cache_segments */
+
 #define SEND_BUSY	0
 #define SEND_NOWAIT	1
 #define SEND_BLOCK	2
@@ -106,6 +109,30 @@ struct ps2cdvd_tocentry {
 	unsigned char abs_msf[3];
 };
 
+/*
+ * one segment of the data sector cache
+ * `unused' marks sectors which were read ahead and not requested yet.
+ */
+struct ps2cdvd_cacheseg {
+	unsigned char		*buf;
+	long			addr;
+	int			nsects;		/* 0 means invalid */
+	unsigned long		lru;
+	int			nunused;
+	u_int32_t		unused[CACHE_MAX_SEGSECTS / 32];
+};
+
+struct ps2cdvd_cachestats {
+	unsigned long		hits;		/* sectors served from cache */
+	unsigned long		misses;		/* reads issued on a miss */
+	unsigned long		prefetches;	/* reads issued while idle */
+	unsigned long		ra_sects;	/* sectors read ahead */
+	unsigned long		ra_hits;	/* read ahead sectors used */
+	unsigned long		ra_waste;	/* read ahead sectors dropped */
+	unsigned long		evictions;
+	unsigned long		merged;		/* requests joined to a read */
+};
+
 struct ps2cdvd_ctx {
 	volatile int		state;
 	spinlock_t		state_lock;
@@ -136,6 +163,14 @@ struct ps2cdvd_ctx {
 	int			databuf_addr;
 	int			databuf_nsects;
 
+	struct ps2cdvd_cacheseg	*cache;
+	int			cache_nsegs;
+	unsigned long		cache_clock;
+	long			ra_next;	/* sector following the last read */
+	int			ra_window;
+	int			ra_armed;	/* may prefetch when idle */
+	struct ps2cdvd_cachestats cache_stats;
+
 	struct semaphore	ack_sem;
 	struct semaphore	command_sem;
 	struct semaphore	wait_sem;
@@ -171,11 +206,13 @@ extern struct file_operations ps2cdvd_altdev_fops;
 extern struct cdrom_device_ops ps2cdvd_dops;
 extern struct cdrom_device_info ps2cdvd_info;
 
+extern int ps2cdvd_cache_segments;
 extern int ps2cdvd_check_interval;
 extern int ps2cdvd_databuf_size;
 extern unsigned long ps2cdvd_debug;
 extern int ps2cdvd_immediate_ioerr;
 extern int ps2cdvd_major;
+extern int ps2cdvd_ra_min;
 extern int ps2cdvd_read_ahead;
 extern int ps2cdvd_spindown;
 extern int ps2cdvd_wrong_disc_retry;
@@ -0,0 +1,171 @@
+/*
+ *  PlayStation 2 CD/DVD driver: request scheduling replay benchmark
+ *
+ *  This file is subject to the terms and conditions of the GNU General
+ *  Public License Version 2. See the file "COPYING" in the main
+ *  directory of this archive for more details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/module.h>
+#include <linux/major.h>
+#include <linux/fs.h>
+#include <linux/locks.h>
+#include <linux/bench.h>
+
+/*
+ * Built as ps2cdvdtest.o with CONFIG_BENCH_MODULES; load it with a
+ * data disc in the drive.
+ * Each access pattern below is replayed against the ps2cdvd block
+ * device, BENCH_BATCH reads at a time through ll_rw_block(), so that
+ * the request thread finds a full queue to merge and reorder. A
+ * recorded trace can be replayed too: trace=sector,sector,... (2048
+ * byte sectors, up to 64 of them, relative to base= and so nonzero).
+ *
+ * Every pattern reads its own range of the disc, so neither the
+ * buffer cache nor the driver's sector cache holds any of it yet. The
+ * time and throughput of each are printed; /proc/ps2cdvd shows the
+ * merged requests.
+ */
+#define BENCH_READS	256
+#define BENCH_BATCH	32
+#define BENCH_SPAN	8192		/* sectors per pattern */
+#define SECT_SIZE	2048
+
+static int major = PS2CDVD_MAJOR;
+static int base = 1024;			/* skip the volume descriptors */
+static int trace[64];
+MODULE_PARM(major, "i");
+MODULE_PARM(base, "i");
+MODULE_PARM(trace, "1-64i");
+
+static int sectors[BENCH_READS];
+
+/* sequential */
+static int make_seq(int start)
+{
+	int i;
+
+	for (i = 0; i < BENCH_READS; i++)
+		sectors[i] = start + i;
+	return BENCH_READS;
+}
+
+/* two sequential readers, interleaved */
+static int make_streams(int start)
+{
+	int i;
+
+	for (i = 0; i < BENCH_READS; i++)
+		sectors[i] = start + (i & 1) * (BENCH_SPAN / 2) + i / 2;
+	return BENCH_READS;
+}
+
+/* backwards in strides, the worst case for a one-way scan */
+static int make_reverse(int start)
+{
+	int i;
+
+	for (i = 0; i < BENCH_READS; i++)
+		sectors[i] = start + BENCH_SPAN - 16 - (i / 8) * 16 - (i % 8);
+	return BENCH_READS;
+}
+
+/* uniformly random */
+static int make_random(int start)
+{
+	uint32_t seed = 0x12345678;
+	int i;
+
+	for (i = 0; i < BENCH_READS; i++) {
+		seed = seed * 1103515245 + 12345;
+		sectors[i] = start + (seed >> 8) % BENCH_SPAN;
+	}
+	return BENCH_READS;
+}
+
+/* the recorded trace given at load time */
+static int make_trace(int start)
+{
+	int i;
+
+	for (i = 0; i < 64 && trace[i] != 0; i++)
+		sectors[i] = start + trace[i];
+	return i;
+}
+
+static struct {
+	char *name;
+	int (*make)(int start);
+} patterns[] = {
+	{ "sequential", make_seq },
+	{ "2 streams", make_streams },
+	{ "reverse", make_reverse },
+	{ "random", make_random },
+	{ "trace", make_trace },
+};
+
+static int replay(kdev_t dev, int n)
+{
+	struct buffer_head *bhs[BENCH_BATCH];
+	int i, j, nbh, res = 0;
+
+	for (i = 0; i < n; i += nbh) {
+		nbh = n - i < BENCH_BATCH ? n - i : BENCH_BATCH;
+		for (j = 0; j < nbh; j++)
+			bhs[j] = getblk(dev, sectors[i + j], SECT_SIZE);
+		ll_rw_block(READ, nbh, bhs);
+		for (j = 0; j < nbh; j++) {
+			wait_on_buffer(bhs[j]);
+			if (!buffer_uptodate(bhs[j]))
+				res = -EIO;
+			brelse(bhs[j]);
+		}
+	}
+
+	return res;
+}
+
+int init_module(void)
+{
+	kdev_t dev = MKDEV(major, 0);
+	struct block_device *bdev;
+	struct timeval start;
+	uint32_t usec;
+	int i, n, res;
+
+	bdev = bdget(kdev_t_to_nr(dev));
+	if (bdev == NULL)
+		return -ENOMEM;
+	if ((res = blkdev_get(bdev, FMODE_READ, 0, BDEV_RAW)) < 0) {
+		printk("cdvdtest: can't open the drive, %d\n", res);
+		return res;
+	}
+
+	printk("cdvdtest: %d reads of each, %d in flight\n",
+	       BENCH_READS, BENCH_BATCH);
+	for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+		n = patterns[i].make(base + i * BENCH_SPAN);
+		if (n == 0)
+			continue;
+		invalidate_buffers(dev);
+
+		do_gettimeofday(&start);
+		res = replay(dev, n);
+		usec = bench_usec(&start);
+
+		if (res < 0) {
+			printk("%-10s: read error\n", patterns[i].name);
+			continue;
+		}
+		printk("%-10s: %3d reads in %6d ms, %5d KiB/s\n",
+		       patterns[i].name, n, usec / 1000,
+		       n * SECT_SIZE / 1024 * 1000 / (usec / 1000 ? usec / 1000 : 1));
+	}
+	invalidate_buffers(dev);
+
+	blkdev_put(bdev, BDEV_RAW);
+
+	return BENCH_DONE;
+}
@@ -146,7 +146,8 @@ ps2mcfs_dir_create(struct inode *dir, struct dentry *dentry, int mode)
 	struct inode *inode;
 	struct ps2mc_dirent mcdirent;
 
-	res = ps2sif_lock_interruptible(ps2mcfs_lock, "mcfs_dir_create");
+	res = ps2sif_lock_prio_interruptible(ps2mcfs_lock, "mcfs_dir_create",
+					     PS2SIF_LOCK_PRIO_LOW);
 	if (res < 0)
 		return (res);
 
@@ -198,7 +199,8 @@ ps2mcfs_dir_rename(struct inode *old_dir, struct dentry *old_dentry,
 	struct ps2mcfs_dirent *parent = old_dir->u.generic_ip;
 	struct ps2mcfs_dirent *dirent;
 
-	res = ps2sif_lock_interruptible(ps2mcfs_lock, "mcfs_dir_rename");
+	res = ps2sif_lock_prio_interruptible(ps2mcfs_lock, "mcfs_dir_rename",
+					     PS2SIF_LOCK_PRIO_LOW);
 	if (res < 0)
 		return (res);
 
@@ -222,6 +224,8 @@ ps2mcfs_dir_rename(struct inode *old_dir, struct dentry *old_dentry,
 	}
 
 	dirent = old_dentry->d_inode->u.generic_ip;
+	if ((res = ps2mcfs_flush_wbuf(dirent)) < 0)
+		goto out;
 	ps2mcfs_free_fd(dirent);
 	if ((res = ps2mc_rename(parent->root->portslot, path, name)) == 0) {
 		ps2mcfs_free_path(dirent);
@@ -242,7 +246,8 @@ ps2mcfs_dir_lookup(struct inode *dir, struct dentry *dentry)
 	char path[PS2MC_PATH_MAX + 1];
 	struct inode *inode;
 
-	res = ps2sif_lock_interruptible(ps2mcfs_lock, "mcfs_dir_lookup");
+	res = ps2sif_lock_prio_interruptible(ps2mcfs_lock, "mcfs_dir_lookup",
+					     PS2SIF_LOCK_PRIO_LOW);
 	if (res < 0)
 		return ERR_PTR(res);
 	ps2mc_terminate_name(path, dentry->d_name.name, dentry->d_name.len);
@@ -333,7 +338,8 @@ ps2mcfs_dir_mkdir(struct inode *dir, struct dentry *dentry, int mode)
 	struct inode *inode;
 	struct ps2mc_dirent mcdirent;
 
-	res = ps2sif_lock_interruptible(ps2mcfs_lock, "mcfs_dir_create");
+	res = ps2sif_lock_prio_interruptible(ps2mcfs_lock, "mcfs_dir_create",
+					     PS2SIF_LOCK_PRIO_LOW);
 	if (res < 0)
 		return (res);
 
@@ -377,7 +383,8 @@ ps2mcfs_dir_delete(struct inode *inode, struct dentry *dentry)
 	char path[PS2MC_PATH_MAX + 1];
 	struct ps2mcfs_dirent *de = inode->u.generic_ip;
 
-	res = ps2sif_lock_interruptible(ps2mcfs_lock, "mcfs_dir_create");
+	res = ps2sif_lock_prio_interruptible(ps2mcfs_lock, "mcfs_dir_create",
+					     PS2SIF_LOCK_PRIO_LOW);
 	if (res < 0)
 		return (res);
 
@@ -387,6 +394,7 @@ ps2mcfs_dir_delete(struct inode *inode, struct dentry *dentry)
 	TRACE("ps2mcfs_dir_delete(%s): inode=%p dentry=%p\n",
 	      path, inode, dentry);
 
+	ps2mcfs_discard_wbuf((struct ps2mcfs_dirent*)dentry->d_inode->u.generic_ip);
 	ps2mcfs_free_fd((struct ps2mcfs_dirent*)dentry->d_inode->u.generic_ip);
 	if ((res = ps2mc_delete(de->root->portslot, path)) < 0)
 		goto out;
@@ -173,6 +173,7 @@ static void ps2mcfs_clean_dirent(struct ps2mcfs_dirent *de)
 	INIT_LIST_HEAD(&de->hashlink);
 	de->flags = 0;
 	de->inode = NULL;
+	de->wb = NULL;
 	de->root = NULL;
 	de->refcount = 0;
 }
@@ -213,6 +214,11 @@ void ps2mcfs_free_dirent(struct ps2mcfs_dirent *de)
 	if (de->flags & PS2MCFS_DIRENT_BMAPPED)
 		invalidate_buffers(de->root->dev);
 
+	/*
+	 * drop write-back buffer (it should have been flushed already)
+	 */
+	ps2mcfs_discard_wbuf(de);
+
 	/*
 	 * free file descriptor cache entry
 	 */
@@ -248,7 +254,8 @@ ps2mcfs_invalidate_dirents(struct ps2mcfs_root *root)
 
 	TRACE("ps2mcfs_invalidate_dirents(card%02x)\n", root->portslot);
 
-	if (ps2sif_lock_interruptible(ps2mcfs_lock, "mcfs_invalidate_dirents") < 0)
+	if (ps2sif_lock_prio_interruptible(ps2mcfs_lock, "mcfs_invalidate_dirents",
+					   PS2SIF_LOCK_PRIO_LOW) < 0)
 		return;
 	for (i = 0; i < ARRAYSIZEOF(active_dirents); i++) {
 		for (p = active_dirents[i].next;
@@ -263,6 +270,7 @@ ps2mcfs_invalidate_dirents(struct ps2mcfs_root *root)
 			ps2mcfs_put_path(de, path);
 
 			de->flags |= PS2MCFS_DIRENT_INVALID;
+			ps2mcfs_discard_wbuf(de);
 			if (de->flags & PS2MCFS_DIRENT_BMAPPED) {
 				de->flags &= ~PS2MCFS_DIRENT_BMAPPED;
 
@@ -31,10 +31,12 @@
 
 char *ps2mcfs_filebuf;
 void *dmabuf;
+static LIST_HEAD(ps2mcfs_wblist);
 
 static ssize_t ps2mcfs_read(struct file *, char *, size_t, loff_t *);
 static ssize_t ps2mcfs_write(struct file *, const char *, size_t, loff_t *);
 static void ps2mcfs_truncate(struct inode *);
+static int ps2mcfs_fsync(struct file *, struct dentry *, int);
 static int ps2mcfs_open(struct inode *, struct file *);
 static int ps2mcfs_release(struct inode *, struct file *);
 static int ps2mcfs_readpage(struct file *, struct page *);
@@ -49,6 +51,7 @@ struct file_operations ps2mcfs_file_operations = {
 	mmap:		generic_file_mmap,
 	open:		ps2mcfs_open,
 	release:	ps2mcfs_release,
+	fsync:		ps2mcfs_fsync,
 };
 
 struct inode_operations ps2mcfs_file_inode_operations = {
@@ -97,6 +100,7 @@ ps2mcfs_exit_filebuf()
 #define READ_MODE	0
 #define WRITE_MODE	1
 #define USER_COPY	2
+#define DIRECT_IO	4	/* buf is aligned, transfer it without copying */
 
 static ssize_t
 ps2mcfs_rw(struct inode *inode, char *buf, size_t nbytes, loff_t *ppos, int mode)
@@ -160,7 +164,15 @@ ps2mcfs_rw(struct inode *inode, char *buf, size_t nbytes, loff_t *ppos, int mode
 	res = 0;
 	while (0 < nbytes) {
 		int n = MIN(nbytes, PS2MCFS_FILEBUFSIZE);
-		if (mode & WRITE_MODE) {
+		if (mode & DIRECT_IO) {
+			/* no more than PS2MC_RWBUFSIZE per call either */
+			if (mode & WRITE_MODE)
+				res = ps2mc_write(fd, buf, n);
+			else
+				res = ps2mc_read(fd, buf, n);
+			if (res <= 0) /* error or EOF */
+				break;
+		} else if (mode & WRITE_MODE) {
 			/* write */
 			if (mode & USER_COPY) {
 				if (copy_from_user(filebuf, buf, n)) {
@@ -200,6 +212,158 @@ ps2mcfs_rw(struct inode *inode, char *buf, size_t nbytes, loff_t *ppos, int mode
 	return (res);
 }
 
+/*
+ * write-back buffer
+ *
+ * Every ps2mc_write() is a round trip to the IOP and a read-modify-write
+ * of a card page, so contiguous small writes are gathered here when the
+ * card is mounted with the `writeback' option.  A buffer is written out
+ * with one seek and full PS2MCFS_FILEBUFSIZE transfers (PS2MC_RWBUFSIZE,
+ * what /dev/ps2mc passes to ps2mc_write() at most too) when a write
+ * doesn't continue it or doesn't fit, before the file is read, on
+ * fsync(2), when the inode goes away and at the latest
+ * PS2MCFS_WB_EXPIRE_TIME after it was started.
+ * The buffer only starts at or before the current end of the file on the
+ * card, so flushing it never has to fill a hole.
+ */
+static struct ps2mcfs_wbuf *
+ps2mcfs_alloc_wbuf(struct ps2mcfs_dirent *de)
+{
+	struct ps2mcfs_wbuf *wb;
+
+	wb = kmalloc(sizeof(struct ps2mcfs_wbuf), GFP_KERNEL);
+	if (wb == NULL)
+		return (NULL);
+	wb->mem = kmalloc(PS2MCFS_WBUFSIZE + 64, GFP_KERNEL);
+	if (wb->mem == NULL) {
+		kfree(wb);
+		return (NULL);
+	}
+	wb->buf = ALIGN(wb->mem, 64);
+	wb->dirent = de;
+	wb->pos = 0;
+	wb->len = 0;
+	wb->expire_time = PS2MCFS_WB_EXPIRE_TIME;
+	list_add(&wb->link, &ps2mcfs_wblist);
+	de->wb = wb;
+
+	return (wb);
+}
+
+void
+ps2mcfs_discard_wbuf(struct ps2mcfs_dirent *de)
+{
+	struct ps2mcfs_wbuf *wb = de->wb;
+
+	ps2sif_assertlock(ps2mcfs_lock, "mcfs_discard_wbuf");
+	if (wb == NULL)
+		return;
+	de->wb = NULL;
+	list_del(&wb->link);
+	kfree(wb->mem);
+	kfree(wb);
+}
+
+int
+ps2mcfs_flush_wbuf(struct ps2mcfs_dirent *de)
+{
+	struct ps2mcfs_wbuf *wb = de->wb;
+	loff_t pos;
+	int res;
+
+	ps2sif_assertlock(ps2mcfs_lock, "mcfs_flush_wbuf");
+	if (wb == NULL)
+		return (0);
+	res = 0;
+	if (wb->len != 0 && de->inode != NULL) {
+		DPRINT(DBG_FILECACHE, "flush_wbuf: pos=%ld len=%d\n",
+		       (long)wb->pos, wb->len);
+		pos = wb->pos;
+		res = ps2mcfs_rw(de->inode, wb->buf, wb->len, &pos,
+				 WRITE_MODE|DIRECT_IO);
+		if (0 <= res)
+			res = (res == wb->len) ? 0 : -EIO;
+		if (res < 0)
+			printk(KERN_ERR "ps2mcfs: write-back failed (%d)\n",
+			       res);
+	}
+	ps2mcfs_discard_wbuf(de);
+
+	return (res);
+}
+
+/*
+ * ps2mcfs_check_wbuf() is called from daemon thread (ps2mcfs_thread)
+ * periodically.
+ */
+void
+ps2mcfs_check_wbuf()
+{
+	struct list_head *p, *next;
+	struct ps2mcfs_wbuf *wb;
+
+	ps2sif_assertlock(ps2mcfs_lock, "mcfs_check_wbuf");
+	for (p = ps2mcfs_wblist.next; p != &ps2mcfs_wblist; p = next) {
+		next = p->next;
+		wb = list_entry(p, struct ps2mcfs_wbuf, link);
+		wb->expire_time -= PS2MCFS_CHECK_INTERVAL;
+		if (wb->expire_time < 0)
+			ps2mcfs_flush_wbuf(wb->dirent);
+	}
+}
+
+/*
+ * write out all buffers of a card, used on umount
+ */
+void
+ps2mcfs_sync_wbuf(int portslot)
+{
+	struct list_head *p, *next;
+	struct ps2mcfs_wbuf *wb;
+
+	ps2sif_lock_prio(ps2mcfs_lock, "mcfs_sync_wbuf", PS2SIF_LOCK_PRIO_LOW);
+	for (p = ps2mcfs_wblist.next; p != &ps2mcfs_wblist; p = next) {
+		next = p->next;
+		wb = list_entry(p, struct ps2mcfs_wbuf, link);
+		if (wb->dirent->root->portslot == portslot)
+			ps2mcfs_flush_wbuf(wb->dirent);
+	}
+	ps2sif_unlock(ps2mcfs_lock);
+}
+
+static ssize_t
+ps2mcfs_wb_write(struct inode *inode, const char *buf, size_t nbytes,
+		 loff_t *ppos)
+{
+	struct ps2mcfs_dirent *de = inode->u.generic_ip;
+	struct ps2mcfs_wbuf *wb = de->wb;
+	int res;
+
+	if (de->flags & PS2MCFS_DIRENT_INVALID)
+		return -EIO;
+
+	if (wb != NULL && (*ppos != wb->pos + wb->len ||
+			   PS2MCFS_WBUFSIZE < wb->len + nbytes)) {
+		if ((res = ps2mcfs_flush_wbuf(de)) < 0)
+			return (res);
+		wb = NULL;
+	}
+	if (wb == NULL) {
+		if (PS2MCFS_WBUFSIZE < nbytes || inode->i_size < *ppos ||
+		    (wb = ps2mcfs_alloc_wbuf(de)) == NULL)
+			return ps2mcfs_rw(inode, (char*)buf, nbytes, ppos,
+					  WRITE_MODE|USER_COPY);
+		wb->pos = *ppos;
+	}
+
+	if (copy_from_user(wb->buf + wb->len, buf, nbytes))
+		return -EFAULT;
+	wb->len += nbytes;
+	*ppos += nbytes;
+
+	return (nbytes);
+}
+
 int
 ps2mcfs_create(struct ps2mcfs_dirent *de)
 {
@@ -207,7 +371,8 @@ ps2mcfs_create(struct ps2mcfs_dirent *de)
 	const char *path;
 
 	/* need the lock to call get_fd() */
-	res = ps2sif_lock_interruptible(ps2mcfs_lock, "mcfs_read");
+	res = ps2sif_lock_prio_interruptible(ps2mcfs_lock, "mcfs_read",
+					     PS2SIF_LOCK_PRIO_LOW);
 	if (res < 0)
 		return (res);
 
@@ -229,12 +394,15 @@ ps2mcfs_read(struct file *filp, char * buf, size_t count, loff_t *ppos)
 	int res;
 	TRACE("ps2mcfs_read(filp=%p, pos=%ld)\n", filp, (long)*ppos);
 
-	res = ps2sif_lock_interruptible(ps2mcfs_lock, "mcfs_read");
+	res = ps2sif_lock_prio_interruptible(ps2mcfs_lock, "mcfs_read",
+					     PS2SIF_LOCK_PRIO_LOW);
 	if (res < 0)
 		return (res);
 
-	res = ps2mcfs_rw(filp->f_dentry->d_inode, buf,
-			 count, ppos, READ_MODE|USER_COPY);
+	res = ps2mcfs_flush_wbuf(filp->f_dentry->d_inode->u.generic_ip);
+	if (res == 0)
+		res = ps2mcfs_rw(filp->f_dentry->d_inode, buf,
+				 count, ppos, READ_MODE|USER_COPY);
 	ps2sif_unlock_interruptible(ps2mcfs_lock);
 
 	return (res);
@@ -247,12 +415,19 @@ ps2mcfs_write(struct file *filp, const char * buf, size_t count, loff_t *ppos)
 	struct inode *inode = filp->f_dentry->d_inode;
 
 	TRACE("ps2mcfs_write(filp=%p, pos=%ld)\n", filp, (long)*ppos);
-	res = ps2sif_lock_interruptible(ps2mcfs_lock, "mcfs_write");
+	res = ps2sif_lock_prio_interruptible(ps2mcfs_lock, "mcfs_write",
+					     PS2SIF_LOCK_PRIO_LOW);
 	if (res < 0)
 		return (res);
 
-	res = ps2mcfs_rw(filp->f_dentry->d_inode, (char*)buf,
-			 count, ppos, WRITE_MODE|USER_COPY);
+	if (filp->f_flags & O_APPEND)
+		*ppos = inode->i_size;
+	if (((struct ps2mcfs_dirent *)inode->u.generic_ip)->root->opts.writeback
+	    && !(filp->f_flags & O_SYNC))
+		res = ps2mcfs_wb_write(inode, buf, count, ppos);
+	else
+		res = ps2mcfs_rw(inode, (char*)buf,
+				 count, ppos, WRITE_MODE|USER_COPY);
 	if (res < 0)
 		goto out;
 
@@ -278,7 +453,8 @@ ps2mcfs_open(struct inode *inode, struct file *filp)
 		return -ENAMETOOLONG; /* path name might be too long */
 	ps2mcfs_put_path(de, path);
 
-	res = ps2sif_lock_interruptible(ps2mcfs_lock, "mcfs_read");
+	res = ps2sif_lock_prio_interruptible(ps2mcfs_lock, "mcfs_read",
+					     PS2SIF_LOCK_PRIO_LOW);
 	if (res < 0)
 		return (res);
 	ps2mcfs_ref_dirent(de);
@@ -298,7 +474,8 @@ ps2mcfs_release(struct inode *inode, struct file *filp)
 	TRACE("ps2mcfs_release(%s)\n", path);
 	ps2mcfs_put_path(de, path);
 
-	res = ps2sif_lock_interruptible(ps2mcfs_lock, "mcfs_read");
+	res = ps2sif_lock_prio_interruptible(ps2mcfs_lock, "mcfs_read",
+					     PS2SIF_LOCK_PRIO_LOW);
 	if (res < 0)
 		return (res);
 	ps2mcfs_free_fd(de);
@@ -308,6 +485,21 @@ ps2mcfs_release(struct inode *inode, struct file *filp)
 	return (0);
 }
 
+static int
+ps2mcfs_fsync(struct file *filp, struct dentry *dentry, int datasync)
+{
+	int res;
+
+	res = ps2sif_lock_prio_interruptible(ps2mcfs_lock, "mcfs_fsync",
+					     PS2SIF_LOCK_PRIO_LOW);
+	if (res < 0)
+		return (res);
+	res = ps2mcfs_flush_wbuf(dentry->d_inode->u.generic_ip);
+	ps2sif_unlock_interruptible(ps2mcfs_lock);
+
+	return (res);
+}
+
 static int
 ps2mcfs_readpage(struct file *filp, struct page *page)
 {
@@ -328,7 +520,7 @@ ps2mcfs_get_block(struct inode *inode, long block, struct buffer_head *bh,
 	int block_shift;
 	long sector;
 
-	ps2sif_lock(ps2mcfs_lock, "mcfs_bmap");
+	ps2sif_lock_prio(ps2mcfs_lock, "mcfs_bmap", PS2SIF_LOCK_PRIO_LOW);
 	de = inode->u.generic_ip;
 	block_shift = de->root->block_shift;
 	if ((1 << PS2MCFS_SECTOR_BITS) <= (block << block_shift)) {
@@ -388,7 +580,7 @@ ps2mcfs_blkrw(int rw, int sector, void *buffer, int nsectors)
         DPRINT(DBG_BLOCKRW, "ps2mcfs: %s dirent=%d sect=%x, len=%d, addr=%p\n",
 	       rw ? "write" : "read", dno, sector, nsectors, buffer);
 
-	ps2sif_lock(ps2mcfs_lock, "mcfs_bmap");
+	ps2sif_lock_prio(ps2mcfs_lock, "mcfs_bmap", PS2SIF_LOCK_PRIO_LOW);
 	if ((de = ps2mcfs_find_dirent_no(dno)) == NULL ||
 	    de->inode == NULL) {
 		res = -ENOENT;
@@ -400,6 +592,9 @@ ps2mcfs_blkrw(int rw, int sector, void *buffer, int nsectors)
 		goto out;
 	}
 
+	if ((res = ps2mcfs_flush_wbuf(de)) < 0)
+		goto out;
+
 	pos = sector * 512;
 	res = ps2mcfs_rw(de->inode, buffer, nsectors * 512, &pos,
 			 rw ? WRITE_MODE : READ_MODE);
@@ -418,7 +613,7 @@ ps2mcfs_truncate(struct inode *inode)
 	const char *path;
 	struct ps2mc_dirent mcdirent;
 
-	ps2sif_lock(ps2mcfs_lock, "truncate");
+	ps2sif_lock_prio(ps2mcfs_lock, "truncate", PS2SIF_LOCK_PRIO_LOW);
 	de = inode->u.generic_ip;
 	path = ps2mcfs_get_path(de);
 	if (*path == '\0')
@@ -435,6 +630,7 @@ ps2mcfs_truncate(struct inode *inode)
 	 */
 	if (inode->i_size != 0)
 		goto out;
+	ps2mcfs_discard_wbuf(de);
 
 	/*
 	 * save mode and time of creation 
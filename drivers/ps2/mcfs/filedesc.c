@@ -173,7 +173,7 @@ ps2mcfs_get_fd(struct ps2mcfs_dirent *dirent, int rwmode)
 void
 ps2mcfs_free_fd(struct ps2mcfs_dirent *dirent)
 {
-	ps2sif_lock(ps2mcfs_lock, "mcfs_free_fd");
+	ps2sif_lock_prio(ps2mcfs_lock, "mcfs_free_fd", PS2SIF_LOCK_PRIO_LOW);
 	__free_fd(dirent);
 	ps2sif_unlock(ps2mcfs_lock);
 }
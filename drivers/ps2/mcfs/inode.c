@@ -45,8 +45,13 @@ static void ps2mcfs_put_inode(struct inode *inode)
 		ps2mc_terminate_name(buf, de->name, de->namelen);
 		TRACE("ps2mcfs_put_inode(%p): %s, icount=%d\n",
 		      inode, buf, atomic_read(&inode->i_count));
-		if (atomic_read(&inode->i_count) == 1)
+		if (atomic_read(&inode->i_count) == 1) {
+			ps2sif_lock_prio(ps2mcfs_lock, "mcfs_put_inode",
+					 PS2SIF_LOCK_PRIO_LOW);
+			ps2mcfs_flush_wbuf(de);
+			ps2sif_unlock(ps2mcfs_lock);
 			ps2mcfs_free_fd(de);
+		}
 	}
 
 	/*
@@ -64,13 +69,15 @@ static void ps2mcfs_delete_inode(struct inode *inode)
 {
 	struct ps2mcfs_dirent *de;
 
-	ps2sif_lock(ps2mcfs_lock, "mcfs_delete_inode");
+	ps2sif_lock_prio(ps2mcfs_lock, "mcfs_delete_inode",
+			 PS2SIF_LOCK_PRIO_LOW);
 	de = inode->u.generic_ip;
 	if (de) {
 		char buf[PS2MC_NAME_MAX + 1];
 
 		ps2mc_terminate_name(buf, de->name, de->namelen);
 		TRACE("ps2mcfs_delete_inode(%p): %s\n", inode, buf);
+		ps2mcfs_flush_wbuf(de);
 		de->inode = NULL;		/* failsafe */
 		inode->u.generic_ip = NULL;	/* failsafe */
 		ps2mcfs_unref_dirent(de);
@@ -167,8 +174,13 @@ ps2mcfs_setattr(struct dentry *dentry, struct iattr *attr)
 		inode->i_mode = (mcdirent.mode & ~((mode_t)de->root->opts.umask));
 	if (attr->ia_valid & ATTR_MTIME)
 		inode->i_mtime = mcdirent.mtime;
-	if (attr->ia_valid & ATTR_SIZE)
+	if (attr->ia_valid & ATTR_SIZE) {
+		ps2sif_lock_prio(ps2mcfs_lock, "mcfs_setattr",
+				 PS2SIF_LOCK_PRIO_LOW);
+		ps2mcfs_discard_wbuf(de);
+		ps2sif_unlock(ps2mcfs_lock);
 		inode->i_size = attr->ia_size;
+	}
 
 	return res;
 }
@@ -177,6 +189,7 @@ void ps2mcfs_put_super(struct super_block *sb)
 {
 
 	TRACE("ps2mcfs_put_super(dev=%s)\n", kdevname(sb->s_dev));
+	ps2mcfs_sync_wbuf(MINOR(sb->s_dev));
 	ps2mcfs_put_root(MINOR(sb->s_dev));
 }
 
@@ -201,6 +214,7 @@ static int parse_options(char *options, struct ps2mcfs_options *opts)
 	opts->uid = current->uid;
 	opts->gid = current->gid;
 	opts->umask = 077;
+	opts->writeback = 0;
 
 	for (this_char = strtok(options, ",");
 	     this_char;
@@ -217,6 +231,10 @@ static int parse_options(char *options, struct ps2mcfs_options *opts)
 			opts->gid = simple_strtoul(value, &value, 0);
 			if (*value) return (0);
 		}
+		else if (!strcmp(this_char, "writeback")) {
+			if (value) return (0);
+			opts->writeback = 1;
+		}
 		else if (!strcmp(this_char, "umask")) {
 			if (!value || !*value) return (0);
 			opts->umask = simple_strtoul(value, &value, 8);
@@ -315,7 +333,7 @@ void ps2mcfs_read_inode(struct inode * inode)
 	inode->i_uid = 0;
 	inode->i_gid = 0;
 
-	ps2sif_lock(ps2mcfs_lock, "mcfs_read_inode");
+	ps2sif_lock_prio(ps2mcfs_lock, "mcfs_read_inode", PS2SIF_LOCK_PRIO_LOW);
 	if ((de = ps2mcfs_find_dirent_ino(inode->i_ino)) == NULL) {
 		printk(KERN_CRIT "ps2mcfs: can't find dirent!\n");
 		goto out;
@@ -347,7 +365,8 @@ int ps2mcfs_update_inode(struct inode * inode)
 	struct ps2mcfs_dirent *de;
 	const char *path;
 
-	ps2sif_lock(ps2mcfs_lock, "mcfs_update_inode");
+	ps2sif_lock_prio(ps2mcfs_lock, "mcfs_update_inode",
+			 PS2SIF_LOCK_PRIO_LOW);
 	de = inode->u.generic_ip;
 
 	path = ps2mcfs_get_path(de);
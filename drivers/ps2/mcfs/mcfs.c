@@ -60,7 +60,8 @@ ps2mcfs_init()
 	}
 #endif
 
-	if (ps2sif_lock_interruptible(ps2mcfs_lock, "mcfs init") < 0)
+	if (ps2sif_lock_prio_interruptible(ps2mcfs_lock, "mcfs init",
+					   PS2SIF_LOCK_PRIO_LOW) < 0)
 		return (-1);
 
 	if (ps2mcfs_init_filebuf() < 0 ||
@@ -101,7 +102,7 @@ ps2mcfs_cleanup()
 {
 	TRACE("ps2mcfs_cleanup()\n");
 
-	ps2sif_lock(ps2mcfs_lock, "mcfs cleanup");
+	ps2sif_lock_prio(ps2mcfs_lock, "mcfs cleanup", PS2SIF_LOCK_PRIO_LOW);
 #ifdef PS2MCFS_DEBUG
 	if (ps2mcfs_debug & DBG_LOCK)
 		ps2sif_setlockflags(ps2mcfs_lock, oldflags);
@@ -158,7 +159,9 @@ ps2mcfs_thread(void *arg)
 	 * loop
 	 */
 	while(1) {
-		if (ps2sif_lock_interruptible(ps2mcfs_lock, "mcfs_thread")==0){
+		if (ps2sif_lock_prio_interruptible(ps2mcfs_lock, "mcfs_thread",
+						   PS2SIF_LOCK_PRIO_LOW)==0){
+			ps2mcfs_check_wbuf();
 			ps2mcfs_check_fd();
 			ps2sif_unlock(ps2mcfs_lock);
 		}
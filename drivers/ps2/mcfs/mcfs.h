@@ -18,6 +18,8 @@
 #define PS2MCFS_CHECK_INTERVAL	(PS2MCFS_FD_EXPIRE_TIME/3)
 #define PS2MCFS_SUPER_MAGIC	0xaaaa
 #define PS2MCFS_NAME_CACHESIZE	30
+#define PS2MCFS_WBUFSIZE	8192
+#define PS2MCFS_WB_EXPIRE_TIME	(HZ * 3)
 
 #define PS2MCFS_DIRENT_INVALID	(1<<0)
 #define PS2MCFS_DIRENT_BMAPPED	(1<<1)
@@ -35,6 +37,7 @@ struct ps2mcfs_options {
 	uid_t uid;
 	gid_t gid;
 	unsigned short umask;
+	int writeback;
 };
 
 struct ps2mcfs_root {
@@ -46,6 +49,20 @@ struct ps2mcfs_root {
 	kdev_t dev;
 };
 
+/*
+ * write-back buffer, holds data of contiguous small writes to a file
+ * which have not been written to the card yet
+ */
+struct ps2mcfs_wbuf {
+	struct ps2mcfs_dirent *dirent;
+	struct list_head link;
+	void *mem;
+	char *buf;		/* 64 byte aligned */
+	loff_t pos;
+	int len;
+	int expire_time;
+};
+
 struct ps2mcfs_dirent {
 	int no;
 	unsigned long ino;
@@ -53,6 +70,7 @@ struct ps2mcfs_dirent {
 	char name[PS2MC_NAME_MAX];
 	struct ps2mcfs_pathent *path;
 	struct ps2mcfs_filedesc *fd;
+	struct ps2mcfs_wbuf *wb;
 	unsigned short namelen;
 	unsigned long size;
 	struct inode *inode;
@@ -87,6 +105,10 @@ void ps2mcfs_check_fd(void);
 int ps2mcfs_init_filebuf(void);
 int ps2mcfs_exit_filebuf(void);
 int ps2mcfs_blkrw(int, int, void*, int);
+int ps2mcfs_flush_wbuf(struct ps2mcfs_dirent *);
+void ps2mcfs_discard_wbuf(struct ps2mcfs_dirent *);
+void ps2mcfs_check_wbuf(void);
+void ps2mcfs_sync_wbuf(int);
 
 int ps2mcfs_get_root(kdev_t, struct ps2mcfs_root **);
 int ps2mcfs_put_root(int);
@@ -0,0 +1,138 @@
+/*
+ *  PlayStation 2 Memory Card File System: small write benchmark
+ *
+ *  This file is subject to the terms and conditions of the GNU General
+ *  Public License Version 2. See the file "COPYING" in the main
+ *  directory of this archive for more details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/bench.h>
+#include <asm/uaccess.h>
+
+/*
+ * Built as ps2mcfstest.o with CONFIG_BENCH_MODULES. Load it with path=
+ * naming a file on a mounted memory card. The file is created (or truncated), filled by
+ * appending BENCH_FILESIZE bytes in pieces of each size below and
+ * fsync()ed, then read back sequentially and checked. The throughput
+ * of both is printed. Mount the card with and without "writeback" to
+ * compare. The file is left behind.
+ */
+#define BENCH_FILESIZE	(32 * 1024)
+#define BENCH_READSIZE	1024
+
+static char *path;
+MODULE_PARM(path, "s");
+
+static int writesizes[] = { 16, 128, 512, 1024 };
+
+static unsigned char buf[BENCH_FILESIZE];
+static unsigned char rbuf[BENCH_READSIZE];
+
+/* KiB/s; the card is slow enough for milliseconds */
+#define KIBPS(bytes, usec) ((bytes) / 1024 * 1000 / ((usec) / 1000 ? (usec) / 1000 : 1))
+
+static int bench_append(int size, uint32_t *usec)
+{
+	struct file *file;
+	struct timeval start;
+	mm_segment_t oldfs;
+	int pos, res = 0;
+
+	file = filp_open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+	if (file->f_op == NULL || file->f_op->write == NULL) {
+		filp_close(file, NULL);
+		return -EINVAL;
+	}
+
+	oldfs = get_fs();
+	set_fs(KERNEL_DS);
+	do_gettimeofday(&start);
+	for (pos = 0; pos < BENCH_FILESIZE; pos += size) {
+		res = file->f_op->write(file, buf + pos, size, &file->f_pos);
+		if (res != size) {
+			res = res < 0 ? res : -EIO;
+			break;
+		}
+		res = 0;
+	}
+	if (res == 0 && file->f_op->fsync)
+		res = file->f_op->fsync(file, file->f_dentry, 0);
+	*usec = bench_usec(&start);
+	set_fs(oldfs);
+
+	filp_close(file, NULL);
+
+	return res;
+}
+
+static int bench_read(uint32_t *usec)
+{
+	struct file *file;
+	struct timeval start;
+	int pos, res = 0;
+
+	file = filp_open(path, O_RDONLY, 0);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+
+	do_gettimeofday(&start);
+	for (pos = 0; pos < BENCH_FILESIZE; pos += BENCH_READSIZE) {
+		res = kernel_read(file, pos, rbuf, BENCH_READSIZE);
+		if (res != BENCH_READSIZE) {
+			res = res < 0 ? res : -EIO;
+			break;
+		}
+		if (memcmp(rbuf, buf + pos, BENCH_READSIZE) != 0) {
+			printk("mcfstest: data read back differs at %d\n", pos);
+			res = -EIO;
+			break;
+		}
+		res = 0;
+	}
+	*usec = bench_usec(&start);
+
+	filp_close(file, NULL);
+
+	return res;
+}
+
+int init_module(void)
+{
+	uint32_t seed = 0x12345678;
+	uint32_t wusec, rusec;
+	int i, res;
+
+	if (path == NULL) {
+		printk("mcfstest: give a file on a memory card as path=\n");
+		return -EINVAL;
+	}
+
+	for (i = 0; i < BENCH_FILESIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+
+	printk("mcfstest: %s, %d bytes\n", path, BENCH_FILESIZE);
+	for (i = 0; i < sizeof(writesizes) / sizeof(writesizes[0]); i++) {
+		if ((res = bench_append(writesizes[i], &wusec)) < 0) {
+			printk("mcfstest: write failed, %d\n", res);
+			break;
+		}
+		if ((res = bench_read(&rusec)) < 0) {
+			printk("mcfstest: read failed, %d\n", res);
+			break;
+		}
+		printk("%4d byte appends: %4d KiB/s, sequential read %4d KiB/s\n",
+		       writesizes[i], KIBPS(BENCH_FILESIZE, wusec),
+		       KIBPS(BENCH_FILESIZE, rusec));
+	}
+
+	return BENCH_DONE;
+}
@@ -78,7 +78,7 @@ ps2mcfs_get_path(struct ps2mcfs_dirent *dirent)
 	struct ps2mcfs_dirent *p;
 	int i;
 
-	ps2sif_lock(ps2mcfs_lock, "mcfs_get_path");
+	ps2sif_lock_prio(ps2mcfs_lock, "mcfs_get_path", PS2SIF_LOCK_PRIO_LOW);
 	ent = dirent->path;
 	if (ent != NULL) {
 		list_del(&ent->link);
@@ -142,7 +142,7 @@ void
 ps2mcfs_put_path(struct ps2mcfs_dirent *dirent, const char *path)
 {
 
-	ps2sif_lock(ps2mcfs_lock, "mcfs_put_path");
+	ps2sif_lock_prio(ps2mcfs_lock, "mcfs_put_path", PS2SIF_LOCK_PRIO_LOW);
 	if (dirent->path != NULL) {
 #ifdef PS2MCFS_DEBUG
 		if (dirent->path->pathname != path)
@@ -161,7 +161,7 @@ ps2mcfs_free_path(struct ps2mcfs_dirent *dirent)
 {
 	struct ps2mcfs_pathent *ent;
 
-	ps2sif_lock(ps2mcfs_lock, "mcfs_free_path");
+	ps2sif_lock_prio(ps2mcfs_lock, "mcfs_free_path", PS2SIF_LOCK_PRIO_LOW);
 	if (dirent->path != NULL) {
 		ent = dirent->path;
 #ifdef PS2MCFS_DEBUG
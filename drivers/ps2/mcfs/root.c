@@ -32,7 +32,7 @@ static void ps2mcfs_listener(void *ctxx, int portslot, int oldstate, int newstat
 	DPRINT(DBG_INFO, "card%02x state=%d->%d\n",
 	       portslot, oldstate, newstate);
 
-	ps2sif_lock(ps2mcfs_lock, "mcfs_listener");
+	ps2sif_lock_prio(ps2mcfs_lock, "mcfs_listener", PS2SIF_LOCK_PRIO_LOW);
 	if (ps2mcfs_get_root(portslot, &root) < 0) {
 		ps2sif_unlock(ps2mcfs_lock);
 		return;
@@ -146,7 +146,7 @@ int ps2mcfs_get_root(kdev_t dev, struct ps2mcfs_root **rootp)
 	struct ps2mcfs_root *ent = NULL;
 	extern int * blksize_size[MAX_BLKDEV]; /* linux/blkdev.h */
 
-	ps2sif_lock(ps2mcfs_lock, "mcfs_get_root");
+	ps2sif_lock_prio(ps2mcfs_lock, "mcfs_get_root", PS2SIF_LOCK_PRIO_LOW);
 	if (ps2mc_checkdev(dev) < 0) {
 		res = -EINVAL;
 		goto out;
@@ -202,7 +202,7 @@ int ps2mcfs_put_root(int portslot)
 {
 	int i, res;
 
-	ps2sif_lock(ps2mcfs_lock, "mcfs_get_root");
+	ps2sif_lock_prio(ps2mcfs_lock, "mcfs_get_root", PS2SIF_LOCK_PRIO_LOW);
 	res = 0;
 	for (i = 0; i < ARRAYSIZEOF(roots); i++) {
 		if (roots[i].portslot == portslot) {
@@ -16,7 +16,10 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/major.h>
+#include <linux/sched.h>
+#include <linux/interrupt.h>
 #include <asm/addrspace.h>
+#include <asm/ps2/irq.h>
 #include <asm/uaccess.h>
 #ifdef CONFIG_PROC_FS
 #include <linux/proc_fs.h>
@@ -34,9 +37,24 @@
 #define MAXNPADS	PS2PAD_MAXNPADS
 #define DMABUFSIZE	(16 * 16)
 #define INTERVAL_TIME  	HZ/10	/* 100ms */
+#define EVBUFSIZE	64	/* must be power of 2 */
 
 struct ps2pad_dev {
 	struct ps2pad_libctx *pad;
+
+	/* event mode (PS2PAD_IOCSETEVENTMODE) */
+	int evmode;
+	int evsync;		/* post current state even if unchanged */
+	int evflags;		/* flags for the next event */
+	unsigned int overruns;
+	struct ps2pad_dev *evnext;
+	wait_queue_head_t evq;
+	/*
+	 * single producer (ps2pad_post_events) and single consumer
+	 * (ps2pad_read_events), no lock needed
+	 */
+	volatile int evhead, evtail;
+	struct ps2pad_event ev[EVBUFSIZE];
 };
 
 struct ps2pad_ctl_dev {
@@ -44,8 +62,7 @@ struct ps2pad_ctl_dev {
 	struct ps2pad_stat stat[MAXNPADS];
 };
 
-static void ps2pad_start_timer(void);
-static inline void ps2pad_stop_timer(void);
+static void ps2pad_set_source(void);
 static inline void ps2pad_update_status(void);
 static int lock(void);
 static void unlock(void);
@@ -89,9 +106,18 @@ static DECLARE_WAIT_QUEUE_HEAD(watchq);
 static struct timer_list ps2pad_timer;
 static struct ps2pad_stat cur_stat[MAXNPADS];
 static struct ps2pad_stat new_stat[MAXNPADS];
-static int open_devices = 0;
+static int timer_users = 0;
 static int run_timer = 0;
 
+/* event mode */
+static struct ps2pad_dev *evdevs = NULL;
+static int evreaders = 0;
+static int vblank_active = 0;
+static struct {
+	unsigned char stat, len;
+	unsigned char data[PS2PAD_DATASIZE];
+} last_data[MAXNPADS];
+
 static struct file_operations ps2pad_fops = {
 	owner:		THIS_MODULE,
 	read:		ps2pad_read,
@@ -207,6 +233,86 @@ ps2pad_read_stat(struct ps2pad_stat *stat)
 	}
 }
 
+static void
+ps2pad_put_event(struct ps2pad_dev *dev, struct ps2pad_event *ev)
+{
+	int tail = dev->evtail;
+	int next = (tail + 1) & (EVBUFSIZE - 1);
+
+	if (next == dev->evhead) {
+		/* the reader is not keeping up, drop the newest one */
+		dev->overruns++;
+		dev->evflags |= PS2PAD_EVENT_OVERRUN;
+		return;
+	}
+	dev->ev[tail] = *ev;
+	dev->ev[tail].flags = dev->evflags;
+	dev->evflags = 0;
+	wmb();
+	dev->evtail = next;
+	wake_up_interruptible(&dev->evq);
+}
+
+/*
+ * compare each pad with the previous sample and queue one event per
+ * changed pad to the readers of that pad
+ */
+static void
+ps2pad_post_events(void)
+{
+	int i, res, changed, stamped;
+	struct ps2pad_dev *dev;
+	struct ps2pad_event ev;
+	struct timeval tv;
+
+	if (evdevs == NULL)
+		return;
+
+	stamped = 0;
+	for (i = 0; i < ps2pad_npads; i++) {
+		res = ps2padlib_GetState(ps2pad_pads[i].port,
+					 ps2pad_pads[i].slot);
+		/* the whole event is copied out, data[] past len too */
+		memset(&ev, 0, sizeof(ev));
+		ev.stat = ps2pad_stat_conv(res);
+		if (ev.stat == PS2PAD_STAT_READY) {
+			res = ps2padlib_Read(ps2pad_pads[i].port,
+					     ps2pad_pads[i].slot, ev.data);
+			if (res != 0 && ev.data[0] == 0) {
+				/* pad data is valid */
+				ev.len = (ev.data[1] & 0x0f) * 2 + 2;
+			} else {
+				ev.stat = PS2PAD_STAT_ERROR;
+			}
+		}
+
+		changed = (ev.stat != last_data[i].stat ||
+			   ev.len != last_data[i].len ||
+			   memcmp(ev.data, last_data[i].data, ev.len));
+		if (changed) {
+			last_data[i].stat = ev.stat;
+			last_data[i].len = ev.len;
+			memcpy(last_data[i].data, ev.data, ev.len);
+		}
+
+		for (dev = evdevs; dev != NULL; dev = dev->evnext) {
+			if (dev->pad != &ps2pad_pads[i] ||
+			    (!changed && !dev->evsync))
+				continue;
+			dev->evsync = 0;
+			if (!stamped) {
+				do_gettimeofday(&tv);
+				stamped = 1;
+			}
+			ev.sec = tv.tv_sec;
+			ev.usec = tv.tv_usec;
+			ev.portslot = ((ps2pad_pads[i].port << 4) |
+				       ps2pad_pads[i].slot);
+			ps2pad_put_event(dev, &ev);
+		}
+	}
+}
+
 static void
 ps2pad_do_timer(unsigned long data)
 {
@@ -226,29 +332,70 @@ ps2pad_do_timer(unsigned long data)
 #endif
 		wake_up_interruptible(&watchq);
 	}
+	ps2pad_post_events();
 
-	ps2pad_timer.expires = jiffies + INTERVAL_TIME;
-	add_timer(&ps2pad_timer);
+	if (run_timer) {
+		/* fall back to every tick if event readers have no vblank */
+		ps2pad_timer.expires = jiffies + (evreaders ? 1 : INTERVAL_TIME);
+		add_timer(&ps2pad_timer);
+	}
 }
 
 static void
-ps2pad_start_timer()
+ps2pad_do_tasklet(unsigned long data)
 {
-	DPRINT("start timer\n");
-	ps2pad_read_stat(cur_stat);
 	cli();
-	run_timer = 1;
-	ps2pad_do_timer(ps2pad_timer.data);
+	ps2pad_do_timer(data);
 	sti();
 }
 
-static inline void
-ps2pad_stop_timer()
+static DECLARE_TASKLET(ps2pad_tasklet, ps2pad_do_tasklet, 0);
+
+static void
+ps2pad_vblank(int irq, void *dev_id, struct pt_regs *regs)
+{
+	tasklet_schedule(&ps2pad_tasklet);
+}
+
+/*
+ * Choose what samples the pads:
+ *   event readers	every vblank (or every tick if we can't share it)
+ *   ctl device/waiters	every INTERVAL_TIME
+ *   otherwise		nothing, read() on a pad device needs no sampling
+ * Must be called from process context.
+ */
+static void
+ps2pad_set_source()
 {
-	DPRINT("stop timer\n");
+	if (evreaders && !vblank_active) {
+		if (request_irq(IRQ_INTC_VB_ON, ps2pad_vblank,
+				SA_INTERRUPT|SA_SHIRQ, "ps2pad",
+				ps2pad_pads) == 0) {
+			DPRINT("start vblank\n");
+			vblank_active = 1;
+		} else {
+			printk(KERN_WARNING
+			       "ps2pad: can't share vblank interrupt\n");
+		}
+	} else if (!evreaders && vblank_active) {
+		DPRINT("stop vblank\n");
+		free_irq(IRQ_INTC_VB_ON, ps2pad_pads);
+		tasklet_kill(&ps2pad_tasklet);
+		vblank_active = 0;
+	}
+
 	cli();
-	run_timer = 0;
-	del_timer(&ps2pad_timer);
+	if (vblank_active || (!evreaders && !timer_users)) {
+		if (run_timer) {
+			DPRINT("stop timer\n");
+			run_timer = 0;
+			del_timer(&ps2pad_timer);
+		}
+	} else if (!run_timer) {
+		DPRINT("start timer\n");
+		run_timer = 1;
+		ps2pad_do_timer(ps2pad_timer.data);
+	}
 	sti();
 }
 
@@ -256,11 +403,42 @@ static inline void
 ps2pad_update_status()
 {
 	cli();
-	if (run_timer) {
+	if (run_timer)
 		del_timer(&ps2pad_timer);
+	if (run_timer || vblank_active)
 		ps2pad_do_timer(ps2pad_timer.data);
+	sti();
+}
+
+static void
+ps2pad_set_evmode(struct ps2pad_dev *dev, int on)
+{
+	struct ps2pad_dev **pp;
+
+	if (dev->evmode == on)
+		return;
+
+	cli();
+	if (on) {
+		dev->evhead = dev->evtail = 0;
+		dev->evflags = 0;
+		dev->evsync = 1;
+		dev->evnext = evdevs;
+		evdevs = dev;
+		evreaders++;
+	} else {
+		for (pp = &evdevs; *pp != NULL; pp = &(*pp)->evnext) {
+			if (*pp == dev) {
+				*pp = dev->evnext;
+				break;
+			}
+		}
+		evreaders--;
 	}
+	dev->evmode = on;
 	sti();
+
+	ps2pad_set_source();
 }
 
 static int
@@ -290,6 +468,39 @@ unlock()
 	sti();
 }
 
+static ssize_t
+ps2pad_read_events(struct file *filp, char *buf, size_t size)
+{
+	struct ps2pad_dev *dev = filp->private_data;
+	int head;
+	size_t n;
+
+	if (size < sizeof(struct ps2pad_event))
+		return -EINVAL;
+
+	while (dev->evhead == dev->evtail) {
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(dev->evq,
+					     dev->evhead != dev->evtail))
+			return -ERESTARTSYS;
+	}
+
+	head = dev->evhead;
+	for (n = 0; n + sizeof(struct ps2pad_event) <= size &&
+		     head != dev->evtail; n += sizeof(struct ps2pad_event)) {
+		rmb();
+		if (copy_to_user(buf + n, &dev->ev[head],
+				 sizeof(struct ps2pad_event)))
+			break;
+		head = (head + 1) & (EVBUFSIZE - 1);
+	}
+	mb();
+	dev->evhead = head;
+
+	return n ? n : -EFAULT;
+}
+
 static ssize_t
 ps2pad_read(struct file *filp, char *buf, size_t size, loff_t *off)
 {
@@ -297,6 +508,9 @@ ps2pad_read(struct file *filp, char *buf, size_t size, loff_t *off)
 	struct ps2pad_dev *dev = filp->private_data;
 	u_char data[PS2PAD_DATASIZE];
 
+	if (dev->evmode)
+		return ps2pad_read_events(filp, buf, size);
+
 	/* ps2padlib_Read() does not involve any RPC to IOP.
 	  if (lock() < 0) return -ERESTARTSYS;
 	 */
@@ -326,6 +540,9 @@ ps2pad_wait_req_stat(struct ps2pad_dev *dev)
 {
 	int res;
 
+	/* someone has to wake us up */
+	timer_users++;
+	ps2pad_set_source();
 	for ( ; ; ) {
 		cli();
 		res = ps2padlib_GetReqState(dev->pad->port, dev->pad->slot);
@@ -333,14 +550,19 @@ ps2pad_wait_req_stat(struct ps2pad_dev *dev)
 		       dev->pad->port, dev->pad->slot, res);
 		if (res != PadReqStateBusy) {
 			sti();
-			return res;
+			break;
 		}
 		interruptible_sleep_on(&watchq);
 		sti();
 		if(signal_pending(current)) {
-			return -ERESTARTSYS;
+			res = -ERESTARTSYS;
+			break;
 		}
 	}
+	timer_users--;
+	ps2pad_set_source();
+
+	return res;
 }
 
 static int
@@ -502,6 +724,12 @@ ps2pad_ioctl(struct inode *inode, struct file *filp, u_int cmd, u_long arg)
 		return 0;
 		}
 		break;
+	case PS2PAD_IOCSETEVENTMODE:
+		if (get_user(res, (int *)arg))
+			return -EFAULT;
+		ps2pad_set_evmode(dev, res != 0);
+		return 0;
+		break;
 	default:
 		return -EINVAL;
 	}
@@ -537,6 +765,9 @@ ps2pad_open(struct inode *inode, struct file *filp)
 		filp->f_op = &ps2pad_ctlops;
 
 		dev->stat_is_valid = 0;
+
+		timer_users++;
+		ps2pad_set_source();
 	} else {
 		/*
 		 * control device
@@ -568,11 +799,12 @@ ps2pad_open(struct inode *inode, struct file *filp)
 		filp->private_data = dev;
 
 		dev->pad = &ps2pad_pads[i];
+		dev->evmode = 0;
+		dev->evnext = NULL;
+		dev->overruns = 0;
+		init_waitqueue_head(&dev->evq);
 	}
 
-	if (open_devices++ == 0)
-		ps2pad_start_timer();
-
 	return 0;
 }
 
@@ -634,7 +866,15 @@ ps2pad_ctl_ioctl(struct inode *inode, struct file *filp, u_int cmd, u_long arg)
 static unsigned int
 ps2pad_poll(struct file *file, poll_table * wait)
 {
-	return POLLIN | POLLRDNORM;
+	struct ps2pad_dev *dev = file->private_data;
+
+	if (!dev->evmode)
+		return POLLIN | POLLRDNORM;
+
+	poll_wait(file, &dev->evq, wait);
+	if (dev->evhead != dev->evtail)
+		return POLLIN | POLLRDNORM;
+	return 0;
 }
 
 static unsigned int
@@ -659,11 +899,9 @@ ps2pad_release(struct inode *inode, struct file *filp)
 
 	DPRINT("close, dev=%lx\n", (unsigned long)dev);
 
+	ps2pad_set_evmode(dev, 0);
        	kfree(dev);
 
-	if (--open_devices == 0)
-		ps2pad_stop_timer();
-
 	return 0;
 }
 
@@ -676,8 +914,8 @@ ps2pad_ctl_release(struct inode *inode, struct file *filp)
 
 	kfree(dev);
 
-	if (--open_devices == 0)
-		ps2pad_stop_timer();
+	timer_users--;
+	ps2pad_set_source();
 
 	return 0;
 }
@@ -719,6 +957,8 @@ ps2pad_read_proc(char *page, char **start, off_t offset, int len, int *eof, void
 		}
 		p += sprintf(p, "\n");
 	}
+	p += sprintf(p, "event readers: %d (%s)\n", evreaders,
+		     vblank_active ? "vblank" : (run_timer ? "timer" : "idle"));
 	sti();
 
 	return (p - page);
@@ -732,10 +972,52 @@ static int init_flags;
 #define INIT_DEV	(1<< 2)
 #define INIT_PROC	(1<< 3)
 
+/*
+ * Open every port and slot at once instead of one RPC round trip after
+ * another. Each candidate gets the DMA buffer of its own index, so the
+ * calls don't depend on each other's results.
+ */
+static void __init ps2pad_scan(void)
+{
+	struct sbios_rpc_queue q;
+	struct sbios_rpc_req req[NPORTS * NSLOTS];
+	struct sbr_pad_portopen_arg arg[NPORTS * NSLOTS];
+	void *buf;
+	int i, port, slot;
+
+	sbios_rpc_queue_init(&q, NPORTS * NSLOTS);
+	for (i = 0; i < NPORTS * NSLOTS; i++) {
+		if (MAXNPADS <= i) {
+			printk(KERN_WARNING "ps2pad: too many pads\n");
+			break;
+		}
+		if (ps2padlib_PortOpenAsync(&q, &req[i], &arg[i],
+					    i / NSLOTS, i % NSLOTS,
+					    ps2pad_pads[i].dmabuf) != 0)
+			req[i].result = -1;
+	}
+	sbios_rpc_flush(&q);
+	while (sbios_rpc_reap(&q, 1) != NULL)
+		;
+
+	for (i = 0; i < NPORTS * NSLOTS && i < MAXNPADS; i++) {
+		if (req[i].result != 1)
+			continue;
+		port = i / NSLOTS;
+		slot = i % NSLOTS;
+		DPRINT("port%d  slot%d\n", port, slot);
+		buf = ps2pad_pads[i].dmabuf;
+		ps2pad_pads[i].dmabuf = ps2pad_pads[ps2pad_npads].dmabuf;
+		ps2pad_pads[ps2pad_npads].dmabuf = buf;
+		ps2pad_pads[ps2pad_npads].port = port;
+		ps2pad_pads[ps2pad_npads].slot = slot;
+		ps2pad_npads++;
+	}
+}
+
 int __init ps2pad_init(void)
 {
 	int res, i;
-	int port, slot;
 
 	DPRINT("PlayStation 2 game pad: initialize...\n");
 
@@ -770,22 +1052,7 @@ int __init ps2pad_init(void)
 	 * scan all pads and start DMA
 	 */
 	if (lock() < 0) return -ERESTARTSYS;
-	for (port = 0; port < NPORTS; port++) {
-	    for (slot = 0; slot < NSLOTS; slot++) {
-		res = ps2padlib_PortOpen(port, slot,
-				     (void *)ps2pad_pads[ps2pad_npads].dmabuf);
-		if (res == 1) {
-			if (MAXNPADS <= ps2pad_npads) {
-				printk(KERN_WARNING "ps2pad: too many pads\n");
-				break;
-			}
-			DPRINT("port%d  slot%d\n", port, slot);
-			ps2pad_pads[ps2pad_npads].port = port;
-			ps2pad_pads[ps2pad_npads].slot = slot;
-			ps2pad_npads++;
-		}
-	    }
-	}
+	ps2pad_scan();
 	unlock();
 
 	/*
@@ -818,19 +1085,27 @@ void
 ps2pad_cleanup(void)
 {
 #ifndef PS2PAD_NOPORTCLOSE
-	int res, i;
+	struct sbios_rpc_queue q;
+	struct sbios_rpc_req req[MAXNPADS], *done;
+	struct sbr_pad_portclose_arg arg[MAXNPADS];
+	int i;
 #endif
 
 	DPRINT("unload\n");
 
 #ifndef PS2PAD_NOPORTCLOSE
 	if (init_flags & INIT_LIB) {
+		/* close all ports at once, the calls are independent */
+		sbios_rpc_queue_init(&q, MAXNPADS);
 		for (i = 0; i < ps2pad_npads; i++) {
-			res = ps2padlib_PortClose(ps2pad_pads[i].port,
-					      ps2pad_pads[i].slot);
-			if (res != 1) {
+			if (ps2padlib_PortCloseAsync(&q, &req[i], &arg[i],
+						     ps2pad_pads[i].port,
+						     ps2pad_pads[i].slot) != 0)
+				printk(KERN_WARNING "ps2pad: failed to close\n");
+		}
+		while ((done = sbios_rpc_reap(&q, 0)) != NULL) {
+			if (done->result != 1)
 				printk(KERN_WARNING "ps2pad: failed to close\n");
-			}
 		}
 	}
 #endif
@@ -64,6 +64,32 @@ static __inline__ int ps2padlib_PortClose(int port, int slot)
 	return res;
 }
 
+/*
+ * The asynchronous variants only issue the call. The argument block and
+ * the request must stay valid until the request has been reaped from q;
+ * the result is in req->result then.
+ */
+static __inline__ int ps2padlib_PortOpenAsync(struct sbios_rpc_queue *q,
+					      struct sbios_rpc_req *req,
+					      struct sbr_pad_portopen_arg *po_arg,
+					      int port, int slot, void *addr)
+{
+	po_arg->port = port;
+	po_arg->slot = slot;
+	po_arg->addr = addr;
+	return sbios_rpc_submit(q, req, SBR_PAD_PORTOPEN, po_arg);
+}
+
+static __inline__ int ps2padlib_PortCloseAsync(struct sbios_rpc_queue *q,
+					       struct sbios_rpc_req *req,
+					       struct sbr_pad_portclose_arg *pc_arg,
+					       int port, int slot)
+{
+	pc_arg->port = port;
+	pc_arg->slot = slot;
+	return sbios_rpc_submit(q, req, SBR_PAD_PORTCLOSE, pc_arg);
+}
+
 static __inline__ int ps2padlib_SetMainMode(int port, int slot, int offs, int lock)
 {
 	struct sbr_pad_setmainmode_arg sm_arg;
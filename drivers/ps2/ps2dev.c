@@ -60,6 +60,8 @@ static int ps2dev_send_ioctl(struct dma_device *dev,
     struct ps2_plist plist;
     struct ps2_pstop pstop;
     struct ps2_pchain pchain;
+    struct ps2_cmdlist clist;
+    struct ps2_cmdsub *subs;
     int result;
     u32 ff, oldff;
     int val;
@@ -92,6 +94,8 @@ static int ps2dev_send_ioctl(struct dma_device *dev,
 	return copy_to_user((void *)arg, &pstop, sizeof(pstop)) ? -EFAULT : 0;
     case PS2IOC_SENDLIMIT:
 	return ps2dma_set_qlimit(dev, DMA_SENDCH, arg);
+    case PS2IOC_SENDLBATCH:
+	return ps2dma_set_sendl_batch(dev, arg);
 
     case PS2IOC_SENDC:
 	if (!capable(CAP_SYS_ADMIN) || !capable(CAP_SYS_RAWIO))
@@ -100,6 +104,28 @@ static int ps2dev_send_ioctl(struct dma_device *dev,
 	    return -EFAULT;
 	return ps2dma_send_chain(dev, &pchain);
 
+    case PS2IOC_CMDBUFREG:
+	if (copy_from_user(&pkt, (void *)arg, sizeof(pkt)))
+	    return -EFAULT;
+	return ps2dma_cmdbuf_register(dev, &pkt);
+    case PS2IOC_CMDBUFUNREG:
+	return ps2dma_cmdbuf_unregister(dev, arg);
+    case PS2IOC_CMDBUFSUBMIT:
+	if (copy_from_user(&clist, (void *)arg, sizeof(clist)))
+	    return -EFAULT;
+	if (clist.num <= 0 ||
+	    clist.num > PAGE_SIZE / sizeof(struct ps2_cmdsub))
+	    return -EINVAL;
+	if ((subs = kmalloc(sizeof(struct ps2_cmdsub) * clist.num, GFP_KERNEL)) == NULL)
+	    return -ENOMEM;
+	if (copy_from_user(subs, clist.sub, sizeof(struct ps2_cmdsub) * clist.num)) {
+	    kfree(subs);
+	    return -EFAULT;
+	}
+	result = ps2dma_cmdbuf_submit(dev, clist.num, subs);
+	kfree(subs);
+	return result;
+
     case PS2IOC_ENABLEEVENT:
 	oldff = dev->intr_mask;
 	if ((int)arg >= 0) {
@@ -233,20 +259,87 @@ static struct vm_operations_struct ps2dev_vmops = {
  *  Graphics Synthesizer (/dev/ps2gs) driver
  */
 
-static int vb_gssreg_num = 0;
-static struct ps2_gssreg *vb_gssreg_p = NULL;
+/*
+ *  Privileged register updates deferred to the next V-Blank start.
+ *  Each PS2IOC_SGSSREG_VB call is validated and staged on the stack,
+ *  then merged into the pending set with interrupts off; the V-Blank
+ *  handler writes the whole pending set in one go.  A page flip plus
+ *  any display mode registers therefore land in the same frame, and a
+ *  second call before the next V-Blank just overrides older values.
+ */
+
+#define VB_GSSREG_CSR		(PS2_GSSREG_BGCOLOR + 1)
+#define VB_GSSREG_SIGLBLID	(PS2_GSSREG_BGCOLOR + 2)
+#define VB_GSSREG_NUM		(PS2_GSSREG_BGCOLOR + 3)
+
+struct vb_gssreg_set {
+    u32 mask;				/* slots to be written */
+    u64 val[VB_GSSREG_NUM];
+};
+
+static spinlock_t vb_gssreg_lock = SPIN_LOCK_UNLOCKED;
+static struct vb_gssreg_set vb_gssreg;	/* pending set */
+static const int vb_gssreg_reg[VB_GSSREG_NUM] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    PS2_GSSREG_CSR, PS2_GSSREG_SIGLBLID,
+};
 
+static inline int vb_gssreg_slot(int reg)
+{
+    if (reg >= PS2_GSSREG_PMODE && reg <= PS2_GSSREG_BGCOLOR)
+	return reg;
+    if (reg == PS2_GSSREG_CSR)
+	return VB_GSSREG_CSR;
+    if (reg == PS2_GSSREG_SIGLBLID)
+	return VB_GSSREG_SIGLBLID;
+    return -1;
+}
+
+/* called from the V-Blank start handler */
 void ps2gs_sgssreg_vb(void)
 {
     int i;
+    u32 mask;
 
-    if (vb_gssreg_num) {
-	for (i = 0; i < vb_gssreg_num; i++)
-	    ps2gs_set_gssreg(vb_gssreg_p[i].reg, vb_gssreg_p[i].val);
-	kfree(vb_gssreg_p);
-	vb_gssreg_num = 0;
-	vb_gssreg_p = NULL;
+    if (vb_gssreg.mask == 0)
+	return;
+
+    spin_lock(&vb_gssreg_lock);
+    mask = vb_gssreg.mask;
+    for (i = 0; mask != 0; i++, mask >>= 1)
+	if (mask & 1)
+	    ps2gs_set_gssreg(vb_gssreg_reg[i], vb_gssreg.val[i]);
+    vb_gssreg.mask = 0;
+    spin_unlock(&vb_gssreg_lock);
+}
+
+static int ps2gs_sgssreg_vb_queue(struct ps2_sgssreg_vb *sgssreg_vb)
+{
+    struct vb_gssreg_set set;
+    struct ps2_gssreg gssreg;
+    unsigned long flags;
+    int i, slot;
+
+    if (sgssreg_vb->num <= 0)
+	return -EINVAL;
+    set.mask = 0;
+    for (i = 0; i < sgssreg_vb->num; i++) {
+	if (copy_from_user(&gssreg, &sgssreg_vb->gssreg[i], sizeof(gssreg)))
+	    return -EFAULT;
+	if ((slot = vb_gssreg_slot(gssreg.reg)) < 0)
+	    return -EINVAL;
+	set.mask |= 1 << slot;
+	set.val[slot] = gssreg.val;
     }
+
+    spin_lock_irqsave(&vb_gssreg_lock, flags);
+    vb_gssreg.mask |= set.mask;
+    for (i = 0; i < VB_GSSREG_NUM; i++)
+	if (set.mask & (1 << i))
+	    vb_gssreg.val[i] = set.val[i];
+    spin_unlock_irqrestore(&vb_gssreg_lock, flags);
+    return 0;
 }
 
 static int ps2gs_ioctl(struct inode *inode, struct file *file,
@@ -256,6 +349,8 @@ static int ps2gs_ioctl(struct inode *inode, struct file *file,
     struct dma_device *dev = (struct dma_device *)file->private_data;
     struct ps2_gsinfo gsinfo;
     struct ps2_image image;
+    struct ps2_imagelist imagelist;
+    struct ps2_imagereq imagereq;
     struct ps2_gssreg gssreg;
     struct ps2_gsreg gsreg;
     struct ps2_gifreg gifreg;
@@ -265,7 +360,7 @@ static int ps2gs_ioctl(struct inode *inode, struct file *file,
     struct ps2_dispfb dispfb;
     struct ps2_pmode pmode;
     struct ps2_sgssreg_vb sgssreg_vb;
-    int val;
+    int val, i, ticket = 0;
 
     if ((result = ps2dev_send_ioctl(dev, cmd, arg)) != -ENOIOCTLCMD)
 	return result;
@@ -282,11 +377,38 @@ static int ps2gs_ioctl(struct inode *inode, struct file *file,
     case PS2IOC_LOADIMAGEA:
 	if (copy_from_user(&image, (void *)arg, sizeof(image)))
 	    return -EFAULT;
-	return ps2gs_loadimage(&image, dev, cmd == PS2IOC_LOADIMAGEA);
+	return ps2gs_loadimage(&image, dev,
+			       cmd == PS2IOC_LOADIMAGEA ? PS2IMAGE_ASYNC : 0);
     case PS2IOC_STOREIMAGE:
+    case PS2IOC_STOREIMAGEA:
 	if (copy_from_user(&image, (void *)arg, sizeof(image)))
 	    return -EFAULT;
-	return ps2gs_storeimage(&image, dev);
+	return ps2gs_storeimage(&image, dev,
+				cmd == PS2IOC_STOREIMAGEA ? PS2IMAGE_NOTIFY : 0);
+    case PS2IOC_IMAGEQUEUE:
+	if (copy_from_user(&imagelist, (void *)arg, sizeof(imagelist)))
+	    return -EFAULT;
+	if (imagelist.num <= 0)
+	    return -EINVAL;
+	for (i = 0; i < imagelist.num; i++) {
+	    if (copy_from_user(&imagereq, &imagelist.req[i], sizeof(imagereq))) {
+		result = -EFAULT;
+		break;
+	    }
+	    if (imagereq.dir == PS2_IMAGE_LOAD)
+		result = ps2gs_loadimage(&imagereq.image, dev, PS2IMAGE_NOTIFY);
+	    else if (imagereq.dir == PS2_IMAGE_STORE)
+		result = ps2gs_storeimage(&imagereq.image, dev, PS2IMAGE_NOTIFY);
+	    else
+		result = -EINVAL;
+	    if (result < 0)
+		break;
+	    ticket = result;
+	}
+	/* preceding entries stay queued, report the last one of them */
+	return i > 0 ? ticket : result;
+    case PS2IOC_IMAGEDONE:
+	return ps2gs_image_isdone(arg);
 
     case PS2IOC_SGSSREG:
 	if (copy_from_user(&gssreg, (void *)arg, sizeof(gssreg)))
@@ -392,20 +514,9 @@ static int ps2gs_ioctl(struct inode *inode, struct file *file,
 	return 0;
 
     case PS2IOC_SGSSREG_VB:
-	if (vb_gssreg_num)
-	    return -EBUSY;
 	if (copy_from_user(&sgssreg_vb, (void *)arg, sizeof(sgssreg_vb)))
 	    return -EFAULT;
-	if (sgssreg_vb.num <= 0)
-	    return -EINVAL;
-	if ((vb_gssreg_p = kmalloc(sizeof(struct ps2_gssreg) * sgssreg_vb.num, GFP_KERNEL)) == NULL)
-	    return -ENOMEM;
-	if (copy_from_user(vb_gssreg_p, sgssreg_vb.gssreg, sizeof(struct ps2_gssreg) * sgssreg_vb.num)) {
-	    kfree(vb_gssreg_p);
-	    return -EFAULT;
-	}
-	vb_gssreg_num = sgssreg_vb.num;
-	return 0;
+	return ps2gs_sgssreg_vb_queue(&sgssreg_vb);
     }
     return -EINVAL;
 }
@@ -1060,6 +1171,7 @@ int __init ps2dev_init(void)
     }
 
     ps2ev_init();
+    ps2pl_init();
     spin_lock_irq(&ps2dma_channels[DMA_GIF].lock);
     ps2dma_channels[DMA_GIF].reset = ps2gif_reset;
     ps2dma_channels[DMA_VIF0].reset = ps2vpu0_reset;
@@ -1095,6 +1207,7 @@ void ps2dev_cleanup(void)
     ps2dma_channels[DMA_IPU_to].reset = NULL;
     spin_unlock_irq(&ps2dma_channels[DMA_GIF].lock);
     ps2ev_cleanup();
+    ps2pl_cleanup();
 }
 
 module_init(ps2dev_init);
@@ -26,6 +26,12 @@
 
 #define DMA_QUEUE_LIMIT_MAX	16
 #define DMA_USER_LIMIT	(1 * 1024 * 1024)
+#define DMA_TAG_MAXLEN	(0xffff * DMA_TRUNIT)	/* max. data size of a tag */
+
+/* contiguous page pool for page lists */
+#define PS2PL_CHUNK_ORDER	6		/* 256KB */
+#define PS2PL_CHUNK_PAGES	(1 << PS2PL_CHUNK_ORDER)
+#define PS2PL_POOL_MAX		32
 
 /* structure defines */
 
@@ -40,9 +46,21 @@ struct dma_devch {
     volatile int qct;
     volatile int qsize;
     int qlimit;
+    int batch;			/* PS2IOC_SENDL pipelining unit, 0: off */
     wait_queue_head_t done;
 };
 
+/* registered command buffer (PS2IOC_CMDBUFREG) */
+
+struct dma_cmdbuf {
+    struct file *file;			/* ps2mem file which owns the pages */
+    unsigned long offset;		/* start offset in the first page */
+    unsigned int len;
+    int busy;				/* DMA requests using this buffer */
+    int pages;
+    unsigned long page[0];		/* bus address of each page */
+};
+
 struct dma_device {
     struct dma_devch devch[2];
     wait_queue_head_t empty;
@@ -52,6 +70,7 @@ struct dma_device {
     int sig;
     void *data;
     spinlock_t lock;
+    struct dma_cmdbuf *cmdbuf[PS2_CMDBUF_MAX];
 };
 
 struct dma_dev_request {
@@ -91,6 +110,11 @@ struct udma_sendl_request {
     unsigned long saddr;
 };
 
+struct udma_cmdbuf_request {
+    struct udma_sendl_request r;
+    struct dma_cmdbuf *used[PS2_CMDBUF_MAX];
+};
+
 struct udma_request_list {
     struct dma_dev_request r;
     int reqs, index;
@@ -107,12 +131,18 @@ extern struct file_operations ps2mem_fops;
 extern struct file_operations ps2ev_fops;
 void ps2ev_init(void);
 void ps2ev_cleanup(void);
+void ps2ev_post(int event);
 
 /* ps2image.c */
-int ps2gs_loadimage(struct ps2_image *img, struct dma_device *dev, int async);
-int ps2gs_storeimage(struct ps2_image *img, struct dma_device *dev);
+#define PS2IMAGE_ASYNC		1	/* don't wait for completion */
+#define PS2IMAGE_NOTIFY		2	/* return a ticket, post PS2EV_IMAGE */
+int ps2gs_loadimage(struct ps2_image *img, struct dma_device *dev, int flags);
+int ps2gs_storeimage(struct ps2_image *img, struct dma_device *dev, int flags);
+int ps2gs_image_isdone(int ticket);
 
 /* ps2dma.c */
+void ps2pl_init(void);
+void ps2pl_cleanup(void);
 struct page_list *ps2pl_alloc(int pages);
 struct page_list *ps2pl_realloc(struct page_list *list, int newpages);
 void ps2pl_free(struct page_list *list);
@@ -122,18 +152,24 @@ int ps2pl_copy_to_user(void *to, struct page_list *list, long len);
 int ps2dma_make_tag(unsigned long start, int len, struct dma_tag **tagp, struct dma_tag **lastp, struct page_list **memp);
 void ps2dma_dev_end(struct dma_request *req, struct dma_channel *ch);
 int ps2dma_check_and_add_queue(struct dma_dev_request *req, int nonblock);
+int ps2dma_check_and_add_queue_seq(struct dma_dev_request *req, int nonblock, int *seq);
 
 int ps2dma_write(struct dma_device *dev, struct ps2_packet *pkt, int nonblock);
 int ps2dma_send(struct dma_device *dev, struct ps2_packet *pkt, int async);
 int ps2dma_send_list(struct dma_device *dev, int num, struct ps2_packet *pkts);
 int ps2dma_send_chain(struct dma_device *dev, struct ps2_pchain *pchain);
 
+int ps2dma_cmdbuf_register(struct dma_device *dev, struct ps2_packet *pkt);
+int ps2dma_cmdbuf_unregister(struct dma_device *dev, int id);
+int ps2dma_cmdbuf_submit(struct dma_device *dev, int num, struct ps2_cmdsub *subs);
+
 int ps2dma_recv(struct dma_device *dev, struct ps2_packet *pkt, int async);
 int ps2dma_recv_list(struct dma_device *dev, int num, struct ps2_packet *pkts);
 
 int ps2dma_stop(struct dma_device *dev, int dir, struct ps2_pstop *pstop);
 int ps2dma_get_qct(struct dma_device *dev, int dir, int param);
 int ps2dma_set_qlimit(struct dma_device *dev, int dir, int param);
+int ps2dma_set_sendl_batch(struct dma_device *dev, int param);
 struct dma_device *ps2dma_dev_init(int send, int recv);
 int ps2dma_finish(struct dma_device *dev);
 
@@ -11,22 +11,28 @@
  *  $Id: ps2dma.c,v 1.1.2.4 2002/08/07 09:18:35 miwa Exp $
  */
 
+#define __NO_VERSION__
 #include <linux/config.h>
+#include <linux/module.h>
 #include <linux/mm.h>
 #include <linux/types.h>
 #include <linux/errno.h>
 #include <linux/sched.h>
 #include <linux/kernel.h>
 #include <linux/slab.h>
+#include <linux/file.h>
 #include <linux/timer.h>
 #include <linux/interrupt.h>
 #include <linux/init.h>
+#include <linux/bitops.h>
+#include <linux/proc_fs.h>
 
 #include <asm/types.h>
 #include <asm/io.h>
 #include <asm/uaccess.h>
 #include <asm/pgtable.h>
 #include <asm/irq.h>
+#include <asm/div64.h>
 #include <asm/ps2/irq.h>
 
 #include <linux/ps2/dev.h>
@@ -35,35 +41,136 @@
 
 extern struct file_operations ps2spr_fops, ps2mem_fops;
 
+#define CYCLES_PER_USEC	295	/* R5900 count register, 294.912MHz */
+
+/*
+ *  contiguous page pool
+ *
+ *  Chunks of physically contiguous pages are reserved when the driver
+ *  starts, before memory gets fragmented. Page lists large enough get
+ *  whole chunks, and each chunk then needs only one DMA tag instead of
+ *  one per page.
+ */
+
+static int ps2pl_pool_chunks = 4;	/* 1MB */
+MODULE_PARM(ps2pl_pool_chunks, "i");
+
+static spinlock_t ps2pl_pool_lock = SPIN_LOCK_UNLOCKED;
+static unsigned long ps2pl_pool[PS2PL_POOL_MAX];
+static u32 ps2pl_pool_free;		/* bitmap of free chunks */
+static int ps2pl_pool_size;
+
+static struct {
+    unsigned long allocs;		/* ps2pl_alloc/ps2pl_realloc calls */
+    unsigned long pages;		/* pages allocated */
+    unsigned long pool_pages;		/* ... of which from the pool */
+    unsigned long long alloc_cycles;	/* time spent allocating */
+    unsigned long tags;			/* REF tags made from page lists */
+    unsigned long long tag_bytes;
+} ps2pl_stats;
+
+static unsigned long ps2pl_pool_get(void)
+{
+    unsigned long flags;
+    unsigned long chunk = 0;
+    int i;
+
+    spin_lock_irqsave(&ps2pl_pool_lock, flags);
+    if (ps2pl_pool_free) {
+	i = ffs(ps2pl_pool_free) - 1;
+	ps2pl_pool_free &= ~(1 << i);
+	chunk = ps2pl_pool[i];
+    }
+    spin_unlock_irqrestore(&ps2pl_pool_lock, flags);
+
+    if (chunk)
+	memset((void *)chunk, 0, PS2PL_CHUNK_PAGES * PAGE_SIZE);
+    return chunk;
+}
+
+/* put addr back and return 1 if it is a chunk of the pool */
+static int ps2pl_pool_put(unsigned long addr)
+{
+    unsigned long flags;
+    int i;
+
+    for (i = 0; i < ps2pl_pool_size; i++) {
+	if (ps2pl_pool[i] == addr) {
+	    spin_lock_irqsave(&ps2pl_pool_lock, flags);
+	    ps2pl_pool_free |= 1 << i;
+	    spin_unlock_irqrestore(&ps2pl_pool_lock, flags);
+	    return 1;
+	}
+    }
+    return 0;
+}
+
 /*
  *  memory page list management functions
  */
 
+static void ps2pl_put_pages(struct page_list *list, int from, int to)
+{
+    int i = from;
+
+    while (i < to) {
+	DPRINT("ps2pl_free: %08X\n", list->page[i]);
+	if (i + PS2PL_CHUNK_PAGES <= to && ps2pl_pool_put(list->page[i])) {
+	    i += PS2PL_CHUNK_PAGES;
+	    continue;
+	}
+	free_page(list->page[i]);
+	i++;
+    }
+}
+
+/* allocate list->page[from] and above */
+static int ps2pl_get_pages(struct page_list *list, int from)
+{
+    int i, j;
+    unsigned long chunk;
+    cycles_t start = get_cycles();
+
+    for (i = from; i < list->pages; ) {
+	if (list->pages - i >= PS2PL_CHUNK_PAGES &&
+	    (chunk = ps2pl_pool_get()) != 0) {
+	    for (j = 0; j < PS2PL_CHUNK_PAGES; j++)
+		list->page[i++] = chunk + j * PAGE_SIZE;
+	    ps2pl_stats.pool_pages += PS2PL_CHUNK_PAGES;
+	    continue;
+	}
+	if (!(list->page[i] = get_free_page(GFP_KERNEL))) {
+	    /* out of memory */
+	    ps2pl_put_pages(list, from, i);
+	    return -ENOMEM;
+	}
+	DPRINT("ps2pl_alloc: %08X\n", list->page[i]);
+	i++;
+    }
+
+    ps2pl_stats.allocs++;
+    ps2pl_stats.pages += list->pages - from;
+    ps2pl_stats.alloc_cycles += (cycles_t)(get_cycles() - start);
+    return 0;
+}
+
 struct page_list *ps2pl_alloc(int pages)
 {
-    int i;
     struct page_list *list;
 
     if ((list = kmalloc(sizeof(struct page_list) + pages * sizeof(unsigned long), GFP_KERNEL)) == NULL)
 	return NULL;
     list->pages = pages;
 
-    for (i = 0; i < list->pages; i++) {
-	if (!(list->page[i] = get_free_page(GFP_KERNEL))) {
-	    /* out of memory */
-	    while (--i >= 0)
-		free_page(list->page[i]);
-	    kfree(list);
-	    return NULL;
-	}
-	DPRINT("ps2pl_alloc: %08X\n", list->page[i]);
+    if (ps2pl_get_pages(list, 0) < 0) {
+	kfree(list);
+	return NULL;
     }
     return list;
 }
 
 struct page_list *ps2pl_realloc(struct page_list *list, int newpages)
 {
-    int i;
     struct page_list *newlist;
 
     if (list->pages >= newpages)
@@ -73,14 +180,9 @@ struct page_list *ps2pl_realloc(struct page_list *list, int newpages)
 
     memcpy(newlist->page, list->page, list->pages * sizeof(unsigned long));
     newlist->pages = newpages;
-    for (i = list->pages; i < newpages; i++) {
-	if (!(newlist->page[i] = get_free_page(GFP_KERNEL))) {
-	    /* out of memory */
-	    while (--i >= list->pages)
-		free_page(newlist->page[i]);
-	    kfree(newlist);
-	    return NULL;
-	}
+    if (ps2pl_get_pages(newlist, list->pages) < 0) {
+	kfree(newlist);
+	return NULL;
     }
     kfree(list);
     return newlist;
@@ -88,13 +190,104 @@ struct page_list *ps2pl_realloc(struct page_list *list, int newpages)
 
 void ps2pl_free(struct page_list *list)
 {
-    int i;
+    ps2pl_put_pages(list, 0, list->pages);
+    kfree(list);
+}
 
-    for (i = 0; i < list->pages; i++) {
-	free_page(list->page[i]);
-	DPRINT("ps2pl_free: %08X\n", list->page[i]);
+/*
+ * Return how many bytes from offset (up to end) are physically
+ * contiguous in the page array, as much as a single tag can carry.
+ */
+static unsigned long ps2pl_contig(unsigned long *page, unsigned long offset, unsigned long end)
+{
+    int index = offset >> PAGE_SHIFT;
+    unsigned long next = (offset + PAGE_SIZE) & PAGE_MASK;
+
+    while (next < end && page[index + 1] == page[index] + PAGE_SIZE &&
+	   next + PAGE_SIZE - offset <= DMA_TAG_MAXLEN) {
+	index++;
+	next += PAGE_SIZE;
     }
-    kfree(list);
+    if (next > end)
+	next = end;
+    ps2pl_stats.tags++;
+    ps2pl_stats.tag_bytes += next - offset;
+    return next - offset;
+}
+
+#ifdef CONFIG_PROC_FS
+static int ps2pl_read_proc(char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+    unsigned long long usec, avg;
+    int len;
+    char *p = page;
+
+    usec = ps2pl_stats.alloc_cycles;
+    do_div(usec, CYCLES_PER_USEC);
+    avg = ps2pl_stats.tag_bytes;
+    if (ps2pl_stats.tags)
+	do_div(avg, ps2pl_stats.tags);
+
+    p += sprintf(p, "pool: %d/%d chunks free, %lu KB each\n",
+		 hweight32(ps2pl_pool_free), ps2pl_pool_size,
+		 (PS2PL_CHUNK_PAGES * PAGE_SIZE) >> 10);
+    p += sprintf(p, "allocs: %lu pages: %lu from pool: %lu time: %lu usec\n",
+		 ps2pl_stats.allocs, ps2pl_stats.pages,
+		 ps2pl_stats.pool_pages, (unsigned long)usec);
+    p += sprintf(p, "tags: %lu average: %lu bytes\n",
+		 ps2pl_stats.tags, (unsigned long)avg);
+
+    len = p - page;
+    if (len <= off + count)
+	*eof = 1;
+    *start = page + off;
+    len -= off;
+    if (len > count)
+	len = count;
+    if (len < 0)
+	len = 0;
+    return len;
+}
+#endif
+
+void ps2pl_init(void)
+{
+    unsigned long chunk;
+    int i, j;
+
+    for (i = 0; i < ps2pl_pool_chunks && i < PS2PL_POOL_MAX; i++) {
+	if (!(chunk = __get_free_pages(GFP_KERNEL, PS2PL_CHUNK_ORDER)))
+	    break;
+	/* the pages are freed and mmapped one by one */
+	for (j = 1; j < PS2PL_CHUNK_PAGES; j++)
+	    set_page_count(virt_to_page(chunk + j * PAGE_SIZE), 1);
+	ps2pl_pool[i] = chunk;
+	ps2pl_pool_free |= 1 << i;
+    }
+    ps2pl_pool_size = i;
+    if (ps2pl_pool_size < ps2pl_pool_chunks)
+	printk(KERN_WARNING "ps2dev: reserved %d of %d contiguous buffers\n",
+	       ps2pl_pool_size, ps2pl_pool_chunks);
+
+#ifdef CONFIG_PROC_FS
+    create_proc_read_entry("ps2mem", 0, NULL, ps2pl_read_proc, NULL);
+#endif
+}
+
+void ps2pl_cleanup(void)
+{
+    int i, j;
+
+#ifdef CONFIG_PROC_FS
+    remove_proc_entry("ps2mem", NULL);
+#endif
+    for (i = 0; i < ps2pl_pool_size; i++) {
+	for (j = 1; j < PS2PL_CHUNK_PAGES; j++)
+	    set_page_count(virt_to_page(ps2pl_pool[i] + j * PAGE_SIZE), 0);
+	free_pages(ps2pl_pool[i], PS2PL_CHUNK_ORDER);
+    }
+    ps2pl_pool_size = 0;
+    ps2pl_pool_free = 0;
 }
 
 int ps2pl_copy_from_user(struct page_list *list, void *from, long len)
@@ -166,7 +359,7 @@ static int ps2dma_make_tag_mem(unsigned long offset, int len, struct dma_tag **t
 {
     struct dma_tag *tag;
     int sindex, eindex;
-    unsigned long vaddr, next, end;
+    unsigned long vaddr, size, end;
 
     DPRINT("ps2dma_make_tag_mem: %08X %08X\n", offset, len);
     end = offset + len;
@@ -176,16 +369,15 @@ static int ps2dma_make_tag_mem(unsigned long offset, int len, struct dma_tag **t
 	return -ENOMEM;
     *tagp = tag;
 
-    while (sindex <= eindex) {
-	vaddr = mem->page[sindex] + (offset & ~PAGE_MASK);
-	next = (offset + PAGE_SIZE) & PAGE_MASK;
+    while (offset < end) {
+	vaddr = mem->page[offset >> PAGE_SHIFT] + (offset & ~PAGE_MASK);
+	size = ps2pl_contig(mem->page, offset, end);
 	tag->id = DMATAG_REF;
-	tag->qwc = (next < end ? next - offset : end - offset) >> 4;
+	tag->qwc = size >> 4;
 	tag->addr = virt_to_bus((void *)vaddr);
 	DPRINT("ps2dma_make_tag_mem: tag %08X %08X\n", tag->addr, tag->qwc);
 	tag++;
-	offset = next;
-	sindex++;
+	offset += size;
     }
 
     if (lastp)
@@ -477,12 +669,10 @@ static unsigned long dma_sendl_stop(struct dma_request *req, struct dma_channel
     return 0;
 }
 
-static void dma_sendl_free(struct dma_request *req, struct dma_channel *ch)
+static void sendl_free_pages(struct udma_sendl_request *usreq)
 {
-    struct udma_sendl_request *usreq = (struct udma_sendl_request *)req;
     void *p, *q;
 
-    DPRINT("dma_sendl_free\n");
     p = usreq->mem_tail;
     while (p) {
 	q = *(void **)p;
@@ -495,9 +685,31 @@ static void dma_sendl_free(struct dma_request *req, struct dma_channel *ch)
 	free_page((unsigned long)p);
 	p = q;
     }
+}
+
+static void dma_sendl_free(struct dma_request *req, struct dma_channel *ch)
+{
+    struct udma_sendl_request *usreq = (struct udma_sendl_request *)req;
+
+    DPRINT("dma_sendl_free\n");
+    sendl_free_pages(usreq);
     kfree(usreq);
 }
 
+static void dma_cmdbuf_free(struct dma_request *req, struct dma_channel *ch)
+{
+    struct udma_cmdbuf_request *ucbreq = (struct udma_cmdbuf_request *)req;
+    int i;
+
+    DPRINT("dma_cmdbuf_free\n");
+    /* called with dev->lock held */
+    for (i = 0; i < PS2_CMDBUF_MAX; i++)
+	if (ucbreq->used[i])
+	    ucbreq->used[i]->busy--;
+    sendl_free_pages(&ucbreq->r);
+    kfree(ucbreq);
+}
+
 static struct dma_ops dma_sendl_ops =
 { dma_sendl_start, NULL, dma_sendl_stop, ps2dma_dev_end };
 static struct dma_ops dma_sendl_spr_ops =
@@ -557,9 +769,16 @@ static struct dma_ops dma_recv_list_ops =
  */
 
 int ps2dma_check_and_add_queue(struct dma_dev_request *req, int nonblock)
+{
+    return ps2dma_check_and_add_queue_seq(req, nonblock, NULL);
+}
+
+/* returns the value of *seq taken in queue order, see ps2dma_add_queue_seq() */
+int ps2dma_check_and_add_queue_seq(struct dma_dev_request *req, int nonblock, int *seq)
 {
     unsigned long flags;
     struct dma_devch *devch = req->devch;
+    int n;
 
 #define QUEUEABLE(_devch, _qsize)	\
 	((_devch)->qct < (_devch)->qlimit && \
@@ -594,11 +813,11 @@ int ps2dma_check_and_add_queue(struct dma_dev_request *req, int nonblock)
     devch->qct++;
     devch->qsize += req->qsize;
 
-    ps2dma_add_queue(&req->r, devch->channel);
+    n = ps2dma_add_queue_seq(&req->r, devch->channel, seq);
 
     spin_unlock_irqrestore(&devch->device->lock, flags);
 
-    return 0;
+    return n;
 }
 
 int ps2dma_write(struct dma_device *dev, struct ps2_packet *pkt, int nonblock)
@@ -739,32 +958,103 @@ int ps2dma_send(struct dma_device *dev, struct ps2_packet *pkt, int async)
     return result;
 }
 
+/*
+ * advance to the next tag of a send list, linking a new tag page
+ * with a NEXT tag when the current one is full
+ */
+static struct dma_tag *sendl_next_tag(struct udma_sendl_request *usreq,
+				      struct dma_tag *tag,
+				      struct dma_tag **bottomp)
+{
+    struct dma_tag *nexthead, *nexttag;
+
+    if (++tag < *bottomp)
+	return tag;
+
+    if ((nexthead = (struct dma_tag *)__get_free_page(GFP_KERNEL)) == NULL)
+	return NULL;
+    DPRINT(" alloc tag %08X\n", nexthead);
+    *(void **)usreq->tag_head = nexthead;
+    *(void **)nexthead = NULL;
+    usreq->tag_head = nexthead;
+    nexttag = &(usreq->tag_head[1]);
+    *bottomp = &(usreq->tag_head[(PAGE_SIZE / DMA_TRUNIT) - 1]);
+    DPRINT(" tag next %08X -> %08X\n", tag, nexttag);
+    tag->id = DMATAG_NEXT;
+    tag->qwc = 0;
+    tag->addr = virt_to_bus((void *)nexttag);
+    return nexttag;
+}
+
+static int sendl_init(struct udma_sendl_request *usreq, struct dma_tag **tagp,
+		      struct dma_tag **bottomp)
+{
+    if ((usreq->tag_head = (struct dma_tag *)__get_free_page(GFP_KERNEL))
+	== NULL)
+	return -ENOMEM;
+    usreq->tag_tail = usreq->tag_head;
+    *(void **)usreq->tag_head = NULL;
+    *tagp = usreq->tag = &(usreq->tag_head[1]);
+    *bottomp = &(usreq->tag_head[(PAGE_SIZE / DMA_TRUNIT) - 1]);
+    usreq->mem_head = usreq->mem_tail = NULL;
+    return 0;
+}
+
+static struct udma_sendl_request *sendl_alloc(struct dma_devch *devch,
+					      struct dma_tag **tagp,
+					      struct dma_tag **bottomp)
+{
+    struct udma_sendl_request *usreq;
+
+    if ((usreq = kmalloc(sizeof(struct udma_sendl_request), GFP_KERNEL)) == NULL)
+	return NULL;
+    init_dma_dev_request(&usreq->r, &dma_sendl_ops, devch, 0, dma_sendl_free);
+
+    if (sendl_init(usreq, tagp, bottomp) < 0) {
+	kfree(usreq);
+	return NULL;
+    }
+    return usreq;
+}
+
+static int sendl_queue(struct udma_sendl_request *usreq, struct dma_tag *tag)
+{
+    int result;
+
+    tag->id = DMATAG_END;
+    tag->qwc = 0;
+    DPRINT(" tag finish %08X\n", tag);
+
+    result = ps2dma_check_and_add_queue((struct dma_dev_request *)usreq, 0);
+    if (result < 0)
+	dma_sendl_free((struct dma_request *)usreq, usreq->r.devch->channel);
+    return result;
+}
+
+/*
+ * PS2IOC_SENDL: send a list of packets
+ *
+ * Normally the list is one request, and either all of it is queued or
+ * none. After PS2IOC_SENDLBATCH it is queued in pieces of at least that
+ * many bytes as they are built; requests of other submitters may then
+ * run between the pieces. If a packet fails after some pieces have gone
+ * out, those can't be recalled, and the number of packets queued is
+ * returned instead of the error, so the caller can resend the rest.
+ */
 int ps2dma_send_list(struct dma_device *dev, int num, struct ps2_packet *pkts)
 {
     struct udma_sendl_request *usreq;
     struct dma_devch *devch = &dev->devch[DMA_SENDCH];
     struct dma_channel *ch = devch->channel;
     struct dma_tag *tag, *tag_bottom;
-    int i;
-    int result;
+    int i, result;
+    int batch = 0, sent = 0;
 
     DPRINT("dma_send_list\n");
     if (num <= 0)
 	return -EINVAL;
-    if ((usreq = kmalloc(sizeof(struct udma_sendl_request), GFP_KERNEL)) == NULL)
+    if ((usreq = sendl_alloc(devch, &tag, &tag_bottom)) == NULL)
 	return -ENOMEM;
-    init_dma_dev_request(&usreq->r, &dma_sendl_ops, devch, 0, dma_sendl_free);
-
-    if ((usreq->tag_head = (struct dma_tag *)__get_free_page(GFP_KERNEL))
-	== NULL) {
-	kfree(usreq);
-	return -ENOMEM;
-    }
-    usreq->tag_tail = usreq->tag_head;
-    *(void **)usreq->tag_head = NULL;
-    tag = usreq->tag = &(usreq->tag_head[1]);
-    tag_bottom = &(usreq->tag_head[(PAGE_SIZE / DMA_TRUNIT) - 1]);
-    usreq->mem_head = usreq->mem_tail = NULL;
     
     for (i = 0; i < num; i++) {
 	unsigned long start;
@@ -779,8 +1069,8 @@ int ps2dma_send_list(struct dma_device *dev, int num, struct ps2_packet *pkts)
 	/* alignment check */
 	if ((start & (DMA_TRUNIT - 1)) != 0 ||
 	    (len & (DMA_TRUNIT - 1)) != 0 || len <= 0) {
-	    dma_sendl_free((struct dma_request *)usreq, ch);
-	    return -EINVAL;
+	    result = -EINVAL;
+	    goto error;
 	}
 
 	if (!(ps2mem_vma_cache != NULL &&
@@ -790,14 +1080,14 @@ int ps2dma_send_list(struct dma_device *dev, int num, struct ps2_packet *pkts)
 	    /* vma cache miss - get buffer type */
 	    ps2mem_vma_cache = NULL;
 	    if ((vma = find_vma(current->mm, start)) == NULL) {
-		dma_sendl_free((struct dma_request *)usreq, ch);
-		return -EINVAL;
+		result = -EINVAL;
+		goto error;
 	    }
 	    if (vma->vm_file != NULL) {
 		if (vma->vm_file->f_op == &ps2mem_fops) {
 		    if (start + len >= vma->vm_end) {
-			dma_sendl_free((struct dma_request *)usreq, ch);
-			return -EINVAL;		/* illegal address range */
+			result = -EINVAL;		/* illegal address range */
+			goto error;
 		    }
 		    ps2mem_vma_cache = vma;
 		}
@@ -806,45 +1096,24 @@ int ps2dma_send_list(struct dma_device *dev, int num, struct ps2_packet *pkts)
 
 	if (ps2mem_vma_cache != NULL) {
 	    struct page_list *mem;
-	    int sindex, eindex;
-	    unsigned long vaddr, next, end;
+	    unsigned long vaddr, size, end;
 
 	    vma = ps2mem_vma_cache;
 	    offset = start - vma->vm_start + vma->vm_pgoff;
 	    mem = (struct page_list *)vma->vm_file->private_data;
 	    end = offset + len;
-	    sindex = offset >> PAGE_SHIFT;
-	    eindex = (end - 1) >> PAGE_SHIFT;
 
-	    while (sindex <= eindex) {
-		vaddr = mem->page[sindex] + (offset & ~PAGE_MASK);
-		next = (offset + PAGE_SIZE) & PAGE_MASK;
+	    while (offset < end) {
+		vaddr = mem->page[offset >> PAGE_SHIFT] + (offset & ~PAGE_MASK);
+		size = ps2pl_contig(mem->page, offset, end);
 		tag->id = DMATAG_REF;
-		tag->qwc = (next < end ? next - offset : end - offset) >> 4;
+		tag->qwc = size >> 4;
 		tag->addr = virt_to_bus((void *)vaddr);
 		DPRINT(" tag %08X %08X %08X\n", tag, tag->addr, tag->qwc);
-		offset = next;
-		sindex++;
-		tag++;
-
-		if (tag >= tag_bottom) {
-		    struct dma_tag *nexthead, *nexttag;
-
-		    if ((nexthead = (struct dma_tag *)__get_free_page(GFP_KERNEL)) == NULL) {
-			dma_sendl_free((struct dma_request *)usreq, ch);
-			return -ENOMEM;
-		    }
-		    DPRINT(" alloc tag %08X\n", nexthead);
-		    *(void **)usreq->tag_head = nexthead;
-		    *(void **)nexthead = NULL;
-		    usreq->tag_head = nexthead;
-		    nexttag = &(usreq->tag_head[1]);
-		    tag_bottom = &(usreq->tag_head[(PAGE_SIZE / DMA_TRUNIT) - 1]);
-		    DPRINT(" tag next %08X -> %08X\n", tag, nexttag);
-		    tag->id = DMATAG_NEXT;
-		    tag->qwc = 0;
-		    tag->addr = virt_to_bus((void *)nexttag);
-		    tag = nexttag;
+		offset += size;
+		if ((tag = sendl_next_tag(usreq, tag, &tag_bottom)) == NULL) {
+		    result = -ENOMEM;
+		    goto error;
 		}
 	    }
 	} else {
@@ -853,8 +1122,8 @@ int ps2dma_send_list(struct dma_device *dev, int num, struct ps2_packet *pkts)
 		void *nextmem;
 		
 		if ((nextmem = (void *)__get_free_page(GFP_KERNEL)) == NULL) {
-		    dma_sendl_free((struct dma_request *)usreq, ch);
-		    return -ENOMEM;
+		    result = -ENOMEM;
+		    goto error;
 		}
 		if (usreq->mem_head != NULL)
 		    *(void **)usreq->mem_head = nextmem;
@@ -866,50 +1135,52 @@ int ps2dma_send_list(struct dma_device *dev, int num, struct ps2_packet *pkts)
 
 		DPRINT(" copy_from_user: %08X <- %08X %08X\n", nextmem, start, size);
 		if (copy_from_user(nextmem, (void *)start, size)) {
-		    dma_sendl_free((struct dma_request *)usreq, ch);
-		    return -EFAULT;
+		    result = -EFAULT;
+		    goto error;
 		}
 		tag->id = DMATAG_REF;
 		tag->qwc = size >> 4;
 		tag->addr = virt_to_bus(nextmem);
+		usreq->r.qsize += size;
 		DPRINT(" tag %08X %08X %08X\n", tag, tag->addr, tag->qwc);
 		start += size;
 		len -= size;
-		tag++;
-
-		if (tag >= tag_bottom) {
-		    struct dma_tag *nexthead, *nexttag;
-
-		    if ((nexthead = (struct dma_tag *)__get_free_page(GFP_KERNEL)) == NULL) {
-			dma_sendl_free((struct dma_request *)usreq, ch);
-			return -ENOMEM;
-		    }
-		    DPRINT(" alloc tag %08X\n", nexthead);
-		    *(void **)usreq->tag_head = nexthead;
-		    *(void **)nexthead = NULL;
-		    usreq->tag_head = nexthead;
-		    nexttag = &(usreq->tag_head[1]);
-		    tag_bottom = &(usreq->tag_head[(PAGE_SIZE / DMA_TRUNIT) - 1]);
-		    DPRINT(" tag next %08X -> %08X\n", tag, nexttag);
-		    tag->id = DMATAG_NEXT;
-		    tag->qwc = 0;
-		    tag->addr = virt_to_bus((void *)nexttag);
-		    tag = nexttag;
+		if ((tag = sendl_next_tag(usreq, tag, &tag_bottom)) == NULL) {
+		    result = -ENOMEM;
+		    goto error;
 		}
 	    }
 	}
-    }
 
-    tag->id = DMATAG_END;
-    tag->qwc = 0;
-    DPRINT(" tag finish %08X\n", tag);
-
-    result = ps2dma_check_and_add_queue((struct dma_dev_request *)usreq, 0);
-    if (result < 0) {
-	dma_sendl_free((struct dma_request *)usreq, ch);
-	return result;
+	/*
+	 * With PS2IOC_SENDLBATCH set, queue the list in pieces and build
+	 * the rest while the DMAC is busy with them. How far ahead we may
+	 * get is bounded by the queue limit (PS2IOC_SENDLIMIT).
+	 */
+	batch += pkts[i].len;
+	if (devch->batch > 0 && batch >= devch->batch && i < num - 1) {
+	    DPRINT(" queue batch %08X\n", batch);
+	    if ((result = sendl_queue(usreq, tag)) < 0)
+		return sent ? sent : result;
+	    sent = i + 1;
+	    if ((usreq = sendl_alloc(devch, &tag, &tag_bottom)) == NULL)
+		return sent;
+	    batch = 0;
+	}
     }
+
+    /*
+     * By default the whole list goes out as one request, so that it
+     * stays contiguous on the channel and nothing is sent if any
+     * packet fails above.
+     */
+    if ((result = sendl_queue(usreq, tag)) < 0)
+	return sent ? sent : result;
     return 0;
+
+ error:
+    dma_sendl_free((struct dma_request *)usreq, ch);
+    return sent ? sent : result;
 }
 
 int ps2dma_send_chain(struct dma_device *dev, struct ps2_pchain *pchain)
@@ -951,6 +1222,217 @@ int ps2dma_send_chain(struct dma_device *dev, struct ps2_pchain *pchain)
     return result;
 }
 
+/*
+ * registered command buffers
+ *
+ * A buffer in ps2mem is looked up and validated once at registration
+ * and its pages are remembered, so that each submission only has to
+ * turn (id, offset, len) tuples into REF tags. All tuples of one
+ * submission go out as a single chained DMA request.
+ */
+
+int ps2dma_cmdbuf_register(struct dma_device *dev, struct ps2_packet *pkt)
+{
+    unsigned long start = (unsigned long)pkt->ptr;
+    unsigned long offset;
+    int len = pkt->len;
+    struct vm_area_struct *vma;
+    struct page_list *mem, *newmem;
+    struct dma_cmdbuf *cbuf;
+    int id, i, sindex, eindex;
+
+    DPRINT("dma_cmdbuf_register %08X %08X\n", start, len);
+
+    /* alignment check */
+    if ((start & (DMA_TRUNIT - 1)) != 0 ||
+	(len & (DMA_TRUNIT - 1)) != 0 || len <= 0)
+	return -EINVAL;
+    if (dev->devch[DMA_SENDCH].channel == NULL ||
+	dev->devch[DMA_SENDCH].channel->isspr)
+	return -EINVAL;
+
+    /* the buffer must be in ps2mem */
+    if ((vma = find_vma(current->mm, start)) == NULL ||
+	vma->vm_start > start || start + len > vma->vm_end ||
+	vma->vm_file == NULL ||
+	vma->vm_file->f_op != &ps2mem_fops)
+	return -EINVAL;
+
+    offset = start - vma->vm_start + vma->vm_pgoff;
+    sindex = offset >> PAGE_SHIFT;
+    eindex = (offset + len - 1) >> PAGE_SHIFT;
+
+    /* pages not touched yet have not been allocated */
+    mem = (struct page_list *)vma->vm_file->private_data;
+    if (mem->pages <= eindex) {
+	if ((newmem = ps2pl_realloc(mem, eindex + 1)) == NULL)
+	    return -ENOMEM;
+	ps2mem_vma_cache = NULL;
+	mem = vma->vm_file->private_data = newmem;
+    }
+
+    if ((cbuf = kmalloc(sizeof(struct dma_cmdbuf) + (eindex - sindex + 1) * sizeof(unsigned long), GFP_KERNEL)) == NULL)
+	return -ENOMEM;
+    cbuf->offset = offset & ~PAGE_MASK;
+    cbuf->len = len;
+    cbuf->busy = 0;
+    cbuf->pages = eindex - sindex + 1;
+    for (i = 0; i < cbuf->pages; i++)
+	cbuf->page[i] = virt_to_bus((void *)mem->page[sindex + i]);
+
+    /* keep the pages while registered */
+    get_file(vma->vm_file);
+    cbuf->file = vma->vm_file;
+
+    /* the slot is taken under the lock; kmalloc() above may sleep */
+    spin_lock_irq(&dev->lock);
+    for (id = 0; id < PS2_CMDBUF_MAX; id++)
+	if (dev->cmdbuf[id] == NULL)
+	    break;
+    if (id < PS2_CMDBUF_MAX)
+	dev->cmdbuf[id] = cbuf;
+    spin_unlock_irq(&dev->lock);
+
+    if (id >= PS2_CMDBUF_MAX) {
+	fput(cbuf->file);
+	kfree(cbuf);
+	return -ENOSPC;
+    }
+    return id;
+}
+
+int ps2dma_cmdbuf_unregister(struct dma_device *dev, int id)
+{
+    struct dma_devch *devch = &dev->devch[DMA_SENDCH];
+    struct dma_cmdbuf *cbuf;
+
+    DPRINT("dma_cmdbuf_unregister %d\n", id);
+    if (id < 0 || id >= PS2_CMDBUF_MAX)
+	return -EINVAL;
+
+    /* another unregister may have taken it since the caller looked */
+    spin_lock_irq(&dev->lock);
+    if ((cbuf = dev->cmdbuf[id]) == NULL) {
+	spin_unlock_irq(&dev->lock);
+	return -EINVAL;
+    }
+
+    /* wait until DMA is no longer reading the buffer */
+    if (cbuf->busy) {
+	DECLARE_WAITQUEUE(wait, current);
+
+	add_wait_queue(&devch->done, &wait);
+	while (cbuf->busy && !signal_pending(current)) {
+	    set_current_state(TASK_INTERRUPTIBLE);
+	    spin_unlock_irq(&dev->lock);
+	    schedule();
+	    spin_lock_irq(&dev->lock);
+	}
+	set_current_state(TASK_RUNNING);
+	remove_wait_queue(&devch->done, &wait);
+
+	if (cbuf->busy) {
+	    spin_unlock_irq(&dev->lock);
+	    return -ERESTARTSYS;		/* signal arrived */
+	}
+    }
+    dev->cmdbuf[id] = NULL;
+    spin_unlock_irq(&dev->lock);
+
+    fput(cbuf->file);
+    kfree(cbuf);
+    return 0;
+}
+
+int ps2dma_cmdbuf_submit(struct dma_device *dev, int num, struct ps2_cmdsub *subs)
+{
+    struct udma_cmdbuf_request *ucbreq;
+    struct dma_devch *devch = &dev->devch[DMA_SENDCH];
+    struct dma_channel *ch = devch->channel;
+    struct dma_cmdbuf *cbuf;
+    struct dma_tag *tag, *tag_bottom;
+    unsigned long offset, size, end;
+    int i, result;
+
+    DPRINT("dma_cmdbuf_submit %d\n", num);
+    if (num <= 0)
+	return -EINVAL;
+    if ((ucbreq = kmalloc(sizeof(struct udma_cmdbuf_request), GFP_KERNEL)) == NULL)
+	return -ENOMEM;
+    init_dma_dev_request(&ucbreq->r.r, &dma_sendl_ops, devch, 0, dma_cmdbuf_free);
+    memset(ucbreq->used, 0, sizeof(ucbreq->used));
+
+    if (sendl_init(&ucbreq->r, &tag, &tag_bottom) < 0) {
+	kfree(ucbreq);
+	return -ENOMEM;
+    }
+
+    for (i = 0; i < num; i++) {
+	DPRINT(" submit %d %08X %08X\n", subs[i].id, subs[i].offset, subs[i].len);
+	if (subs[i].id < 0 || subs[i].id >= PS2_CMDBUF_MAX) {
+	    result = -EINVAL;
+	    goto error;
+	}
+
+	/* a buffer is only safe to use once it is marked busy */
+	spin_lock_irq(&dev->lock);
+	if ((cbuf = dev->cmdbuf[subs[i].id]) == NULL ||
+	    (subs[i].offset & (DMA_TRUNIT - 1)) != 0 ||
+	    (subs[i].len & (DMA_TRUNIT - 1)) != 0 || subs[i].len == 0 ||
+	    subs[i].offset >= cbuf->len ||
+	    subs[i].len > cbuf->len - subs[i].offset) {
+	    spin_unlock_irq(&dev->lock);
+	    result = -EINVAL;
+	    goto error;
+	}
+	if (ucbreq->used[subs[i].id] == NULL) {
+	    cbuf->busy++;
+	    ucbreq->used[subs[i].id] = cbuf;
+	}
+	spin_unlock_irq(&dev->lock);
+
+	offset = cbuf->offset + subs[i].offset;
+	end = offset + subs[i].len;
+	while (offset < end) {
+	    size = ps2pl_contig(cbuf->page, offset, end);
+	    tag->id = DMATAG_REF;
+	    tag->qwc = size >> 4;
+	    tag->addr = cbuf->page[offset >> PAGE_SHIFT] + (offset & ~PAGE_MASK);
+	    DPRINT(" tag %08X %08X %08X\n", tag, tag->addr, tag->qwc);
+	    offset += size;
+
+	    if ((tag = sendl_next_tag(&ucbreq->r, tag, &tag_bottom)) == NULL) {
+		result = -ENOMEM;
+		goto error;
+	    }
+	}
+    }
+
+    tag->id = DMATAG_END;
+    tag->qwc = 0;
+    DPRINT(" tag finish %08X\n", tag);
+
+    result = ps2dma_check_and_add_queue((struct dma_dev_request *)ucbreq, 0);
+    if (result < 0)
+	goto error;
+    return 0;
+
+ error:
+    spin_lock_irq(&dev->lock);
+    dma_cmdbuf_free((struct dma_request *)ucbreq, ch);
+    spin_unlock_irq(&dev->lock);
+    return result;
+}
+
+static void ps2dma_cmdbuf_cleanup(struct dma_device *dev)
+{
+    int id;
+
+    for (id = 0; id < PS2_CMDBUF_MAX; id++)
+	if (dev->cmdbuf[id] != NULL)
+	    ps2dma_cmdbuf_unregister(dev, id);
+}
+
 static int make_recv_request(struct udma_request **ureqp,
 			     struct dma_device *dev, struct dma_channel *ch,
 			     struct ps2_packet *pkt, 
@@ -1110,6 +1592,7 @@ int ps2dma_stop(struct dma_device *dev, int dir, struct ps2_pstop *pstop)
 
     spin_lock_irq(&dev->lock);
     spin_lock_irqsave(&ch->lock, flags);
+    ps2dma_account(ch);
 
     /* delete all DMA requests from the queue */
     reqp = &ch->tail;
@@ -1139,6 +1622,9 @@ int ps2dma_stop(struct dma_device *dev, int dir, struct ps2_pstop *pstop)
     ch->head = hreq;
     dev->devch[dir].qct = 0;
     dev->devch[dir].qsize = 0;
+    /* the freed requests will never reach ps2dma_dev_end() */
+    wake_up(&dev->empty);
+    wake_up(&dev->devch[dir].done);
 
     spin_unlock_irqrestore(&ch->lock, flags);
 
@@ -1181,6 +1667,19 @@ int ps2dma_get_qct(struct dma_device *dev, int dir, int param)
     return qct;
 }
 
+int ps2dma_set_sendl_batch(struct dma_device *dev, int param)
+{
+    int oldbatch;
+    struct dma_devch *devch = &dev->devch[DMA_SENDCH];
+
+    if (param < 0)
+	return -EINVAL;
+
+    oldbatch = devch->batch;
+    devch->batch = (param + DMA_TRUNIT - 1) & ~(DMA_TRUNIT - 1);
+    return oldbatch;
+}
+
 int ps2dma_set_qlimit(struct dma_device *dev, int dir, int param)
 {
     int oldlimit;
@@ -1259,6 +1758,7 @@ int ps2dma_finish(struct dma_device *dev)
 		/* force break by a signal */
 		ps2dma_stop(dev, DMA_SENDCH, &pstop);
 		ps2dma_stop(dev, DMA_RECVCH, &pstop);
+		ps2dma_cmdbuf_cleanup(dev);
 
 		return -1;
 	    }
@@ -1266,5 +1766,6 @@ int ps2dma_finish(struct dma_device *dev)
 	set_current_state(TASK_RUNNING);
 	remove_wait_queue(&dev->empty, &wait);
     }
+    ps2dma_cmdbuf_cleanup(dev);
     return 0;
 }
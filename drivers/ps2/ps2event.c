@@ -121,6 +121,15 @@ static void ev_vbstart_handler(int irq, void *dev_id, struct pt_regs *regs)
 	ev_check(p, PS2EV_N_VBSTART, PS2EV_VBSTART);
 }
 
+/* software events (no interrupt source), called at interrupt level */
+void ps2ev_post(int event)
+{
+    struct ps2ev_data *p;
+
+    for (p = ps2ev_data; p != NULL; p = p->next)
+	ev_check(p, event, 1 << event);
+}
+
 static struct ev_list ev_list[] = {
     { PS2EV_N_VBSTART, IRQ_INTC_VB_ON,  ev_vbstart_handler, "V-Blank start" },
     { PS2EV_N_VBEND,   IRQ_INTC_VB_OFF, ev_handler,         "V-Blank end" },
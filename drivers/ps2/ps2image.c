@@ -21,6 +21,8 @@
 #include <linux/timer.h>
 #include <linux/interrupt.h>
 #include <linux/completion.h>
+#include <linux/file.h>
+#include <linux/tqueue.h>
 
 #include <asm/pgtable.h>
 #include <asm/atomic.h>
@@ -33,6 +35,34 @@
 #include <asm/ps2/eedev.h>
 #include "ps2dev.h"
 
+/*
+ *  asynchronous transfer tickets
+ *
+ *  Every transfer queued with PS2IMAGE_NOTIFY takes the next ticket
+ *  under the GIF channel queue lock as it is queued, and keeps it in
+ *  its request.  Loads and stores complete in queue order (both are
+ *  serialized on the GIF channel), so a ticket is done when the last
+ *  completed ticket has reached it.  Tickets wrap at 31 bits to stay
+ *  positive as ioctl return values.
+ */
+
+#define IMAGE_TICKET_MASK	0x7fffffff
+
+static int image_queued;		/* under the GIF channel lock */
+static atomic_t image_done = ATOMIC_INIT(0);
+
+static void image_complete(int ticket)
+{
+    atomic_set(&image_done, ticket);
+    ps2ev_post(PS2EV_N_IMAGE);
+}
+
+int ps2gs_image_isdone(int ticket)
+{
+    return ((atomic_read(&image_done) - ticket) & IMAGE_TICKET_MASK) <=
+	(IMAGE_TICKET_MASK >> 1);
+}
+
 /*
  *  loadimage (EE->GS image data transfer)
  */
@@ -41,6 +71,8 @@ struct loadimage_request {
     struct dma_dev_request r;
     struct page_list *mem;
     volatile int *done;
+    int notify;
+    int ticket;
     struct dma_tag tag[0] __attribute__((aligned(DMA_TRUNIT)));
 } __attribute__((aligned(DMA_TRUNIT)));
 
@@ -67,13 +99,15 @@ static void loadimage_free(struct dma_request *req, struct dma_channel *ch)
 	ps2pl_free(lreq->mem);
     if (lreq->done)
 	*lreq->done = 1;
+    if (lreq->notify)
+	image_complete(lreq->ticket);
     kfree(lreq);
 }
 
 static struct dma_ops loadimage_ops =
 { loadimage_start, NULL, loadimage_stop, ps2dma_dev_end };
 
-int ps2gs_loadimage(struct ps2_image *img, struct dma_device *dev, int async)
+int ps2gs_loadimage(struct ps2_image *img, struct dma_device *dev, int flags)
 {
     struct loadimage_request *lreq; 
     struct dma_devch *devch = &dev->devch[DMA_SENDCH];
@@ -83,6 +117,7 @@ int ps2gs_loadimage(struct ps2_image *img, struct dma_device *dev, int async)
     struct page_list *mem = NULL;
     int size, qsize;
     volatile int done = 0;
+    int async = flags & (PS2IMAGE_ASYNC | PS2IMAGE_NOTIFY);
     int result;
 
     switch (img->psm) {
@@ -149,6 +184,7 @@ int ps2gs_loadimage(struct ps2_image *img, struct dma_device *dev, int async)
     init_dma_dev_request(&lreq->r, &loadimage_ops, devch, qsize, loadimage_free);
     lreq->mem = mem;
     lreq->done = NULL;
+    lreq->notify = flags & PS2IMAGE_NOTIFY;
 
     p = (u64 *)lreq->tag;
     *p++ = DMATAG_SET(5, DMATAG_CNT, 0);
@@ -184,11 +220,17 @@ int ps2gs_loadimage(struct ps2_image *img, struct dma_device *dev, int async)
     if (!async)
 	lreq->done = &done;
 
-    result = ps2dma_check_and_add_queue((struct dma_dev_request *)lreq, 0);
+    result = ps2dma_check_and_add_queue_seq((struct dma_dev_request *)lreq,
+					    0, &image_queued);
     if (result < 0) {
+	lreq->notify = 0;
         loadimage_free((struct dma_request *)lreq, ch);
 	return result;
     }
+    /* the request may be gone already, use our copy of the ticket */
+    if (flags & PS2IMAGE_NOTIFY)
+	return result & IMAGE_TICKET_MASK;
+    result = 0;
 
     if (!async && !done) {
 	DECLARE_WAITQUEUE(wait, current);
@@ -218,13 +260,25 @@ int ps2gs_loadimage(struct ps2_image *img, struct dma_device *dev, int async)
  *  storeimage (GS->EE image data transfer)
  */
 
+struct storeimage_request;
+
+struct storeimage_gif_request {
+    struct dma_request r;
+    struct storeimage_request *sreq;
+};
+
 struct storeimage_request {
     struct dma_request r;
+    struct storeimage_gif_request gifreq;	/* placeholder on GIF queue */
     struct dma_channel *vifch, *gifch;
     struct page_list *mem;
+    struct file *file;		/* ps2mem pinned by an async store */
+    struct tq_struct fput_tq;
     struct completion c;
     struct timer_list timer;
     int result;
+    int async;
+    int ticket;
     atomic_t count;
 
     void *hptr;
@@ -240,11 +294,6 @@ struct storeimage_request {
     struct dma_tag tag[0] __attribute__((aligned(DMA_TRUNIT)));
 } __attribute__((aligned(DMA_TRUNIT)));
 
-struct storeimage_gif_request {
-    struct dma_request r;
-    struct storeimage_request *sreq;
-};
-
 static u32 mask_vifcode[] __attribute__((aligned(DMA_TRUNIT))) = {
     0x00000000,		/* NOP */
     0x06008000,		/* MSKPATH3(0x8000, 0) */
@@ -409,6 +458,10 @@ static inline void storeimage_terminate(struct storeimage_request *sreq, int res
     DMAREG(ch, PS2_Dn_QWC) = sizeof(unmask_vifcode)/ DMA_TRUNIT;
     DMAREG(ch, PS2_Dn_CHCR) = CHCR_SENDN;
 
+    /* the image is in memory; notify before later GIF requests complete */
+    if (sreq->async & PS2IMAGE_NOTIFY)
+	image_complete(sreq->ticket);
+
     /* restart GIF DMA */
     ps2dma_intr_handler(sreq->gifch->irq, sreq->gifch, NULL);
 
@@ -430,6 +483,15 @@ static void storeimage_timer_handler(unsigned long ptr)
     storeimage_terminate(sreq, -1);
 }
 
+/* fput() may sleep, so the pinned ps2mem is released from keventd */
+static void storeimage_fput(void *data)
+{
+    struct storeimage_request *sreq = (struct storeimage_request *)data;
+
+    fput(sreq->file);
+    kfree(sreq);
+}
+
 static void storeimage_vif_free(struct dma_request *req, struct dma_channel *ch)
 {
     struct storeimage_request *sreq = (struct storeimage_request *)req;
@@ -437,6 +499,15 @@ static void storeimage_vif_free(struct dma_request *req, struct dma_channel *ch)
     DSPRINT("storeimage_vif_free:\n");
     if (sreq->mem)
 	ps2pl_free(sreq->mem);
+    if (sreq->async) {
+	/* nobody waits for it */
+	if (sreq->file) {
+	    INIT_TQUEUE(&sreq->fput_tq, storeimage_fput, sreq);
+	    schedule_task(&sreq->fput_tq);
+	} else
+	    kfree(sreq);
+	return;
+    }
     DSPRINT("storeimage_vif_free: wake_up\n");
     complete(&sreq->c);
     DSPRINT("storeimage_vif_free: wake_up end\n");
@@ -501,15 +572,15 @@ static inline int pio_transfer(unsigned char *ptr, int len, int dummy)
     return 0;
 }
 
-int ps2gs_storeimage(struct ps2_image *img, struct dma_device *dev)
+int ps2gs_storeimage(struct ps2_image *img, struct dma_device *dev, int flags)
 {
-    struct storeimage_gif_request gifreq;
     struct storeimage_request *sreq;
     struct dma_channel *gifch = dev->devch[DMA_SENDCH].channel;
     struct dma_channel *vifch = &ps2dma_channels[DMA_VIF1];
 
     struct dma_tag *tag, *dp, *tp;
     struct page_list *recv_mem = NULL;
+    struct vm_area_struct *vma;
     int result;
 
     int size;
@@ -571,6 +642,12 @@ int ps2gs_storeimage(struct ps2_image *img, struct dma_device *dev)
     default:
 	return result;
     }
+    if (recv_mem && flags) {
+	/* no asynchronous copy_to_user function */
+	ps2pl_free(recv_mem);
+	kfree(tag);
+	return -EINVAL;
+    }
     DSPRINT("storeimage: hptr = %08X\n", hptr);
     if (recv_mem) { DSPRINT("storeimage: USER: %08X\n", recv_mem->page[0]); }
 
@@ -632,12 +709,13 @@ int ps2gs_storeimage(struct ps2_image *img, struct dma_device *dev)
     tp++;
     kfree(tag);
 
-    init_dma_request(&gifreq.r, &storeimage_gif_ops);
-    gifreq.sreq = sreq;
+    init_dma_request(&sreq->gifreq.r, &storeimage_gif_ops);
+    sreq->gifreq.sreq = sreq;
 
     init_dma_request(&sreq->r, &storeimage_vif_ops);
     init_completion(&sreq->c);
     sreq->result = 0;
+    sreq->async = flags;
     sreq->vifch = vifch;
     sreq->gifch = gifch;
     sreq->hptr = hptr;
@@ -647,6 +725,13 @@ int ps2gs_storeimage(struct ps2_image *img, struct dma_device *dev)
     sreq->tlen = tlen;
     sreq->tdummy = tdummy;
     atomic_set(&sreq->count, 0);
+
+    /* keep the pages of ps2mem until an async store is done with them */
+    if (flags && result == BUFTYPE_MEM &&
+	(vma = find_vma(current->mm, (unsigned long)img->ptr)) != NULL) {
+	get_file(vma->vm_file);
+	sreq->file = vma->vm_file;
+    }
     
     init_timer(&sreq->timer);
     sreq->timer.function = storeimage_timer_handler;
@@ -669,8 +754,15 @@ int ps2gs_storeimage(struct ps2_image *img, struct dma_device *dev)
     *p++ = 1;
     *p++ = PS2_GS_TRXDIR;
 
-    ps2dma_add_queue((struct dma_request *)&gifreq, gifch);
+    sreq->ticket = ps2dma_add_queue_seq((struct dma_request *)&sreq->gifreq,
+					gifch, &image_queued) & IMAGE_TICKET_MASK;
+    /* read it before the request can complete and be freed */
+    result = sreq->ticket;
     ps2dma_add_queue((struct dma_request *)sreq, vifch);
+    if (flags & PS2IMAGE_NOTIFY)
+	return result;
+    if (flags)
+	return 0;
     DSPRINT("storeimage: sleep_on\n");
     wait_for_completion(&sreq->c);
     DSPRINT("storeimage: sleep_on end\n");
@@ -0,0 +1,113 @@
+/*
+ *  PlayStation 2 SBIOS RPC latency and throughput benchmark
+ *
+ *  This file is subject to the terms and conditions of the GNU General
+ *  Public License Version 2. See the file "COPYING" in the main
+ *  directory of this archive for more details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/module.h>
+#include <linux/bench.h>
+#include <asm/ps2/sifdefs.h>
+#include <asm/ps2/sbcall.h>
+
+/*
+ * Built as ps2rpctest.o along with the sound driver, which must be
+ * loaded first. It uses SBR_SOUND_GCOREATTR, which only reads a core
+ * attribute on the IOP, as an echo service: the call costs little
+ * more than the EE-IOP round trip itself.
+ *
+ * The call is made BENCH_ITERATIONS times through sbios_rpc(), one at
+ * a time, and then through an sbios_rpc_queue with each window size
+ * below, keeping the window full, and reports the mean time per call
+ * and the call rate.
+ */
+#define BENCH_ITERATIONS 2000
+#define BENCH_MAXWINDOW 16
+
+static int windows[] = { 1, 2, 4, 8, BENCH_MAXWINDOW };
+
+static struct sbios_rpc_req reqs[BENCH_MAXWINDOW];
+static struct sbr_sound_coreattr_arg args[BENCH_MAXWINDOW];
+
+static void report(char *what, uint32_t usec, int calls)
+{
+	printk("%-10s: %5d ns/call, %6d calls/s\n", what,
+	       usec / (calls / 1000), calls * 1000 / (usec / 1000 ? usec / 1000 : 1));
+}
+
+static int bench_sync(void)
+{
+	struct sbr_sound_coreattr_arg arg;
+	struct timeval start;
+	int i, res, result;
+
+	do_gettimeofday(&start);
+	for (i = 0; i < BENCH_ITERATIONS; i++) {
+		arg.idx = SB_SOUND_CA_EFFECT_ENABLE;
+		/* -SIF_RPCE_GETP, a failure too, is positive */
+		if ((res = sbios_rpc(SBR_SOUND_GCOREATTR, &arg, &result)) != 0) {
+			printk("rpctest: sbios_rpc() failed, %d\n", res);
+			return -EIO;
+		}
+	}
+	report("sync", bench_usec(&start), BENCH_ITERATIONS);
+
+	return 0;
+}
+
+static int submit(struct sbios_rpc_queue *q, int n)
+{
+	args[n].idx = SB_SOUND_CA_EFFECT_ENABLE;
+	if (sbios_rpc_submit(q, &reqs[n], SBR_SOUND_GCOREATTR, &args[n]) != 0) {
+		printk("rpctest: sbios_rpc_submit() failed\n");
+		return -EIO;
+	}
+	return 0;
+}
+
+static int bench_async(int window)
+{
+	struct sbios_rpc_queue q;
+	struct sbios_rpc_req *req;
+	struct timeval start;
+	char what[16];
+	int i, res = 0;
+
+	sbios_rpc_queue_init(&q, window);
+
+	do_gettimeofday(&start);
+	for (i = 0; i < window; i++)
+		if ((res = submit(&q, i)) < 0)
+			goto out;
+	/* reuse each request as soon as it comes back */
+	for (; i < BENCH_ITERATIONS; i++) {
+		req = sbios_rpc_reap(&q, 0);
+		if ((res = submit(&q, req - reqs)) < 0)
+			goto out;
+	}
+	sbios_rpc_flush(&q);
+	sprintf(what, "window %d", window);
+	report(what, bench_usec(&start), BENCH_ITERATIONS);
+
+ out:
+	/* nothing may be left in flight on the stack */
+	sbios_rpc_flush(&q);
+	return res;
+}
+
+int init_module(void)
+{
+	int i;
+
+	printk("rpctest: %d calls of each\n", BENCH_ITERATIONS);
+	if (bench_sync() < 0)
+		return BENCH_DONE;
+	for (i = 0; i < sizeof(windows) / sizeof(windows[0]); i++)
+		if (bench_async(windows[i]) < 0)
+			break;
+
+	return BENCH_DONE;
+}
@@ -17,6 +17,9 @@
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/wrapper.h>
+#include <linux/proc_fs.h>
 #include <linux/interrupt.h>
 #include <linux/soundcard.h>
 #include <linux/autoconf.h>
@@ -50,6 +53,7 @@
 #define PS2SD_INIT_TIMER	(1 <<  7)
 #define PS2SD_INIT_BUFFERALLOC	(1 <<  8)
 #define PS2SD_INIT_THREAD	(1 <<  9)
+#define PS2SD_INIT_PROC		(1 << 10)
 
 #define DEVICE_NAME	"PS2 Sound"
 
@@ -92,6 +96,10 @@
 	(b) = tmp; \
     } while (0)
 
+/* the staging area in devc->mixbuf of an IOP half */
+#define MIXBUF(devc, iopbuf)	\
+    ((devc)->mixbuf + ((iopbuf) - (devc)->iopbufs) * (ps2sd_max_iopbufsize/2))
+
 #define CHECKBUFRANGE
 #ifdef CHECKBUFRANGE
 #define CHECK_BUF_RANGE(startaddr, bufsize, tailaddr, size, count) \
@@ -148,6 +156,7 @@ static int ps2sd_mmap(struct file *, struct vm_area_struct *);
 static int ps2sd_ioctl(struct inode *, struct file *, unsigned int, unsigned long);
 static int ps2sd_open(struct inode *, struct file *);
 static int ps2sd_release(struct inode *, struct file *);
+static int ps2sd_stream_open(struct ps2sd_unit_context *, struct file *);
 static void ps2sd_setup(void);
 static int ps2sd_command_end(struct ps2sd_unit_context *devc);
 static void ps2sd_mute(struct ps2sd_unit_context *);
@@ -189,6 +198,10 @@ int ps2sd_iopbufsize = PS2SD_DEFAULT_IOP_BUFSIZE;
 int ps2sd_max_dmabufsize = PS2SD_MAX_DMA_BUFSIZE;
 int ps2sd_max_iopbufsize = PS2SD_MAX_IOP_BUFSIZE;
 int ps2sd_normal_debug;
+int ps2sd_max_streams = 4;	/* additional openers mixed in software */
+#ifdef PS2SD_USE_THREAD
+int ps2sd_intr_thread = 0;	/* refill from the thread instead of the callback */
+#endif
 #ifdef CONFIG_T10000_DEBUG_HOOK
 int ps2sd_debug_hook = 0;
 #endif
@@ -198,6 +211,10 @@ MODULE_PARM(ps2sd_dmabufsize, "i");
 MODULE_PARM(ps2sd_iopbufsize, "i");
 MODULE_PARM(ps2sd_max_dmabufsize, "i");
 MODULE_PARM(ps2sd_max_iopbufsize, "i");
+MODULE_PARM(ps2sd_max_streams, "i");
+#ifdef PS2SD_USE_THREAD
+MODULE_PARM(ps2sd_intr_thread, "i");
+#endif
 #ifdef CONFIG_T10000_DEBUG_HOOK
 MODULE_PARM(ps2sd_debug_hook, "0-1i");
 #endif
@@ -271,6 +288,30 @@ src_to_dest_bytes(struct ps2sd_unit_context *devc, int src_bytes)
 		  devc->cnvdstrate / devc->cnvsrcrate);
 }
 
+/*
+ * bytes in SPU2 native format which have been played so far, with
+ * sub-fragment accuracy.  call with devc->spinlock held.
+ */
+static int
+output_bytes(struct ps2sd_unit_context *devc)
+{
+	int n;
+
+	if (devc->dmastat != DMASTAT_RUNNING)
+		return (devc->total_output_bytes);
+	/* 192 bytes per millisecond at 48KHz stereo */
+	if (devc->prevdmaintrvalid)
+		n = 192 * getudelay(devc) / 1000;
+	else
+		n = 192 * (getudelay(devc) - 1000) / 1000;
+	if (n < 0)
+		n = 0;
+	if (devc->iopbufsize/2 < n)
+		n = devc->iopbufsize/2;
+
+	return (devc->total_output_bytes + (n & ~3));
+}
+
 static int
 setdmastate(struct ps2sd_unit_context *devc, int curstat, int newstat, char *cause)
 {
@@ -361,14 +402,18 @@ ps2sd_read(struct file *filp, char *buffer, size_t count, loff_t *ppos)
 	return -EINVAL;
 }
 
+/*
+ * move BUFUNIT bytes of native samples at src into the DMA buffer,
+ * converting them into 512 bytes interleaved format on the way
+ */
 static int
-flush_intbuf(struct ps2sd_unit_context *devc, int nonblock)
+put_dmabuf(struct ps2sd_unit_context *devc, unsigned char *src, int nonblock)
 {
-	int res, i, buftail, bufcount;
+	int res, buftail, bufcount;
 	unsigned long flags;
 	DECLARE_WAITQUEUE(wait, current);
 
-	TRACE("flush_intbuf\n");
+	TRACE("put_dmabuf\n");
 	spin_lock_irqsave(&devc->spinlock, flags);
 	add_wait_queue(&devc->write_wq, &wait);
 	res = -EINVAL; /* failsafe */
@@ -394,11 +439,11 @@ flush_intbuf(struct ps2sd_unit_context *devc, int nonblock)
 		schedule();
 		spin_lock_irq(&devc->spinlock);
 		if (signal_pending(current)) {
-			DPRINT(DBG_INFO, "flush_intbuf(): interrupted\n");
+			DPRINT(DBG_INFO, "put_dmabuf(): interrupted\n");
 			res = -ERESTARTSYS;
 			break;
 		}
-		TRACE2("flush_intbuf loop\n");
+		TRACE2("put_dmabuf loop\n");
 		continue;
 	}
 	remove_wait_queue(&devc->write_wq, &wait);
@@ -408,24 +453,14 @@ flush_intbuf(struct ps2sd_unit_context *devc, int nonblock)
 
 	/* now, we have at least BUFUNIT space in dma buffer */
 	/* convert into 512 bytes interleaved format */
-	if (devc->flags & PS2SD_UNIT_INT512) {
-		memcpy(&devc->dmabuf[buftail], devc->intbuf, BUFUNIT);
-	} else {
-		unsigned short *src, *dst;
-		src = (unsigned short*)devc->intbuf;
-		dst = (unsigned short*)&devc->dmabuf[buftail];
-		for (i = 0; i < BUFUNIT/sizeof(u_short)/2; i++) {
-			dst[0] = *src++;
-			dst[BUFUNIT/sizeof(u_short)/2] = *src++;
-			dst++;
-		}
-	}
+	if (devc->flags & PS2SD_UNIT_INT512)
+		memcpy(&devc->dmabuf[buftail], src, BUFUNIT);
+	else
+		ps2sd_deinterleave(&devc->dmabuf[buftail], src, BUFUNIT);
 	ps2sif_writebackdcache(&devc->dmabuf[buftail], BUFUNIT);
 
 	buftail += BUFUNIT;
 	buftail %= devc->dmabufsize;
-	bufcount += BUFUNIT;
-	devc->intbufcount = 0;
 	spin_lock_irqsave(&devc->spinlock, flags);
 	devc->dmabuftail = buftail;
 	devc->dmabufcount += BUFUNIT;
@@ -434,6 +469,21 @@ flush_intbuf(struct ps2sd_unit_context *devc, int nonblock)
 	return (0);
 }
 
+static int
+flush_intbuf(struct ps2sd_unit_context *devc, int nonblock)
+{
+	int res;
+
+	TRACE("flush_intbuf\n");
+	if ((res = put_dmabuf(devc, devc->intbuf, nonblock)) < 0)
+		return (res);
+	devc->intbufcount = 0;
+
+	return (0);
+}
+
+#define CNVBLKFRAMES	64	/* frames converted at once when resampling */
+
 static void
 flush_cnvbuf(struct ps2sd_unit_context *devc)
 {
@@ -452,31 +502,69 @@ flush_cnvbuf(struct ps2sd_unit_context *devc)
 		devc->cnvbufcount -= n;
 		devc->cnvbufhead += n;
 		devc->cnvbufhead %= CNVBUFSIZE;
+	} else if (devc->cnvsrcrate == devc->cnvdstrate) {
+		/*
+		 * no resampling, convert straight into the interleave buffer
+		 * (CNVBUFSIZE is a multiple of any samplesize, so a sample
+		 *  never wraps around the end of the conversion buffer)
+		 */
+		n = MIN((INTBUFSIZE - devc->intbufcount) /
+			sizeof(struct ps2sd_sample),
+			devc->cnvbufcount / devc->samplesize);
+		if ((CNVBUFSIZE - devc->cnvbufhead) / devc->samplesize < n)
+			n = (CNVBUFSIZE - devc->cnvbufhead) / devc->samplesize;
+		(*devc->convert)((void*)&devc->intbuf[devc->intbufcount],
+				 &devc->cnvbuf[devc->cnvbufhead], n);
+		devc->intbufcount += n * sizeof(struct ps2sd_sample);
+		devc->cnvbufcount -= n * devc->samplesize;
+		devc->cnvbufhead += n * devc->samplesize;
+		devc->cnvbufhead %= CNVBUFSIZE;
+		DPRINT(DBG_VERBOSE, "dma%d: flush_cnvbuf convert %d samples cnvbufcount=%d intbufcount=%d\n",
+		       devc->dmach, n, devc->cnvbufcount, devc->intbufcount);
 	} else {
-		struct ps2sd_sample s0, s1, *d;
-		int scount = 0, dcount = 0;
+		struct ps2sd_sample blk[CNVBLKFRAMES + 1], *d;
+		int i, n1, scount = 0, dcount = 0;
 
-#define CUR_ADDR &devc->cnvbuf[devc->cnvbufhead]
-#define NEXT_ADDR &devc->cnvbuf[(devc->cnvbufhead + devc->samplesize) % CNVBUFSIZE]
-		(*devc->fetch)(&s0, CUR_ADDR);
-		(*devc->fetch)(&s1, NEXT_ADDR);
 		d = (void*)&devc->intbuf[devc->intbufcount];
 		while (devc->intbufcount < INTBUFSIZE &&
 		       devc->samplesize * 2 <= devc->cnvbufcount) {
-			d->l = (s0.l * devc->cnvd + s1.l * (devc->cnvdstrate - devc->cnvd))/devc->cnvdstrate;
-			d->r = (s0.r * devc->cnvd + s1.r * (devc->cnvdstrate - devc->cnvd))/devc->cnvdstrate;
-			d++;
-			devc->intbufcount += sizeof(struct ps2sd_sample);
-			dcount += sizeof(struct ps2sd_sample);
-			if ((devc->cnvd -= devc->cnvsrcrate) < 0) {
-				s0 = s1;
-				devc->cnvbufhead += devc->samplesize;
-				devc->cnvbufhead %= CNVBUFSIZE;
-				devc->cnvbufcount -= devc->samplesize;
-				(*devc->fetch)(&s1, NEXT_ADDR);
-				devc->cnvd += devc->cnvdstrate;
-				scount += devc->samplesize;
+			/*
+			 * convert a block of source samples at once,
+			 * but not much more than the room left in intbuf
+			 * will consume
+			 */
+			n = devc->cnvbufcount / devc->samplesize;
+			if (CNVBLKFRAMES + 1 < n)
+				n = CNVBLKFRAMES + 1;
+			i = (INTBUFSIZE - devc->intbufcount) /
+			    sizeof(struct ps2sd_sample) *
+			    devc->cnvsrcrate / devc->cnvdstrate + 2;
+			if (i < n)
+				n = i;
+			n1 = MIN(n, (CNVBUFSIZE - devc->cnvbufhead) /
+				 devc->samplesize);
+			(*devc->convert)(blk, &devc->cnvbuf[devc->cnvbufhead],
+					 n1);
+			if (n1 < n)
+				(*devc->convert)(&blk[n1], devc->cnvbuf, n - n1);
+
+			/* blk[i] and blk[i + 1] are the current pair */
+			i = 0;
+			while (devc->intbufcount < INTBUFSIZE && i + 1 < n) {
+				d->l = (blk[i].l * devc->cnvd + blk[i + 1].l * (devc->cnvdstrate - devc->cnvd))/devc->cnvdstrate;
+				d->r = (blk[i].r * devc->cnvd + blk[i + 1].r * (devc->cnvdstrate - devc->cnvd))/devc->cnvdstrate;
+				d++;
+				devc->intbufcount += sizeof(struct ps2sd_sample);
+				dcount += sizeof(struct ps2sd_sample);
+				if ((devc->cnvd -= devc->cnvsrcrate) < 0) {
+					i++;
+					devc->cnvd += devc->cnvdstrate;
+				}
 			}
+			devc->cnvbufhead += i * devc->samplesize;
+			devc->cnvbufhead %= CNVBUFSIZE;
+			devc->cnvbufcount -= i * devc->samplesize;
+			scount += i * devc->samplesize;
 		}
 		DPRINT(DBG_VERBOSE, "dma%d: flush_cnvbuf convert %d -> %d bytes cnvbufcount=%d intbufcount=%d\n",
 		       devc->dmach, scount, dcount, devc->cnvbufcount, devc->intbufcount);
@@ -491,6 +579,9 @@ post_buffer(struct ps2sd_unit_context *devc)
 	unsigned long flags;
 
 
+	/* running out of data from here on is not an underrun */
+	devc->draining = 1;
+
 	/* just falesafe, this sould not occur */
 	if (devc->samplesize == 0) {
 		printk(KERN_CRIT "ps2sd: internal error, sampelsize = 0");
@@ -550,6 +641,44 @@ sync_buffer(struct ps2sd_unit_context *devc)
 	return wait_dma_stop(devc);
 }
 
+/*
+ * wait for the owner's data to be played while other streams are open
+ */
+static int
+sync_owner(struct ps2sd_unit_context *devc)
+{
+	int res;
+	DECLARE_WAITQUEUE(wait, current);
+
+	if ((res = post_buffer(devc)) < 0)
+		return res;
+
+	/*
+	 * the owner's data is taken a whole fragment at a time while
+	 * mixing, pad it with silence up to the fragment boundary.
+	 */
+	memset(devc->intbuf, 0, INTBUFSIZE);
+	while (devc->dmabuftail % (devc->iopbufsize/2) != 0)
+		if ((res = flush_intbuf(devc, 0 /* block */)) < 0)
+			return res;
+
+	add_wait_queue(&devc->write_wq, &wait);
+	for ( ; ; ) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (devc->dmabufcount <= 0 || devc->dmastat == DMASTAT_STOP)
+			break;
+		schedule();
+		if (signal_pending(current)) {
+			res = -ERESTARTSYS;
+			break;
+		}
+	}
+	set_current_state(TASK_RUNNING);
+	remove_wait_queue(&devc->write_wq, &wait);
+
+	return (res);
+}
+
 static ssize_t
 ps2sd_write(struct file *filp, const char *buffer, size_t count, loff_t *ppos)
 {
@@ -567,6 +696,10 @@ ps2sd_write(struct file *filp, const char *buffer, size_t count, loff_t *ppos)
 	if (devc->cnvbuf == NULL)
 		return -EINVAL; /* no PCM buffers allocated */
 
+	if (devc->flags & PS2SD_UNIT_MMAPPED)
+		return -ENXIO; /* the buffer is fed through mmap */
+
+	devc->draining = 0;
 	ret = 0;
 	while (0 < count) {
 		int n;
@@ -604,6 +737,25 @@ ps2sd_write(struct file *filp, const char *buffer, size_t count, loff_t *ppos)
 		}
 		preempt_enable();
 
+		/*
+		 * SPU2 native format with nothing pending in the interleave
+		 * buffer: cnvbuf -> dmabuf directly
+		 */
+		if (devc->noconversion && devc->intbufcount == 0 &&
+		    BUFUNIT <= devc->cnvbufcount &&
+		    BUFUNIT <= CNVBUFSIZE - devc->cnvbufhead) {
+			res = put_dmabuf(devc, &devc->cnvbuf[devc->cnvbufhead],
+					 filp->f_flags & O_NONBLOCK);
+			if (res < 0)
+				return ret ? ret : res;
+			preempt_disable();
+			devc->cnvbufcount -= BUFUNIT;
+			devc->cnvbufhead += BUFUNIT;
+			devc->cnvbufhead %= CNVBUFSIZE;
+			preempt_enable();
+			goto kick;
+		}
+
 		/* 
 		 * format conversion
 		 * cnvbuf -> intbuf
@@ -621,6 +773,7 @@ ps2sd_write(struct file *filp, const char *buffer, size_t count, loff_t *ppos)
 			}
 		}
 
+	kick:
 		/* kick DMA */
 		if (devc->iopbufsize <= devc->dmabufcount)
 			if ((res = start(devc)) < 0)
@@ -651,10 +804,50 @@ ps2sd_poll(struct file *filp, struct poll_table_struct *wait)
 	return mask;
 }
 
+/*
+ * map the DMA buffer into user space
+ *
+ * The application writes SPU2 native samples (16bit signed little
+ * endian, 48KHz stereo) straight into the ring and starts the playback
+ * with SNDCTL_DSP_SETTRIGGER.  DMA then loops over the ring until the
+ * trigger is cleared; SNDCTL_DSP_GETOPTR tells where it is.  In
+ * PS2SD_INTMODE_512 the ring is transferred as it is, otherwise each
+ * fragment is split into 512 bytes L/R blocks in devc->mixbuf just
+ * before being sent to the IOP, leaving the ring as the user wrote it.
+ * devc->mixbuf holds one fragment per IOP half, since the DMA of one
+ * half may still be reading it while the other is composed.
+ */
 static int
 ps2sd_mmap(struct file *filp, struct vm_area_struct *vma)
 {
-       	return -EINVAL;
+	struct ps2sd_unit_context *devc;
+	unsigned long size;
+
+	devc = PS2SD_DEVC(filp);
+
+	if (!(vma->vm_flags & VM_WRITE) || devc->dmabuf == NULL)
+		return -EINVAL;
+	if ((devc->flags & PS2SD_UNIT_COMMANDMODE) || devc->nstreams != 0)
+		return -EBUSY;
+	size = vma->vm_end - vma->vm_start;
+	if (vma->vm_pgoff != 0 || PAGE_ALIGN(ps2sd_max_dmabufsize) < size)
+		return -EINVAL;
+	if (devc->mixbuf == NULL &&
+	    (devc->mixbuf = kmalloc(ps2sd_max_iopbufsize, GFP_KERNEL)) == NULL)
+		return -ENOMEM;
+	if (remap_page_range(vma->vm_start, virt_to_phys(devc->dmabuf),
+			     size, vma->vm_page_prot))
+		return -EAGAIN;
+
+	/* stop playback via write() and forget pending samples */
+	if (devc->dmastat != DMASTAT_STOP)
+		stop(devc);
+	reset_error(devc);
+	reset_buffer(devc);
+	devc->flags |= PS2SD_UNIT_MMAPPED;
+	DPRINT(DBG_INFO, "core%d: mmap %ld bytes\n", devc->core, size);
+
+	return 0;
 }
 
 static int
@@ -684,7 +877,8 @@ ps2sd_ioctl(struct inode *inode, struct file *filp, unsigned int cmd, unsigned l
 
 	case SNDCTL_DSP_GETCAPS:
 		DPRINT(DBG_IOCTL, "ioctl(SNDCTL_DSP_GETCAPS)\n");
-		return put_user(DSP_CAP_BATCH, (int *)arg);
+		return put_user(DSP_CAP_BATCH | DSP_CAP_MMAP | DSP_CAP_TRIGGER,
+				(int *)arg);
 
 	case SNDCTL_DSP_RESET:
 		DPRINT(DBG_IOCTL, "ioctl(SNDCTL_DSP_RESET)\n");
@@ -748,13 +942,39 @@ ps2sd_ioctl(struct inode *inode, struct file *filp, unsigned int cmd, unsigned l
 
 	case SNDCTL_DSP_GETTRIGGER:
 		DPRINT(DBG_IOCTL, "ioctl(SNDCTL_DSP_GETTRIGGER)\n");
-		/* trigger function is not supported */
-		return -EINVAL;
+		/* trigger function is supported in mmap mode only */
+		if (!(devc->flags & PS2SD_UNIT_MMAPPED))
+			return -EINVAL;
+		val = (devc->flags & PS2SD_UNIT_TRIGGER) ? PCM_ENABLE_OUTPUT : 0;
+		return put_user(val, (int *)arg);
 
 	case SNDCTL_DSP_SETTRIGGER:
-		DPRINT(DBG_IOCTL, "ioctl(SNDCTL_DSP_SETTRIGGER)\n");
-		/* trigger function is not supported */
-		return -EINVAL;
+		if (get_user(val, (int *)arg))
+			return (-EFAULT);
+		DPRINT(DBG_IOCTL, "ioctl(SNDCTL_DSP_SETTRIGGER): %x\n", val);
+		/* trigger function is supported in mmap mode only */
+		if (!(devc->flags & PS2SD_UNIT_MMAPPED) || !devc->noconversion)
+			return -EINVAL;
+		if (!(val & PCM_ENABLE_OUTPUT)) {
+			devc->flags &= ~PS2SD_UNIT_TRIGGER;
+			res = stop(devc);
+			reset_error(devc);
+			reset_buffer(devc);
+			return res;
+		}
+		if (devc->flags & PS2SD_UNIT_TRIGGER)
+			return (0);
+		reset_error(devc);
+		spin_lock_irqsave(&devc->spinlock, flags);
+		reset_buffer(devc);
+		devc->dmabufcount = devc->dmabufsize;
+		devc->total_output_bytes = 0;
+		devc->optr_frags = 0;
+		devc->flags |= PS2SD_UNIT_TRIGGER;
+		spin_unlock_irqrestore(&devc->spinlock, flags);
+		if ((res = start(devc)) < 0)
+			devc->flags &= ~PS2SD_UNIT_TRIGGER;
+		return res;
 
 	case SNDCTL_DSP_GETOSPACE:
 		/*DPRINT(DBG_IOCTL, "ioctl(SNDCTL_DSP_GETOSPACE)\n");
@@ -821,9 +1041,16 @@ ps2sd_ioctl(struct inode *inode, struct file *filp, unsigned int cmd, unsigned l
 	case SNDCTL_DSP_GETOPTR:
 		DPRINT(DBG_IOCTL, "ioctl(SNDCTL_DSP_GETOPTR)\n");
 		spin_lock_irqsave(&devc->spinlock, flags);
-                cinfo.bytes = dest_to_src_bytes(devc,devc->total_output_bytes);
-                cinfo.blocks = devc->total_output_bytes / (devc->iopbufsize/2);
+		val = output_bytes(devc);
+                cinfo.bytes = dest_to_src_bytes(devc, val);
+                cinfo.blocks = val / (devc->iopbufsize/2);
                 cinfo.ptr = 0;
+		if (devc->flags & PS2SD_UNIT_MMAPPED) {
+			/* fragments played since the last call */
+			cinfo.blocks -= devc->optr_frags;
+			devc->optr_frags += cinfo.blocks;
+			cinfo.ptr = val % devc->dmabufsize;
+		}
 		spin_unlock_irqrestore(&devc->spinlock, flags);
                 return copy_to_user((void *)arg, &cinfo, sizeof(cinfo)) ? -EFAULT : 0;
 
@@ -1079,8 +1306,9 @@ return (-EFAULT);    \
 static int
 ps2sd_open(struct inode *inode, struct file *filp)
 {
-	int i, minor = MINOR(inode->i_rdev);
+	int i, busy, minor = MINOR(inode->i_rdev);
 	struct ps2sd_unit_context *devc;
+	unsigned long flags;
 
 	/*
 	 * we have no input device
@@ -1097,16 +1325,13 @@ ps2sd_open(struct inode *inode, struct file *filp)
 	spin_lock_irq(&ps2sd_mc.spinlock);
 	if (devc->flags & PS2SD_UNIT_EXCLUSIVE) {
 		for (i = 0; i < ps2sd_nunits; i++) {
-			if (ps2sd_units[i].flags & PS2SD_UNIT_OPENED) {
+			if ((ps2sd_units[i].flags & PS2SD_UNIT_OPENED) ||
+			    ps2sd_units[i].nstreams != 0) {
 				spin_unlock_irq(&ps2sd_mc.spinlock);
 				return -EBUSY;
 			}
 		}
 	} else {
-		if (devc->flags & PS2SD_UNIT_OPENED) {
-			spin_unlock_irq(&ps2sd_mc.spinlock);
-			return -EBUSY;
-		}
 		for (i = 0; i < ps2sd_nunits; i++) {
 			if ((ps2sd_units[i].flags & PS2SD_UNIT_EXCLUSIVE) &&
 			    (ps2sd_units[i].flags & PS2SD_UNIT_OPENED)) {
@@ -1114,21 +1339,35 @@ ps2sd_open(struct inode *inode, struct file *filp)
 				return -EBUSY;
 			}
 		}
+		if (devc->flags & PS2SD_UNIT_OPENED)
+			return ps2sd_stream_open(devc, filp);
 	}
-	devc->flags = (devc->init_flags | PS2SD_UNIT_OPENED);
+	devc->flags = (devc->init_flags | PS2SD_UNIT_OPENED | PS2SD_UNIT_SETUP);
+	busy = (devc->nstreams != 0);
 	spin_unlock_irq(&ps2sd_mc.spinlock);
 
 	devc->total_output_bytes = 0;
+	devc->underruns = 0;
+	memset(devc->lathist, 0, sizeof(devc->lathist));
 	filp->private_data = devc;
 
 	/*
-	 * set defaut format and fragment size
+	 * set defaut format and fragment size, unless the streams left
+	 * over from the previous owner are still playing through them.
 	 */
 	devc->requested_fragsize = 0; /* no request */
-	devc->dmabufsize = ps2sd_dmabufsize;
-	devc->iopbufsize = ps2sd_iopbufsize;
-	set_format(devc, AFMT_MU_LAW, 8000, 0 /* monaural */, 1);
-	reset_buffer(devc);
+	if (!busy) {
+		spin_lock_irqsave(&devc->spinlock, flags);
+		devc->dmabufsize = ps2sd_dmabufsize;
+		devc->iopbufsize = ps2sd_iopbufsize;
+		reset_buffer(devc);
+		spin_unlock_irqrestore(&devc->spinlock, flags);
+		set_format(devc, AFMT_MU_LAW, 8000, 0 /* monaural */, 1);
+	}
+
+	spin_lock_irq(&ps2sd_mc.spinlock);
+	devc->flags &= ~PS2SD_UNIT_SETUP;
+	spin_unlock_irq(&ps2sd_mc.spinlock);
 
 	/* initialize iopmem list (if any) */
 	if (devc->iopmemlist != NULL)
@@ -1145,7 +1384,15 @@ ps2sd_release(struct inode *inode, struct file *filp)
 	devc = PS2SD_DEVC(filp);
 	DPRINT(DBG_INFO, "close: core%d, dmastat=%s\n",
 	       devc->core, dmastatnames[devc->dmastat]);
-	sync_buffer(devc);
+	if (devc->flags & PS2SD_UNIT_MMAPPED) {
+		/* nobody knows how much of the ring is valid */
+		devc->flags &= ~PS2SD_UNIT_TRIGGER;
+		stop(devc);
+	} else if (devc->nstreams != 0) {
+		/* don't stop the DMA under the other streams */
+		sync_owner(devc);
+	} else
+		sync_buffer(devc);
 
 	if (devc->flags & PS2SD_UNIT_COMMANDMODE)
 		ps2sd_command_end(devc);
@@ -1161,6 +1408,472 @@ ps2sd_release(struct inode *inode, struct file *filp)
 	return 0;
 }
 
+/*
+ * software mixing
+ *
+ * When a unit is opened already, up to ps2sd_max_streams further openers
+ * get a stream of their own instead of EBUSY.  A stream converts what is
+ * written to it into SPU2 native samples in its own ring and
+ * ps2sd_dmaintr() adds all the streams, with saturation, on top of the
+ * owner's data whenever it sends a fragment to the IOP.
+ */
+#define INTRFRAMES	(INTRSIZE/sizeof(short))	/* samples per L/R block */
+
+static int
+stream_pending(struct ps2sd_unit_context *devc)
+{
+	struct ps2sd_stream *st;
+
+	for (st = devc->streams; st != NULL; st = st->next)
+		if (st->bufcount != 0)
+			return (1);
+	return (0);
+}
+
+/*
+ * add the streams to a fragment in 512 bytes interleaved format.
+ * called from ps2sd_dmaintr().
+ */
+static void
+stream_mix(struct ps2sd_unit_context *devc, unsigned char *frag, int size)
+{
+	struct ps2sd_stream *st;
+	int i, j, n, frames;
+	short *blk;
+
+	for (st = devc->streams; st != NULL; st = st->next) {
+		frames = MIN(st->bufcount, size / sizeof(struct ps2sd_sample));
+		for (i = 0; i < frames; i += n) {
+			j = i % INTRFRAMES;
+			blk = (short *)&frag[i / INTRFRAMES * BUFUNIT];
+			n = MIN(frames - i, INTRFRAMES - j);
+			if (PS2SD_STREAMFRAMES - st->bufhead < n)
+				n = PS2SD_STREAMFRAMES - st->bufhead;
+			ps2sd_mix(&blk[j], &blk[INTRFRAMES + j],
+				  &st->buf[st->bufhead], n, st->gainl, st->gainr);
+			st->bufhead = (st->bufhead + n) % PS2SD_STREAMFRAMES;
+			st->bufcount -= n;
+		}
+		if (frames)
+			wake_up(&st->wq);
+	}
+}
+
+static int
+stream_set_format(struct ps2sd_stream *st, int format, int speed, int stereo)
+{
+	ps2sd_cnv_t convert;
+	unsigned long flags;
+
+	speed = ALIGN(speed, 25);
+	if (speed < 4000) speed = 4000;
+	if (SPU2SPEED < speed) speed = SPU2SPEED;
+
+	if ((convert = ps2sd_get_converter(format, stereo)) == NULL)
+		return -EINVAL;
+
+	spin_lock_irqsave(&st->devc->spinlock, flags);
+	st->format = format;
+	st->speed = speed;
+	st->stereo = stereo;
+	st->convert = convert;
+	switch (format) {
+	case AFMT_S8:
+	case AFMT_U8:
+	case AFMT_MU_LAW:
+		st->samplesize = stereo ? 2 : 1;
+		break;
+	default:
+		st->samplesize = stereo ? 4 : 2;
+		break;
+	}
+	st->cnvsrcrate = speed/25 * 2;
+	st->cnvdstrate = SPU2SPEED/25 * 2;
+	st->cnvd = st->cnvdstrate / 2;
+	st->havelast = 0;
+	st->bufhead = 0;
+	st->bufcount = 0;
+	spin_unlock_irqrestore(&st->devc->spinlock, flags);
+
+	return 0;
+}
+
+/*
+ * wait until at most `count' samples are left in the ring or the DMA
+ * stops with `stop' set
+ */
+static int
+stream_wait(struct ps2sd_stream *st, int count, int stop, int nonblock)
+{
+	struct ps2sd_unit_context *devc = st->devc;
+	int res;
+	DECLARE_WAITQUEUE(wait, current);
+	DECLARE_WAITQUEUE(waitstat, current);
+
+	add_wait_queue(&st->wq, &wait);
+	add_wait_queue(&devc->dmastat_wq, &waitstat);
+	res = 0;
+	for ( ; ; ) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (st->bufcount <= count)
+			break;
+		if (devc->dmastat == DMASTAT_STOP) {
+			if (stop)
+				break;
+			if ((res = start(devc)) < 0)
+				break;
+			if (devc->dmastat == DMASTAT_STOP) {
+				/* start() may have refused, keep trying */
+				set_current_state(TASK_INTERRUPTIBLE);
+				schedule_timeout(HZ/100);
+				continue;
+			}
+		}
+		if (nonblock) {
+			res = -EAGAIN;
+			break;
+		}
+		schedule();
+		if (signal_pending(current)) {
+			res = -ERESTARTSYS;
+			break;
+		}
+	}
+	set_current_state(TASK_RUNNING);
+	remove_wait_queue(&devc->dmastat_wq, &waitstat);
+	remove_wait_queue(&st->wq, &wait);
+
+	return (res);
+}
+
+/*
+ * convert `n' samples at src and append them to the ring, which has
+ * enough room
+ */
+static void
+stream_put(struct ps2sd_stream *st, unsigned char *src, int n)
+{
+	struct ps2sd_sample blk[CNVBLKFRAMES + 1], *d;
+	unsigned long flags;
+	int i, m, nblk, tail;
+
+	spin_lock_irqsave(&st->devc->spinlock, flags);
+	tail = (st->bufhead + st->bufcount) % PS2SD_STREAMFRAMES;
+	spin_unlock_irqrestore(&st->devc->spinlock, flags);
+
+	if (st->cnvsrcrate == st->cnvdstrate) {
+		m = MIN(n, PS2SD_STREAMFRAMES - tail);
+		(*st->convert)(&st->buf[tail], src, m);
+		if (m < n)
+			(*st->convert)(st->buf, src + m * st->samplesize,
+				       n - m);
+		m = n;
+	} else {
+		i = 0;
+		if (st->havelast)
+			blk[i++] = st->last;
+		(*st->convert)(&blk[i], src, n);
+		nblk = i + n;
+
+		m = 0;
+		i = 0;
+		while (i + 1 < nblk) {
+			d = &st->buf[(tail + m) % PS2SD_STREAMFRAMES];
+			d->l = (blk[i].l * st->cnvd + blk[i + 1].l * (st->cnvdstrate - st->cnvd))/st->cnvdstrate;
+			d->r = (blk[i].r * st->cnvd + blk[i + 1].r * (st->cnvdstrate - st->cnvd))/st->cnvdstrate;
+			m++;
+			if ((st->cnvd -= st->cnvsrcrate) < 0) {
+				i++;
+				st->cnvd += st->cnvdstrate;
+			}
+		}
+		st->last = blk[nblk - 1];
+		st->havelast = 1;
+	}
+
+	spin_lock_irqsave(&st->devc->spinlock, flags);
+	st->bufcount += m;
+	spin_unlock_irqrestore(&st->devc->spinlock, flags);
+}
+
+static ssize_t
+ps2sd_stream_write(struct file *filp, const char *buffer, size_t count,
+		   loff_t *ppos)
+{
+	struct ps2sd_stream *st = filp->private_data;
+	struct ps2sd_unit_context *devc = st->devc;
+	/* the converters read it as words and, with MMI, as quadwords */
+	u_int32_t src[CNVBLKFRAMES] __attribute__((aligned(16)));
+	int ret, res, n, need;
+
+	if (!access_ok(VERIFY_READ, buffer, count))
+		return -EFAULT;
+
+	ret = 0;
+	while (st->samplesize <= count) {
+		if ((res = reset_error(devc)) < 0)
+			return ret ? ret : res;
+
+		n = MIN(count / st->samplesize, CNVBLKFRAMES);
+		/* the most samples n source samples can turn into */
+		need = n * ((st->cnvdstrate + st->cnvsrcrate - 1) /
+			    st->cnvsrcrate);
+		res = stream_wait(st, PS2SD_STREAMFRAMES - need, 0,
+				  filp->f_flags & O_NONBLOCK);
+		if (res < 0)
+			return ret ? ret : res;
+
+		if (copy_from_user(src, buffer, n * st->samplesize))
+			return ret ? ret : -EFAULT;
+		stream_put(st, (unsigned char *)src, n);
+		buffer += n * st->samplesize;
+		count -= n * st->samplesize;
+		ret += n * st->samplesize;
+
+		/* kick DMA */
+		if (devc->dmastat == DMASTAT_STOP &&
+		    devc->iopbufsize/2/sizeof(struct ps2sd_sample) <=
+		    st->bufcount)
+			if ((res = start(devc)) < 0)
+				return ret ? ret : res;
+	}
+	/* a piece of sample, nothing can be done with it */
+	ret += count;
+
+	return ret;
+}
+
+static unsigned int
+ps2sd_stream_poll(struct file *filp, struct poll_table_struct *wait)
+{
+	struct ps2sd_stream *st = filp->private_data;
+
+	poll_wait(filp, &st->wq, wait);
+	if (st->bufcount <= PS2SD_STREAMFRAMES * 3 / 4)
+		return (POLLOUT | POLLWRNORM);
+
+	return 0;
+}
+
+static int
+stream_sync(struct ps2sd_stream *st)
+{
+	int res;
+
+	/* play the rest even if it is less than a fragment */
+	while (st->bufcount != 0) {
+		if ((res = reset_error(st->devc)) < 0)
+			return res;
+		if ((res = start(st->devc)) < 0)
+			return res;
+		if ((res = stream_wait(st, 0, 1, 0)) < 0)
+			return res;
+		if (st->devc->dmastat == DMASTAT_STOP && st->bufcount != 0) {
+			set_current_state(TASK_INTERRUPTIBLE);
+			schedule_timeout(HZ/100);
+			if (signal_pending(current))
+				return -ERESTARTSYS;
+		}
+	}
+
+	return 0;
+}
+
+static int
+ps2sd_stream_ioctl(struct inode *inode, struct file *filp, unsigned int cmd,
+		   unsigned long arg)
+{
+	struct ps2sd_stream *st = filp->private_data;
+	unsigned long flags;
+	audio_buf_info abinfo;
+	int val, res;
+
+	switch (cmd) {
+	case OSS_GETVERSION:
+		return put_user(SOUND_VERSION, (int *)arg);
+
+	case SNDCTL_DSP_GETCAPS:
+		return put_user(DSP_CAP_BATCH, (int *)arg);
+
+	case SNDCTL_DSP_SYNC:
+	case SNDCTL_DSP_POST:
+		return stream_sync(st);
+
+	case SNDCTL_DSP_RESET:
+		spin_lock_irqsave(&st->devc->spinlock, flags);
+		st->bufcount = 0;
+		st->havelast = 0;
+		spin_unlock_irqrestore(&st->devc->spinlock, flags);
+		return 0;
+
+	case SNDCTL_DSP_SPEED:
+		if (get_user(val, (int *)arg))
+			return (-EFAULT);
+		if (0 <= val) {
+			if ((res = stream_set_format(st, st->format,
+						     val, st->stereo)) < 0)
+				return res;
+		}
+		return put_user(st->speed, (int *)arg);
+
+	case SNDCTL_DSP_STEREO:
+		if (get_user(val, (int *)arg))
+			return (-EFAULT);
+		return stream_set_format(st, st->format, st->speed, val);
+
+	case SNDCTL_DSP_CHANNELS:
+		if (get_user(val, (int *)arg))
+			return (-EFAULT);
+		if (val != 1 && val != 2)
+			return -EINVAL;
+		return stream_set_format(st, st->format, st->speed, val == 2);
+
+	case SNDCTL_DSP_GETFMTS:
+		return put_user(SUPPORTEDFMT, (int *)arg);
+
+	case SNDCTL_DSP_SETFMT:
+		if (get_user(val, (int *)arg))
+			return (-EFAULT);
+		if (val != AFMT_QUERY) {
+			if ((res = stream_set_format(st, val, st->speed,
+						     st->stereo)) < 0)
+				return res;
+		}
+		return put_user(st->format, (int *)arg);
+
+	case SNDCTL_DSP_GETOSPACE:
+		spin_lock_irqsave(&st->devc->spinlock, flags);
+		val = (PS2SD_STREAMFRAMES - st->bufcount) * st->samplesize *
+			st->cnvsrcrate / st->cnvdstrate;
+		abinfo.fragsize = (PS2SD_STREAMFRAMES / 4) * st->samplesize *
+			st->cnvsrcrate / st->cnvdstrate;
+		spin_unlock_irqrestore(&st->devc->spinlock, flags);
+		abinfo.bytes = val;
+		abinfo.fragstotal = 4;
+		abinfo.fragments = val / abinfo.fragsize;
+		return copy_to_user((void *)arg, &abinfo, sizeof(abinfo)) ? -EFAULT : 0;
+
+	case SNDCTL_DSP_GETBLKSIZE:
+		return put_user((PS2SD_STREAMFRAMES / 4) * st->samplesize *
+				st->cnvsrcrate / st->cnvdstrate, (int *)arg);
+
+	case SNDCTL_DSP_GETODELAY:
+		val = st->bufcount * st->samplesize *
+			st->cnvsrcrate / st->cnvdstrate;
+		return put_user(val, (int *)arg);
+
+	case SNDCTL_DSP_NONBLOCK:
+		filp->f_flags |= O_NONBLOCK;
+		return (0);
+	}
+
+	/* volume of this stream */
+	return ps2sdmixer_stream_ioctl(st, cmd, arg);
+}
+
+static int
+ps2sd_stream_release(struct inode *inode, struct file *filp)
+{
+	struct ps2sd_stream *st = filp->private_data;
+	struct ps2sd_unit_context *devc = st->devc;
+	struct ps2sd_stream **stp;
+	unsigned long flags;
+
+	DPRINT(DBG_INFO, "close: core%d stream %p\n", devc->core, st);
+	stream_sync(st);
+
+	spin_lock_irqsave(&devc->spinlock, flags);
+	for (stp = &devc->streams; *stp != NULL; stp = &(*stp)->next)
+		if (*stp == st) {
+			*stp = st->next;
+			break;
+		}
+	spin_unlock_irqrestore(&devc->spinlock, flags);
+
+	spin_lock_irq(&ps2sd_mc.spinlock);
+	devc->nstreams--;
+	spin_unlock_irq(&ps2sd_mc.spinlock);
+
+	kfree(st->buf);
+	kfree(st);
+
+	return 0;
+}
+
+static struct file_operations ps2sd_stream_fops = {
+	owner:		THIS_MODULE,
+	llseek:		ps2sd_llseek,
+	read:		ps2sd_read,
+	write:		ps2sd_stream_write,
+	poll:		ps2sd_stream_poll,
+	ioctl:		ps2sd_stream_ioctl,
+	release:	ps2sd_stream_release,
+};
+
+/*
+ * called with ps2sd_mc.spinlock held, which is released here
+ */
+static int
+ps2sd_stream_open(struct ps2sd_unit_context *devc, struct file *filp)
+{
+	struct ps2sd_stream *st;
+	unsigned char *mixbuf;
+	unsigned long flags;
+
+	if (ps2sd_max_streams <= devc->nstreams ||
+	    (devc->flags & (PS2SD_UNIT_MMAPPED | PS2SD_UNIT_COMMANDMODE |
+			    PS2SD_UNIT_SETUP))) {
+		spin_unlock_irq(&ps2sd_mc.spinlock);
+		return -EBUSY;
+	}
+	devc->nstreams++;
+	spin_unlock_irq(&ps2sd_mc.spinlock);
+
+	st = kmalloc(sizeof(*st), GFP_KERNEL);
+	if (st != NULL) {
+		memset(st, 0, sizeof(*st));
+		st->buf = kmalloc(PS2SD_STREAMFRAMES *
+				  sizeof(struct ps2sd_sample), GFP_KERNEL);
+	}
+	if (devc->mixbuf == NULL) {
+		/* another opener may have installed one while we slept */
+		mixbuf = kmalloc(ps2sd_max_iopbufsize, GFP_KERNEL);
+		spin_lock_irqsave(&devc->spinlock, flags);
+		if (devc->mixbuf == NULL) {
+			devc->mixbuf = mixbuf;
+			mixbuf = NULL;
+		}
+		spin_unlock_irqrestore(&devc->spinlock, flags);
+		if (mixbuf != NULL)
+			kfree(mixbuf);
+	}
+	if (st == NULL || st->buf == NULL || devc->mixbuf == NULL) {
+		if (st != NULL && st->buf != NULL)
+			kfree(st->buf);
+		if (st != NULL)
+			kfree(st);
+		spin_lock_irq(&ps2sd_mc.spinlock);
+		devc->nstreams--;
+		spin_unlock_irq(&ps2sd_mc.spinlock);
+		return -ENOMEM;
+	}
+	st->devc = devc;
+	init_waitqueue_head(&st->wq);
+	ps2sdmixer_stream_setvol(st, 100, 100);
+	stream_set_format(st, AFMT_MU_LAW, 8000, 0 /* monaural */);
+
+	spin_lock_irqsave(&devc->spinlock, flags);
+	st->next = devc->streams;
+	devc->streams = st;
+	spin_unlock_irqrestore(&devc->spinlock, flags);
+
+	filp->private_data = st;
+	filp->f_op = &ps2sd_stream_fops;
+	DPRINT(DBG_INFO, "open: core%d stream %p\n", devc->core, st);
+
+	return 0;
+}
+
 struct ps2sd_unit_context *
 ps2sd_lookup_by_dsp(int dsp)
 {
@@ -1246,6 +1959,26 @@ ps2sd_thread(void *arg)
 static int
 ps2sd_intr(void* argx, int dmach)
 {
+	struct ps2sd_unit_context *devc;
+
+	if ((devc = ps2sd_lookup_by_dmach(dmach)) != NULL) {
+		devc->intrstamp = getcounter();
+		devc->intrstamped = 1;
+	}
+
+	if (!ps2sd_intr_thread) {
+		unsigned long flags;
+
+		/*
+		 * refill the IOP buffer right now, a trip through the
+		 * thread costs a scheduling latency per fragment.
+		 */
+		DPRINT(DBG_INTR, "DMA interrupt %d\n", dmach);
+		local_irq_save(flags);
+		ps2sd_dmaintr(NULL, dmach);
+		local_irq_restore(flags);
+		return (0);
+	}
 
 	spin_lock(&ps2sd_mc.spinlock);
 	ps2sd_mc.intr_status |= (1 << dmach);
@@ -1263,6 +1996,7 @@ ps2sd_dmaintr(void* argx, int dmach)
 	int i;
 	struct ps2sd_unit_context *devc;
 	ps2sif_dmadata_t dmacmd;
+	int stopreq = 0;
 #ifdef PS2SD_DMA_ADDR_CHECK
 	unsigned int dmamode, maddr;
 #endif
@@ -1318,6 +2052,8 @@ ps2sd_dmaintr(void* argx, int dmach)
 		setdmastate(devc, DMASTAT_STOPREQ, DMASTAT_RUNNING,
 			    "stop by request, dmabufcount -> 0");
 		devc->dmabufcount = 0;
+		stopreq = 1;
+		devc->flags &= ~PS2SD_UNIT_TRIGGER;
 #endif
 	}
 
@@ -1345,11 +2081,11 @@ ps2sd_dmaintr(void* argx, int dmach)
 			unsigned long flags;
 
 			spin_lock_irqsave(&devc->spinlock, flags);
-			devc->dmabufhead += devc->bg->size;
+			devc->dmabufhead += devc->bg->dmabytes;
 			devc->dmabufhead %= devc->dmabufsize;
 			DPRINT(DBG_INTR | DBG_VERBOSE, "dmabufcount = %d-%d\n",
-			       devc->dmabufcount, devc->bg->size);
-			devc->dmabufcount -= devc->bg->size;
+			       devc->dmabufcount, devc->bg->dmabytes);
+			devc->dmabufcount -= devc->bg->dmabytes;
 			wake_up(&devc->write_wq);
 			spin_unlock_irqrestore(&devc->spinlock, flags);
 		}
@@ -1384,11 +2120,28 @@ ps2sd_dmaintr(void* argx, int dmach)
 	SWAP(devc->fg, devc->bg);
 #endif
 
+	/* the mmapped ring never runs dry while it is triggered */
+	if (devc->flags & PS2SD_UNIT_TRIGGER)
+		devc->dmabufcount = devc->dmabufsize;
+
+	devc->bg->dmabytes = devc->bg->size;
+	if (devc->streams != NULL && !stopreq &&
+	    devc->dmabufunderflow == 0 && devc->dmabufcount < devc->bg->size &&
+	    stream_pending(devc)) {
+		/*
+		 * the owner has nothing to play but the other streams do.
+		 * leave the owner's data alone and send only the streams.
+		 */
+		devc->bg->dmabytes = 0;
+	} else
 	if ((devc->dmabufunderflow == 0 && devc->dmabufcount < devc->bg->size)
 	    || devc->dmabufunderflow != 0) {
 		unsigned char *head = 0;
 		int n;
 
+		if (devc->dmabufunderflow == 0 && !stopreq &&
+		    !devc->draining)
+			devc->underruns++;
 		if (devc->dmabufunderflow == 0 &&
 		    devc->dmabufcount < 0)
 			devc->dmabufunderflow = 1;
@@ -1454,6 +2207,34 @@ ps2sd_dmaintr(void* argx, int dmach)
 	}
 
 	dmacmd.data = (u_int)&devc->dmabuf[devc->dmabufhead];
+	if ((devc->flags & PS2SD_UNIT_TRIGGER) &&
+	    devc->dmabufunderflow == 0) {
+		unsigned char *head = &devc->dmabuf[devc->dmabufhead];
+		unsigned char *frag = MIXBUF(devc, devc->bg);
+
+		if (!(devc->flags & PS2SD_UNIT_INT512)) {
+			/* the ring belongs to the user, split into mixbuf */
+			for (i = 0; i < devc->bg->size; i += BUFUNIT)
+				ps2sd_deinterleave(&frag[i], &head[i],
+						   BUFUNIT);
+			head = frag;
+			dmacmd.data = (u_int)frag;
+		}
+		ps2sif_writebackdcache(head, devc->bg->size);
+	}
+
+	if (devc->streams != NULL) {
+		unsigned char *frag = MIXBUF(devc, devc->bg);
+
+		if (devc->bg->dmabytes != 0)
+			memcpy(frag, &devc->dmabuf[devc->dmabufhead],
+			       devc->bg->size);
+		else
+			memset(frag, 0, devc->bg->size);
+		stream_mix(devc, frag, devc->bg->size);
+		ps2sif_writebackdcache(frag, devc->bg->size);
+		dmacmd.data = (u_int)frag;
+	}
 	dmacmd.addr = (u_int)devc->bg->iopaddr;
 	dmacmd.size = devc->bg->size;
 	dmacmd.mode = 0;
@@ -1482,6 +2263,15 @@ ps2sd_dmaintr(void* argx, int dmach)
 		goto stopdma;
 	}
 	DPRINTK(DBG_INTR | DBG_VERBOSE, "= %d\n", devc->bg->dmaid);
+
+	if (devc->intrstamped) {
+		int delay = convertusec(getcounter() - devc->intrstamp);
+
+		for (i = 0; i < PS2SD_LATHIST - 1 && (64 << i) <= delay; i++)
+			;
+		devc->lathist[i]++;
+		devc->intrstamped = 0;
+	}
 	
 	return 0;
 
@@ -1521,6 +2311,9 @@ ps2sd_attach_unit(struct ps2sd_unit_context *devc, int core, int dmach,
 	devc->dmabuf = NULL;
 	devc->cnvbuf = NULL;
 	devc->intbuf = NULL;
+	devc->mixbuf = NULL;
+	devc->streams = NULL;
+	devc->nstreams = 0;
 	devc->iopbuf = 0;
 	init_waitqueue_head(&devc->write_wq);
 	init_waitqueue_head(&devc->dmastat_wq);
@@ -1741,6 +2534,7 @@ static int
 alloc_buffer(struct ps2sd_unit_context *devc)
 {
 	int res;
+	struct page *p;
 
 	if ((res = free_buffer(devc)) < 0) return res;
 
@@ -1765,11 +2559,16 @@ alloc_buffer(struct ps2sd_unit_context *devc)
 	/*
 	 * allocate buffer on main memory
 	 */
-	devc->dmabuf = kmalloc(ps2sd_max_dmabufsize, GFP_KERNEL);
+	/* whole pages, so that the buffer can be mapped into user space */
+	devc->dmabuf = (unsigned char *)__get_free_pages(GFP_KERNEL,
+					get_order(ps2sd_max_dmabufsize));
 	if (devc->dmabuf == NULL) {
 		printk(KERN_ERR "ps2sd: can't alloc DMA buffer\n");
 		return -ENOMEM;
 	}
+	for (p = virt_to_page(devc->dmabuf);
+	     p <= virt_to_page(devc->dmabuf + ps2sd_max_dmabufsize - 1); p++)
+		mem_map_reserve(p);
 	DPRINT(DBG_INFO, "core%d: allocate %d bytes, 0x%p for DMA\n",
 	       devc->core, ps2sd_max_dmabufsize, devc->dmabuf);
 
@@ -1792,100 +2591,6 @@ alloc_buffer(struct ps2sd_unit_context *devc)
 	return reset_buffer(devc);
 }
 
-static void fetch_s8(struct ps2sd_sample *s, unsigned char *addr)
-{
-	char *p = (char *)addr;
-	s->r = (int)*p++ * 256;
-	s->l = (int)*p++ * 256;
-}
-
-static void fetch_s8_m(struct ps2sd_sample *s, unsigned char *addr)
-{
-	char *p = (char *)addr;
-	s->r = (int)*p * 256;
-	s->l = (int)*p * 256;
-}
-
-static void fetch_u8(struct ps2sd_sample *s, unsigned char *addr)
-{
-	char *p = (u_char *)addr;
-	s->r = ((u_int)*p++ * 256) - 0x8000;
-	s->l = ((u_int)*p++ * 256) - 0x8000;
-}
-
-static void fetch_u8_m(struct ps2sd_sample *s, unsigned char *addr)
-{
-	char *p = (u_char *)addr;
-	s->r = ((u_int)*p * 256) - 0x8000;
-	s->l = ((u_int)*p * 256) - 0x8000;
-}
-
-static void fetch_s16le(struct ps2sd_sample *s, unsigned char *addr)
-{
-	*s = *(struct ps2sd_sample *)addr;
-}
-
-static void fetch_s16le_m(struct ps2sd_sample *s, unsigned char *addr)
-{
-	short *p = (short*)addr;
-	s->r = s->l = *p;
-}
-
-static void fetch_s16be(struct ps2sd_sample *s, unsigned char *addr)
-{
-	struct ps2sd_sample *p = (struct ps2sd_sample *)addr;
-	s->r = ___swab16(p->r);
-	s->l = ___swab16(p->l);
-}
-
-static void fetch_s16be_m(struct ps2sd_sample *s, unsigned char *addr)
-{
-	short *p = (short*)addr;
-	s->r = s->l = ___swab16(*p);
-}
-
-static void fetch_u16le(struct ps2sd_sample *s, unsigned char *addr)
-{
-	struct ps2sd_sample *p = (struct ps2sd_sample *)addr;
-	s->r = p->r - 0x8000;
-	s->l = p->l - 0x8000;
-}
-
-static void fetch_u16le_m(struct ps2sd_sample *s, unsigned char *addr)
-{
-	short *p = (short*)addr;
-	s->r = s->l = *p - 0x8000;
-}
-
-static void fetch_u16be(struct ps2sd_sample *s, unsigned char *addr)
-{
-	struct ps2sd_sample *p = (struct ps2sd_sample *)addr;
-	s->r = ___swab16(p->r) - 0x8000;
-	s->l = ___swab16(p->l) - 0x8000;
-}
-
-static void fetch_u16be_m(struct ps2sd_sample *s, unsigned char *addr)
-{
-	short *p = (short*)addr;
-	s->r = s->l = ___swab16(*p) - 0x8000;
-}
-
-static void fetch_mulaw(struct ps2sd_sample *s, unsigned char *addr)
-{
-	extern short ps2sd_mulaw2liner16[];
-	unsigned char *p = (unsigned char *)addr;
-	s->r = ps2sd_mulaw2liner16[(int)*p++];
-	s->l = ps2sd_mulaw2liner16[(int)*p++ * 256];
-}
-
-static void fetch_mulaw_m(struct ps2sd_sample *s, unsigned char *addr)
-{
-	extern short ps2sd_mulaw2liner16[];
-	unsigned char *p = (unsigned char *)addr;
-	s->r = ps2sd_mulaw2liner16[(int)*p];
-	s->l = ps2sd_mulaw2liner16[(int)*p];
-}
-
 static int
 set_format(struct ps2sd_unit_context *devc, int format, int speed, int stereo, int force)
 {
@@ -1931,37 +2636,30 @@ set_format(struct ps2sd_unit_context *devc, int format, int speed, int stereo, i
 		switch (format) {
 		case AFMT_S8:
 			devc->samplesize = stereo ? 2 : 1;
-			devc->fetch = stereo ? fetch_s8 : fetch_s8_m;
 			formatname = "8bit signed";
 			break;
 		case AFMT_U8:
 			devc->samplesize = stereo ? 2 : 1;
-			devc->fetch = stereo ? fetch_u8 : fetch_u8_m;
 			formatname = "8bit unsigned";
 			break;
 		case AFMT_S16_LE:
 			devc->samplesize = stereo ? 4 : 2;
-			devc->fetch = stereo ? fetch_s16le : fetch_s16le_m;
 			formatname = "16bit signed little endian";
 			break;
 		case AFMT_S16_BE:
 			devc->samplesize = stereo ? 4 : 2;
-			devc->fetch = stereo ? fetch_s16be : fetch_s16be_m;
 			formatname = "16bit signed big endian";
 			break;
 		case AFMT_U16_LE:
 			devc->samplesize = stereo ? 4 : 2;
-			devc->fetch = stereo ? fetch_u16le : fetch_u16le_m;
 			formatname = "16bit unsigned little endian";
 			break;
 		case AFMT_U16_BE:
 			devc->samplesize = stereo ? 4 : 2;
-			devc->fetch = stereo ? fetch_u16be : fetch_u16be_m;
 			formatname = "16bit unsigned big endian";
 			break;
 		case AFMT_MU_LAW:
 			devc->samplesize = stereo ? 2 : 1;
-			devc->fetch = stereo ? fetch_mulaw : fetch_mulaw_m;
 			formatname = "logarithmic mu-Law";
 			break;
 		case AFMT_A_LAW:
@@ -1970,6 +2668,8 @@ set_format(struct ps2sd_unit_context *devc, int format, int speed, int stereo, i
 			devc->samplesize = 1; /* XXX */
 			return -EINVAL;
 		}
+		if ((devc->convert = ps2sd_get_converter(format, stereo)) == NULL)
+			return -EINVAL;
 	}
 
 	/*
@@ -2024,6 +2724,7 @@ reset_buffer(struct ps2sd_unit_context *devc)
 		devc->iopbufs[i].iopaddr =
 			devc->iopbuf + devc->iopbufs[i].size * i;
 		devc->iopbufs[i].dmaid = 0;
+		devc->iopbufs[i].dmabytes = 0;
 	}
 	devc->fg = &devc->iopbufs[0];
 	devc->bg = &devc->iopbufs[1];
@@ -2035,6 +2736,7 @@ reset_buffer(struct ps2sd_unit_context *devc)
 	devc->dmabufhead = 0;
 	devc->dmabuftail = 0;
 	devc->dmabufunderflow = 0;
+	devc->draining = 0;
 	devc->cnvbufcount = 0;
 	devc->cnvbufhead = 0;
 	devc->cnvbuftail = 0;
@@ -2061,7 +2763,14 @@ free_buffer(struct ps2sd_unit_context *devc)
 	}
 	ps2sif_unlock(ps2sd_mc.lock);
 	if (devc->dmabuf != NULL) {
-		kfree(devc->dmabuf);
+		struct page *p;
+
+		for (p = virt_to_page(devc->dmabuf);
+		     p <= virt_to_page(devc->dmabuf + ps2sd_max_dmabufsize - 1);
+		     p++)
+			mem_map_unreserve(p);
+		free_pages((unsigned long)devc->dmabuf,
+			   get_order(ps2sd_max_dmabufsize));
 		DPRINT(DBG_INFO, "core%d: free %d bytes, 0x%p for DMA\n",
 		       devc->core,  devc->dmabufsize, devc->dmabuf);
 		devc->dmabuf = NULL;
@@ -2073,6 +2782,10 @@ free_buffer(struct ps2sd_unit_context *devc)
 		       devc->core,  CNVBUFSIZE, devc->cnvbuf);
 		devc->cnvbuf = NULL;
 	}
+	if (devc->mixbuf != NULL) {
+		kfree(devc->mixbuf);
+		devc->mixbuf = NULL;
+	}
 	if (devc->intbuf != NULL) {
 		kfree(devc->intbuf);
 		DPRINT(DBG_INFO, "core%d: free %d bytes, 0x%p for conversion\n",
@@ -2144,7 +2857,7 @@ ps2sd_unmute(struct ps2sd_unit_context *devc)
 static int
 start(struct ps2sd_unit_context *devc)
 {
-	int res, resiop, dmamode;
+	int res, resiop, dmamode, total;
 	unsigned long flags;
 
 	if (devc->dmastat != DMASTAT_STOP /* just avoid verbose messages */
@@ -2160,7 +2873,7 @@ start(struct ps2sd_unit_context *devc)
 		return (res);
 	}
 
-	if (devc->dmabufcount < devc->iopbufsize/2) {
+	if (devc->dmabufcount < devc->iopbufsize/2 && !stream_pending(devc)) {
 		setdmastate(devc, DMASTAT_START, DMASTAT_STOP,
 			    "no enought data");
 		CHECKPOINT("start unlock 1");
@@ -2192,14 +2905,16 @@ start(struct ps2sd_unit_context *devc)
 	    ps2sif_writebackdcache(&devc->dmabuf[devc->dmabufhead], BUFUNIT);
 	}
 #endif
+	total = devc->total_output_bytes; /* nothing is played yet */
 	devc->bg->dmaid = 0;
 	ps2sd_dmaintr(NULL, devc->dmach);
 	devc->bg->dmaid = 0;
-	devc->dmabufhead += devc->bg->size;
+	devc->dmabufhead += devc->bg->dmabytes;
 	devc->dmabufhead %= devc->dmabufsize;
-	devc->dmabufcount -= devc->bg->size;
+	devc->dmabufcount -= devc->bg->dmabytes;
 	ps2sd_dmaintr(NULL, devc->dmach);
 	devc->prevdmaintrvalid = 0;
+	devc->total_output_bytes = total;
 	spin_unlock_irqrestore(&devc->spinlock, flags);
 
 	/*
@@ -2443,6 +3158,55 @@ reset_error(struct ps2sd_unit_context *devc)
 	return (0);
 }
 
+#ifdef CONFIG_PROC_FS
+static int
+ps2sd_read_proc(char *page, char **start, off_t off, int count, int *eof,
+		void *data)
+{
+	char *p = page;
+	int i, j, len;
+	struct ps2sd_unit_context *devc;
+
+#ifdef PS2SD_USE_THREAD
+	p += sprintf(p, "refill: %s\n",
+		     ps2sd_intr_thread ? "thread" : "callback");
+#else
+	p += sprintf(p, "refill: callback\n");
+#endif
+	for (i = 0; i < ps2sd_nunits; i++) {
+		devc = &ps2sd_units[i];
+		if (devc->flags & PS2SD_UNIT_NOPCM)
+			continue;
+		/* 192 bytes per millisecond at 48KHz stereo */
+		p += sprintf(p, "unit%d: core%d %s %s fragment=%d x %d "
+			     "latency=%dus\n",
+			     i, devc->core,
+			     (devc->flags & PS2SD_UNIT_OPENED) ? "open" : "close",
+			     dmastatnames[devc->dmastat],
+			     devc->iopbufsize/2, devc->dmabufsize/(devc->iopbufsize/2),
+			     (devc->dmabufsize + devc->iopbufsize) * 1000 / 192);
+		p += sprintf(p, "  streams=%d underruns=%u phaseerr=%d\n",
+			     devc->nstreams, devc->underruns, devc->phaseerr);
+		p += sprintf(p, "  refill delay:");
+		for (j = 0; j < PS2SD_LATHIST - 1; j++)
+			p += sprintf(p, " <%dus=%u", 64 << j, devc->lathist[j]);
+		p += sprintf(p, " more=%u\n", devc->lathist[j]);
+	}
+
+	len = p - page;
+	if (len <= off + count)
+		*eof = 1;
+	*start = page + off;
+	len -= off;
+	if (len > count)
+		len = count;
+	if (len < 0)
+		len = 0;
+
+	return (len);
+}
+#endif /* CONFIG_PROC_FS */
+
 #ifdef CONFIG_T10000_DEBUG_HOOK
 static void
 ps2sd_debug_proc(int c)
@@ -2568,6 +3332,10 @@ ps2sd_init(void)
 	if (ps2sd_max_iopbufsize < ps2sd_iopbufsize)
 		ps2sd_iopbufsize = ps2sd_max_iopbufsize;
 	ps2sd_dmabufsize = ALIGN(ps2sd_dmabufsize, ps2sd_iopbufsize);
+	if (ps2sd_max_streams < 0)
+		ps2sd_max_streams = 0;
+	if (PS2SD_MAX_STREAMS < ps2sd_max_streams)
+		ps2sd_max_streams = PS2SD_MAX_STREAMS;
 
 	DPRINT(DBG_INFO, "iopbufsize %3dKB (max %3dKB)\n",
 	       ps2sd_iopbufsize / 1024, ps2sd_max_iopbufsize / 1024);
@@ -2684,6 +3452,11 @@ ps2sd_init(void)
 	       ps2sd_mixers[0].mixer);
 	ps2sd_mc.init |= PS2SD_INIT_REGMIXERDEV;
 
+#ifdef CONFIG_PROC_FS
+	if (create_proc_read_entry("ps2sd", 0, NULL, ps2sd_read_proc, NULL))
+		ps2sd_mc.init |= PS2SD_INIT_PROC;
+#endif
+
 #ifdef CONFIG_T10000_DEBUG_HOOK
 	if (ps2sd_debug_hook) {
 		extern void (*ps2_debug_hook[0x80])(int c);
@@ -2740,6 +3513,12 @@ ps2sd_cleanup(void)
 		unregister_sound_mixer(ps2sd_mixers[0].mixer);
 	ps2sd_mc.init &= ~PS2SD_INIT_REGMIXERDEV;
 
+#ifdef CONFIG_PROC_FS
+	if (ps2sd_mc.init & PS2SD_INIT_PROC)
+		remove_proc_entry("ps2sd", NULL);
+	ps2sd_mc.init &= ~PS2SD_INIT_PROC;
+#endif
+
 	if (ps2sd_mc.init & PS2SD_INIT_IOP)
 		ps2sdcall_end(&resiop);
 	ps2sd_mc.init &= ~PS2SD_INIT_IOP;
@@ -72,6 +72,8 @@
 
 #define PS2SD_DEVC(filp)	((struct ps2sd_unit_context *)(filp)->private_data)
 
+#define PS2SD_LATHIST	8	/* below 64us, 128us, ... 4ms and above */
+
 /*
  * types
  */
@@ -119,12 +121,49 @@ struct ps2sd_iopbuf {
 	int size;
 	long iopaddr;
 	unsigned int dmaid;
+	int dmabytes;		/* bytes taken from the DMA buffer */
 };
 
 struct ps2sd_sample {
 	short l, r;
 };
 
+typedef void (*ps2sd_cnv_t)(struct ps2sd_sample *, unsigned char *, int);
+
+/*
+ * an additional opener of a unit, mixed into the DMA stream of the unit
+ */
+#define PS2SD_STREAMFRAMES	4096	/* 16KB, about 85ms */
+#define PS2SD_MAX_STREAMS	16	/* upper limit of ps2sd_max_streams */
+
+struct ps2sd_unit_context;
+struct ps2sd_stream {
+	struct ps2sd_stream *next;
+	struct ps2sd_unit_context *devc;
+	wait_queue_head_t wq;
+
+	/* format */
+	int format;
+	int speed;
+	int stereo;
+	int samplesize;
+	ps2sd_cnv_t convert;
+	long cnvd;
+	long cnvsrcrate;
+	long cnvdstrate;
+	struct ps2sd_sample last;	/* previous source sample */
+	int havelast;
+
+	/* samples in SPU2 native format waiting to be mixed */
+	struct ps2sd_sample *buf;
+	volatile int bufhead;
+	volatile int bufcount;		/* in samples */
+
+	/* volume */
+	int vol;
+	int gainl, gainr;		/* 0x8000 is unity */
+};
+
 struct ps2iopmem_list;
 
 struct ps2sd_unit_context {
@@ -136,7 +175,10 @@ struct ps2sd_unit_context {
 #define PS2SD_UNIT_INT512	(1<<1)
 #define PS2SD_UNIT_EXCLUSIVE	(1<<2)
 #define PS2SD_UNIT_COMMANDMODE	(1<<3)
+#define PS2SD_UNIT_SETUP	(1<<4)	/* owner open in progress */
 #define PS2SD_UNIT_NOPCM	(1<<5)
+#define PS2SD_UNIT_MMAPPED	(1<<6)
+#define PS2SD_UNIT_TRIGGER	(1<<7)
 
 	int core;
 	int dmach;
@@ -145,6 +187,7 @@ struct ps2sd_unit_context {
 	spinlock_t spinlock;
 	volatile int dmastat;
 	int total_output_bytes;
+	int optr_frags;		/* fragments reported by last GETOPTR */
 	ps2sif_lock_queue_t lockq;
         struct timer_list timer;
 	int intr_count;
@@ -170,6 +213,11 @@ struct ps2sd_unit_context {
 	int dmabufunderflow;
 	unsigned char *dmabuf;
 	int phaseerr;
+	int intrstamp;		/* counter value at the DMA callback */
+	int intrstamped;
+	unsigned int underruns;
+	int draining;		/* the writer has posted its last data */
+	unsigned int lathist[PS2SD_LATHIST];	/* callback -> refill delay */
 	int prevdmaintr; 
 	int prevdmaintrvalid; 
 
@@ -182,7 +230,7 @@ struct ps2sd_unit_context {
 
 	/* format conversion stuff */
 	int samplesize;
-	void (*fetch)(struct ps2sd_sample *, unsigned char *);
+	ps2sd_cnv_t convert;
 	int noconversion;
 
 	int cnvbufcount;
@@ -196,6 +244,11 @@ struct ps2sd_unit_context {
 	unsigned char *intbuf;
 
 	struct ps2iopmem_list *iopmemlist;
+
+	/* software mixing stuff */
+	struct ps2sd_stream *streams;
+	int nstreams;
+	unsigned char *mixbuf;	/* fragments being composed, one per IOP half */
 };
 
 /*
@@ -205,9 +258,17 @@ struct ps2sd_unit_context *ps2sd_lookup_by_dsp(int dsp);
 struct ps2sd_unit_context *ps2sd_lookup_by_dmach(int dmach);
 struct ps2sd_mixer_context *ps2sd_lookup_mixer(int mixer);
 
+ps2sd_cnv_t ps2sd_get_converter(int format, int stereo);
+void ps2sd_deinterleave(unsigned char *dst, unsigned char *src, int n);
+void ps2sd_mix(short *dstl, short *dstr, struct ps2sd_sample *src, int n,
+	       int gainl, int gainr);
+
 int ps2sdmixer_setvol(struct ps2sd_mixer_channel *ch, int volr, int voll);
 int ps2sdmixer_do_ioctl(struct ps2sd_mixer_context *, unsigned int,
 			unsigned long);
+void ps2sdmixer_stream_setvol(struct ps2sd_stream *, int volr, int voll);
+int ps2sdmixer_stream_ioctl(struct ps2sd_stream *, unsigned int,
+			    unsigned long);
 
 /*
  * variables
@@ -217,5 +278,6 @@ extern struct ps2sd_module_context ps2sd_mc;
 extern struct ps2sd_unit_context ps2sd_units[];
 extern int ps2sd_nunits;
 extern struct file_operations ps2sd_mixer_fops;
+extern short ps2sd_mulaw2liner16[];
 
 #endif /* PS2SD_H */
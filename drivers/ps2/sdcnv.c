@@ -10,6 +10,16 @@
  * $Id: sdcnv.c,v 1.1.2.2 2002/04/16 09:49:55 takemura Exp $
  */
 
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/soundcard.h>
+#include <linux/autoconf.h>
+#include <asm/byteorder.h>
+#include <asm/ps2/siflock.h>
+
+#include "sd.h"
+
 short ps2sd_mulaw2liner16[] = {
 -32124,-31100,-30076,-29052,-28028,-27004,-25980,-24956,
 -23932,-22908,-21884,-20860,-19836,-18812,-17788,-16764,
@@ -44,3 +54,372 @@ short ps2sd_mulaw2liner16[] = {
    120,   112,   104,    96,    88,    80,    72,    64,
     56,    48,    40,    32,    24,    16,     8,     0,
 };
+
+/*
+ * block converters
+ *
+ * Each converter turns `n' frames of one format into 16bit signed
+ * little endian stereo, the first sample of a frame being the left one.
+ * 16bit stereo formats are converted a frame (one word) at a time and,
+ * when the source and the destination are equally aligned, 4 frames at a
+ * time with the 128bit multimedia instructions of the R5900.  MMI may be
+ * used only if the kernel saves the full 128bit registers on exceptions,
+ * i.e. with CONFIG_CPU_R5900_CONTEXT.
+ */
+#define CNV_SWAB	(1 << 0)	/* swap bytes of each sample */
+#define CNV_FLIP	(1 << 1)	/* unsigned <-> signed */
+
+#define SWAB16X2(x)	((((x) & 0x00ff00ff) << 8) | (((x) >> 8) & 0x00ff00ff))
+
+#ifdef CONFIG_CPU_R5900_CONTEXT
+static u_int32_t cnv_flipmask[4] __attribute__((aligned(16))) = {
+	0x80008000, 0x80008000, 0x80008000, 0x80008000
+};
+
+static void
+cnv16_mmi(u_int32_t *dst, u_int32_t *src, int nquads, int op)
+{
+	unsigned long t0, t1, mask;
+
+	switch (op) {
+	case CNV_SWAB:
+		__asm__ __volatile__(
+			".set\tpush\n\t"
+			".set\tnoreorder\n\t"
+			"1:\tlq\t%3,0(%1)\n\t"
+			"psllh\t%4,%3,8\n\t"
+			"psrlh\t%3,%3,8\n\t"
+			"por\t%3,%3,%4\n\t"
+			"sq\t%3,0(%0)\n\t"
+			"addiu\t%1,%1,16\n\t"
+			"addiu\t%2,%2,-1\n\t"
+			"bnez\t%2,1b\n\t"
+			"addiu\t%0,%0,16\n\t"
+			".set\tpop"
+			: "=r" (dst), "=r" (src), "=r" (nquads),
+			  "=&r" (t0), "=&r" (t1)
+			: "0" (dst), "1" (src), "2" (nquads)
+			: "memory");
+		break;
+	case CNV_FLIP:
+		__asm__ __volatile__(
+			".set\tpush\n\t"
+			".set\tnoreorder\n\t"
+			"lq\t%4,0(%5)\n"
+			"1:\tlq\t%3,0(%1)\n\t"
+			"pxor\t%3,%3,%4\n\t"
+			"sq\t%3,0(%0)\n\t"
+			"addiu\t%1,%1,16\n\t"
+			"addiu\t%2,%2,-1\n\t"
+			"bnez\t%2,1b\n\t"
+			"addiu\t%0,%0,16\n\t"
+			".set\tpop"
+			: "=r" (dst), "=r" (src), "=r" (nquads),
+			  "=&r" (t0), "=&r" (mask)
+			: "r" (cnv_flipmask),
+			  "0" (dst), "1" (src), "2" (nquads)
+			: "memory");
+		break;
+	case CNV_SWAB|CNV_FLIP:
+		__asm__ __volatile__(
+			".set\tpush\n\t"
+			".set\tnoreorder\n\t"
+			"lq\t%5,0(%6)\n"
+			"1:\tlq\t%3,0(%1)\n\t"
+			"psllh\t%4,%3,8\n\t"
+			"psrlh\t%3,%3,8\n\t"
+			"por\t%3,%3,%4\n\t"
+			"pxor\t%3,%3,%5\n\t"
+			"sq\t%3,0(%0)\n\t"
+			"addiu\t%1,%1,16\n\t"
+			"addiu\t%2,%2,-1\n\t"
+			"bnez\t%2,1b\n\t"
+			"addiu\t%0,%0,16\n\t"
+			".set\tpop"
+			: "=r" (dst), "=r" (src), "=r" (nquads),
+			  "=&r" (t0), "=&r" (t1), "=&r" (mask)
+			: "r" (cnv_flipmask),
+			  "0" (dst), "1" (src), "2" (nquads)
+			: "memory");
+		break;
+	}
+}
+#endif
+
+static void
+cnv16(struct ps2sd_sample *d, unsigned char *s, int n, int op)
+{
+	u_int32_t *dp = (u_int32_t *)d;
+	u_int32_t *sp = (u_int32_t *)s;
+	u_int32_t x;
+
+#ifdef CONFIG_CPU_R5900_CONTEXT
+	if ((((unsigned long)dp ^ (unsigned long)sp) & 15) == 0) {
+		for ( ; 0 < n && ((unsigned long)sp & 15); n--) {
+			x = *sp++;
+			if (op & CNV_SWAB)
+				x = SWAB16X2(x);
+			if (op & CNV_FLIP)
+				x ^= 0x80008000;
+			*dp++ = x;
+		}
+		if (4 <= n) {
+			cnv16_mmi(dp, sp, n / 4, op);
+			dp += n & ~3;
+			sp += n & ~3;
+			n &= 3;
+		}
+	}
+#endif
+	while (0 < n--) {
+		x = *sp++;
+		if (op & CNV_SWAB)
+			x = SWAB16X2(x);
+		if (op & CNV_FLIP)
+			x ^= 0x80008000;
+		*dp++ = x;
+	}
+}
+
+/*
+ * In every stereo format the first sample of a frame is the left one,
+ * as in the 16bit formats, which are copied as struct ps2sd_sample.
+ */
+static void
+cnv_s8(struct ps2sd_sample *d, unsigned char *s, int n)
+{
+	signed char *p = (signed char *)s;
+
+	for ( ; 0 < n; n--, d++, p += 2) {
+		d->l = p[0] << 8;
+		d->r = p[1] << 8;
+	}
+}
+
+static void
+cnv_s8_m(struct ps2sd_sample *d, unsigned char *s, int n)
+{
+	signed char *p = (signed char *)s;
+
+	for ( ; 0 < n; n--, d++, p++)
+		d->l = d->r = p[0] << 8;
+}
+
+static void
+cnv_u8(struct ps2sd_sample *d, unsigned char *s, int n)
+{
+	for ( ; 0 < n; n--, d++, s += 2) {
+		d->l = (s[0] - 0x80) << 8;
+		d->r = (s[1] - 0x80) << 8;
+	}
+}
+
+static void
+cnv_u8_m(struct ps2sd_sample *d, unsigned char *s, int n)
+{
+	for ( ; 0 < n; n--, d++, s++)
+		d->l = d->r = (s[0] - 0x80) << 8;
+}
+
+static void
+cnv_s16le(struct ps2sd_sample *d, unsigned char *s, int n)
+{
+	memcpy(d, s, n * sizeof(struct ps2sd_sample));
+}
+
+static void
+cnv_s16le_m(struct ps2sd_sample *d, unsigned char *s, int n)
+{
+	short *p = (short *)s;
+
+	for ( ; 0 < n; n--, d++)
+		d->l = d->r = *p++;
+}
+
+static void
+cnv_s16be(struct ps2sd_sample *d, unsigned char *s, int n)
+{
+	cnv16(d, s, n, CNV_SWAB);
+}
+
+static void
+cnv_s16be_m(struct ps2sd_sample *d, unsigned char *s, int n)
+{
+	unsigned short *p = (unsigned short *)s;
+
+	for ( ; 0 < n; n--, d++)
+		d->l = d->r = ___swab16(*p++);
+}
+
+static void
+cnv_u16le(struct ps2sd_sample *d, unsigned char *s, int n)
+{
+	cnv16(d, s, n, CNV_FLIP);
+}
+
+static void
+cnv_u16le_m(struct ps2sd_sample *d, unsigned char *s, int n)
+{
+	unsigned short *p = (unsigned short *)s;
+
+	for ( ; 0 < n; n--, d++)
+		d->l = d->r = *p++ ^ 0x8000;
+}
+
+static void
+cnv_u16be(struct ps2sd_sample *d, unsigned char *s, int n)
+{
+	cnv16(d, s, n, CNV_SWAB|CNV_FLIP);
+}
+
+static void
+cnv_u16be_m(struct ps2sd_sample *d, unsigned char *s, int n)
+{
+	unsigned short *p = (unsigned short *)s;
+
+	for ( ; 0 < n; n--, d++)
+		d->l = d->r = ___swab16(*p++) ^ 0x8000;
+}
+
+static void
+cnv_mulaw(struct ps2sd_sample *d, unsigned char *s, int n)
+{
+	for ( ; 0 < n; n--, d++, s += 2) {
+		d->l = ps2sd_mulaw2liner16[s[0]];
+		d->r = ps2sd_mulaw2liner16[s[1]];
+	}
+}
+
+static void
+cnv_mulaw_m(struct ps2sd_sample *d, unsigned char *s, int n)
+{
+	for ( ; 0 < n; n--, d++, s++)
+		d->l = d->r = ps2sd_mulaw2liner16[s[0]];
+}
+
+static struct {
+	int format;
+	ps2sd_cnv_t stereo, mono;
+} cnv_table[] = {
+	{ AFMT_S8,	cnv_s8,		cnv_s8_m },
+	{ AFMT_U8,	cnv_u8,		cnv_u8_m },
+	{ AFMT_S16_LE,	cnv_s16le,	cnv_s16le_m },
+	{ AFMT_S16_BE,	cnv_s16be,	cnv_s16be_m },
+	{ AFMT_U16_LE,	cnv_u16le,	cnv_u16le_m },
+	{ AFMT_U16_BE,	cnv_u16be,	cnv_u16be_m },
+	{ AFMT_MU_LAW,	cnv_mulaw,	cnv_mulaw_m },
+};
+
+ps2sd_cnv_t
+ps2sd_get_converter(int format, int stereo)
+{
+	int i;
+
+	for (i = 0; i < sizeof(cnv_table)/sizeof(*cnv_table); i++)
+		if (cnv_table[i].format == format)
+			return (stereo ? cnv_table[i].stereo : cnv_table[i].mono);
+
+	return (NULL);
+}
+
+/*
+ * split `n' bytes of L/R interleaved samples into a block of left
+ * samples followed by a block of right samples, n/2 bytes each
+ */
+void
+ps2sd_deinterleave(unsigned char *dst, unsigned char *src, int n)
+{
+	unsigned short *s = (unsigned short *)src;
+	unsigned short *d = (unsigned short *)dst;
+	int i, half = n / sizeof(u_short) / 2;
+
+#ifdef CONFIG_CPU_R5900_CONTEXT
+	if (0 < n && (((unsigned long)src | (unsigned long)dst | n) & 31) == 0) {
+		unsigned long a, b, l, r;
+		unsigned char *end = dst + n / 2;
+
+		/* 8 frames per loop */
+		__asm__ __volatile__(
+			".set\tpush\n\t"
+			".set\tnoreorder\n"
+			"1:\tlq\t%2,0(%1)\n\t"
+			"lq\t%3,16(%1)\n\t"
+			"ppach\t%4,%3,%2\n\t"
+			"psrlw\t%2,%2,16\n\t"
+			"psrlw\t%3,%3,16\n\t"
+			"ppach\t%5,%3,%2\n\t"
+			"sq\t%4,0(%0)\n\t"
+			"addu\t%2,%0,%7\n\t"
+			"sq\t%5,0(%2)\n\t"
+			"addiu\t%0,%0,16\n\t"
+			"bne\t%0,%6,1b\n\t"
+			"addiu\t%1,%1,32\n\t"
+			".set\tpop"
+			: "=r" (dst), "=r" (src),
+			  "=&r" (a), "=&r" (b), "=&r" (l), "=&r" (r)
+			: "r" (end), "r" (n / 2),
+			  "0" (dst), "1" (src)
+			: "memory");
+		return;
+	}
+#endif
+	for (i = 0; i < half; i++) {
+		d[0] = *s++;
+		d[half] = *s++;
+		d++;
+	}
+}
+
+/*
+ * add `n' samples to separated left and right blocks with saturation,
+ * scaling them by gainl and gainr (0x8000 is unity)
+ */
+void
+ps2sd_mix(short *dstl, short *dstr, struct ps2sd_sample *src, int n,
+	  int gainl, int gainr)
+{
+	int l, r;
+
+#ifdef CONFIG_CPU_R5900_CONTEXT
+	if (gainl == 0x8000 && gainr == 0x8000 && 8 <= n &&
+	    (((unsigned long)dstl | (unsigned long)dstr |
+	      (unsigned long)src) & 15) == 0) {
+		unsigned long a, b, x, y;
+		int nloops = n / 8;
+
+		/* 8 samples per loop, paddsh saturates for us */
+		__asm__ __volatile__(
+			".set\tpush\n\t"
+			".set\tnoreorder\n"
+			"1:\tlq\t%4,0(%2)\n\t"
+			"lq\t%5,16(%2)\n\t"
+			"ppach\t%6,%5,%4\n\t"
+			"psrlw\t%4,%4,16\n\t"
+			"psrlw\t%5,%5,16\n\t"
+			"ppach\t%7,%5,%4\n\t"
+			"lq\t%4,0(%0)\n\t"
+			"lq\t%5,0(%1)\n\t"
+			"paddsh\t%4,%4,%6\n\t"
+			"paddsh\t%5,%5,%7\n\t"
+			"sq\t%4,0(%0)\n\t"
+			"sq\t%5,0(%1)\n\t"
+			"addiu\t%0,%0,16\n\t"
+			"addiu\t%1,%1,16\n\t"
+			"addiu\t%3,%3,-1\n\t"
+			"bnez\t%3,1b\n\t"
+			"addiu\t%2,%2,32\n\t"
+			".set\tpop"
+			: "=r" (dstl), "=r" (dstr), "=r" (src), "=r" (nloops),
+			  "=&r" (a), "=&r" (b), "=&r" (x), "=&r" (y)
+			: "0" (dstl), "1" (dstr), "2" (src), "3" (nloops)
+			: "memory");
+		n &= 7;
+	}
+#endif
+	for ( ; 0 < n; n--, src++) {
+		l = *dstl + ((src->l * gainl) >> 15);
+		r = *dstr + ((src->r * gainr) >> 15);
+		*dstl++ = l < -32768 ? -32768 : (32767 < l ? 32767 : l);
+		*dstr++ = r < -32768 ? -32768 : (32767 < r ? 32767 : r);
+	}
+}
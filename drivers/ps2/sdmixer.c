@@ -236,3 +236,41 @@ ps2sdmixer_setvol(struct ps2sd_mixer_channel *ch, int volr, int voll)
 
 	return res;
 }
+
+/*
+ * volume of an additional /dev/dsp opener, applied by the software mixer
+ */
+void
+ps2sdmixer_stream_setvol(struct ps2sd_stream *st, int volr, int voll)
+{
+	if (volr < 0) volr = 0;
+	if (100 < volr) volr = 100;
+	if (voll < 0) voll = 0;
+	if (100 < voll) voll = 100;
+
+	st->vol = (volr << 8) | voll;
+	st->gainr = volr * 0x8000 / 100;
+	st->gainl = voll * 0x8000 / 100;
+	DPRINT(DBG_MIXER, "stream %p R=%04x/L=%04x\n",
+	       st, st->gainr, st->gainl);
+}
+
+int
+ps2sdmixer_stream_ioctl(struct ps2sd_stream *st,
+			unsigned int cmd, unsigned long arg)
+{
+	int val;
+
+	switch (cmd) {
+	case SOUND_MIXER_READ_PCM:
+		return put_user(st->vol, (int *)arg);
+
+	case SOUND_MIXER_WRITE_PCM:
+		if (get_user(val, (int *)arg))
+			return (-EFAULT);
+		ps2sdmixer_stream_setvol(st, (val >> 8) & 0xff, val & 0xff);
+		return put_user(st->vol, (int *)arg);
+	}
+
+	return -EINVAL;
+}
@@ -0,0 +1,234 @@
+/*
+ *  PlayStation 2 Sound driver: PCM conversion and mixing benchmark
+ *
+ *  This file is subject to the terms and conditions of the GNU General
+ *  Public License Version 2. See the file "COPYING" in the main
+ *  directory of this archive for more details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/soundcard.h>
+#include <linux/bench.h>
+#include <asm/ps2/siflock.h>
+
+#include "sd.h"
+
+/*
+ * Built as ps2sdtest.o, with its own copy of sdcnv.o, when
+ * CONFIG_BENCH_MODULES and the sound driver are configured; the driver
+ * need not be loaded. Every block converter is run BENCH_ITERATIONS
+ * times over BENCH_FRAMES frames of random data, with the buffers equally aligned (the MMI path where
+ * there is one) and misaligned by a word (the scalar path). Its output
+ * is checked sample by sample against a plain decoding of the format,
+ * and the rate goes to the kernel log. ps2sd_deinterleave() is timed
+ * and checked the same way.
+ *
+ * Then 1 to MIX_MAXSTREAMS synthetic streams are mixed into a
+ * deinterleaved owner fragment with ps2sd_mix(), at unity gain (the
+ * paddsh path) and at other gains (the scalar path), the way
+ * ps2sd_dmaintr() composes a fragment. The result is checked against
+ * a saturating sum done sample by sample, and the cost is given as a
+ * share of the CPU a 48kHz unit would need.
+ */
+#define BENCH_ITERATIONS 100
+#define BENCH_FRAMES	4096
+#define MIX_MAXSTREAMS	4
+
+/* 16bit stereo source, plus room to misalign it */
+static unsigned char srcbuf[BENCH_FRAMES * 4 + 16] __attribute__((aligned(16)));
+static struct ps2sd_sample dstbuf[BENCH_FRAMES] __attribute__((aligned(16)));
+static unsigned char deintbuf[BENCH_FRAMES * 4] __attribute__((aligned(16)));
+static struct ps2sd_sample streams[MIX_MAXSTREAMS][BENCH_FRAMES] __attribute__((aligned(16)));
+static short mixbuf[BENCH_FRAMES * 2] __attribute__((aligned(16)));
+
+static struct {
+	char *name;
+	int format;
+	int bytes;		/* per sample */
+} formats[] = {
+	{ "S8",		AFMT_S8,	1 },
+	{ "U8",		AFMT_U8,	1 },
+	{ "S16_LE",	AFMT_S16_LE,	2 },
+	{ "S16_BE",	AFMT_S16_BE,	2 },
+	{ "U16_LE",	AFMT_U16_LE,	2 },
+	{ "U16_BE",	AFMT_U16_BE,	2 },
+	{ "MU_LAW",	AFMT_MU_LAW,	1 },
+};
+
+/* thousands of frames per second */
+#define KFPS(frames, usec) ((frames) * BENCH_ITERATIONS / ((usec) / 1000 ? (usec) / 1000 : 1))
+
+/* what one sample of the format should turn into */
+static short decode(int format, unsigned char *p)
+{
+	switch (format) {
+	case AFMT_S8:		return (signed char)p[0] << 8;
+	case AFMT_U8:		return (p[0] ^ 0x80) << 8;
+	case AFMT_S16_LE:	return p[0] | (p[1] << 8);
+	case AFMT_S16_BE:	return p[1] | (p[0] << 8);
+	case AFMT_U16_LE:	return (p[0] | (p[1] << 8)) ^ 0x8000;
+	case AFMT_U16_BE:	return (p[1] | (p[0] << 8)) ^ 0x8000;
+	case AFMT_MU_LAW:	return ps2sd_mulaw2liner16[p[0]];
+	}
+	return 0;
+}
+
+static int check(int n, int stereo, unsigned char *src)
+{
+	int i, bytes = formats[n].bytes;
+	short l, r;
+
+	for (i = 0; i < BENCH_FRAMES; i++) {
+		l = decode(formats[n].format, src);
+		src += bytes;
+		if (stereo) {
+			r = decode(formats[n].format, src);
+			src += bytes;
+		} else
+			r = l;
+		if (dstbuf[i].l != l || dstbuf[i].r != r) {
+			printk("%-6s %s: frame %d is %d,%d, should be %d,%d\n",
+			       formats[n].name, stereo ? "stereo" : "mono",
+			       i, dstbuf[i].l, dstbuf[i].r, l, r);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void bench_cnv(int n, int stereo)
+{
+	ps2sd_cnv_t cnv = ps2sd_get_converter(formats[n].format, stereo);
+	struct timeval start;
+	uint32_t ausec, musec;
+	int i;
+
+	do_gettimeofday(&start);
+	for (i = 0; i < BENCH_ITERATIONS; i++)
+		cnv(dstbuf, srcbuf, BENCH_FRAMES);
+	ausec = bench_usec(&start);
+	if (check(n, stereo, srcbuf))
+		return;
+
+	do_gettimeofday(&start);
+	for (i = 0; i < BENCH_ITERATIONS; i++)
+		cnv(dstbuf, srcbuf + 4, BENCH_FRAMES);
+	musec = bench_usec(&start);
+	if (check(n, stereo, srcbuf + 4))
+		return;
+
+	printk("%-6s %-6s: aligned %6d, misaligned %6d kframes/s\n",
+	       formats[n].name, stereo ? "stereo" : "mono",
+	       KFPS(BENCH_FRAMES, ausec), KFPS(BENCH_FRAMES, musec));
+}
+
+static void bench_deinterleave(void)
+{
+	unsigned short *s = (unsigned short *)srcbuf;
+	unsigned short *d = (unsigned short *)deintbuf;
+	struct timeval start;
+	uint32_t usec;
+	int i;
+
+	do_gettimeofday(&start);
+	for (i = 0; i < BENCH_ITERATIONS; i++)
+		ps2sd_deinterleave(deintbuf, srcbuf, BENCH_FRAMES * 4);
+	usec = bench_usec(&start);
+
+	for (i = 0; i < BENCH_FRAMES; i++) {
+		if (d[i] != s[i * 2] || d[BENCH_FRAMES + i] != s[i * 2 + 1]) {
+			printk("deinterleave: frame %d is wrong\n", i);
+			return;
+		}
+	}
+	printk("deinterleave : %6d kframes/s\n", KFPS(BENCH_FRAMES, usec));
+}
+
+static short saturate(int x)
+{
+	return x < -32768 ? -32768 : (32767 < x ? 32767 : x);
+}
+
+static void mix(int nstreams, int gainl, int gainr)
+{
+	int i;
+
+	memcpy(mixbuf, deintbuf, sizeof(mixbuf));
+	for (i = 0; i < nstreams; i++)
+		ps2sd_mix(mixbuf, mixbuf + BENCH_FRAMES, streams[i],
+			  BENCH_FRAMES, gainl, gainr);
+}
+
+static void bench_mix(int nstreams, int gainl, int gainr)
+{
+	short *owner = (short *)deintbuf;
+	struct timeval start;
+	uint32_t usec;
+	int i, k, l, r, kfps, share;
+
+	do_gettimeofday(&start);
+	for (i = 0; i < BENCH_ITERATIONS; i++)
+		mix(nstreams, gainl, gainr);
+	usec = bench_usec(&start);
+
+	/* the streams are added one after another, each sum saturated */
+	for (i = 0; i < BENCH_FRAMES; i++) {
+		l = owner[i];
+		r = owner[BENCH_FRAMES + i];
+		for (k = 0; k < nstreams; k++) {
+			l = saturate(l + ((streams[k][i].l * gainl) >> 15));
+			r = saturate(r + ((streams[k][i].r * gainr) >> 15));
+		}
+		if (mixbuf[i] != l || mixbuf[BENCH_FRAMES + i] != r) {
+			printk("mix %d streams: frame %d is %d,%d, should be %d,%d\n",
+			       nstreams, i, mixbuf[i], mixbuf[BENCH_FRAMES + i],
+			       l, r);
+			return;
+		}
+	}
+
+	/* CPU needed for 48 kframes/s, in hundredths of a percent */
+	kfps = KFPS(BENCH_FRAMES, usec);
+	share = 48 * 10000 / (kfps ? kfps : 1);
+	printk("mix %d streams, gain %04x/%04x: %6d kframes/s, %2d.%02d%% at 48kHz\n",
+	       nstreams, gainl, gainr, kfps, share / 100, share % 100);
+}
+
+int init_module(void)
+{
+	uint32_t seed = 0x12345678;
+	int i, k;
+
+	for (i = 0; i < sizeof(srcbuf); i++) {
+		seed = seed * 1103515245 + 12345;
+		srcbuf[i] = seed >> 16;
+	}
+
+	printk("sdtest: %d iterations of %d frames\n",
+	       BENCH_ITERATIONS, BENCH_FRAMES);
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		bench_cnv(i, 1);
+		bench_cnv(i, 0);
+	}
+	bench_deinterleave();
+
+	/* quiet, loud and full scale streams, so that some sums saturate */
+	for (k = 0; k < MIX_MAXSTREAMS; k++) {
+		for (i = 0; i < BENCH_FRAMES; i++) {
+			seed = seed * 1103515245 + 12345;
+			streams[k][i].l = (short)(seed >> 16) >> (MIX_MAXSTREAMS - 1 - k);
+			seed = seed * 1103515245 + 12345;
+			streams[k][i].r = (short)(seed >> 16) >> (MIX_MAXSTREAMS - 1 - k);
+		}
+	}
+	for (i = 1; i <= MIX_MAXSTREAMS; i++) {
+		bench_mix(i, 0x8000, 0x8000);
+		bench_mix(i, 0x4000, 0x6000);
+	}
+
+	return BENCH_DONE;
+}
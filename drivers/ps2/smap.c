@@ -21,18 +21,25 @@ static void smap_skb_enqueue(struct sk_buff_head *head, struct sk_buff *newsk);
 static void smap_skb_requeue(struct sk_buff_head *head, struct sk_buff *newsk);
 static struct sk_buff * smap_skb_dequeue(struct sk_buff_head *head);
 static void smap_skb_queue_clear(struct smap_chan *smap, struct sk_buff_head *head);
+static struct sk_buff * smap_rxskb_alloc(int gfp_mask);
+static struct sk_buff * smap_rxskb_get(struct smap_chan *smap);
+static void smap_rxskb_refill(struct smap_chan *smap);
 static int  smap_start_xmit(struct sk_buff *skb, struct net_device *net_dev);
 static int  smap_start_xmit2(struct smap_chan *smap);
 static void smap_tx_intr(struct net_device *net_dev);
-static void smap_rx_intr(struct net_device *net_dev);
+static int  smap_rx_intr(struct net_device *net_dev);
+static int  smap_rx_poll(struct smap_chan *smap);
+static void smap_rxpoll_timer(unsigned long arg);
 static void smap_emac3_intr(struct net_device *net_dev);
 static void smap_interrupt(int irq, void *dev_id, struct pt_regs *pt_regs);
-static u_int8_t smap_bitrev(u_int8_t val);
-static u_int32_t smap_crc32(u_int32_t crcval, u_int8_t cval);
 static u_int32_t smap_calc_crc32(struct smap_chan *smap, u_int8_t *addr);
-static int  smap_store_new_mc_list(struct smap_chan *smap);
+static int  smap_calc_mc_hash(struct smap_chan *smap, u_int32_t *val);
+static void smap_store_new_mc_list(struct smap_chan *smap, u_int32_t *val);
 static void smap_multicast_list(struct net_device *net_dev);
 static struct net_device_stats * smap_get_stats(struct net_device *net_dev);
+#ifdef CONFIG_PROC_FS
+static int  smap_read_proc(char *page, char **start, off_t off, int count, int *eof, void *data);
+#endif /* CONFIG_PROC_FS */
 static int  smap_open(struct net_device *net_dev);
 static int  smap_close(struct net_device *net_dev);
 static int  smap_ioctl(struct net_device *net_dev, struct ifreq *ifr, int cmd);
@@ -135,6 +142,62 @@ smap_skb_queue_clear(struct smap_chan *smap, struct sk_buff_head *head)
 
 /*--------------------------------------------------------------------------*/
 
+static int smap_rxskbpool_size = SMAP_RXSKBPOOL_DEF;
+MODULE_PARM(smap_rxskbpool_size, "i");
+
+static struct sk_buff *
+smap_rxskb_alloc(int gfp_mask)
+{
+	struct sk_buff *skb;
+	int off;
+
+	skb = alloc_skb(SMAP_RXSKBSIZE, gfp_mask);
+	if (skb == NULL)
+		return(NULL);
+
+	/* cache line align the buffer, then 16 byte align the data fields */
+	off = (int)skb->data & (SMAP_ALIGN-1);
+	if (off)
+		skb_reserve(skb, SMAP_ALIGN - off);
+	skb_reserve(skb, 2);
+	return(skb);
+}
+
+/* called from smap thread only */
+static struct sk_buff *
+smap_rxskb_get(struct smap_chan *smap)
+{
+	struct sk_buff *skb;
+
+	skb = smap_skb_dequeue(&smap->rxskbpool);
+	if (skb != NULL) {
+		smap->xstats.rx_pool_hit++;
+		return(skb);
+	}
+	smap->xstats.rx_pool_miss++;
+	return(smap_rxskb_alloc(GFP_ATOMIC));
+}
+
+/*
+ * called from smap thread only, once it has run out of work, so the
+ * allocations stay off the receive path
+ */
+static void
+smap_rxskb_refill(struct smap_chan *smap)
+{
+	struct sk_buff *skb;
+
+	while (skb_queue_len(&smap->rxskbpool) < smap_rxskbpool_size) {
+		skb = smap_rxskb_alloc(GFP_KERNEL);
+		if (skb == NULL)
+			break;
+		(void)smap_skb_enqueue(&smap->rxskbpool, skb);
+	}
+	return;
+}
+
+/*--------------------------------------------------------------------------*/
+
 /* return value: 0 if success, !0 if error */
 static int
 smap_start_xmit(struct sk_buff *skb, struct net_device *net_dev)
@@ -164,6 +227,14 @@ smap_start_xmit(struct sk_buff *skb, struct net_device *net_dev)
 	return(0);
 }
 
+static int smap_tx_coalesce = SMAP_DMA_ENTRIES;
+MODULE_PARM(smap_tx_coalesce, "i");
+
+/*
+ * Send frames queued since the last call. In DMA mode up to
+ * smap_tx_coalesce frames are packed into one SmapDmaWrite RPC,
+ * one sdd entry per frame.
+ */
 static int
 smap_start_xmit2(struct smap_chan *smap)
 {
@@ -181,7 +252,7 @@ smap_start_xmit2(struct smap_chan *smap)
 	tx_re_q = CLEAR;
 	tmp_txbwp = smap->txbwp;
 	smap->txdma_request.count = smap->txdma_request.size = 0;
-	for (i = 0; i < SMAP_DMA_ENTRIES; i++) {
+	for (i = 0; i < smap_tx_coalesce; i++) {
 		skb = NULL;
 
 		if (((smap->flags & SMAP_F_DMA_TX_ENABLE) == 0) && (i > 0))
@@ -258,6 +329,9 @@ smap_start_xmit2(struct smap_chan *smap)
 					net_dev->name,smap->dma_result);
 			goto end;
 		}
+		smap->xstats.tx_rpc++;
+		smap->xstats.tx_rpc_frames += smap->txdma_request.count;
+		smap->xstats.tx_rpc_hist[smap->txdma_request.count - 1]++;
 
 	} else {
 smappiosend:
@@ -483,7 +557,8 @@ smap_tx_intr(struct net_device *net_dev)
 	return;
 }
 
-static void
+/* return value: number of rx buffer descriptors consumed */
+static int
 smap_rx_intr(struct net_device *net_dev)
 {
 	struct smap_chan *smap = net_dev->priv;
@@ -497,6 +572,7 @@ smap_rx_intr(struct net_device *net_dev)
 	u_int8_t *rxbp;
 	int l_rxbdi;
 	int validrcvpkt, rcvpkt;
+	struct sk_buff *pioskb = NULL;
 	struct completion compl;
 	unsigned long flags;
 
@@ -639,14 +715,30 @@ smap_rx_intr(struct net_device *net_dev)
 
 	} else {
 smappiorecv:
+		pioskb = smap_rxskb_get(smap);
 		spin_lock_irqsave(&smap->spinlock, flags);
 		/* recv from FIFO to memory */
 		SMAPREG16(smap,SMAP_RXFIFO_RD_PTR) =
 			(u_int16_t)smap->rxdma_request.sdd[0].f_addr;
-		datap = (u_int32_t *)smap->rxbuf;
 		rxlen = smap->rxdma_request.sdd[0].size;
-		for (i = 0; i < rxlen; i += 4) {	/* FIFO -> memory */
-			*datap++ = SMAPREG32(smap,SMAP_RXFIFO_DATA);
+		if (pioskb != NULL) {
+			/*
+			 * FIFO -> skb directly. skb->data is 2 bytes off
+			 * word alignment, so store each word as two halves.
+			 */
+			u_int16_t *hp = (u_int16_t *)pioskb->data;
+			u_int32_t val;
+
+			for (i = 0; i < rxlen; i += 4) {
+				val = SMAPREG32(smap,SMAP_RXFIFO_DATA);
+				*hp++ = (u_int16_t)val;
+				*hp++ = (u_int16_t)(val >> 16);
+			}
+		} else {
+			datap = (u_int32_t *)smap->rxbuf;
+			for (i = 0; i < rxlen; i += 4) { /* FIFO -> memory */
+				*datap++ = SMAPREG32(smap,SMAP_RXFIFO_DATA);
+			}
 		}
 		spin_unlock_irqrestore(&smap->spinlock, flags);
 		pkt_err = CLEAR;
@@ -662,7 +754,7 @@ smappiorecv:
 				net_dev->name,l_rxbdi,rxbd->ctrl_stat,
 				rxbd->length,rxbd->pointer);
 			if (pioflag) {
-				rxbp = smap->rxbuf;
+				rxbp = pioskb ? pioskb->data : smap->rxbuf;
 			} else {
 				rxbp = (u_int8_t *)(smap->rxdma_request.sdd[i].i_addr);
 			}
@@ -681,7 +773,7 @@ smappiorecv:
 			if (pkt_err & (1 << i))
 				continue;
 			if (pioflag) {
-				rxbp = smap->rxbuf;
+				rxbp = pioskb ? pioskb->data : smap->rxbuf;
 			} else {
 				rxbp = (u_int8_t *)(smap->rxdma_request.sdd[i].i_addr);
 			}
@@ -701,26 +793,29 @@ smappiorecv:
 	for (i = 0; i < rcvpkt; i++) {
 		if (pkt_err & (1 << i))
 			continue;
-		if (pioflag) {
-			rxbp = smap->rxbuf;
-		} else {
-			rxbp = (u_int8_t *)(smap->rxdma_request.sdd[i].i_addr);
-		}
 		pkt_len = smap->rxdma_request.sdd[i].sdd_misc;
 
-		skb = dev_alloc_skb(pkt_len + 2);
-		if (skb == NULL) {
-			printk("%s:rx intr(%d): skb alloc error\n",
-						net_dev->name, i);
-			break;
+		if (pioskb != NULL) {
+			/* already received into skb */
+			skb = pioskb;
+			pioskb = NULL;
+			skb_put(skb, pkt_len);
+			smap->xstats.rx_pio_direct++;
+		} else {
+			if (pioflag) {
+				rxbp = smap->rxbuf;
+			} else {
+				rxbp = (u_int8_t *)(smap->rxdma_request.sdd[i].i_addr);
+			}
+			skb = smap_rxskb_get(smap);
+			if (skb == NULL) {
+				printk("%s:rx intr(%d): skb alloc error\n",
+							net_dev->name, i);
+				break;
+			}
+			memcpy(skb_put(skb, pkt_len), rxbp, pkt_len);
+			smap->xstats.rx_copy++;
 		}
-		skb_reserve(skb, 2);	/* 16 byte align the data fields */
-#if 1
-		eth_copy_and_sum(skb, rxbp, pkt_len, 0);
-		skb_put(skb, pkt_len);
-#else
-		memcpy(skb_put(skb, pkt_len), rxbp, pkt_len);
-#endif
 		skb->dev = net_dev;
 		skb->protocol = eth_type_trans(skb, net_dev);
 		net_dev->last_rx = jiffies;
@@ -728,6 +823,9 @@ smappiorecv:
 	}
 
 end:
+	if (pioskb != NULL)
+		dev_kfree_skb(pioskb);	/* dropped */
+
 	spin_lock_irqsave(&smap->spinlock, flags);
 	rxbd = &smap->rxbd[smap->rxbdi];
 	for (i = 0; i < rcvpkt; i++) {
@@ -758,9 +856,86 @@ end:
 		SMAPREG16(smap,SMAP_INTR_CLR) = INTR_RXDNV;
 	}
 
-	smap->rxicnt--;
 	spin_unlock_irqrestore(&smap->spinlock, flags);
 
+	return(rcvpkt);
+}
+
+static int smap_rxpoll_budget = SMAP_RXPOLL_BUDGET_DEF;
+MODULE_PARM(smap_rxpoll_budget, "i");
+static int smap_rxpoll_holdoff = 0;
+MODULE_PARM(smap_rxpoll_holdoff, "i");
+
+/*
+ * Drain the rx ring with RXEND masked, at most rxpoll_budget frames
+ * per pass. RXEND is re-enabled once a pass finds the ring empty; if
+ * rxpoll_holdoff is set, a pass that received frames re-polls from a
+ * timer instead, so a busy link stays in polled mode.
+ * return value: !0 if the ring has not been drained yet
+ */
+static int
+smap_rx_poll(struct smap_chan *smap)
+{
+	volatile struct smapbd *rxbd;
+	int n, work, budget;
+	unsigned long flags;
+
+	spin_lock_irqsave(&smap->spinlock, flags);
+	smap->rxicnt = 0;
+	spin_unlock_irqrestore(&smap->spinlock, flags);
+
+	/* mitigation may have been switched off while RXEND was masked */
+	budget = smap->rxpoll_budget;
+	if (budget <= 0)
+		budget = SMAP_BD_MAX_ENTRY;
+
+	smap->xstats.rx_polls++;
+	work = 0;
+	while (work < budget) {
+		n = smap_rx_intr(smap->net_dev);
+		if (n == 0)
+			break;
+		work += n;
+	}
+	smap->xstats.rx_poll_frames += work;
+
+	spin_lock_irqsave(&smap->spinlock, flags);
+	if (work >= budget) {
+		/* budget used up, poll again after others have run */
+		smap->xstats.rx_poll_exhausted++;
+		smap->rxicnt++;
+		spin_unlock_irqrestore(&smap->spinlock, flags);
+		return(1);
+	}
+	if ((work > 0) && (smap->rxpoll_holdoff > 0)) {
+		smap->xstats.rx_poll_holdoff++;
+		mod_timer(&smap->rxpoll_timer, jiffies + smap->rxpoll_holdoff);
+		spin_unlock_irqrestore(&smap->spinlock, flags);
+		return(0);
+	}
+	if (smap->rxend_masked) {
+		smap->rxend_masked = 0;
+		SMAPREG16(smap,SMAP_INTR_CLR) = INTR_RXEND;
+		SMAPREG16(smap,SMAP_INTR_ENABLE) |= INTR_RXEND;
+	}
+	/* a frame may have arrived before RXEND was cleared */
+	rxbd = &smap->rxbd[smap->rxbdi];
+	if ((rxbd->ctrl_stat & SMAP_BD_RX_EMPTY) == 0)
+		smap->rxicnt++;
+	spin_unlock_irqrestore(&smap->spinlock, flags);
+	return(0);
+}
+
+static void
+smap_rxpoll_timer(unsigned long arg)
+{
+	struct smap_chan *smap = (struct smap_chan *)arg;
+	unsigned long flags;
+
+	spin_lock_irqsave(&smap->spinlock, flags);
+	smap->rxicnt++;
+	wake_up_interruptible(&smap->wait_smaprun);
+	spin_unlock_irqrestore(&smap->spinlock, flags);
 	return;
 }
 
@@ -923,6 +1098,12 @@ smap_interrupt(int irq, void *dev_id, struct pt_regs *pt_regs)
 	}
 	if (stat & INTR_RXEND) {
 		SMAPREG16(smap,SMAP_INTR_CLR) = INTR_RXEND;
+		smap->xstats.rx_intr++;
+		if (smap->rxpoll_budget > 0) {
+			/* mask RXEND, smap thread polls the rx ring */
+			SMAPREG16(smap,SMAP_INTR_ENABLE) &= ~INTR_RXEND;
+			smap->rxend_masked = 1;
+		}
 		/* workaround for race condition of TxEND/RxEND */
 		if ((smap->txbdusedcnt > 0) &&
 		    (smap->txbdusedcnt > SMAPREG8(smap,SMAP_TXFIFO_FRAME_CNT))
@@ -942,85 +1123,146 @@ end:
 
 /*--------------------------------------------------------------------------*/
 
-#define	POLY32	0x04C11DB7
-
-static u_int8_t
-smap_bitrev(u_int8_t val)
+static u_int32_t
+smap_calc_crc32(struct smap_chan *smap, u_int8_t *addr)
 {
-	int i;
-	u_int8_t ret = 0;
-
-	for (i = 0; i < 8; i++) {
-		ret <<= 1;
-		ret |= (val & 0x01) ? 1 : 0;
-		val >>= 1;
-	}
-	return(ret);
+	return(crc32_be_ether(addr, ETH_ALEN));
 }
 
-static u_int32_t
-smap_crc32(u_int32_t crcval, u_int8_t cval)
+static void
+smap_mc_bit_set(struct smap_chan *smap, int bit)
 {
-	int i;
-
-	crcval ^= cval << 24;
-	for (i = 0; i < 8; i++) {
-		crcval = crcval & 0x80000000 ? (crcval << 1) ^ POLY32 : crcval << 1;
-	}
-
-	return(crcval);
+	if (smap->mc_bitcnt[bit]++ == 0)
+		smap->mc_bits[bit/16] |= (1 << (15 - (bit%16)));
+	return;
 }
 
-static u_int32_t
-smap_calc_crc32(struct smap_chan *smap, u_int8_t *addr)
+static void
+smap_mc_bit_clear(struct smap_chan *smap, int bit)
 {
-	int i;
-	u_int32_t crc;
+	if (--smap->mc_bitcnt[bit] == 0)
+		smap->mc_bits[bit/16] &= ~(1 << (15 - (bit%16)));
+	return;
+}
 
-	crc = 0xFFFFFFFF;
-	for (i = 0; i < ETH_ALEN; i++)
-		crc = smap_crc32(crc, smap_bitrev(*addr++));
+static void
+smap_mc_reset(struct smap_chan *smap)
+{
+	struct smap_mc_ent *ent, *next;
+	int h;
 
-	return(crc ^ 0xFFFFFFFF);
+	for (h = 0; h < SMAP_MC_HASHSIZE; h++) {
+		for (ent = smap->mc_ent[h]; ent; ent = next) {
+			next = ent->next;
+			kfree(ent);
+		}
+		smap->mc_ent[h] = NULL;
+	}
+	smap->mc_nent = 0;
+	memset(smap->mc_bitcnt, 0, sizeof(smap->mc_bitcnt));
+	memset(smap->mc_bits, 0, sizeof(smap->mc_bits));
+	return;
 }
 
+/*
+ * Bring mc_bits up to date with dev->mc_list. Only addresses which
+ * were added since the last call are hashed, and only the bits of
+ * added or removed addresses are touched. Each address is looked up
+ * in the mc_ent table, so an update costs O(mc_count). If an entry
+ * can't be allocated, the list is hashed in full this time and the
+ * table is rebuilt on the next call.
+ *
+ * return value: !0 if any bit is set in the group hash
+ */
 static int
-smap_store_new_mc_list(struct smap_chan *smap)
+smap_calc_mc_hash(struct smap_chan *smap, u_int32_t *val)
 {
 	struct net_device *net_dev = smap->net_dev;
 	struct dev_mc_list *mcp;
-	int idx, reg, bit, sethtbl = 0;
-	u_int32_t val[4];
+	struct smap_mc_ent *ent, **entp;
+	int h, idx;
 
-	/* clear HW gourp list */
-	EMAC3REG_WRITE(smap, SMAP_EMAC3_GROUP_HASH1, 0x0);
-	EMAC3REG_WRITE(smap, SMAP_EMAC3_GROUP_HASH2, 0x0);
-	EMAC3REG_WRITE(smap, SMAP_EMAC3_GROUP_HASH3, 0x0);
-	EMAC3REG_WRITE(smap, SMAP_EMAC3_GROUP_HASH4, 0x0);
-	val[0] = val[1] = val[2] = val[3] = 0;
+	if (smap->mc_nent < 0)
+		smap_mc_reset(smap);
+	for (h = 0; h < SMAP_MC_HASHSIZE; h++)
+		for (ent = smap->mc_ent[h]; ent; ent = ent->next)
+			ent->seen = 0;
 
 	for (mcp = net_dev->mc_list; mcp; mcp = mcp->next) {
-		/* set new HW group list */
+		if ((mcp->dmi_addr[0]&0x1) == 0)
+			continue;
+		if (mcp->dmi_addrlen != ETH_ALEN)
+			continue;
+		h = SMAP_MC_HASH(mcp->dmi_addr);
+		for (ent = smap->mc_ent[h]; ent; ent = ent->next)
+			if (!ent->seen &&
+			    memcmp(ent->addr, mcp->dmi_addr, ETH_ALEN) == 0)
+				break;
+		if (ent) {
+			ent->seen = 1;
+			continue;
+		}
+		/* new address */
+		if ((ent = kmalloc(sizeof(*ent), GFP_ATOMIC)) == NULL)
+			goto rehash;
+		memcpy(ent->addr, mcp->dmi_addr, ETH_ALEN);
+		ent->bit = (smap_calc_crc32(smap, mcp->dmi_addr) >> 26) & 0x3f;
+		ent->seen = 1;
+		ent->next = smap->mc_ent[h];
+		smap->mc_ent[h] = ent;
+		smap->mc_nent++;
+		smap_mc_bit_set(smap, ent->bit);
+	}
+
+	/* drop the addresses which have gone from the list */
+	for (h = 0; h < SMAP_MC_HASHSIZE; h++) {
+		for (entp = &smap->mc_ent[h]; (ent = *entp) != NULL; ) {
+			if (ent->seen) {
+				entp = &ent->next;
+				continue;
+			}
+			smap_mc_bit_clear(smap, ent->bit);
+			*entp = ent->next;
+			smap->mc_nent--;
+			kfree(ent);
+		}
+	}
+
+	memcpy(val, smap->mc_bits, sizeof(smap->mc_bits));
+	return(val[0] | val[1] | val[2] | val[3]);
 
+ rehash:
+	smap_mc_reset(smap);
+	smap->mc_nent = -1;
+	for (mcp = net_dev->mc_list; mcp; mcp = mcp->next) {
 		if ((mcp->dmi_addr[0]&0x1) == 0)
 			continue;
 		if (mcp->dmi_addrlen != ETH_ALEN)
 			continue;
-		idx = smap_calc_crc32(smap, mcp->dmi_addr);
-		idx = (idx >> 26) & 0x3f;
-		reg = idx/16;
-		bit = 15 - (idx%16);
-		val[reg] |= (1 << bit);
-		sethtbl = 1;
+		idx = (smap_calc_crc32(smap, mcp->dmi_addr) >> 26) & 0x3f;
+		smap->mc_bits[idx/16] |= (1 << (15 - (idx%16)));
 	}
-	if (sethtbl) {
-		/* set HW group list */
-		EMAC3REG_WRITE(smap, SMAP_EMAC3_GROUP_HASH1, val[0]);
-		EMAC3REG_WRITE(smap, SMAP_EMAC3_GROUP_HASH2, val[1]);
-		EMAC3REG_WRITE(smap, SMAP_EMAC3_GROUP_HASH3, val[2]);
-		EMAC3REG_WRITE(smap, SMAP_EMAC3_GROUP_HASH4, val[3]);
+	memcpy(val, smap->mc_bits, sizeof(smap->mc_bits));
+	return(val[0] | val[1] | val[2] | val[3]);
+}
+
+/* write the group hash registers that differ from the last written ones */
+static void
+smap_store_new_mc_list(struct smap_chan *smap, u_int32_t *val)
+{
+	static const u_int32_t hashreg[4] = {
+		SMAP_EMAC3_GROUP_HASH1, SMAP_EMAC3_GROUP_HASH2,
+		SMAP_EMAC3_GROUP_HASH3, SMAP_EMAC3_GROUP_HASH4,
+	};
+	int reg;
+
+	for (reg = 0; reg < 4; reg++) {
+		if (smap->mc_hash_valid && (smap->mc_hash[reg] == val[reg]))
+			continue;
+		EMAC3REG_WRITE(smap, hashreg[reg], val[reg]);
+		smap->mc_hash[reg] = val[reg];
 	}
-	return(sethtbl);
+	return;
 }
 
 static void
@@ -1028,14 +1270,12 @@ smap_multicast_list(struct net_device *net_dev)
 {
 	struct smap_chan *smap = net_dev->priv;
 	u_int32_t e3v;
-
-	/* stop tx/rx */
-	(void)smap_txrx_XXable(smap, DISABLE);
+	u_int32_t val[4];
 
 	/* disable promisc, all multi, indvi hash and group hash mode */
 	e3v = EMAC3REG_READ(smap, SMAP_EMAC3_RxMODE);
 	e3v &= ~(E3_RX_PROMISC|E3_RX_PROMISC_MCAST|E3_RX_INDIVID_HASH|E3_RX_MCAST);
-	EMAC3REG_WRITE(smap, SMAP_EMAC3_RxMODE, e3v);
+	val[0] = val[1] = val[2] = val[3] = 0;
 
 	if (net_dev->flags & IFF_PROMISC) {
 		e3v |= E3_RX_PROMISC;
@@ -1044,12 +1284,27 @@ smap_multicast_list(struct net_device *net_dev)
 	} else if (net_dev->mc_count == 0) {
 	    /* Nothing to do, because INDIVID_ADDR & BCAST are already set */
 	} else {
-		if (smap_store_new_mc_list(smap))
+		if (smap_calc_mc_hash(smap, val))
 			e3v |= E3_RX_MCAST;
 	}
 
+	/* nothing changed, leave tx/rx running */
+	if (smap->mc_hash_valid &&
+	    (smap->mc_rxmode == e3v) &&
+	    (memcmp(smap->mc_hash, val, sizeof(val)) == 0))
+		return;
+
+	/* stop tx/rx */
+	(void)smap_txrx_XXable(smap, DISABLE);
+
+	EMAC3REG_WRITE(smap, SMAP_EMAC3_RxMODE, e3v &
+		~(E3_RX_PROMISC|E3_RX_PROMISC_MCAST|E3_RX_INDIVID_HASH|E3_RX_MCAST));
+	(void)smap_store_new_mc_list(smap, val);
+
 	/* set RxMODE register */
 	EMAC3REG_WRITE(smap, SMAP_EMAC3_RxMODE, e3v);
+	smap->mc_rxmode = e3v;
+	smap->mc_hash_valid = 1;
 
 	/* start tx/rx */
 	(void)smap_txrx_XXable(smap, ENABLE);
@@ -1067,6 +1322,55 @@ smap_get_stats(struct net_device *net_dev)
 	return(&smap->net_stats);
 }
 
+#ifdef CONFIG_PROC_FS
+static int
+smap_read_proc(char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	struct smap_chan *smap = (struct smap_chan *)data;
+	char *p = page;
+	int i, len;
+
+	p += sprintf(p, "%s: %s\n", smap->net_dev->name,
+		(smap->flags & SMAP_F_DMA_RX_ENABLE) ? "rx dma" : "rx pio");
+	p += sprintf(p, "rx pio direct %lu\n", smap->xstats.rx_pio_direct);
+	p += sprintf(p, "rx copy       %lu\n", smap->xstats.rx_copy);
+	p += sprintf(p, "rx pool hit   %lu\n", smap->xstats.rx_pool_hit);
+	p += sprintf(p, "rx pool miss  %lu\n", smap->xstats.rx_pool_miss);
+	p += sprintf(p, "rx pool       %d/%d\n",
+		skb_queue_len(&smap->rxskbpool), smap_rxskbpool_size);
+	p += sprintf(p, "tx rpc        %lu\n", smap->xstats.tx_rpc);
+	p += sprintf(p, "tx rpc frames %lu\n", smap->xstats.tx_rpc_frames);
+	if (smap->xstats.tx_rpc > 0) {
+		i = (smap->xstats.tx_rpc_frames * 100) / smap->xstats.tx_rpc;
+		p += sprintf(p, "tx frames/rpc %d.%02d (max %d)\n",
+				i / 100, i % 100, smap_tx_coalesce);
+	}
+	p += sprintf(p, "tx frames/rpc histogram:");
+	for (i = 0; i < SMAP_DMA_ENTRIES; i++)
+		p += sprintf(p, " %lu", smap->xstats.tx_rpc_hist[i]);
+	p += sprintf(p, "\n");
+	p += sprintf(p, "rx poll       budget %d, holdoff %d\n",
+		smap->rxpoll_budget, smap->rxpoll_holdoff);
+	p += sprintf(p, "rx interrupts %lu\n", smap->xstats.rx_intr);
+	p += sprintf(p, "rx polls      %lu\n", smap->xstats.rx_polls);
+	p += sprintf(p, "rx poll frames %lu\n", smap->xstats.rx_poll_frames);
+	p += sprintf(p, "rx poll exhausted %lu\n",
+		smap->xstats.rx_poll_exhausted);
+	p += sprintf(p, "rx poll holdoff %lu\n", smap->xstats.rx_poll_holdoff);
+
+	len = p - page;
+	if (len <= off + count)
+		*eof = 1;
+	*start = page + off;
+	len -= off;
+	if (len > count)
+		len = count;
+	if (len < 0)
+		len = 0;
+	return(len);
+}
+#endif /* CONFIG_PROC_FS */
+
 static int
 smap_open(struct net_device *net_dev)
 {
@@ -1116,6 +1420,7 @@ smap_open(struct net_device *net_dev)
 
 	(void)smap_skb_queue_init(smap, &smap->txqueue);
 	smap->txicnt = smap->rxicnt = 0;
+	(void)smap_rxskb_refill(smap);
 
 	(void)smap_clear_all_interrupt(smap);
 	(void)smap_interrupt_XXable(smap, ENABLE);
@@ -1172,6 +1477,7 @@ smap_close(struct net_device *net_dev)
 
 	(void)smap_interrupt_XXable(smap, DISABLE);
 	(void)smap_clear_all_interrupt(smap);
+	del_timer_sync(&smap->rxpoll_timer);
 	smap->txicnt = smap->rxicnt = 0;
 
 	(void)free_irq(smap->irq, net_dev);
@@ -1295,6 +1601,42 @@ smap_ioctl(struct net_device *net_dev, struct ifreq *ifr, int cmd)
 			smap->flags &= ~SMAP_F_PRINT_MSG;
 		break;
 
+	case SMAP_IOC_RXPOLL_BUDGET:
+		if (!capable(CAP_NET_ADMIN)) {
+			retval = -EPERM;
+			break;
+		}
+		if (ifr == NULL) {
+			printk("%s: ifr is NULL\n", net_dev->name);
+			retval = -EINVAL;
+			break;
+		}
+		if (((int)ifr->ifr_data < 0) ||
+		    ((int)ifr->ifr_data > SMAP_BD_MAX_ENTRY)) {
+			retval = -EINVAL;
+			break;
+		}
+		smap->rxpoll_budget = (int)ifr->ifr_data;
+		break;
+
+	case SMAP_IOC_RXPOLL_HOLDOFF:
+		if (!capable(CAP_NET_ADMIN)) {
+			retval = -EPERM;
+			break;
+		}
+		if (ifr == NULL) {
+			printk("%s: ifr is NULL\n", net_dev->name);
+			retval = -EINVAL;
+			break;
+		}
+		if (((int)ifr->ifr_data < 0) ||
+		    ((int)ifr->ifr_data > SMAP_RXPOLL_HOLDOFF_MAX)) {
+			retval = -EINVAL;
+			break;
+		}
+		smap->rxpoll_holdoff = (int)ifr->ifr_data;
+		break;
+
 	case SMAP_IOC_DUMP_PKT:
 		if (ifr == NULL) {
 			printk("%s: ifr is NULL\n", net_dev->name);
@@ -1403,6 +1745,7 @@ smap_clear_all_interrupt(struct smap_chan *smap)
 static void
 smap_interrupt_XXable(struct smap_chan *smap, int enable_flag)
 {
+	smap->rxend_masked = 0;
 	if (enable_flag) {
 		/* enable interrupt */
 		SMAPREG16(smap,SMAP_INTR_ENABLE) |= INTR_ENA_ALL;
@@ -1621,6 +1964,9 @@ smap_emac3_soft_reset(struct smap_chan *smap)
 	int i;
 	u_int32_t e3v;
 
+	/* reset clears RxMODE and group hash registers */
+	smap->mc_hash_valid = 0;
+
 	EMAC3REG_WRITE(smap, SMAP_EMAC3_MODE0, E3_SOFT_RESET);
 	for (i = SMAP_LOOP_COUNT; i; i--) {
 		e3v = EMAC3REG_READ(smap, SMAP_EMAC3_MODE0);
@@ -2614,7 +2960,18 @@ smap_run(struct smap_chan *smap)
 		spin_lock_irqsave(&smap->spinlock, flags);
 		if ((smap->rxicnt > 0) && (smap->flags & SMAP_F_OPENED)) {
 			spin_unlock_irqrestore(&smap->spinlock, flags);
-			(void)smap_rx_intr(smap->net_dev);
+			if (smap->rxend_masked) {
+				if (smap_rx_poll(smap)) {
+					/* let the thread yield the cpu */
+					set_current_state(TASK_RUNNING);
+					break;
+				}
+			} else {
+				(void)smap_rx_intr(smap->net_dev);
+				spin_lock_irqsave(&smap->spinlock, flags);
+				smap->rxicnt--;
+				spin_unlock_irqrestore(&smap->spinlock, flags);
+			}
 		} else
 			spin_unlock_irqrestore(&smap->spinlock, flags);
 
@@ -2627,6 +2984,8 @@ smap_run(struct smap_chan *smap)
 			spin_unlock_irqrestore(&smap->spinlock, flags);
 	}
 
+	if (smap->flags & SMAP_F_OPENED)
+		(void)smap_rxskb_refill(smap);
 	return;
 }
 
@@ -2906,6 +3265,25 @@ smap_probe(struct net_device *net_dev)
 
 	smap_base_init(smap);
 	spin_lock_init(&smap->spinlock);
+	skb_queue_head_init(&smap->rxskbpool);
+	if (smap_rxskbpool_size < 0)
+		smap_rxskbpool_size = 0;
+	if (smap_rxskbpool_size > SMAP_RXSKBPOOL_MAX)
+		smap_rxskbpool_size = SMAP_RXSKBPOOL_MAX;
+	if (smap_tx_coalesce < 1)
+		smap_tx_coalesce = 1;
+	if (smap_tx_coalesce > SMAP_DMA_ENTRIES)
+		smap_tx_coalesce = SMAP_DMA_ENTRIES;
+	if ((smap_rxpoll_budget < 0) || (smap_rxpoll_budget > SMAP_BD_MAX_ENTRY))
+		smap_rxpoll_budget = SMAP_RXPOLL_BUDGET_DEF;
+	if ((smap_rxpoll_holdoff < 0) ||
+	    (smap_rxpoll_holdoff > SMAP_RXPOLL_HOLDOFF_MAX))
+		smap_rxpoll_holdoff = 0;
+	smap->rxpoll_budget = smap_rxpoll_budget;
+	smap->rxpoll_holdoff = smap_rxpoll_holdoff;
+	init_timer(&smap->rxpoll_timer);
+	smap->rxpoll_timer.function = smap_rxpoll_timer;
+	smap->rxpoll_timer.data = (unsigned long)smap;
 	init_waitqueue_head(&smap->wait_linknego);
 	init_waitqueue_head(&smap->wait_linkvalid);
 	init_waitqueue_head(&smap->wait_chk_linkvalid);
@@ -2930,6 +3308,10 @@ smap_probe(struct net_device *net_dev)
 #endif /* HAVE_TX_TIMEOUT */
 	kernel_thread(smap_thread, (void *)smap, 0);
 
+#ifdef CONFIG_PROC_FS
+	create_proc_read_entry("smap", 0, proc_net, smap_read_proc, smap);
+#endif /* CONFIG_PROC_FS */
+
 	printk("PlayStation 2 SMAP(Ethernet) device driver.\n");
 
 	return(0);	/* success */
@@ -3003,6 +3385,10 @@ smap_cleanup_module(void)
 		smap->smaprun_compl = NULL;
 	}
 
+#ifdef CONFIG_PROC_FS
+	remove_proc_entry("smap", proc_net);
+#endif /* CONFIG_PROC_FS */
+
 	if (smap->net_dev == NULL)
 		goto end;
 
@@ -3024,6 +3410,8 @@ end:
 		if (smap->drxbuf) {
 			kfree(smap->drxbuf);
 		}
+		skb_queue_purge(&smap->rxskbpool);
+		smap_mc_reset(smap);
 		if (smap->net_dev); {
 			kfree(smap->net_dev);
 		}
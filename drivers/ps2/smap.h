@@ -28,6 +28,8 @@
 #include <linux/skbuff.h>
 #include <linux/sched.h>
 #include <linux/types.h>
+#include <linux/proc_fs.h>
+#include <linux/crc32.h>
 
 #include <asm/smplock.h>
 #include <asm/io.h>
@@ -49,6 +51,40 @@
 #define	RESET_ONLY	1
 #define	RESET_INIT	0
 
+/*
+ * multicast address folded into the group hash, kept in a table
+ * hashed on the low address bytes
+ */
+#define	SMAP_MC_HASHSIZE	64
+#define	SMAP_MC_HASH(addr)	\
+	(((addr)[3] ^ (addr)[4] ^ (addr)[5]) & (SMAP_MC_HASHSIZE - 1))
+struct smap_mc_ent {
+	struct smap_mc_ent *next;
+	u_int8_t addr[ETH_ALEN];
+	u_int8_t bit;			/* group hash bit, 0-63 */
+	u_int8_t seen;			/* still on dev->mc_list */
+};
+
+/*
+ * SMAP driver private statistics (/proc/net/smap)
+ */
+struct smap_xstats {
+	unsigned long rx_pio_direct;	/* PIO frames read from FIFO straight
+					   into the skb, without the bounce
+					   through rxbuf */
+	unsigned long rx_copy;		/* frames copied into skb */
+	unsigned long rx_pool_hit;	/* skb taken from rx pool */
+	unsigned long rx_pool_miss;	/* rx pool empty, allocated in place */
+	unsigned long tx_rpc;		/* SmapDmaWrite RPCs issued */
+	unsigned long tx_rpc_frames;	/* frames sent by those RPCs */
+	unsigned long tx_rpc_hist[SMAP_DMA_ENTRIES];	/* frames per RPC */
+	unsigned long rx_intr;		/* RXEND interrupts */
+	unsigned long rx_polls;		/* rx poll passes */
+	unsigned long rx_poll_frames;	/* frames received by rx poll */
+	unsigned long rx_poll_exhausted; /* poll passes that used up budget */
+	unsigned long rx_poll_holdoff;	/* RXEND re-enable deferred */
+};
+
 /*
  * SMAP control structure(smap channel)
  */
@@ -90,6 +126,25 @@ struct smap_chan {
 	u_int8_t *drxbuf, *rxbuf;
 	u_int16_t rxbrp;
 	int rxbdi;
+	struct sk_buff_head rxskbpool;
+
+	u_int32_t mc_hash[4];		/* GROUP_HASH1-4 as last written */
+	u_int32_t mc_rxmode;		/* RxMODE as last written */
+	int mc_hash_valid;		/* mc_hash/mc_rxmode match HW */
+	/* multicast addresses folded into mc_bits, and how many of them
+	   hash to each bit; mc_nent < 0 if they couldn't all be kept */
+	struct smap_mc_ent *mc_ent[SMAP_MC_HASHSIZE];
+	int mc_nent;
+	u_int8_t mc_bitcnt[64];
+	u_int32_t mc_bits[4];
+
+	int rxpoll_budget;		/* 0: no rx interrupt mitigation */
+	int rxpoll_holdoff;		/* jiffies */
+	struct timer_list rxpoll_timer;
+	int rxend_masked;		/* rx polling, RXEND masked. Kept out of
+					   flags, which is updated unlocked */
+
+	struct smap_xstats xstats;
 
 	ps2sif_clientdata_t cd_smap_tx, cd_smap_tx_end;
 	ps2sif_clientdata_t cd_smap_rx, cd_smap_rx_end;
@@ -129,6 +184,8 @@ struct smap_chan {
 #define	SMAP_IOC_DUMPPHYSTAT	(SIOCDEVPRIVATE+4)
 #define	SMAP_IOC_PRINT_MSG	(SIOCDEVPRIVATE+5)
 #define	SMAP_IOC_DUMP_PKT	(SIOCDEVPRIVATE+6)
+#define	SMAP_IOC_RXPOLL_BUDGET	(SIOCDEVPRIVATE+7)
+#define	SMAP_IOC_RXPOLL_HOLDOFF	(SIOCDEVPRIVATE+8)
 #ifndef	SIOCGMIIPHY
 /* for MII ioctl */
 #define	SIOCGMIIPHY		(SIOCDEVPRIVATE+13) /* Read from current PHY */
@@ -162,6 +219,11 @@ struct mii_ioctl_data {
 #define	SMAP_RXMAXSIZE		(6+6+2+1500+4)
 #define	SMAP_RXMINSIZE		14		/* ethernet header size */
 #define	SMAP_RXMAXTAILPAD	4
+#define	SMAP_RXSKBSIZE		(SMAP_BUFSIZE+SMAP_ALIGN+2+SMAP_RXMAXTAILPAD)
+#define	SMAP_RXSKBPOOL_DEF	32
+#define	SMAP_RXSKBPOOL_MAX	(SMAP_BD_MAX_ENTRY*2)
+#define	SMAP_RXPOLL_BUDGET_DEF	(SMAP_BD_MAX_ENTRY/2)
+#define	SMAP_RXPOLL_HOLDOFF_MAX	(HZ/10)
 
 #define	SMAP_LOOP_COUNT		10000
 #define	SMAP_AUTONEGO_TIMEOUT	300
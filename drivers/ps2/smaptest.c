@@ -0,0 +1,111 @@
+/*
+ *  PlayStation 2 Ethernet: multicast filter update benchmark
+ *
+ *  This file is subject to the terms and conditions of the GNU General
+ *  Public License Version 2. See the file "COPYING" in the main
+ *  directory of this archive for more details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/module.h>
+#include <linux/netdevice.h>
+#include <linux/rtnetlink.h>
+#include <linux/bench.h>
+
+/*
+ * Built as ps2smaptest.o with CONFIG_BENCH_MODULES. Load it while the
+ * smap interface is up (ifname=, default eth0). The device's multicast list is grown step
+ * by step to each of the sizes below, and at each size two things are
+ * timed, BENCH_ITERATIONS times:
+ *
+ *   resync  dev_mc_upload() on an unchanged list: the hash is brought
+ *           up to date and compared, nothing is written to the MAC.
+ *   change  one address joined and left again: two updates, each of
+ *           which rewrites a hash register with tx/rx stopped.
+ *
+ * Each update walks the list once and looks every address up in the
+ * driver's table, so the time per address should stay flat as the list
+ * grows. Every address the benchmark added is removed again.
+ */
+#define BENCH_ITERATIONS 1000
+
+static char *ifname = "eth0";
+MODULE_PARM(ifname, "s");
+
+static int listsize[] = { 1, 8, 16, 32, 64, 128, 256, 512 };
+
+static void mc_addr(unsigned char *addr, int i)
+{
+	/* 01:00:5e:xx:xx:xx, the IPv4 multicast range */
+	addr[0] = 0x01;
+	addr[1] = 0x00;
+	addr[2] = 0x5e;
+	addr[3] = (i >> 16) & 0x7f;
+	addr[4] = i >> 8;
+	addr[5] = i;
+}
+
+/* nanoseconds per update; n is a multiple of 1000 */
+#define NSPER(usec, n) ((usec) / ((n) / 1000))
+
+int init_module(void)
+{
+	struct net_device *dev;
+	struct timeval start;
+	unsigned char addr[ETH_ALEN], extra[ETH_ALEN];
+	uint32_t rusec, cusec;
+	int i, n, s;
+
+	dev = dev_get_by_name(ifname);
+	if (dev == NULL) {
+		printk("smaptest: no device %s\n", ifname);
+		return -ENODEV;
+	}
+	if (!(dev->flags & IFF_UP)) {
+		printk("smaptest: %s is not up\n", ifname);
+		dev_put(dev);
+		return -ENETDOWN;
+	}
+
+	/* an address none of the list's can be */
+	mc_addr(extra, 0x7fffff);
+
+	rtnl_lock();
+	printk("smaptest: %s, %d iterations of each\n", ifname, BENCH_ITERATIONS);
+	n = 0;
+	for (s = 0; s < sizeof(listsize) / sizeof(listsize[0]); s++) {
+		for (; n < listsize[s]; n++) {
+			mc_addr(addr, n);
+			if (dev_mc_add(dev, addr, ETH_ALEN, 0) < 0) {
+				printk("smaptest: dev_mc_add() failed\n");
+				goto out;
+			}
+		}
+
+		do_gettimeofday(&start);
+		for (i = 0; i < BENCH_ITERATIONS; i++)
+			dev_mc_upload(dev);
+		rusec = bench_usec(&start);
+
+		do_gettimeofday(&start);
+		for (i = 0; i < BENCH_ITERATIONS; i++) {
+			dev_mc_add(dev, extra, ETH_ALEN, 0);
+			dev_mc_delete(dev, extra, ETH_ALEN, 0);
+		}
+		cusec = bench_usec(&start);
+
+		printk("%4d groups: resync %6d ns, change %6d ns per update\n",
+		       dev->mc_count, NSPER(rusec, BENCH_ITERATIONS),
+		       NSPER(cusec, BENCH_ITERATIONS * 2));
+	}
+ out:
+	while (0 < n--) {
+		mc_addr(addr, n);
+		dev_mc_delete(dev, addr, ETH_ALEN, 0);
+	}
+	rtnl_unlock();
+	dev_put(dev);
+
+	return BENCH_DONE;
+}
@@ -23,6 +23,9 @@
 #include "nodelist.h"
 
 
+/* Gap between background passes when there's no pressure on free space */
+#define JFFS2_GC_IDLE_DELAY (HZ/25)
+
 static int jffs2_garbage_collect_thread(void *);
 static int thread_should_wake(struct jffs2_sb_info *c);
 
@@ -149,9 +152,22 @@ static int jffs2_garbage_collect_thread(void *_c)
 
 		D1(printk(KERN_DEBUG "jffs2_garbage_collect_thread(): pass\n"));
 		jffs2_garbage_collect_pass(c);
+
+		if (thread_should_wake(c) == 1) {
+			/* Only trickling. Pace the passes so that they don't
+			   keep foreground writes waiting on the alloc_sem, and
+			   so that the work is spread out rather than all landing
+			   at once when free space does run short. SIGHUP is
+			   blocked here, so writers calling the trigger don't cut
+			   this short; SIGKILL still does. */
+			set_current_state(TASK_INTERRUPTIBLE);
+			schedule_timeout(JFFS2_GC_IDLE_DELAY);
+		}
 	}
 }
 
+/* Returns 2 if GC should run flat out, 1 if it's worth collecting very
+   dirty blocks at a leisurely pace, or 0 if there's nothing to do */
 static int thread_should_wake(struct jffs2_sb_info *c)
 {
 	int ret = 0;
@@ -159,11 +175,14 @@ static int thread_should_wake(struct jffs2_sb_info *c)
 	if (c->unchecked_size) {
 		D1(printk(KERN_DEBUG "thread_should_wake(): unchecked_size %d, checked_ino #%d\n",
 			  c->unchecked_size, c->checked_ino));
-		return 1;
+		return 2;
 	}
 
 	if (c->nr_free_blocks + c->nr_erasing_blocks < JFFS2_RESERVED_BLOCKS_GCTRIGGER && 
 			(c->dirty_size > c->sector_size)) 
+		ret = 2;
+	else if (c->nr_free_blocks + c->nr_erasing_blocks < JFFS2_RESERVED_BLOCKS_GCIDLE &&
+		 !list_empty(&c->very_dirty_list))
 		ret = 1;
 
 	D1(printk(KERN_DEBUG "thread_should_wake(): nr_free_blocks %d, nr_erasing_blocks %d, dirty_size 0x%x: %s\n", 
@@ -224,6 +224,11 @@ int jffs2_do_mount_fs(struct jffs2_sb_info *c)
 		c->blocks[i].used_size = 0;
 		c->blocks[i].first_node = NULL;
 		c->blocks[i].last_node = NULL;
+		c->blocks[i].fill_seq = 0;
+	}
+	if (jffs2_sum_init(c)) {
+		kfree(c->blocks);
+		return -ENOMEM;
 	}
 
 	init_MUTEX(&c->alloc_sem);
@@ -249,6 +254,7 @@ int jffs2_do_mount_fs(struct jffs2_sb_info *c)
 		D1(printk(KERN_DEBUG "build_fs failed\n"));
 		jffs2_free_ino_caches(c);
 		jffs2_free_raw_node_refs(c);
+		jffs2_sum_exit(c);
 		kfree(c->blocks);
 		return -EIO;
 	}
@@ -11,21 +11,13 @@
  *
  */
 
-#ifdef __KERNEL__
 #include <linux/kernel.h>
 #include <linux/string.h>
 #include <linux/errno.h>
-#else 
-#define KERN_DEBUG
-#define KERN_NOTICE
-#define KERN_WARNING
-#define printk printf
-#include <stdio.h>
-#include <stdint.h>
-#include <errno.h>
-#endif
-
+#include <linux/time.h>
+#include <linux/spinlock.h>
 #include <linux/jffs2.h>
+#include "nodelist.h"
 
 int jffs2_zlib_compress(unsigned char *data_in, unsigned char *cpage_out, uint32_t *sourcelen, uint32_t *dstlen);
 void jffs2_zlib_decompress(unsigned char *data_in, unsigned char *cpage_out, uint32_t srclen, uint32_t destlen);
@@ -35,9 +27,53 @@ int jffs2_rubinmips_compress(unsigned char *data_in, unsigned char *cpage_out, u
 void jffs2_rubinmips_decompress(unsigned char *data_in, unsigned char *cpage_out, uint32_t srclen, uint32_t destlen);
 int jffs2_dynrubin_compress(unsigned char *data_in, unsigned char *cpage_out, uint32_t *sourcelen, uint32_t *dstlen);
 void jffs2_dynrubin_decompress(unsigned char *data_in, unsigned char *cpage_out, uint32_t srclen, uint32_t destlen);
+int jffs2_lzf_compress(unsigned char *data_in, unsigned char *cpage_out, uint32_t *sourcelen, uint32_t *dstlen);
+void jffs2_lzf_decompress(unsigned char *data_in, unsigned char *cpage_out, uint32_t srclen, uint32_t destlen);
+
+struct jffs2_compressor {
+	unsigned char type;
+	int (*compress)(unsigned char *data_in, unsigned char *cpage_out,
+			uint32_t *sourcelen, uint32_t *dstlen);
+};
+
+/* For each mode, the compressors to try in turn until one of them
+   manages to make the data smaller. */
+static struct jffs2_compressor jffs2_compr_size[] = {
+	{ JFFS2_COMPR_ZLIB, jffs2_zlib_compress },
+#if 0 /* Disabled 23/9/1. With zlib it hardly ever gets a look in */
+	{ JFFS2_COMPR_DYNRUBIN, jffs2_dynrubin_compress },
+#endif
+	/* rtime does manage to recompress already-compressed data */
+	{ JFFS2_COMPR_RTIME, jffs2_rtime_compress },
+	{ JFFS2_COMPR_NONE, NULL }
+};
+
+static struct jffs2_compressor jffs2_compr_speed[] = {
+	{ JFFS2_COMPR_LZF, jffs2_lzf_compress },
+	{ JFFS2_COMPR_RTIME, jffs2_rtime_compress },
+	{ JFFS2_COMPR_NONE, NULL }
+};
 
+static struct jffs2_compr_stats jffs2_compr_stats[JFFS2_COMPR_TYPES];
+static spinlock_t jffs2_compr_stats_lock = SPIN_LOCK_UNLOCKED;
+
+static uint32_t jffs2_compr_usec(struct timeval *start)
+{
+	struct timeval now;
+
+	do_gettimeofday(&now);
+	return (now.tv_sec - start->tv_sec) * 1000000 + now.tv_usec - start->tv_usec;
+}
+
+void jffs2_get_compr_stats(struct jffs2_compr_stats *stats)
+{
+	spin_lock(&jffs2_compr_stats_lock);
+	memcpy(stats, jffs2_compr_stats, sizeof(jffs2_compr_stats));
+	spin_unlock(&jffs2_compr_stats_lock);
+}
 
 /* jffs2_compress:
+ * @c: The filesystem. c->compr_mode chooses which compressors are tried.
  * @data: Pointer to uncompressed data
  * @cdata: Pointer to buffer for compressed data
  * @datalen: On entry, holds the amount of data available for compression.
@@ -54,31 +90,45 @@ void jffs2_dynrubin_decompress(unsigned char *data_in, unsigned char *cpage_out,
  * jffs2_compress should compress as much as will fit, and should set 
  * *datalen accordingly to show the amount of data which were compressed.
  */
-unsigned char jffs2_compress(unsigned char *data_in, unsigned char *cpage_out, 
-		    uint32_t *datalen, uint32_t *cdatalen)
+unsigned char jffs2_compress(struct jffs2_sb_info *c, unsigned char *data_in,
+			     unsigned char *cpage_out, uint32_t *datalen, uint32_t *cdatalen)
 {
+	struct jffs2_compressor *compr;
+	struct jffs2_compr_stats *st;
+	struct timeval start;
+	uint32_t usec;
 	int ret;
 
-	ret = jffs2_zlib_compress(data_in, cpage_out, datalen, cdatalen);
-	if (!ret) {
-		return JFFS2_COMPR_ZLIB;
-	}
-#if 0 /* Disabled 23/9/1. With zlib it hardly ever gets a look in */
-	ret = jffs2_dynrubin_compress(data_in, cpage_out, datalen, cdatalen);
-	if (!ret) {
-		return JFFS2_COMPR_DYNRUBIN;
-	}
-#endif
-#if 0 /* Disabled 26/2/1. Obsoleted by dynrubin */
-	ret = jffs2_rubinmips_compress(data_in, cpage_out, datalen, cdatalen);
-	if (!ret) {
-		return JFFS2_COMPR_RUBINMIPS;
+	switch (c->compr_mode) {
+	case JFFS2_COMPR_MODE_SPEED:
+		compr = jffs2_compr_speed;
+		break;
+	case JFFS2_COMPR_MODE_SIZE:
+		compr = jffs2_compr_size;
+		break;
+	default:
+		return JFFS2_COMPR_NONE;
 	}
-#endif
-	/* rtime does manage to recompress already-compressed data */
-	ret = jffs2_rtime_compress(data_in, cpage_out, datalen, cdatalen);
-	if (!ret) {
-		return JFFS2_COMPR_RTIME;
+
+	for ( ; compr->compress; compr++) {
+		do_gettimeofday(&start);
+		ret = compr->compress(data_in, cpage_out, datalen, cdatalen);
+		usec = jffs2_compr_usec(&start);
+
+		st = &jffs2_compr_stats[compr->type];
+		spin_lock(&jffs2_compr_stats_lock);
+		st->attempts++;
+		st->compr_usec += usec;
+		if (ret) {
+			st->failures++;
+		} else {
+			st->compr_in += *datalen;
+			st->compr_out += *cdatalen;
+		}
+		spin_unlock(&jffs2_compr_stats_lock);
+
+		if (!ret)
+			return compr->type;
 	}
 #if 0
 	/* We don't need to copy. Let the caller special-case the COMPR_NONE case. */
@@ -96,6 +146,11 @@ unsigned char jffs2_compress(unsigned char *data_in, unsigned char *cpage_out,
 int jffs2_decompress(unsigned char comprtype, unsigned char *cdata_in, 
 		     unsigned char *data_out, uint32_t cdatalen, uint32_t datalen)
 {
+	struct timeval start;
+	uint32_t usec;
+
+	do_gettimeofday(&start);
+
 	switch (comprtype) {
 	case JFFS2_COMPR_NONE:
 		/* This should be special-cased elsewhere, but we might as well deal with it */
@@ -114,6 +169,10 @@ int jffs2_decompress(unsigned char comprtype, unsigned char *cdata_in,
 		jffs2_rtime_decompress(cdata_in, data_out, cdatalen, datalen);
 		break;
 
+	case JFFS2_COMPR_LZF:
+		jffs2_lzf_decompress(cdata_in, data_out, cdatalen, datalen);
+		break;
+
 	case JFFS2_COMPR_RUBINMIPS:
 #if 0 /* Disabled 23/9/1 */
 		jffs2_rubinmips_decompress(cdata_in, data_out, cdatalen, datalen);
@@ -133,5 +192,11 @@ int jffs2_decompress(unsigned char comprtype, unsigned char *cdata_in,
 		printk(KERN_NOTICE "Unknown JFFS2 compression type 0x%02x\n", comprtype);
 		return -EIO;
 	}
+
+	usec = jffs2_compr_usec(&start);
+	spin_lock(&jffs2_compr_stats_lock);
+	jffs2_compr_stats[comprtype].decompr_bytes += datalen;
+	jffs2_compr_stats[comprtype].decompr_usec += usec;
+	spin_unlock(&jffs2_compr_stats_lock);
 	return 0;
 }
@@ -0,0 +1,152 @@
+/*
+ * JFFS2 -- Journalling Flash File System, Version 2.
+ *
+ * For licensing information, see the file 'LICENCE' in this directory.
+ *
+ *
+ * Fast byte-oriented LZ77 compressor, using the LZF stream format.
+ *
+ * It makes a single pass over the data, looking up each three-byte
+ * sequence in a small hash table of recent positions, and never goes
+ * back to look for a better match. That makes it several times faster
+ * than zlib in both directions, for a worse compression ratio.
+ *
+ * The stream is a sequence of control bytes:
+ *   000LLLLL                      L+1 literal bytes follow
+ *   LLLooooo oooooooo             copy L+2 bytes from o+1 bytes back
+ *   111ooooo LLLLLLLL oooooooo    copy L+9 bytes from o+1 bytes back
+ *
+ * Nodes carry it as JFFS2_COMPR_LZF (0x0f), which only this tree knows;
+ * it is not the LZO type of other JFFS2 implementations.
+ */
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+
+#define LZF_HLOG	9
+#define LZF_HSIZE	(1 << LZF_HLOG)
+#define LZF_MAX_LIT	(1 << 5)
+#define LZF_MAX_OFF	(1 << 13)
+#define LZF_MAX_REF	((1 << 8) + (1 << 3))
+
+#define LZF_HASH(p)	((((p)[0] << 16 | (p)[1] << 8 | (p)[2]) * 0x9e3779b1U) >> (32 - LZF_HLOG))
+
+/* Copy the literals in[lit] to in[end-1] to the output, as many as will
+   fit. Returns the position of the first literal not copied. */
+static uint32_t lzf_literals(unsigned char *in, uint32_t lit, uint32_t end,
+			     unsigned char *out, uint32_t *op, uint32_t outlen)
+{
+	while (lit < end && *op + 1 < outlen) {
+		uint32_t n = min(end - lit, (uint32_t)LZF_MAX_LIT);
+
+		n = min(n, outlen - *op - 1);
+		out[(*op)++] = n - 1;
+		memcpy(out + *op, in + lit, n);
+		*op += n;
+		lit += n;
+	}
+	return lit;
+}
+
+int jffs2_lzf_compress(unsigned char *data_in, unsigned char *cpage_out,
+		       uint32_t *sourcelen, uint32_t *dstlen)
+{
+	unsigned short htab[LZF_HSIZE];
+	uint32_t srclen = min(*sourcelen, (uint32_t)0xffff);
+	uint32_t ip = 0, lit = 0, op = 0;
+
+	memset(htab, 0, sizeof(htab));
+
+	while (ip + 2 < srclen) {
+		unsigned char *p = data_in + ip;
+		uint32_t h = LZF_HASH(p);
+		uint32_t ref = htab[h];
+		uint32_t off = ip - ref - 1;
+		uint32_t len, maxlen;
+
+		htab[h] = ip;
+
+		if (ref >= ip || off >= LZF_MAX_OFF || data_in[ref] != p[0] ||
+		    data_in[ref+1] != p[1] || data_in[ref+2] != p[2]) {
+			ip++;
+			continue;
+		}
+
+		maxlen = min(srclen - ip, (uint32_t)LZF_MAX_REF);
+		for (len = 3; len < maxlen && data_in[ref+len] == p[len]; len++)
+			;
+
+		/* The literals before the match, then up to three bytes of reference */
+		lit = lzf_literals(data_in, lit, ip, cpage_out, &op, *dstlen);
+		if (lit != ip || op + 3 > *dstlen)
+			goto out;
+
+		len -= 2;
+		if (len < 7) {
+			cpage_out[op++] = (len << 5) | (off >> 8);
+		} else {
+			cpage_out[op++] = (7 << 5) | (off >> 8);
+			cpage_out[op++] = len - 7;
+		}
+		cpage_out[op++] = off;
+
+		ip += len + 2;
+		lit = ip;
+	}
+	ip = srclen;
+ out:
+	lit = lzf_literals(data_in, lit, ip, cpage_out, &op, *dstlen);
+
+	if (op >= lit) {
+		/* We failed */
+		return -1;
+	}
+
+	/* Tell the caller how much we managed to compress, and how much space it took */
+	*sourcelen = lit;
+	*dstlen = op;
+	return 0;
+}
+
+void jffs2_lzf_decompress(unsigned char *data_in, unsigned char *cpage_out,
+			  uint32_t srclen, uint32_t destlen)
+{
+	uint32_t ip = 0, op = 0;
+
+	while (op < destlen && ip < srclen) {
+		uint32_t ctrl = data_in[ip++];
+		uint32_t len, back;
+
+		if (ctrl < LZF_MAX_LIT) {
+			len = ctrl + 1;
+			if (ip + len > srclen || op + len > destlen)
+				break;
+			memcpy(cpage_out + op, data_in + ip, len);
+			ip += len;
+			op += len;
+			continue;
+		}
+
+		len = ctrl >> 5;
+		if (len == 7 && ip < srclen)
+			len += data_in[ip++];
+		if (ip >= srclen)
+			break;
+		back = ((ctrl & 0x1f) << 8) + data_in[ip++] + 1;
+		len += 2;
+		if (back > op || op + len > destlen)
+			break;
+
+		/* Overlapping copies are how runs are encoded, so byte by byte */
+		while (len--) {
+			cpage_out[op] = cpage_out[op - back];
+			op++;
+		}
+	}
+
+	if (op != destlen)
+		printk(KERN_WARNING "jffs2_lzf_decompress(): corrupt data: %d of %d bytes decoded\n",
+		       op, destlen);
+}
@@ -2,8 +2,21 @@
 
 #include <linux/kernel.h>
 #include <linux/string.h>
+#include <linux/errno.h>
 #include <linux/module.h>
+#include <linux/bench.h>
 #include <asm/types.h>
+
+/*
+ * Compression benchmark. When JFFS2 is a module, it is built as
+ * jffs2_comprtest.o with its own copy of the compr_*.o objects; a
+ * built-in JFFS2 directory isn't visited for modules. Each compressor
+ * is run BENCH_ITERATIONS times on the test data below and on a page
+ * of random bytes, and the ratio and the throughput in each direction
+ * are printed.
+ */
+#define BENCH_ITERATIONS 100
+#define BENCH_BUFLEN 4096
 #if 0
 #define TESTDATA_LEN 512
 static unsigned char testdata[TESTDATA_LEN] = {
@@ -262,46 +275,91 @@ static unsigned char testdata[TESTDATA_LEN] = {
  0x35, 0x30, 0x30, 0x30, 0x29, 0x3b, 0x0a, 0x7d, 0x0a
 };
 #endif
-static unsigned char comprbuf[TESTDATA_LEN];
-static unsigned char decomprbuf[TESTDATA_LEN];
+static unsigned char randdata[BENCH_BUFLEN];
+static unsigned char comprbuf[BENCH_BUFLEN];
+static unsigned char decomprbuf[BENCH_BUFLEN];
+
+int jffs2_zlib_init(void);
+void jffs2_zlib_exit(void);
+int jffs2_zlib_compress(unsigned char *data_in, unsigned char *cpage_out, uint32_t *sourcelen, uint32_t *dstlen);
+void jffs2_zlib_decompress(unsigned char *data_in, unsigned char *cpage_out, uint32_t srclen, uint32_t destlen);
+int jffs2_rtime_compress(unsigned char *data_in, unsigned char *cpage_out, uint32_t *sourcelen, uint32_t *dstlen);
+void jffs2_rtime_decompress(unsigned char *data_in, unsigned char *cpage_out, uint32_t srclen, uint32_t destlen);
+int jffs2_dynrubin_compress(unsigned char *data_in, unsigned char *cpage_out, uint32_t *sourcelen, uint32_t *dstlen);
+void jffs2_dynrubin_decompress(unsigned char *data_in, unsigned char *cpage_out, uint32_t srclen, uint32_t destlen);
+int jffs2_lzf_compress(unsigned char *data_in, unsigned char *cpage_out, uint32_t *sourcelen, uint32_t *dstlen);
+void jffs2_lzf_decompress(unsigned char *data_in, unsigned char *cpage_out, uint32_t srclen, uint32_t destlen);
+
+static struct {
+	char *name;
+	int (*compress)(unsigned char *, unsigned char *, uint32_t *, uint32_t *);
+	void (*decompress)(unsigned char *, unsigned char *, uint32_t, uint32_t);
+} compressors[] = {
+	{ "zlib", jffs2_zlib_compress, jffs2_zlib_decompress },
+	{ "rtime", jffs2_rtime_compress, jffs2_rtime_decompress },
+	{ "dynrubin", jffs2_dynrubin_compress, jffs2_dynrubin_decompress },
+	{ "lzf", jffs2_lzf_compress, jffs2_lzf_decompress },
+};
+
+/* Bytes processed in usec microseconds, as KiB/s. 1000000/1024 ~= 976 */
+#define KIBPS(bytes, usec) ((bytes) * BENCH_ITERATIONS * 976 / (usec))
+
+static void bench(int n, char *what, unsigned char *data, uint32_t len)
+{
+	struct timeval start;
+	uint32_t c, d, cusec, dusec;
+	int i, ret = 0;
 
-int jffs2_decompress(unsigned char comprtype, unsigned char *cdata_in, 
-		     unsigned char *data_out, uint32_t cdatalen, uint32_t datalen);
-unsigned char jffs2_compress(unsigned char *data_in, unsigned char *cpage_out, 
-			     uint32_t *datalen, uint32_t *cdatalen);
+	do_gettimeofday(&start);
+	for (i = 0; i < BENCH_ITERATIONS; i++) {
+		d = len;
+		c = len;
+		ret = compressors[n].compress(data, comprbuf, &d, &c);
+	}
+	cusec = bench_usec(&start);
+
+	if (ret) {
+		printk("%-8s %-6s: %4d bytes, no gain.        compress %6d KiB/s\n",
+		       compressors[n].name, what, len, KIBPS(len, cusec));
+		return;
+	}
+
+	do_gettimeofday(&start);
+	for (i = 0; i < BENCH_ITERATIONS; i++)
+		compressors[n].decompress(comprbuf, decomprbuf, c, d);
+	dusec = bench_usec(&start);
+
+	if (memcmp(decomprbuf, data, d)) {
+		printk("%-8s %-6s: compression and decompression corrupted data\n",
+		       compressors[n].name, what);
+		return;
+	}
+
+	printk("%-8s %-6s: %4d -> %4d bytes (%3d%%), compress %6d KiB/s, decompress %6d KiB/s\n",
+	       compressors[n].name, what, d, c, c * 100 / d,
+	       KIBPS(d, cusec), KIBPS(d, dusec));
+}
 
 int init_module(void ) {
-	unsigned char comprtype;
-	uint32_t c, d;
-	int ret;
+	uint32_t seed = 0x12345678;
+	int i;
+
+	if (jffs2_zlib_init()) {
+		printk("comprtest: failed to initialise zlib workspaces\n");
+		return -ENOMEM;
+	}
 
-	printk("Original data: %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x\n",
-	       testdata[0],testdata[1],testdata[2],testdata[3], 
-	       testdata[4],testdata[5],testdata[6],testdata[7], 
-	       testdata[8],testdata[9],testdata[10],testdata[11], 
-	       testdata[12],testdata[13],testdata[14],testdata[15]); 
-	d = TESTDATA_LEN;
-	c = TESTDATA_LEN;
-	comprtype = jffs2_compress(testdata, comprbuf, &d, &c);
+	for (i = 0; i < BENCH_BUFLEN; i++) {
+		seed = seed * 1103515245 + 12345;
+		randdata[i] = seed >> 16;
+	}
 
-	printk("jffs2_compress used compression type %d. Compressed size %d, uncompressed size %d\n",
-	       comprtype, c, d);
-	printk("Compressed data: %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x\n",
-	       comprbuf[0],comprbuf[1],comprbuf[2],comprbuf[3], 
-	       comprbuf[4],comprbuf[5],comprbuf[6],comprbuf[7], 
-	       comprbuf[8],comprbuf[9],comprbuf[10],comprbuf[11], 
-	       comprbuf[12],comprbuf[13],comprbuf[14],comprbuf[15]); 
+	printk("comprtest: %d iterations of each\n", BENCH_ITERATIONS);
+	for (i = 0; i < sizeof(compressors) / sizeof(compressors[0]); i++) {
+		bench(i, "text", testdata, TESTDATA_LEN);
+		bench(i, "random", randdata, BENCH_BUFLEN);
+	}
 
-	ret = jffs2_decompress(comprtype, comprbuf, decomprbuf, c, d);
-	printk("jffs2_decompress returned %d\n", ret);
-	printk("Decompressed data:  %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x\n",
-	       decomprbuf[0],decomprbuf[1],decomprbuf[2],decomprbuf[3], 
-	       decomprbuf[4],decomprbuf[5],decomprbuf[6],decomprbuf[7], 
-	       decomprbuf[8],decomprbuf[9],decomprbuf[10],decomprbuf[11], 
-	       decomprbuf[12],decomprbuf[13],decomprbuf[14],decomprbuf[15]); 
-	if (memcmp(decomprbuf, testdata, d))
-		printk("Compression and decompression corrupted data\n");
-	else
-		printk("Compression good for %d bytes\n", d);
-	return 1;
+	jffs2_zlib_exit();
+	return BENCH_DONE;
 }
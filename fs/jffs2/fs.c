@@ -160,13 +160,58 @@ void jffs2_read_inode (struct inode *inode)
 }
 
 
+/* Mount options: "compr=size", "compr=speed" or "compr=none". Nodes
+   written with compr=speed use JFFS2_COMPR_LZF, which other kernels
+   can't read, so it is never the default. */
+static int jffs2_parse_options(char *data, int *compr_mode)
+{
+	char *opt, *value;
+
+	if (!data)
+		return 0;
+
+	while ((opt = strsep(&data, ",")) != NULL) {
+		if (!*opt)
+			continue;
+
+		value = strchr(opt, '=');
+		if (value)
+			*value++ = 0;
+
+		if (strcmp(opt, "compr") || !value)
+			goto bad;
+
+		if (!strcmp(value, "size"))
+			*compr_mode = JFFS2_COMPR_MODE_SIZE;
+		else if (!strcmp(value, "speed")) {
+			printk(KERN_NOTICE "jffs2: compr=speed writes LZF nodes, which only kernels with JFFS2_COMPR_LZF can read\n");
+			*compr_mode = JFFS2_COMPR_MODE_SPEED;
+		}
+		else if (!strcmp(value, "none"))
+			*compr_mode = JFFS2_COMPR_MODE_NONE;
+		else
+			goto bad;
+	}
+	return 0;
+
+ bad:
+	printk(KERN_ERR "jffs2: Unrecognised mount option \"%s%s%s\"\n",
+	       opt, value?"=":"", value?value:"");
+	return -EINVAL;
+}
+
 int jffs2_remount_fs (struct super_block *sb, int *flags, char *data)
 {
 	struct jffs2_sb_info *c = JFFS2_SB_INFO(sb);
+	int compr_mode = c->compr_mode;
 
 	if (c->flags & JFFS2_SB_FLAG_RO && !(sb->s_flags & MS_RDONLY))
 		return -EROFS;
 
+	if (jffs2_parse_options(data, &compr_mode))
+		return -EINVAL;
+	c->compr_mode = compr_mode;
+
 	/* We stop if it was running, then restart if it needs to.
 	   This also catches the case where it was stopped and this
 	   is just a remount to restart it */
@@ -261,6 +306,10 @@ int jffs2_do_fill_super(struct super_block *sb, void *data, int silent)
 
 	c = JFFS2_SB_INFO(sb);
 
+	c->compr_mode = JFFS2_COMPR_MODE_SIZE;
+	if (jffs2_parse_options(data, &c->compr_mode))
+		return -EINVAL;
+
 	c->sector_size = c->mtd->erasesize;
 	c->flash_size = c->mtd->size;
 
@@ -340,6 +389,7 @@ int jffs2_do_fill_super(struct super_block *sb, void *data, int silent)
  out_nodes:
 	jffs2_free_ino_caches(c);
 	jffs2_free_raw_node_refs(c);
+	jffs2_sum_exit(c);
 	kfree(c->blocks);
  out_inohash:
 	kfree(c->inocache_list);
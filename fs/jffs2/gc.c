@@ -18,6 +18,7 @@
 #include <linux/pagemap.h>
 #include <linux/crc32.h>
 #include <linux/compiler.h>
+#include <linux/time.h>
 #include "nodelist.h"
 
 static int jffs2_garbage_collect_metadata(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb, 
@@ -33,33 +34,67 @@ static int jffs2_garbage_collect_dnode(struct jffs2_sb_info *c, struct jffs2_era
 				       struct jffs2_inode_info *f, struct jffs2_full_dnode *fn,
 				       uint32_t start, uint32_t end);
 
+/* Cost-benefit score of collecting jeb: the space we'd get back, weighted
+   by how long the block has gone unwritten, over the cost of copying out
+   the live data. Old blocks hold data which has stopped changing, so
+   what's dirty in them is worth more than the same amount of dirt in a
+   block whose remaining nodes are likely to die soon anyway. */
+static uint32_t jffs2_gc_score(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb)
+{
+	uint32_t live, age;
+
+	/* In 1/256ths of a block, to keep the product within 32 bits */
+	live = ((jeb->used_size + jeb->unchecked_size) >> 8) * 256 / (c->sector_size >> 8);
+	age = min_t(uint32_t, c->fill_seq - jeb->fill_seq, 0x3fff);
+
+	return (256 - live) * (age + 1) / (live + 1);
+}
+
+/* Called with erase_completion_lock held */
+static struct list_head *jffs2_best_gc_block(struct jffs2_sb_info *c)
+{
+	struct list_head *lists[2] = { &c->very_dirty_list, &c->dirty_list };
+	struct list_head *this, *best = NULL;
+	uint32_t score, best_score = 0;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		list_for_each(this, lists[i]) {
+			score = jffs2_gc_score(c, list_entry(this, struct jffs2_eraseblock, list));
+			if (!best || score > best_score) {
+				best = this;
+				best_score = score;
+			}
+		}
+	}
+	return best;
+}
+
 /* Called with erase_completion_lock held */
 static struct jffs2_eraseblock *jffs2_find_gc_block(struct jffs2_sb_info *c)
 {
 	struct jffs2_eraseblock *ret;
 	struct list_head *nextlist = NULL;
+	struct list_head *best;
 	int n = jiffies % 128;
 
-	/* Pick an eraseblock to garbage collect next. This is where we'll
-	   put the clever wear-levelling algorithms. Eventually.  */
-	/* We possibly want to favour the dirtier blocks more when the
-	   number of free blocks is low. */
 	if (!list_empty(&c->bad_used_list) && c->nr_free_blocks > JFFS2_RESERVED_BLOCKS_GCBAD) {
 		D1(printk(KERN_DEBUG "Picking block from bad_used_list to GC next\n"));
 		nextlist = &c->bad_used_list;
-	} else if (n < 50 && !list_empty(&c->erasable_list)) {
-		/* Note that most of them will have gone directly to be erased. 
-		   So don't favour the erasable_list _too_ much. */
+	} else if (!list_empty(&c->erasable_list)) {
+		/* Nothing to copy. Most of them will have gone directly to
+		   be erased anyway. */
 		D1(printk(KERN_DEBUG "Picking block from erasable_list to GC next\n"));
 		nextlist = &c->erasable_list;
-	} else if (n < 110 && !list_empty(&c->very_dirty_list)) {
-		/* Most of the time, pick one off the very_dirty list */
-		D1(printk(KERN_DEBUG "Picking block from very_dirty_list to GC next\n"));
-		nextlist = &c->very_dirty_list;
-	} else if (n < 126 && !list_empty(&c->dirty_list)) {
-		D1(printk(KERN_DEBUG "Picking block from dirty_list to GC next\n"));
-		nextlist = &c->dirty_list;
+	} else if (n >= 2 && (best = jffs2_best_gc_block(c))) {
+		/* Most of the time, the dirty block which gives the best return */
+		ret = list_entry(best, struct jffs2_eraseblock, list);
+		D1(printk(KERN_DEBUG "Picking block at 0x%08x (used 0x%08x, dirty 0x%08x, age %u) to GC next\n",
+			  ret->offset, ret->used_size, ret->dirty_size, c->fill_seq - ret->fill_seq));
+		nextlist = best->prev;
 	} else if (!list_empty(&c->clean_list)) {
+		/* Occasionally a clean one, so that static data still gets
+		   moved about for wear levelling */
 		D1(printk(KERN_DEBUG "Picking block from clean_list to GC next\n"));
 		nextlist = &c->clean_list;
 	} else if (!list_empty(&c->dirty_list)) {
@@ -69,10 +104,6 @@ static struct jffs2_eraseblock *jffs2_find_gc_block(struct jffs2_sb_info *c)
 	} else if (!list_empty(&c->very_dirty_list)) {
 		D1(printk(KERN_DEBUG "Picking block from very_dirty_list to GC next (clean_list and dirty_list were empty)\n"));
 		nextlist = &c->very_dirty_list;
-	} else if (!list_empty(&c->erasable_list)) {
-		D1(printk(KERN_DEBUG "Picking block from erasable_list to GC next (clean_list and {very_,}dirty_list were empty)\n"));
-
-		nextlist = &c->erasable_list;
 	} else {
 		/* Eep. All were empty */
 		printk(KERN_NOTICE "jffs2: No clean, dirty _or_ erasable blocks to GC from! Where are they all?\n");
@@ -101,11 +132,12 @@ static struct jffs2_eraseblock *jffs2_find_gc_block(struct jffs2_sb_info *c)
 	return ret;
 }
 
-/* jffs2_garbage_collect_pass
+/* jffs2_do_garbage_collect_pass
  * Make a single attempt to progress GC. Move one node, and possibly
- * start erasing one eraseblock.
+ * start erasing one eraseblock. Called with alloc_sem held, and
+ * releases it.
  */
-int jffs2_garbage_collect_pass(struct jffs2_sb_info *c)
+static int jffs2_do_garbage_collect_pass(struct jffs2_sb_info *c)
 {
 	struct jffs2_eraseblock *jeb;
 	struct jffs2_inode_info *f;
@@ -118,9 +150,6 @@ int jffs2_garbage_collect_pass(struct jffs2_sb_info *c)
 	struct inode *inode;
 	int ret = 0;
 
-	if (down_interruptible(&c->alloc_sem))
-		return -EINTR;
-
 	spin_lock_bh(&c->erase_completion_lock);
 
 	while (c->unchecked_size) {
@@ -319,6 +348,7 @@ int jffs2_garbage_collect_pass(struct jffs2_sb_info *c)
 		list_add_tail(&c->gcblock->list, &c->erase_pending_list);
 		c->gcblock = NULL;
 		c->nr_erasing_blocks++;
+		c->gc_stats.blocks++;
 		jffs2_erase_pending_trigger(c);
 	}
 	spin_unlock_bh(&c->erase_completion_lock);
@@ -326,6 +356,36 @@ int jffs2_garbage_collect_pass(struct jffs2_sb_info *c)
 	return ret;
 }
 
+/* jffs2_garbage_collect_pass
+ * As above, and account for how long the pass took. The time spent
+ * waiting for alloc_sem is not part of the pass, and a pass that was
+ * interrupted while waiting for it is not counted.
+ */
+int jffs2_garbage_collect_pass(struct jffs2_sb_info *c)
+{
+	struct timeval start, end;
+	uint32_t usec;
+	int ret;
+
+	if (down_interruptible(&c->alloc_sem))
+		return -EINTR;
+
+	do_gettimeofday(&start);
+	ret = jffs2_do_garbage_collect_pass(c);
+	do_gettimeofday(&end);
+
+	usec = (end.tv_sec - start.tv_sec) * 1000000 + end.tv_usec - start.tv_usec;
+
+	spin_lock_bh(&c->erase_completion_lock);
+	c->gc_stats.passes++;
+	c->gc_stats.pass_usec += usec;
+	if (usec > c->gc_stats.pass_usec_max)
+		c->gc_stats.pass_usec_max = usec;
+	spin_unlock_bh(&c->erase_completion_lock);
+
+	return ret;
+}
+
 static int jffs2_garbage_collect_metadata(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb, 
 					struct jffs2_inode_info *f, struct jffs2_full_dnode *fn)
 {
@@ -790,7 +850,7 @@ static int jffs2_garbage_collect_dnode(struct jffs2_sb_info *c, struct jffs2_era
 		writebuf = pg_ptr + (offset & (PAGE_CACHE_SIZE -1));
 
 		if (comprbuf) {
-			comprtype = jffs2_compress(writebuf, comprbuf, &datalen, &cdatalen);
+			comprtype = jffs2_compress(c, writebuf, comprbuf, &datalen, &cdatalen);
 		}
 		if (comprtype) {
 			writebuf = comprbuf;
@@ -11,11 +11,38 @@
  *
  */
 
+#include <linux/kernel.h>
+#include <linux/sched.h>
 #include <linux/fs.h>
+#include <linux/interrupt.h>
+#include <asm/uaccess.h>
+#include "nodelist.h"
 
 int jffs2_ioctl(struct inode *inode, struct file *filp, unsigned int cmd, 
 		unsigned long arg)
 {
+	struct jffs2_sb_info *c = JFFS2_SB_INFO(inode->i_sb);
+	struct jffs2_gc_stats stats;
+	struct jffs2_compr_stats cstats[JFFS2_COMPR_TYPES];
+
+	switch (cmd) {
+	case JFFS2_IOC_GCSTATS:
+		spin_lock_bh(&c->erase_completion_lock);
+		stats = c->gc_stats;
+		spin_unlock_bh(&c->erase_completion_lock);
+
+		if (copy_to_user((void *)arg, &stats, sizeof(stats)))
+			return -EFAULT;
+		return 0;
+
+	case JFFS2_IOC_COMPRSTATS:
+		jffs2_get_compr_stats(cstats);
+
+		if (copy_to_user((void *)arg, cstats, sizeof(cstats)))
+			return -EFAULT;
+		return 0;
+	}
+
 	/* Later, this will provide for lsattr.jffs2 and chattr.jffs2, which
 	   will include compression support etc. */
 	return -EINVAL;
@@ -0,0 +1,139 @@
+/*
+ * JFFS2 -- Journalling Flash File System, Version 2.
+ *
+ * For licensing information, see the file 'LICENCE' in this directory.
+ *
+ *
+ * Mount time benchmark. It is built as jffs2_mounttest.o, next to
+ * comprtest and under the same conditions, with its own copy of the
+ * JFFS2 objects other than super-v24.o and super.o. Load it with
+ * mtd=<number> of an MTD device (mtdram, nandsim or real flash) that
+ * holds a JFFS2 image and is not mounted. The JFFS2 module itself must
+ * not be loaded, since both would create the same slab caches.
+ *
+ * The device is scanned and the node lists are built BENCH_MOUNTS
+ * times, exactly as at mount time, and the time each took goes to the
+ * kernel log. Nothing is written to the flash. Blocks with a valid
+ * summary are accounted from it, all others are scanned in full; an
+ * image written by a kernel without CONFIG_JFFS2_SUMMARY gives the
+ * full scan figure to compare with.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/bench.h>
+#include <linux/jffs2.h>
+#include <linux/mtd/mtd.h>
+#include "nodelist.h"
+
+#define BENCH_MOUNTS 5
+
+static int mtd = -1;
+MODULE_PARM(mtd, "i");
+
+/* The parts of jffs2_do_fill_super() that come before the scan */
+static int bench_mount(struct super_block *sb, uint32_t *usec)
+{
+	struct jffs2_sb_info *c = JFFS2_SB_INFO(sb);
+	struct mtd_info *m = c->mtd;
+	struct timeval start;
+	int ret;
+
+	memset(c, 0, sizeof(*c));
+	c->mtd = m;
+	c->sector_size = c->mtd->erasesize;
+	c->flash_size = c->mtd->size;
+	c->cleanmarker_size = sizeof(struct jffs2_unknown_node);
+	if (jffs2_cleanmarker_oob(c))
+		c->cleanmarker_size = 0;
+	if (c->mtd->type == MTD_NANDFLASH) {
+		c->wbuf_pagesize = c->mtd->oobblock;
+		c->wbuf_ofs = 0xFFFFFFFF;
+		c->wbuf = kmalloc(c->wbuf_pagesize, GFP_KERNEL);
+		if (!c->wbuf)
+			return -ENOMEM;
+	}
+	c->inocache_list = kmalloc(INOCACHE_HASHSIZE * sizeof(struct jffs2_inode_cache *), GFP_KERNEL);
+	if (!c->inocache_list) {
+		ret = -ENOMEM;
+		goto out_wbuf;
+	}
+	memset(c->inocache_list, 0, INOCACHE_HASHSIZE * sizeof(struct jffs2_inode_cache *));
+
+	do_gettimeofday(&start);
+	ret = jffs2_do_mount_fs(c);
+	*usec = bench_usec(&start);
+	if (ret)
+		goto out_inohash;
+
+	jffs2_free_ino_caches(c);
+	jffs2_free_raw_node_refs(c);
+	jffs2_sum_exit(c);
+	kfree(c->blocks);
+ out_inohash:
+	kfree(c->inocache_list);
+ out_wbuf:
+	if (c->wbuf)
+		kfree(c->wbuf);
+	return ret;
+}
+
+int init_module(void)
+{
+	struct super_block *sb;
+	struct mtd_info *m;
+	uint32_t usec, total = 0;
+	int i, ret;
+
+	if (mtd < 0) {
+		printk("mounttest: give the MTD device as mtd=\n");
+		return -EINVAL;
+	}
+	m = get_mtd_device(NULL, mtd);
+	if (!m) {
+		printk("mounttest: no MTD device %d\n", mtd);
+		return -ENODEV;
+	}
+	if (m->size < 5 * m->erasesize) {
+		printk("mounttest: too few erase blocks on MTD device %d\n", mtd);
+		put_mtd_device(m);
+		return -EINVAL;
+	}
+
+	/* jffs2_erase_pending_trigger() finds the super block around c */
+	sb = kmalloc(sizeof(*sb), GFP_KERNEL);
+	if (!sb) {
+		put_mtd_device(m);
+		return -ENOMEM;
+	}
+	memset(sb, 0, sizeof(*sb));
+	ret = jffs2_create_slab_caches();
+	if (ret) {
+		printk("mounttest: failed to initialise slab caches\n");
+		goto out;
+	}
+
+	printk("mounttest: \"%s\", %d blocks of %dKiB\n", m->name,
+	       m->size / m->erasesize, m->erasesize / 1024);
+	for (i = 0; i < BENCH_MOUNTS; i++) {
+		JFFS2_SB_INFO(sb)->mtd = m;
+		if ((ret = bench_mount(sb, &usec))) {
+			printk("mounttest: scan failed, %d\n", ret);
+			break;
+		}
+		printk("mount %d: %6d ms\n", i, usec / 1000);
+		total += usec;
+	}
+	if (i == BENCH_MOUNTS)
+		printk("mounttest: %d ms on average, %d ms per MiB\n",
+		       total / BENCH_MOUNTS / 1000,
+		       total / BENCH_MOUNTS / 1000 * 1024 / (m->size / 1024 ? m->size / 1024 : 1));
+
+	jffs2_destroy_slab_caches();
+ out:
+	kfree(sb);
+	put_mtd_device(m);
+	return BENCH_DONE;
+}
@@ -145,7 +145,16 @@ int jffs2_get_inode_nodes(struct jffs2_sb_info *c, ino_t ino, struct jffs2_inode
 			err = -EIO;
 			goto free_out;
 		}
-			
+
+		if (!(je16_to_cpu(node.u.nodetype) & JFFS2_NODE_ACCURATE)) {
+			/* Obsoleted on the flash after the erase block summary which
+			   we mounted from was written. Catch up with it now. */
+			D1(printk(KERN_DEBUG "Node at 0x%08x was obsoleted on flash\n", ref_offset(ref)));
+			jffs2_mark_node_obsolete(c, ref);
+			spin_lock_bh(&c->erase_completion_lock);
+			continue;
+		}
+
 		switch (je16_to_cpu(node.u.nodetype)) {
 		case JFFS2_NODETYPE_DIRENT:
 			D1(printk(KERN_DEBUG "Node at %08x (%d) is a dirent node\n", ref_offset(ref), ref_flags(ref)));
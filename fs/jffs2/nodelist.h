@@ -181,6 +181,9 @@ struct jffs2_eraseblock
 
 	struct jffs2_raw_node_ref *gc_node;	/* Next node to be garbage collected */
 
+	uint32_t fill_seq;	/* c->fill_seq when the block was filled, or
+				   zero if it was found full at mount time */
+
 	/* For deletia. When a dirent node in this eraseblock is
 	   deleted by a node elsewhere, that other node can only 
 	   be marked as obsolete when this block is actually erased.
@@ -236,6 +239,10 @@ struct jffs2_eraseblock
 #define JFFS2_RESERVED_BLOCKS_GCTRIGGER (JFFS2_RESERVED_BLOCKS_BASE + 3)	/* ... wake up the GC thread */
 #define JFFS2_RESERVED_BLOCKS_GCBAD (JFFS2_RESERVED_BLOCKS_BASE + 1)		/* ... pick a block from the bad_list to GC */
 #define JFFS2_RESERVED_BLOCKS_GCMERGE (JFFS2_RESERVED_BLOCKS_BASE)		/* ... merge pages when garbage collecting */
+#define JFFS2_RESERVED_BLOCKS_GCIDLE (JFFS2_RESERVED_BLOCKS_GCTRIGGER + 2)	/* ... trickle GC of very dirty blocks in the background */
+
+/* Blocks which are being filled, and so live on none of the lists */
+#define jffs2_is_open_block(c, jeb) ((jeb) == (c)->nextblock || (jeb) == (c)->gc_nextblock)
 
 
 /* How much dirty space before it goes on the very_dirty_list */
@@ -353,10 +360,11 @@ char *jffs2_getlink(struct jffs2_sb_info *c, struct jffs2_inode_info *f);
 
 
 /* compr.c */
-unsigned char jffs2_compress(unsigned char *data_in, unsigned char *cpage_out, 
-			     uint32_t *datalen, uint32_t *cdatalen);
+unsigned char jffs2_compress(struct jffs2_sb_info *c, unsigned char *data_in,
+			     unsigned char *cpage_out, uint32_t *datalen, uint32_t *cdatalen);
 int jffs2_decompress(unsigned char comprtype, unsigned char *cdata_in, 
 		     unsigned char *data_out, uint32_t cdatalen, uint32_t datalen);
+void jffs2_get_compr_stats(struct jffs2_compr_stats *stats);
 
 /* scan.c */
 int jffs2_scan_medium(struct jffs2_sb_info *c);
@@ -378,6 +386,27 @@ int jffs2_write_nand_cleanmarker(struct jffs2_sb_info *c, struct jffs2_erasebloc
 int jffs2_nand_read_failcnt(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb);
 #endif
 
+#ifdef CONFIG_JFFS2_SUMMARY
+/* summary.c */
+int jffs2_sum_init(struct jffs2_sb_info *c);
+void jffs2_sum_exit(struct jffs2_sb_info *c);
+void jffs2_sum_reset(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb);
+void jffs2_sum_disable(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb);
+uint32_t jffs2_sum_reserved(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb);
+void jffs2_sum_add_inode(struct jffs2_sb_info *c, struct jffs2_raw_inode *ri, uint32_t ofs);
+void jffs2_sum_add_dirent(struct jffs2_sb_info *c, struct jffs2_raw_dirent *rd, const unsigned char *name, uint32_t ofs);
+void jffs2_sum_write(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb);
+#else
+#define jffs2_sum_init(c) (0)
+#define jffs2_sum_exit(c) do { } while(0)
+#define jffs2_sum_reset(c, jeb) do { } while(0)
+#define jffs2_sum_disable(c, jeb) do { } while(0)
+#define jffs2_sum_reserved(c, jeb) (0)
+#define jffs2_sum_add_inode(c, ri, ofs) do { } while(0)
+#define jffs2_sum_add_dirent(c, rd, name, ofs) do { } while(0)
+#define jffs2_sum_write(c, jeb) do { } while(0)
+#endif
+
 /* compr_zlib.c */
 int jffs2_zlib_init(void);
 void jffs2_zlib_exit(void);
@@ -37,7 +37,8 @@
  *	for the requested allocation.
  */
 
-static int jffs2_do_reserve_space(struct jffs2_sb_info *c,  uint32_t minsize, uint32_t *ofs, uint32_t *len);
+static int jffs2_do_reserve_space(struct jffs2_sb_info *c,  uint32_t minsize, uint32_t *ofs, uint32_t *len,
+				  struct jffs2_eraseblock **nextp);
 
 int jffs2_reserve_space(struct jffs2_sb_info *c, uint32_t minsize, uint32_t *ofs, uint32_t *len, int prio)
 {
@@ -88,11 +89,12 @@ int jffs2_reserve_space(struct jffs2_sb_info *c, uint32_t minsize, uint32_t *ofs
 			spin_lock_bh(&c->erase_completion_lock);
 		}
 
-		ret = jffs2_do_reserve_space(c, minsize, ofs, len);
+		ret = jffs2_do_reserve_space(c, minsize, ofs, len, &c->nextblock);
 		if (ret) {
 			D1(printk(KERN_DEBUG "jffs2_reserve_space: ret is %d\n", ret));
 		}
 	}
+	c->gc_alloc = 0;
 	spin_unlock_bh(&c->erase_completion_lock);
 	if (ret)
 		up(&c->alloc_sem);
@@ -108,23 +110,44 @@ int jffs2_reserve_space_gc(struct jffs2_sb_info *c, uint32_t minsize, uint32_t *
 
 	spin_lock_bh(&c->erase_completion_lock);
 	while(ret == -EAGAIN) {
-		ret = jffs2_do_reserve_space(c, minsize, ofs, len);
+		struct jffs2_eraseblock **nextp = &c->nextblock;
+
+		/* Nodes which GC moves have already outlived the rest of their
+		   block, so they go into a block of their own rather than being
+		   mixed back in with new, short-lived writes. Not on NAND, which
+		   only has the one write buffer, and not when free blocks are
+		   too scarce to keep two blocks open. */
+		if (jffs2_can_mark_obsolete(c) &&
+		    (c->gc_nextblock || c->nr_free_blocks > JFFS2_RESERVED_BLOCKS_GCMERGE))
+			nextp = &c->gc_nextblock;
+
+		ret = jffs2_do_reserve_space(c, minsize, ofs, len, nextp);
 		if (ret) {
 		        D1(printk(KERN_DEBUG "jffs2_reserve_space_gc: looping, ret is %d\n", ret));
 		}
 	}
+	c->gc_alloc = 1;
 	spin_unlock_bh(&c->erase_completion_lock);
 	return ret;
 }
 
-/* Called with alloc sem _and_ erase_completion_lock */
-static int jffs2_do_reserve_space(struct jffs2_sb_info *c,  uint32_t minsize, uint32_t *ofs, uint32_t *len)
+/* Called with alloc sem _and_ erase_completion_lock. nextp is the open block
+   to allocate from: &c->nextblock, or &c->gc_nextblock for GC */
+static int jffs2_do_reserve_space(struct jffs2_sb_info *c,  uint32_t minsize, uint32_t *ofs, uint32_t *len,
+				  struct jffs2_eraseblock **nextp)
 {
-	struct jffs2_eraseblock *jeb = c->nextblock;
+	struct jffs2_eraseblock *jeb = *nextp;
 	
  restart:
-	if (jeb && minsize > jeb->free_size) {
-		/* Skip the end of this block and file it as having some dirty space */
+	if (jeb && minsize + jffs2_sum_reserved(c, jeb) > jeb->free_size) {
+		/* Skip the end of this block and file it as having some dirty space.
+		   If we've been keeping a summary of it, that goes in the space first */
+		if (jffs2_sum_reserved(c, jeb)) {
+			spin_unlock_bh(&c->erase_completion_lock);
+			jffs2_sum_write(c, jeb);
+			spin_lock_bh(&c->erase_completion_lock);
+		}
+
 		/* If there's a pending write to it, flush now */
 		if (c->wbuf_len) {
 			spin_unlock_bh(&c->erase_completion_lock);
@@ -158,7 +181,15 @@ static int jffs2_do_reserve_space(struct jffs2_sb_info *c,  uint32_t minsize, ui
 			  jeb->offset, jeb->free_size, jeb->dirty_size, jeb->used_size));
 			list_add_tail(&jeb->list, &c->clean_list);
 		}
-		c->nextblock = jeb = NULL;
+		jeb->fill_seq = ++c->fill_seq;
+		if (nextp == &c->gc_nextblock) {
+			c->gc_stats.hotcold_blocks++;
+			/* Let jffs2_reserve_space_gc() decide whether there's
+			   still room to open another block just for GC */
+			c->gc_nextblock = NULL;
+			return -EAGAIN;
+		}
+		*nextp = jeb = NULL;
 	}
 	
 	if (!jeb) {
@@ -185,7 +216,7 @@ static int jffs2_do_reserve_space(struct jffs2_sb_info *c,  uint32_t minsize, ui
 			if (!c->nr_erasing_blocks && 
 			    !list_empty(&c->erasable_pending_wbuf_list)) {
 				D1(printk(KERN_DEBUG "jffs2_do_reserve_space: Flushing write buffer\n"));
-				/* c->nextblock is NULL, no update to c->nextblock allowed */			    
+				/* *nextp is NULL, no update to it allowed */
 				spin_unlock_bh(&c->erase_completion_lock);
 				jffs2_flush_wbuf(c, 1);
 				spin_lock_bh(&c->erase_completion_lock);
@@ -227,25 +258,28 @@ static int jffs2_do_reserve_space(struct jffs2_sb_info *c,  uint32_t minsize, ui
 
 		next = c->free_list.next;
 		list_del(next);
-		c->nextblock = jeb = list_entry(next, struct jffs2_eraseblock, list);
+		*nextp = jeb = list_entry(next, struct jffs2_eraseblock, list);
 		c->nr_free_blocks--;
 
 		if (jeb->free_size != c->sector_size - c->cleanmarker_size) {
 			printk(KERN_WARNING "Eep. Block 0x%08x taken from free_list had free_size of 0x%08x!!\n", jeb->offset, jeb->free_size);
 			goto restart;
 		}
+		jffs2_sum_reset(c, jeb);
+		if (minsize + jffs2_sum_reserved(c, jeb) > jeb->free_size)
+			jffs2_sum_disable(c, jeb);
 	}
-	/* OK, jeb (==c->nextblock) is now pointing at a block which definitely has
+	/* OK, jeb (==*nextp) is now pointing at a block which definitely has
 	   enough space */
 	*ofs = jeb->offset + (c->sector_size - jeb->free_size);
-	*len = jeb->free_size;
+	*len = jeb->free_size - jffs2_sum_reserved(c, jeb);
 
 	if (c->cleanmarker_size && jeb->used_size == c->cleanmarker_size &&
 	    !jeb->first_node->next_in_ino) {
 		/* Only node in it beforehand was a CLEANMARKER node (we think). 
 		   So mark it obsolete now that there's going to be another node
 		   in the block. This will reduce used_size to zero but We've 
-		   already set c->nextblock so that jffs2_mark_node_obsolete()
+		   already set *nextp so that jffs2_mark_node_obsolete()
 		   won't try to refile it to the dirty_list.
 		*/
 		spin_unlock_bh(&c->erase_completion_lock);
@@ -278,7 +312,7 @@ int jffs2_add_physical_node_ref(struct jffs2_sb_info *c, struct jffs2_raw_node_r
 	jeb = &c->blocks[new->flash_offset / c->sector_size];
 	D1(printk(KERN_DEBUG "jffs2_add_physical_node_ref(): Node at 0x%x, size 0x%x\n", ref_offset(new), len));
 #if 1
-	if (jeb != c->nextblock || (ref_offset(new)) != jeb->offset + (c->sector_size - jeb->free_size)) {
+	if (!jffs2_is_open_block(c, jeb) || (ref_offset(new)) != jeb->offset + (c->sector_size - jeb->free_size)) {
 		printk(KERN_WARNING "argh. node added in wrong place\n");
 		jffs2_free_raw_node_ref(new);
 		return -EINVAL;
@@ -301,6 +335,10 @@ int jffs2_add_physical_node_ref(struct jffs2_sb_info *c, struct jffs2_raw_node_r
 		jeb->used_size += len;
 		c->used_size += len;
 	}
+	if (c->gc_alloc)
+		c->gc_stats.gc_bytes += len;
+	else
+		c->gc_stats.user_bytes += len;
 
 	if (!jeb->free_size && !jeb->dirty_size) {
 		/* If it lives on the dirty_list, jffs2_reserve_space will put it there */
@@ -314,7 +352,13 @@ int jffs2_add_physical_node_ref(struct jffs2_sb_info *c, struct jffs2_raw_node_r
 		}
 
 		list_add_tail(&jeb->list, &c->clean_list);
-		c->nextblock = NULL;
+		jeb->fill_seq = ++c->fill_seq;
+		if (jeb == c->gc_nextblock) {
+			c->gc_stats.hotcold_blocks++;
+			c->gc_nextblock = NULL;
+		} else {
+			c->nextblock = NULL;
+		}
 	}
 	ACCT_SANITY_CHECK(c,jeb);
 	D1(ACCT_PARANOIA_CHECK(jeb));
@@ -377,7 +421,7 @@ void jffs2_mark_node_obsolete(struct jffs2_sb_info *c, struct jffs2_raw_node_ref
 		c->used_size -= ref->totlen;
 	}
 
-	if ((jeb->dirty_size || ISDIRTY(jeb->wasted_size + ref->totlen)) && jeb != c->nextblock) {
+	if ((jeb->dirty_size || ISDIRTY(jeb->wasted_size + ref->totlen)) && !jffs2_is_open_block(c, jeb)) {
 		D1(printk("Dirtying\n"));
 		jeb->dirty_size += ref->totlen + jeb->wasted_size;
 		c->dirty_size += ref->totlen + jeb->wasted_size;
@@ -404,7 +448,7 @@ void jffs2_mark_node_obsolete(struct jffs2_sb_info *c, struct jffs2_raw_node_ref
 		return;
 	}
 
-	if (jeb == c->nextblock) {
+	if (jffs2_is_open_block(c, jeb)) {
 		D2(printk(KERN_DEBUG "Not moving nextblock 0x%08x to dirty/erase_pending list\n", jeb->offset));
 	} else if (!jeb->used_size && !jeb->unchecked_size) {
 		if (jeb == c->gcblock) {
@@ -531,6 +575,10 @@ void jffs2_dump_block_lists(struct jffs2_sb_info *c)
 	} else {
 		printk(KERN_DEBUG "nextblock: NULL\n");
 	}
+	if (c->gc_nextblock) {
+		printk(KERN_DEBUG "gc_nextblock: %08x (used %08x, dirty %08x, wasted %08x, unchecked %08x, free %08x)\n",
+		       c->gc_nextblock->offset, c->gc_nextblock->used_size, c->gc_nextblock->dirty_size, c->gc_nextblock->wasted_size, c->gc_nextblock->unchecked_size, c->gc_nextblock->free_size);
+	}
 	if (c->gcblock) {
 		printk(KERN_DEBUG "gcblock: %08x (used %08x, dirty %08x, wasted %08x, unchecked %08x, free %08x)\n",
 		       c->gcblock->offset, c->gcblock->used_size, c->gcblock->dirty_size, c->gcblock->wasted_size, c->gcblock->unchecked_size, c->gcblock->free_size);
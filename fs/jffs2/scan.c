@@ -56,6 +56,10 @@ static int jffs2_scan_inode_node(struct jffs2_sb_info *c, struct jffs2_erasebloc
 				 struct jffs2_raw_inode *ri, uint32_t ofs);
 static int jffs2_scan_dirent_node(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
 				 struct jffs2_raw_dirent *rd, uint32_t ofs);
+#ifdef CONFIG_JFFS2_SUMMARY
+static int jffs2_scan_summary(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
+			      unsigned char *buf, uint32_t buf_size);
+#endif
 
 #define BLK_STATE_ALLFF		0
 #define BLK_STATE_CLEAN		1
@@ -298,6 +302,14 @@ static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblo
 		default: 	return ret;
 		}
 	}
+#endif
+#ifdef CONFIG_JFFS2_SUMMARY
+	/* If the block has a valid summary, that's all we need to read */
+	err = jffs2_scan_summary(c, jeb, buf, buf_size);
+	if (err < 0)
+		return err;
+	if (err)
+		goto scan_end;
 #endif
 	buf_ofs = jeb->offset;
 
@@ -584,7 +596,9 @@ static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblo
 		}
 	}
 
-
+#ifdef CONFIG_JFFS2_SUMMARY
+ scan_end:
+#endif
 	D1(printk(KERN_DEBUG "Block at 0x%08x: free 0x%08x, dirty 0x%08x, used 0x%08x\n", jeb->offset, 
 		  jeb->free_size, jeb->dirty_size, jeb->used_size));
 
@@ -783,6 +797,232 @@ static int jffs2_scan_dirent_node(struct jffs2_sb_info *c, struct jffs2_eraseblo
 	return 0;
 }
 
+#ifdef CONFIG_JFFS2_SUMMARY
+/* Walk the records of a summary whose CRCs have already been checked.
+   With 'apply' clear, just check that every record describes a node
+   which lies inside the block, in order and before the summary itself,
+   so that we never have to back out of half a summary. With 'apply'
+   set, build the node refs and dirent lists exactly as the full scan
+   would have done, and account everything else in the block as dirty. */
+static int jffs2_scan_sum_records(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
+				  struct jffs2_raw_summary *summary, uint32_t sumofs, int apply)
+{
+	unsigned char *p = summary->sum;
+	unsigned char *end = p + je32_to_cpu(summary->sum_len);
+	uint32_t num = je32_to_cpu(summary->sum_num);
+	uint32_t pos = 0;
+
+	while (num--) {
+		struct jffs2_sum_unknown_flash *su = (void *)p;
+		struct jffs2_sum_inode_flash *si = (void *)p;
+		struct jffs2_sum_dirent_flash *sd = (void *)p;
+		struct jffs2_raw_node_ref *raw;
+		struct jffs2_full_dirent *fd;
+		struct jffs2_inode_cache *ic;
+		uint32_t ofs, totlen;
+
+		if (p + sizeof(*su) > end)
+			return -EINVAL;
+
+		switch (je16_to_cpu(su->nodetype)) {
+		case JFFS2_NODETYPE_INODE:
+			if (p + sizeof(*si) > end)
+				return -EINVAL;
+			p += sizeof(*si);
+			ofs = je32_to_cpu(si->offset);
+			totlen = je32_to_cpu(si->totlen);
+			if (totlen < sizeof(struct jffs2_raw_inode))
+				return -EINVAL;
+			break;
+
+		case JFFS2_NODETYPE_DIRENT:
+			if (p + sizeof(*sd) > end || p + sizeof(*sd) + sd->nsize > end)
+				return -EINVAL;
+			p += sizeof(*sd) + sd->nsize;
+			ofs = je32_to_cpu(sd->offset);
+			totlen = je32_to_cpu(sd->totlen);
+			if (totlen != sizeof(struct jffs2_raw_dirent) + sd->nsize)
+				return -EINVAL;
+			break;
+
+		default:
+			return -EINVAL;
+		}
+
+		if ((ofs & 3) || ofs < pos || ofs + PAD(totlen) > sumofs)
+			return -EINVAL;
+
+		if (!apply) {
+			pos = ofs + PAD(totlen);
+			continue;
+		}
+
+		if (ofs > pos)
+			DIRTY_SPACE(ofs - pos);
+		pos = ofs + PAD(totlen);
+
+		raw = jffs2_alloc_raw_node_ref();
+		if (!raw) {
+			printk(KERN_NOTICE "jffs2_scan_sum_records(): allocation of node reference failed\n");
+			return -ENOMEM;
+		}
+
+		if (je16_to_cpu(su->nodetype) == JFFS2_NODETYPE_INODE) {
+			ic = jffs2_scan_make_ino_cache(c, je32_to_cpu(si->inode));
+			if (!ic) {
+				jffs2_free_raw_node_ref(raw);
+				return -ENOMEM;
+			}
+			/* Left unchecked, just as the full scan leaves it */
+			raw->flash_offset = (jeb->offset + ofs) | REF_UNCHECKED;
+			fd = NULL;
+			pseudo_random += je32_to_cpu(si->version);
+		} else {
+			fd = jffs2_alloc_full_dirent(sd->nsize+1);
+			if (!fd) {
+				jffs2_free_raw_node_ref(raw);
+				return -ENOMEM;
+			}
+			ic = jffs2_scan_make_ino_cache(c, je32_to_cpu(sd->pino));
+			if (!ic) {
+				jffs2_free_full_dirent(fd);
+				jffs2_free_raw_node_ref(raw);
+				return -ENOMEM;
+			}
+			/* The summary CRC stands in for the node and name CRCs */
+			raw->flash_offset = (jeb->offset + ofs) | REF_PRISTINE;
+			memcpy(&fd->name, sd->name, sd->nsize);
+			fd->name[sd->nsize] = 0;
+			fd->raw = raw;
+			fd->next = NULL;
+			fd->version = je32_to_cpu(sd->version);
+			fd->ino = je32_to_cpu(sd->ino);
+			fd->nhash = full_name_hash(fd->name, sd->nsize);
+			fd->type = sd->type;
+			pseudo_random += je32_to_cpu(sd->version);
+		}
+		raw->totlen = PAD(totlen);
+		raw->next_phys = NULL;
+		raw->next_in_ino = ic->nodes;
+		ic->nodes = raw;
+		if (!jeb->first_node)
+			jeb->first_node = raw;
+		if (jeb->last_node)
+			jeb->last_node->next_phys = raw;
+		jeb->last_node = raw;
+
+		if (fd) {
+			USED_SPACE(PAD(totlen));
+			jffs2_add_fd_to_list(c, fd, &ic->scan_dents);
+		} else {
+			UNCHECKED_SPACE(PAD(totlen));
+		}
+	}
+
+	if (p != end)
+		return -EINVAL;
+
+	/* Anything else, including the summary node itself, is dirty */
+	if (apply)
+		DIRTY_SPACE(c->sector_size - pos);
+
+	return 0;
+}
+
+/* Returns 1 if the block was accounted from its summary, 0 if it must be
+   scanned in full, or a negative error to abort the mount */
+static int jffs2_scan_summary(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
+			      unsigned char *buf, uint32_t buf_size)
+{
+	struct jffs2_sum_marker *sm;
+	struct jffs2_raw_summary *summary;
+	unsigned char *sumbuf = NULL;
+	uint32_t sumofs, sumlen, sum_len, crc;
+	int err;
+
+	if (!buf_size) {
+		sm = (void *)&buf[c->sector_size - sizeof(*sm)];
+	} else {
+		err = jffs2_fill_scan_buf(c, buf, jeb->offset + c->sector_size - sizeof(*sm), sizeof(*sm));
+		if (err)
+			return err;
+		sm = (void *)buf;
+	}
+
+	if (je32_to_cpu(sm->magic) != JFFS2_SUM_MAGIC)
+		return 0;
+
+	sumofs = je32_to_cpu(sm->offset);
+	if ((sumofs & 3) || sumofs > c->sector_size - sizeof(*summary) - sizeof(*sm)) {
+		printk(KERN_NOTICE "jffs2_scan_summary(): Bogus summary offset 0x%08x in block at 0x%08x\n",
+		       sumofs, jeb->offset);
+		return 0;
+	}
+	sumlen = c->sector_size - sumofs;
+
+	if (!buf_size) {
+		summary = (void *)&buf[sumofs];
+	} else {
+		if (sumlen <= buf_size) {
+			summary = (void *)buf;
+		} else {
+			sumbuf = kmalloc(sumlen, GFP_KERNEL);
+			if (!sumbuf)
+				return -ENOMEM;
+			summary = (void *)sumbuf;
+		}
+		err = jffs2_fill_scan_buf(c, (void *)summary, jeb->offset + sumofs, sumlen);
+		if (err)
+			goto out;
+	}
+
+	err = 0;
+	if (je16_to_cpu(summary->magic) != JFFS2_MAGIC_BITMASK ||
+	    je16_to_cpu(summary->nodetype) != JFFS2_NODETYPE_SUMMARY ||
+	    je32_to_cpu(summary->totlen) != sumlen) {
+		D1(printk(KERN_DEBUG "jffs2_scan_summary(): No summary node at 0x%08x\n", jeb->offset + sumofs));
+		goto out;
+	}
+	crc = crc32(0, summary, sizeof(struct jffs2_unknown_node)-4);
+	if (crc != je32_to_cpu(summary->hdr_crc))
+		goto badcrc;
+	crc = crc32(0, summary, sizeof(*summary)-4);
+	if (crc != je32_to_cpu(summary->node_crc))
+		goto badcrc;
+	sum_len = je32_to_cpu(summary->sum_len);
+	if (!je32_to_cpu(summary->sum_num) ||
+	    sum_len > sumlen - sizeof(*summary) - sizeof(*sm)) {
+		printk(KERN_NOTICE "jffs2_scan_summary(): Bogus summary at 0x%08x: %d records, length 0x%x\n",
+		       jeb->offset + sumofs, je32_to_cpu(summary->sum_num), sum_len);
+		goto out;
+	}
+	crc = crc32(0, summary->sum, sum_len);
+	if (crc != je32_to_cpu(summary->sum_crc))
+		goto badcrc;
+
+	if (jffs2_scan_sum_records(c, jeb, summary, sumofs, 0)) {
+		printk(KERN_NOTICE "jffs2_scan_summary(): Inconsistent summary at 0x%08x. Scanning block in full\n",
+		       jeb->offset + sumofs);
+		goto out;
+	}
+
+	D1(printk(KERN_DEBUG "jffs2_scan_summary(): Using summary at 0x%08x with %d records\n",
+		  jeb->offset + sumofs, je32_to_cpu(summary->sum_num)));
+	err = jffs2_scan_sum_records(c, jeb, summary, sumofs, 1);
+	if (!err)
+		err = 1;
+	goto out;
+
+ badcrc:
+	printk(KERN_NOTICE "jffs2_scan_summary(): CRC failed on summary at 0x%08x. Scanning block in full\n",
+	       jeb->offset + sumofs);
+ out:
+	if (sumbuf)
+		kfree(sumbuf);
+	return err;
+}
+#endif /* CONFIG_JFFS2_SUMMARY */
+
 static int count_list(struct list_head *l)
 {
 	uint32_t count = 0;
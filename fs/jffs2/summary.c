@@ -0,0 +1,273 @@
+/*
+ * JFFS2 -- Journalling Flash File System, Version 2.
+ *
+ * Erase block summaries: while an erase block is being filled we keep
+ * a record of each node written to it, and when the block is closed
+ * the records are written into its tail so that the next mount can
+ * build the node lists for that block without reading every node.
+ *
+ * For licensing information, see the file 'LICENCE' in this directory.
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mtd/mtd.h>
+#include <linux/crc32.h>
+#include "nodelist.h"
+
+struct jffs2_summary {
+	struct jffs2_eraseblock *jeb;	/* Block the records describe, or NULL
+					   if this slot isn't collecting */
+	uint32_t sum_num;
+	uint32_t sum_len;
+	unsigned char *records;		/* c->sector_size bytes, in on-flash format */
+};
+
+/* One for each block which can be open at once: nextblock and gc_nextblock */
+#define JFFS2_SUM_SLOTS 2
+
+/* The most a single node can add to the summary: a dirent with a
+   maximum length name */
+#define JFFS2_SUM_MAX_RECORD (sizeof(struct jffs2_sum_dirent_flash) + JFFS2_MAX_NAME_LEN)
+
+int jffs2_sum_init(struct jffs2_sb_info *c)
+{
+	struct jffs2_summary *s;
+	int i;
+
+	s = kmalloc(JFFS2_SUM_SLOTS * sizeof(*s), GFP_KERNEL);
+	if (!s)
+		return -ENOMEM;
+	memset(s, 0, JFFS2_SUM_SLOTS * sizeof(*s));
+	c->summary = s;
+
+	for (i = 0; i < JFFS2_SUM_SLOTS; i++) {
+		s[i].records = vmalloc(c->sector_size);
+		if (!s[i].records) {
+			jffs2_sum_exit(c);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+void jffs2_sum_exit(struct jffs2_sb_info *c)
+{
+	int i;
+
+	if (!c->summary)
+		return;
+
+	for (i = 0; i < JFFS2_SUM_SLOTS; i++) {
+		if (c->summary[i].records)
+			vfree(c->summary[i].records);
+	}
+	kfree(c->summary);
+	c->summary = NULL;
+}
+
+static struct jffs2_summary *jffs2_sum_find(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb)
+{
+	int i;
+
+	if (!jeb)
+		return NULL;
+
+	for (i = 0; i < JFFS2_SUM_SLOTS; i++) {
+		if (c->summary[i].jeb == jeb)
+			return &c->summary[i];
+	}
+	return NULL;
+}
+
+/* Start collecting for a block just taken off the free_list. Blocks
+   which were already partly written when we mounted never get this,
+   so they don't get a summary and are scanned in full next time. */
+void jffs2_sum_reset(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb)
+{
+	struct jffs2_summary *s = NULL;
+	int i;
+
+	/* Any slot not describing the other open block will do */
+	for (i = 0; i < JFFS2_SUM_SLOTS; i++) {
+		s = &c->summary[i];
+		if (!s->jeb || s->jeb == jeb || !jffs2_is_open_block(c, s->jeb))
+			break;
+	}
+	s->jeb = jeb;
+	s->sum_num = 0;
+	s->sum_len = 0;
+}
+
+void jffs2_sum_disable(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb)
+{
+	struct jffs2_summary *s = jffs2_sum_find(c, jeb);
+
+	if (s)
+		s->jeb = NULL;
+}
+
+/* How much of jeb's free space must be kept back so that the summary,
+   including a record for one more node, still fits at the end. */
+uint32_t jffs2_sum_reserved(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb)
+{
+	struct jffs2_summary *s = jffs2_sum_find(c, jeb);
+
+	if (!s)
+		return 0;
+
+	return PAD(sizeof(struct jffs2_raw_summary) + s->sum_len +
+		   JFFS2_SUM_MAX_RECORD + sizeof(struct jffs2_sum_marker));
+}
+
+static void *jffs2_sum_new_record(struct jffs2_sb_info *c, uint32_t ofs, uint32_t len)
+{
+	struct jffs2_summary *s = jffs2_sum_find(c, &c->blocks[ofs / c->sector_size]);
+	void *rec;
+
+	if (!s)
+		return NULL;
+
+	if (s->sum_len + len > c->sector_size) {
+		/* Can't happen while jffs2_sum_reserved() is honoured */
+		printk(KERN_WARNING "jffs2_sum_new_record(): summary for block at 0x%08x overflowed\n",
+		       s->jeb->offset);
+		s->jeb = NULL;
+		return NULL;
+	}
+	rec = s->records + s->sum_len;
+	s->sum_len += len;
+	s->sum_num++;
+	return rec;
+}
+
+void jffs2_sum_add_inode(struct jffs2_sb_info *c, struct jffs2_raw_inode *ri, uint32_t ofs)
+{
+	struct jffs2_sum_inode_flash *rec;
+
+	rec = jffs2_sum_new_record(c, ofs, sizeof(*rec));
+	if (!rec)
+		return;
+
+	rec->nodetype = ri->nodetype;
+	rec->inode = ri->ino;
+	rec->version = ri->version;
+	rec->offset = cpu_to_je32(ofs % c->sector_size);
+	rec->totlen = ri->totlen;
+}
+
+void jffs2_sum_add_dirent(struct jffs2_sb_info *c, struct jffs2_raw_dirent *rd,
+			  const unsigned char *name, uint32_t ofs)
+{
+	struct jffs2_sum_dirent_flash *rec;
+
+	rec = jffs2_sum_new_record(c, ofs, sizeof(*rec) + rd->nsize);
+	if (!rec)
+		return;
+
+	rec->nodetype = rd->nodetype;
+	rec->totlen = rd->totlen;
+	rec->offset = cpu_to_je32(ofs % c->sector_size);
+	rec->pino = rd->pino;
+	rec->version = rd->version;
+	rec->ino = rd->ino;
+	rec->nsize = rd->nsize;
+	rec->type = rd->type;
+	memcpy(rec->name, name, rd->nsize);
+}
+
+/* The 0xff filler between the records and the marker is written from a
+   chunk of this size rather than built in memory for the whole block */
+#define JFFS2_SUM_FILLSIZE 256
+
+static int jffs2_sum_flash_write(struct jffs2_sb_info *c, uint32_t ofs,
+				 uint32_t len, unsigned char *buf)
+{
+	size_t retlen;
+	int ret;
+
+	ret = jffs2_flash_write(c, ofs, len, &retlen, buf);
+	if (ret || retlen != len) {
+		printk(KERN_NOTICE "Write of %d bytes of summary at 0x%08x failed. returned %d, retlen %d\n",
+		       len, ofs, ret, retlen);
+		return ret ? ret : -EIO;
+	}
+	return 0;
+}
+
+/* Called with the alloc_sem held, just before jeb is filed as full.
+   Fills all of the block's remaining free space with the summary node,
+   which jffs2_do_reserve_space() then accounts as wasted/dirty.
+   The node is written front to back in pieces, because writes through
+   the NAND write buffer have to be contiguous. */
+void jffs2_sum_write(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb)
+{
+	struct jffs2_summary *s = jffs2_sum_find(c, jeb);
+	struct jffs2_raw_summary *sum;
+	struct jffs2_sum_marker sm;
+	unsigned char *fill;
+	uint32_t ofs, len, hdrlen, n;
+
+	if (!s)
+		return;
+	s->jeb = NULL;
+
+	if (!s->sum_num)
+		return;
+
+	ofs = c->sector_size - jeb->free_size;
+	len = jeb->free_size;
+	hdrlen = sizeof(*sum) + s->sum_len;
+
+	/* A padded wbuf flush may have eaten into the space we kept back */
+	if (hdrlen + sizeof(sm) > len) {
+		D1(printk(KERN_DEBUG "jffs2_sum_write(): No room for summary of block at 0x%08x (0x%x needed, 0x%x free)\n",
+			  jeb->offset, hdrlen + sizeof(sm), len));
+		return;
+	}
+
+	sum = kmalloc(hdrlen + JFFS2_SUM_FILLSIZE, GFP_KERNEL);
+	if (!sum) {
+		printk(KERN_NOTICE "jffs2_sum_write(): allocation of summary node failed\n");
+		return;
+	}
+	fill = (unsigned char *)sum + hdrlen;
+	memset(fill, 0xff, JFFS2_SUM_FILLSIZE);
+
+	sum->magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
+	sum->nodetype = cpu_to_je16(JFFS2_NODETYPE_SUMMARY);
+	sum->totlen = cpu_to_je32(len);
+	sum->hdr_crc = cpu_to_je32(crc32(0, sum, sizeof(struct jffs2_unknown_node)-4));
+	sum->sum_num = cpu_to_je32(s->sum_num);
+	sum->sum_len = cpu_to_je32(s->sum_len);
+	sum->sum_crc = cpu_to_je32(crc32(0, s->records, s->sum_len));
+	sum->node_crc = cpu_to_je32(crc32(0, sum, sizeof(*sum)-4));
+	memcpy(sum->sum, s->records, s->sum_len);
+
+	sm.offset = cpu_to_je32(ofs);
+	sm.magic = cpu_to_je32(JFFS2_SUM_MAGIC);
+
+	D1(printk(KERN_DEBUG "jffs2_sum_write(): Writing %d records (0x%x bytes) at 0x%08x\n",
+		  s->sum_num, len, jeb->offset + ofs));
+
+	/* On failure there's nothing more to do. The space is written off
+	   either way, and the scan will fall back to reading the block node
+	   by node */
+	ofs += jeb->offset;
+	if (jffs2_sum_flash_write(c, ofs, hdrlen, (unsigned char *)sum))
+		goto out;
+	ofs += hdrlen;
+	len -= hdrlen + sizeof(sm);
+	while (len) {
+		n = min_t(uint32_t, len, JFFS2_SUM_FILLSIZE);
+		if (jffs2_sum_flash_write(c, ofs, n, fill))
+			goto out;
+		ofs += n;
+		len -= n;
+	}
+	jffs2_sum_flash_write(c, ofs, sizeof(sm), (unsigned char *)&sm);
+ out:
+	kfree(sum);
+}
@@ -263,6 +263,7 @@ void jffs2_put_super (struct super_block *sb)
 	up(&c->alloc_sem);
 	jffs2_free_ino_caches(c);
 	jffs2_free_raw_node_refs(c);
+	jffs2_sum_exit(c);
 	kfree(c->blocks);
 	if (c->wbuf)
 		kfree(c->wbuf);
@@ -167,6 +167,7 @@ struct jffs2_full_dnode *jffs2_write_dnode(struct jffs2_sb_info *c, struct jffs2
 	else
 		raw->flash_offset |= REF_NORMAL;
 	jffs2_add_physical_node_ref(c, raw);
+	jffs2_sum_add_inode(c, ri, flash_ofs);
 
 	/* Link into per-inode list */
 	raw->next_in_ino = f->inocache->nodes;
@@ -254,6 +255,7 @@ struct jffs2_full_dirent *jffs2_write_dirent(struct jffs2_sb_info *c, struct jff
 	/* Mark the space used */
 	raw->flash_offset |= REF_PRISTINE;
 	jffs2_add_physical_node_ref(c, raw);
+	jffs2_sum_add_dirent(c, rd, name, flash_ofs);
 	if (writelen)
 		*writelen = retlen;
 
@@ -294,7 +296,7 @@ int jffs2_write_inode_range(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 
 		comprbuf = kmalloc(cdatalen, GFP_KERNEL);
 		if (comprbuf) {
-			comprtype = jffs2_compress(buf, comprbuf, &datalen, &cdatalen);
+			comprtype = jffs2_compress(c, buf, comprbuf, &datalen, &cdatalen);
 		}
 		if (comprtype == JFFS2_COMPR_NONE) {
 			/* Either compression failed, or the allocation of comprbuf failed */
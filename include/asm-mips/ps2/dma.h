@@ -17,6 +17,7 @@
 #include <linux/completion.h>
 #include <asm/types.h>
 #include <asm/io.h>
+#include <asm/timex.h>
 
 //#define DEBUG
 #ifdef DEBUG
@@ -109,6 +110,12 @@ struct dma_channel {
 
     struct dma_request *head, *tail;	/* DMA request queue */
     struct dma_tag *tagp;		/* tag pointer (for destination DMA) */
+
+    /* busy/idle accounting (/proc/ps2dma) */
+    cycles_t stamp;			/* last queue state change */
+    unsigned long stamp_jiffies;
+    unsigned long long busy_cycles, idle_cycles;
+    unsigned long nstart;		/* requests started */
 };
 
 struct dma_ops {
@@ -137,6 +144,8 @@ struct dma_completion {
 extern struct dma_channel ps2dma_channels[];
 void ps2dma_intr_handler(int irq, void *dev_id, struct pt_regs *regs);
 void ps2dma_add_queue(struct dma_request *req, struct dma_channel *ch);
+int ps2dma_add_queue_seq(struct dma_request *req, struct dma_channel *ch, int *seq);
+void ps2dma_account(struct dma_channel *ch);
 void ps2dma_complete(struct dma_completion *x);
 void ps2dma_init_completion(struct dma_completion *x);
 int ps2dma_intr_safe_wait_for_completion(struct dma_channel *ch, int polling, struct dma_completion *x);
@@ -223,6 +223,45 @@ struct sbr_common_arg {
     void *para;
 };
 
+#ifdef __KERNEL__
+#include <linux/list.h>
+#include <linux/wait.h>
+#include <linux/spinlock.h>
+
+/*
+ * asynchronous RPC
+ *
+ * Up to 'window' requests of a queue are in flight at once. Finished
+ * requests are collected on the queue's completion list in the order
+ * the IOP completes them and are picked up with sbios_rpc_reap().
+ * The request and the argument block it points to must stay valid
+ * until the request has been reaped.
+ */
+struct sbios_rpc_queue {
+    spinlock_t lock;
+    wait_queue_head_t wq;
+    struct list_head done;		/* completed requests */
+    int inflight;
+    int window;
+    unsigned int tag;			/* last tag issued */
+};
+
+struct sbios_rpc_req {
+    struct list_head list;
+    struct sbios_rpc_queue *queue;
+    struct sbr_common_arg carg;
+    unsigned int tag;
+    int func;
+    int result;				/* RPC result */
+    void *priv;				/* for the caller */
+};
+
+void sbios_rpc_queue_init(struct sbios_rpc_queue *q, int window);
+int sbios_rpc_submit(struct sbios_rpc_queue *q, struct sbios_rpc_req *req, int func, void *arg);
+struct sbios_rpc_req *sbios_rpc_reap(struct sbios_rpc_queue *q, int nonblock);
+void sbios_rpc_flush(struct sbios_rpc_queue *q);
+#endif /* __KERNEL__ */
+
 /* IOP heap */
 
 #define SBR_IOPH_INIT		64
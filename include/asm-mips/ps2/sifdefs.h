@@ -139,6 +139,10 @@ int ps2sif_freeiopheap(void *);
 unsigned long ps2sif_virttobus(volatile void *);
 void *ps2sif_bustovirt(unsigned long);
 
+struct proc_dir_entry;
+extern struct proc_dir_entry *ps2sif_proc_dir;	/* /proc/ps2sif */
+struct proc_dir_entry *ps2sif_proc_mkdir(void);
+
 /*
  * SBIOS defines
  */
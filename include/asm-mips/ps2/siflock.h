@@ -26,12 +26,24 @@
 
 #define PS2LOCK_FLAG_DEBUG	(1<<0)
 
+/*
+ * lock priority: a free lock is not taken while a waiter of higher
+ * priority is waiting for it.  It only orders the users of one lock;
+ * sound, pad, memory card and CD/DVD each have their own lock, so it
+ * does nothing for one device waiting on another's SIF traffic.
+ */
+#define PS2SIF_LOCK_PRIO_LOW	0	/* bulk transfer */
+#define PS2SIF_LOCK_PRIO_NORMAL	1
+#define PS2SIF_LOCK_PRIO_HIGH	2	/* latency sensitive */
+#define PS2SIF_LOCK_NPRIO	3
+
 typedef struct ps2siflock_queue {
 	struct ps2siflock_queue *prev;
 	struct ps2siflock_queue *next;
 	int (*routine)(void*);
 	void *arg;
 	char *name;
+	int prio;
 } ps2sif_lock_queue_t;
 
 #if 0
@@ -54,6 +66,7 @@ ps2sif_lock_t *ps2sif_getlock(int);
 void ps2sif_lockinit(ps2sif_lock_t *l);
 void ps2sif_lockqueueinit(ps2sif_lock_queue_t *q);
 int __ps2sif_lock(ps2sif_lock_t *l, char*, long state);
+int __ps2sif_lock_prio(ps2sif_lock_t *l, char*, long state, int prio);
 void ps2sif_unlock(ps2sif_lock_t *l);
 void ps2sif_unlock_interruptible(ps2sif_lock_t *l);
 int ps2sif_lowlevel_lock(ps2sif_lock_t *, ps2sif_lock_queue_t *, int);
@@ -67,6 +80,10 @@ unsigned long ps2sif_getlockflags(ps2sif_lock_t *l);
 	((void)__ps2sif_lock(l, n, TASK_UNINTERRUPTIBLE))
 #define ps2sif_lock_interruptible(l, n)	\
 	__ps2sif_lock(l, n, TASK_INTERRUPTIBLE)
+#define ps2sif_lock_prio(l, n, p)		\
+	((void)__ps2sif_lock_prio(l, n, TASK_UNINTERRUPTIBLE, p))
+#define ps2sif_lock_prio_interruptible(l, n, p)	\
+	__ps2sif_lock_prio(l, n, TASK_INTERRUPTIBLE, p)
 #define __ps2sif_str2(x) #x
 #define __ps2sif_str(x) __ps2sif_str2(x)
 #define ps2sif_assertlock(l, msg) \
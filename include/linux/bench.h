@@ -0,0 +1,30 @@
+#ifndef _LINUX_BENCH_H
+#define _LINUX_BENCH_H
+
+/*
+ * Helpers for the benchmark and self-test modules (CONFIG_BENCH_MODULES).
+ *
+ * Each of these does all its work in init_module(), reports to the
+ * kernel log and then returns BENCH_DONE. The load fails, nothing stays
+ * resident, and the module can be loaded again right away.
+ */
+
+#include <linux/types.h>
+#include <linux/time.h>
+
+#define BENCH_DONE	1
+
+/* Microseconds since *start; never 0, so it can be divided by */
+static inline uint32_t
+bench_usec(struct timeval *start)
+{
+	struct timeval now;
+	uint32_t usec;
+
+	do_gettimeofday(&now);
+	usec = (now.tv_sec - start->tv_sec) * 1000000 +
+		now.tv_usec - start->tv_usec;
+	return usec ? usec : 1;
+}
+
+#endif /* _LINUX_BENCH_H */
@@ -5,17 +5,27 @@
 
 #include <linux/types.h>
 
-extern const uint32_t crc32_table[256];
+/* lib/crc32.c */
+extern uint32_t crc32_le(uint32_t crc, const void *p, size_t len);
+extern uint32_t crc32_bitrev(uint32_t x);
 
-/* Return a 32-bit CRC of the contents of the buffer. */
+/*
+ * Return a 32-bit CRC of the contents of the buffer.
+ * No pre- or post-conditioning; callers that want the usual Ethernet
+ * or zlib value pass ~0 and invert the result themselves.
+ */
 
 static inline uint32_t 
 crc32(uint32_t val, const void *ss, int len)
 {
-	const unsigned char *s = ss;
-        while (--len >= 0)
-                val = crc32_table[(val ^ *s++) & 0xff] ^ (val >> 8);
-        return val;
+	return len > 0 ? crc32_le(val, ss, len) : val;
+}
+
+/* Big-endian (MSB first) Ethernet CRC, e.g. for multicast hashing */
+static inline uint32_t
+crc32_be_ether(const void *p, size_t len)
+{
+	return crc32_bitrev(crc32_le(~0U, p, len) ^ ~0U);
 }
 
 #endif
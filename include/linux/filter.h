@@ -31,16 +31,29 @@ struct sock_fprog	/* Required for SO_ATTACH_FILTER. */
 };
 
 #ifdef __KERNEL__
+/* A filter block as predecoded by sk_attach_filter() for sk_filter_run() */
+struct sk_filter_op
+{
+	__u16			code;	/* Private to net/core/filter.c */
+	__u32			k;
+	struct sk_filter_op	*jt;	/* Jump targets, already resolved */
+	struct sk_filter_op	*jf;
+};
+
 struct sk_filter
 {
 	atomic_t		refcnt;
         unsigned int         	len;	/* Number of filter blocks */
+	struct sk_filter_op	*ops;	/* len predecoded blocks, or NULL
+					   to always interpret insns */
+	unsigned int		min_len; /* Linear bytes needed to run ops */
         struct sock_filter     	insns[0];
 };
 
 static inline unsigned int sk_filter_len(struct sk_filter *fp)
 {
-	return fp->len*sizeof(struct sock_filter) + sizeof(*fp);
+	/* ops and min_len are not charged to the socket */
+	return fp->len*sizeof(struct sock_filter) + offsetof(struct sk_filter, ops);
 }
 #endif
 
@@ -134,6 +147,7 @@ static inline unsigned int sk_filter_len(struct sk_filter *fp)
 
 #ifdef __KERNEL__
 extern int sk_run_filter(struct sk_buff *skb, struct sock_filter *filter, int flen);
+extern int sk_filter_run(struct sk_buff *skb, struct sk_filter *fp);
 extern int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk);
 extern int sk_chk_filter(struct sock_filter *filter, int flen);
 #endif /* __KERNEL__ */
@@ -15,6 +15,8 @@
 #ifndef __LINUX_JFFS2_H__
 #define __LINUX_JFFS2_H__
 
+#include <linux/ioctl.h>
+
 #define JFFS2_SUPER_MAGIC 0x72b6
 
 /* Values we may expect to find in the 'magic' field */
@@ -39,6 +41,19 @@
 #define JFFS2_COMPR_COPY	0x04
 #define JFFS2_COMPR_DYNRUBIN	0x05
 #define JFFS2_COMPR_ZLIB	0x06
+/* 0x07 (LZO) and 0x08 (LZMA) are taken by other JFFS2 implementations.
+   LZF is private to this one, at the top of the range, and is only
+   written after an explicit compr=speed mount. Other kernels refuse to
+   read such nodes as an unknown compression type. The stream format is
+   described in fs/jffs2/compr_lzf.c. */
+#define JFFS2_COMPR_LZF		0x0f
+#define JFFS2_COMPR_TYPES	0x10
+
+/* Which compressors jffs2_compress() tries; set with the compr= mount option */
+#define JFFS2_COMPR_MODE_NONE	0	/* Write everything uncompressed */
+#define JFFS2_COMPR_MODE_SIZE	1	/* zlib, then rtime (default) */
+#define JFFS2_COMPR_MODE_SPEED	2	/* lzf, then rtime */
+
 /* Compatibility flags. */
 #define JFFS2_COMPAT_MASK 0xc000      /* What do to if an unknown nodetype is found */
 #define JFFS2_NODE_ACCURATE 0x2000
@@ -55,6 +70,7 @@
 #define JFFS2_NODETYPE_INODE (JFFS2_FEATURE_INCOMPAT | JFFS2_NODE_ACCURATE | 2)
 #define JFFS2_NODETYPE_CLEANMARKER (JFFS2_FEATURE_RWCOMPAT_DELETE | JFFS2_NODE_ACCURATE | 3)
 #define JFFS2_NODETYPE_PADDING (JFFS2_FEATURE_RWCOMPAT_DELETE | JFFS2_NODE_ACCURATE | 4)
+#define JFFS2_NODETYPE_SUMMARY (JFFS2_FEATURE_RWCOMPAT_DELETE | JFFS2_NODE_ACCURATE | 6)
 
 // Maybe later...
 //#define JFFS2_NODETYPE_CHECKPOINT (JFFS2_FEATURE_RWCOMPAT_DELETE | JFFS2_NODE_ACCURATE | 3)
@@ -162,6 +178,93 @@ struct jffs2_raw_inode
 //	uint8_t data[dsize];
 } __attribute__((packed));
 
+/* Erase block summary. Written into the tail of an erase block when it
+   is filled, listing the nodes in the block so that the mount-time scan
+   can build its lists without reading every node. The node runs to the
+   very end of the block; its last eight bytes are a jffs2_sum_marker
+   giving the offset of the summary node within the block. Older code
+   treats it as an unknown RWCOMPAT_DELETE node, i.e. dirty space. */
+
+#define JFFS2_SUM_MAGIC 0x02851885
+
+struct jffs2_raw_summary
+{
+	jint16_t magic;
+	jint16_t nodetype;	/* == JFFS2_NODETYPE_SUMMARY */
+	jint32_t totlen;	/* Up to the end of the erase block */
+	jint32_t hdr_crc;
+	jint32_t sum_num;	/* Number of records */
+	jint32_t sum_len;	/* Length of the record area */
+	jint32_t sum_crc;	/* CRC for the record area */
+	jint32_t node_crc;	/* CRC for the fields above */
+	uint8_t sum[0];
+} __attribute__((packed));
+
+/* Summary records. Offsets are relative to the start of the erase block */
+struct jffs2_sum_unknown_flash
+{
+	jint16_t nodetype;
+} __attribute__((packed));
+
+struct jffs2_sum_inode_flash
+{
+	jint16_t nodetype;	/* == JFFS2_NODETYPE_INODE */
+	jint32_t inode;
+	jint32_t version;
+	jint32_t offset;
+	jint32_t totlen;
+} __attribute__((packed));
+
+struct jffs2_sum_dirent_flash
+{
+	jint16_t nodetype;	/* == JFFS2_NODETYPE_DIRENT */
+	jint32_t totlen;
+	jint32_t offset;
+	jint32_t pino;
+	jint32_t version;
+	jint32_t ino;
+	uint8_t nsize;
+	uint8_t type;
+	uint8_t name[0];
+} __attribute__((packed));
+
+struct jffs2_sum_marker
+{
+	jint32_t offset;	/* Of the summary node within the erase block */
+	jint32_t magic;		/* == JFFS2_SUM_MAGIC */
+} __attribute__((packed));
+
+/* Garbage collection statistics, returned by the JFFS2_IOC_GCSTATS ioctl
+   on any file or directory of a mounted file system. Write amplification
+   is (user_bytes + gc_bytes) / user_bytes. */
+struct jffs2_gc_stats
+{
+	uint64_t user_bytes;	/* Node bytes written by file system operations */
+	uint64_t gc_bytes;	/* Node bytes written by GC to move live nodes */
+	uint64_t pass_usec;	/* Total time spent in GC passes */
+	uint32_t passes;	/* GC passes, foreground and background */
+	uint32_t pass_usec_max;	/* Longest single GC pass */
+	uint32_t blocks;	/* Erase blocks emptied by GC */
+	uint32_t hotcold_blocks; /* Erase blocks filled by GC alone, apart from new writes */
+};
+
+#define JFFS2_IOC_GCSTATS	_IOR('J', 0x40, struct jffs2_gc_stats)
+
+/* JFFS2_IOC_COMPRSTATS returns one of these for each compression type,
+   indexed by JFFS2_COMPR_xxx. The counters are shared by all mounts. */
+struct jffs2_compr_stats
+{
+	uint64_t compr_in;	/* Bytes successfully compressed... */
+	uint64_t compr_out;	/* ...and what they compressed to */
+	uint64_t compr_usec;	/* Time spent compressing, failures included */
+	uint64_t decompr_bytes;	/* Bytes produced by decompression */
+	uint64_t decompr_usec;	/* Time spent decompressing */
+	uint32_t attempts;
+	uint32_t failures;	/* Attempts which didn't make the data smaller */
+};
+
+#define JFFS2_IOC_COMPRSTATS	_IOR('J', 0x41, struct jffs2_compr_stats[JFFS2_COMPR_TYPES])
+
 union jffs2_node_union {
 	struct jffs2_raw_inode i;
 	struct jffs2_raw_dirent d;
@@ -9,6 +9,7 @@
 #include <linux/completion.h>
 #include <asm/semaphore.h>
 #include <linux/list.h>
+#include <linux/jffs2.h>
 
 #define JFFS2_SB_FLAG_RO 1
 #define JFFS2_SB_FLAG_MOUNTING 2
@@ -24,6 +25,7 @@ struct jffs2_sb_info {
 	uint32_t checked_ino;
 
 	unsigned int flags;
+	int compr_mode;			/* JFFS2_COMPR_MODE_xxx, from compr= */
 
 	struct task_struct *gc_task;	/* GC task struct */
 	struct semaphore gc_thread_start; /* GC thread start mutex */
@@ -36,6 +38,8 @@ struct jffs2_sb_info {
 					*/
 	uint32_t cleanmarker_size;	/* Size of an _inline_ CLEANMARKER
 					 (i.e. zero for OOB CLEANMARKER */
+	int gc_alloc;			/* Current reservation is for GC */
+	uint32_t fill_seq;		/* Bumped for each block filled; ages blocks for GC */
 
 	uint32_t flash_size;
 	uint32_t used_size;
@@ -54,6 +58,8 @@ struct jffs2_sb_info {
 	struct jffs2_eraseblock *blocks;	/* The whole array of blocks. Used for getting blocks 
 						 * from the offset (blocks[ofs / sector_size]) */
 	struct jffs2_eraseblock *nextblock;	/* The block we're currently filling */
+	struct jffs2_eraseblock *gc_nextblock;	/* The block GC is filling with the nodes it
+						 * moves, kept apart from new writes */
 
 	struct jffs2_eraseblock *gcblock;	/* The block we're currently garbage-collecting */
 
@@ -89,6 +95,11 @@ struct jffs2_sb_info {
 	struct tq_struct wbuf_task;		/* task for timed wbuf flush */
 	struct timer_list wbuf_timer;		/* timer for flushing wbuf */
 
+	/* Erase block summaries being collected for nextblock and gc_nextblock */
+	struct jffs2_summary *summary;
+
+	struct jffs2_gc_stats gc_stats;		/* Protected by erase_completion_lock */
+
 	/* OS-private pointer for getting back to master superblock info */
 	void *os_priv;
 };
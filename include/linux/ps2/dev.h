@@ -28,6 +28,7 @@
 #define PS2EV_N_VU0		4
 #define PS2EV_N_VU1		5
 #define PS2EV_N_IPU		6
+#define PS2EV_N_IMAGE		7
 #define PS2EV_N_SIGNAL		8
 #define PS2EV_N_FINISH		9
 #define PS2EV_N_HSYNC		10
@@ -42,6 +43,7 @@
 #define PS2EV_VU0		(1 << PS2EV_N_VU0)
 #define PS2EV_VU1		(1 << PS2EV_N_VU1)
 #define PS2EV_IPU		(1 << PS2EV_N_IPU)
+#define PS2EV_IMAGE		(1 << PS2EV_N_IMAGE)
 #define PS2EV_SIGNAL		(1 << PS2EV_N_SIGNAL)
 #define PS2EV_FINISH		(1 << PS2EV_N_FINISH)
 #define PS2EV_HSYNC		(1 << PS2EV_N_HSYNC)
@@ -82,6 +84,19 @@ struct ps2_plist_spr {
     struct ps2_packet_spr *packet;
 };
 
+struct ps2_cmdsub {
+    int id;			/* registered command buffer */
+    unsigned int offset;
+    unsigned int len;
+};
+
+struct ps2_cmdlist {
+    int num;
+    struct ps2_cmdsub *sub;
+};
+
+#define PS2_CMDBUF_MAX		32
+
 struct ps2_pchain {
     void *ptr;
     int tte;
@@ -101,6 +116,19 @@ struct ps2_image {
     int w, h;
 };
 
+struct ps2_imagereq {
+    int dir;			/* PS2_IMAGE_LOAD or PS2_IMAGE_STORE */
+    struct ps2_image image;
+};
+
+struct ps2_imagelist {
+    int num;
+    struct ps2_imagereq *req;
+};
+
+#define PS2_IMAGE_LOAD		0	/* EE -> GS */
+#define PS2_IMAGE_STORE		1	/* GS -> EE (ps2mem or SPR only) */
+
 struct ps2_gssreg {
     __u64 val;
     int reg;
@@ -196,6 +224,7 @@ struct ps2_sgssreg_vb {
 #define PS2IOC_SENDQCT		_IO(PS2IOC_MAGIC, 19)
 #define PS2IOC_SENDSTOP		_IOW(PS2IOC_MAGIC, 20, struct ps2_pstop)
 #define PS2IOC_SENDLIMIT	_IO(PS2IOC_MAGIC, 21)
+#define PS2IOC_SENDLBATCH	_IO(PS2IOC_MAGIC, 22)
 #define PS2IOC_RECV		_IOW(PS2IOC_MAGIC, 24, struct ps2_packet)
 #define PS2IOC_RECVA		_IOW(PS2IOC_MAGIC, 25, struct ps2_packet)
 #define PS2IOC_RECVL		_IOW(PS2IOC_MAGIC, 26, struct ps2_plist)
@@ -226,6 +255,9 @@ struct ps2_sgssreg_vb {
 #define PS2IOC_DPMS		_IO(PS2IOC_MAGIC, 51)
 #define PS2IOC_LOADIMAGEA	_IOW(PS2IOC_MAGIC, 52, struct ps2_image)
 #define PS2IOC_SGSSREG_VB	_IOW(PS2IOC_MAGIC, 53, struct ps2_sgssreg_vb)
+#define PS2IOC_STOREIMAGEA	_IOW(PS2IOC_MAGIC, 54, struct ps2_image)
+#define PS2IOC_IMAGEQUEUE	_IOW(PS2IOC_MAGIC, 55, struct ps2_imagelist)
+#define PS2IOC_IMAGEDONE	_IO(PS2IOC_MAGIC, 56)
 
 /* ps2vpu0, ps2vpu1 */
 #define PS2IOC_VPUINFO		_IOR(PS2IOC_MAGIC, 64, struct ps2_vpuinfo)
@@ -251,4 +283,9 @@ struct ps2_sgssreg_vb {
 /* ps2gs, ps2vpu0, ps2vpu1 */
 #define PS2IOC_SENDC		_IOW(PS2IOC_MAGIC, 129, struct ps2_pchain)
 
+/* ps2gs, ps2vpu0, ps2vpu1, ps2ipu (registered command buffers) */
+#define PS2IOC_CMDBUFREG	_IOW(PS2IOC_MAGIC, 130, struct ps2_packet)
+#define PS2IOC_CMDBUFUNREG	_IO(PS2IOC_MAGIC, 131)
+#define PS2IOC_CMDBUFSUBMIT	_IOW(PS2IOC_MAGIC, 132, struct ps2_cmdlist)
+
 #endif /* __PS2_DEV_H */
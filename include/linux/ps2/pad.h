@@ -56,6 +56,16 @@ struct ps2pad_stat {
 	unsigned char type;
 };
 
+struct ps2pad_event {
+	long sec, usec;		/* time the change was sampled */
+	unsigned char portslot;	/* (port# << 4) | slot#	*/
+	unsigned char stat;	/* PS2PAD_STAT_xxx */
+	unsigned char len;	/* valid bytes in data[] */
+	unsigned char flags;
+	unsigned char data[PS2PAD_DATASIZE];
+};
+#define PS2PAD_EVENT_OVERRUN	0x01	/* events were lost before this one */
+
 struct ps2pad_actinfo {
 	int actno;
 	int term;
@@ -106,5 +116,6 @@ struct ps2pad_act {
 #define	PS2PAD_IOCSETACT		_IOW(PS2PAD_IOCTL, 10, struct ps2pad_act)
 
 #define	PS2PAD_IOCGETNPADS		_IOR(PS2PAD_IOCTL, 11, int)
+#define	PS2PAD_IOCSETEVENTMODE		_IOW(PS2PAD_IOCTL, 12, int)
 
 #endif /* __PS2_PAD_H */
@@ -913,9 +913,9 @@ extern void sklist_destroy_socket(struct sock **list, struct sock *sk);
  *	@filter: filter to apply
  *
  * Run the filter code and then cut skb->data to correct size returned by
- * sk_run_filter. If pkt_len is 0 we toss packet. If skb->len is smaller
+ * sk_filter_run. If pkt_len is 0 we toss packet. If skb->len is smaller
  * than pkt_len we keep whole skb->data. This is the socket level
- * wrapper to sk_run_filter. It returns 0 if the packet should
+ * wrapper to sk_filter_run. It returns 0 if the packet should
  * be accepted or 1 if the packet should be tossed.
  */
  
@@ -923,7 +923,7 @@ static inline int sk_filter(struct sk_buff *skb, struct sk_filter *filter)
 {
 	int pkt_len;
 
-        pkt_len = sk_run_filter(skb, filter->insns, filter->len);
+        pkt_len = sk_filter_run(skb, filter);
         if(!pkt_len)
                 return 1;	/* Toss Packet */
         else
@@ -946,8 +946,11 @@ static inline void sk_filter_release(struct sock *sk, struct sk_filter *fp)
 
 	atomic_sub(size, &sk->omem_alloc);
 
-	if (atomic_dec_and_test(&fp->refcnt))
+	if (atomic_dec_and_test(&fp->refcnt)) {
+		if (fp->ops)
+			kfree(fp->ops);
 		kfree(fp);
+	}
 }
 
 static inline void sk_filter_charge(struct sock *sk, struct sk_filter *fp)
@@ -0,0 +1,84 @@
+/*
+ *  lib/crc32.c
+ *
+ *  CRC32 (IEEE 802.3, reflected polynomial 0xedb88320) shared by
+ *  JFFS2, the MTD partition parsers and network drivers.
+ *
+ *  The byte-wise table method is from Gary S. Brown's public domain
+ *  code, as previously used by fs/jffs2/crc32.c.  The main loop
+ *  processes eight bytes per iteration with eight tables ("slicing by
+ *  8"), which removes the serial dependency between consecutive table
+ *  lookups: the eight lookups of one iteration are independent, and
+ *  only one xor chain of the 32-bit state is carried between them.
+ *
+ *  crc32_le() does no pre- or post-inversion, so it can be chained
+ *  over discontiguous buffers and is a drop-in replacement for the
+ *  old JFFS2 crc32().
+ */
+
+#include <linux/types.h>
+#include <linux/module.h>
+#include <linux/crc32.h>
+#include <asm/byteorder.h>
+
+#include "crc32table.h"
+
+#define DO_CRC(x)	(crc = t0[(crc ^ (x)) & 0xff] ^ (crc >> 8))
+
+uint32_t crc32_le(uint32_t crc, const void *p, size_t len)
+{
+	const unsigned char *s = p;
+	const uint32_t *t0 = crc32_table[0], *t1 = crc32_table[1];
+	const uint32_t *t2 = crc32_table[2], *t3 = crc32_table[3];
+	const uint32_t *t4 = crc32_table[4], *t5 = crc32_table[5];
+	const uint32_t *t6 = crc32_table[6], *t7 = crc32_table[7];
+	const uint32_t *w;
+	uint32_t q, r;
+	size_t n;
+
+	/* align to a word boundary */
+	while (len > 0 && ((unsigned long)s & 3) != 0) {
+		DO_CRC(*s++);
+		len--;
+	}
+
+	/*
+	 * Two aligned word loads per iteration.  On a 32-bit kernel a
+	 * 64-bit load would be split into the same two lw instructions.
+	 */
+	w = (const uint32_t *)s;
+	for (n = len >> 3; n > 0; n--) {
+		q = crc ^ __le32_to_cpu(w[0]);
+		r = __le32_to_cpu(w[1]);
+		w += 2;
+		crc = t7[q & 0xff] ^ t6[(q >> 8) & 0xff] ^
+		      t5[(q >> 16) & 0xff] ^ t4[q >> 24] ^
+		      t3[r & 0xff] ^ t2[(r >> 8) & 0xff] ^
+		      t1[(r >> 16) & 0xff] ^ t0[r >> 24];
+	}
+	s = (const unsigned char *)w;
+	len &= 7;
+
+	while (len > 0) {
+		DO_CRC(*s++);
+		len--;
+	}
+	return crc;
+}
+
+/*
+ * Bit-reverse a 32-bit value.  Big-endian (MSB first) Ethernet CRCs,
+ * as used by multicast hash filters, are the bit-reversed little-endian
+ * CRC of the same bytes.
+ */
+uint32_t crc32_bitrev(uint32_t x)
+{
+	x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+	x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+	x = ((x >> 4) & 0x0f0f0f0f) | ((x & 0x0f0f0f0f) << 4);
+	x = ((x >> 8) & 0x00ff00ff) | ((x & 0x00ff00ff) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+EXPORT_SYMBOL(crc32_le);
+EXPORT_SYMBOL(crc32_bitrev);
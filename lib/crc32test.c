@@ -0,0 +1,132 @@
+/*
+ *  lib/crc32test.c
+ *
+ *  Self-test and benchmark for crc32_le(), built as a module with
+ *  CONFIG_BENCH_MODULES.
+ *
+ *  It checks a few known answers first. It then compares crc32_le()
+ *  with a plain byte-at-a-time CRC for every start offset within eight
+ *  bytes and every length from 0 to CHECK_MAXLEN, which covers the
+ *  byte-wise head, the sliced loop and the byte-wise tail in all their
+ *  combinations. The reference table is built here from the polynomial,
+ *  not taken from crc32table.h, so the generated tables are checked
+ *  too. Last, both are timed over BENCH_BUFLEN bytes.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/crc32.h>
+#include <linux/bench.h>
+
+#define CHECK_MAXLEN		64
+#define CHECK_OFFSETS		8	/* the main loop takes 8 bytes */
+#define BENCH_BUFLEN		4096
+#define BENCH_ITERATIONS	256
+
+static uint32_t ref_table[256];
+static unsigned char buf[BENCH_BUFLEN + CHECK_OFFSETS];
+
+/* with pre- and post-inversion, as zlib and Ethernet have it */
+static struct {
+	char *data;
+	uint32_t crc;
+} known[] = {
+	{ "",		0x00000000 },
+	{ "a",		0xe8b7be43 },
+	{ "abc",	0x352441c2 },
+	{ "123456789",	0xcbf43926 },
+	{ "The quick brown fox jumps over the lazy dog", 0x414fa339 },
+};
+
+static void ref_init(void)
+{
+	uint32_t c;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c >> 1) ^ ((c & 1) ? 0xedb88320 : 0);
+		ref_table[i] = c;
+	}
+}
+
+static uint32_t ref_crc(uint32_t crc, const unsigned char *p, size_t len)
+{
+	while (len-- > 0)
+		crc = ref_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+static int check(void)
+{
+	uint32_t seed = 0, a, b;
+	int i, ofs, len, bad = 0;
+
+	for (i = 0; i < sizeof(known) / sizeof(known[0]); i++) {
+		a = ~crc32_le(~0U, known[i].data, strlen(known[i].data));
+		if (a != known[i].crc) {
+			printk("crc32test: \"%s\": %08x, expected %08x\n",
+			       known[i].data, a, known[i].crc);
+			bad++;
+		}
+	}
+
+	for (ofs = 0; ofs < CHECK_OFFSETS; ofs++) {
+		for (len = 0; len <= CHECK_MAXLEN; len++) {
+			seed = seed * 1103515245 + 12345;
+			a = crc32_le(seed, buf + ofs, len);
+			b = ref_crc(seed, buf + ofs, len);
+			if (a != b && bad++ < 10)
+				printk("crc32test: offset %d, length %d: %08x, expected %08x\n",
+				       ofs, len, a, b);
+		}
+	}
+
+	return bad;
+}
+
+/* Bytes processed in usec microseconds, as KiB/s. 1000000/1024 ~= 976 */
+#define KIBPS(usec) (BENCH_BUFLEN * BENCH_ITERATIONS * 976 / (usec))
+
+int init_module(void)
+{
+	struct timeval start;
+	uint32_t seed = 0x12345678, a, b, ausec, busec;
+	int i;
+
+	for (i = 0; i < sizeof(buf); i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+	ref_init();
+
+	if (check()) {
+		printk("crc32test: crc32_le() FAILED\n");
+		return BENCH_DONE;
+	}
+	printk("crc32test: %d known answers, offsets 0-%d, lengths 0-%d: ok\n",
+	       (int)(sizeof(known) / sizeof(known[0])), CHECK_OFFSETS - 1,
+	       CHECK_MAXLEN);
+
+	a = b = 0;
+	do_gettimeofday(&start);
+	for (i = 0; i < BENCH_ITERATIONS; i++)
+		a = crc32_le(a, buf, BENCH_BUFLEN);
+	ausec = bench_usec(&start);
+
+	do_gettimeofday(&start);
+	for (i = 0; i < BENCH_ITERATIONS; i++)
+		b = ref_crc(b, buf, BENCH_BUFLEN);
+	busec = bench_usec(&start);
+
+	/* the sums are compared, so neither loop can be left out */
+	if (a != b)
+		printk("crc32test: %d KiB: %08x, expected %08x\n",
+		       BENCH_BUFLEN * BENCH_ITERATIONS / 1024, a, b);
+	printk("crc32test: crc32_le %6d KiB/s, byte at a time %6d KiB/s\n",
+	       KIBPS(ausec), KIBPS(busec));
+
+	return BENCH_DONE;
+}
@@ -36,8 +36,11 @@
 #include <linux/timer.h>
 #include <asm/system.h>
 #include <asm/uaccess.h>
+#include <asm/unaligned.h>
 #include <linux/filter.h>
 
+extern int sysctl_optmem_max;
+
 /* No hurry in this branch */
 
 static u8 *load_pointer(struct sk_buff *skb, int k)
@@ -364,6 +367,438 @@ load_b:
 	return (0);
 }
 
+/*
+ * Predecoded filters.
+ *
+ * sk_attach_filter() translates each checked program into an array of
+ * sk_filter_op, which sk_filter_run() executes instead of interpreting
+ * the sock_filter blocks. The translation does, once per program, the
+ * work the interpreter repeats for every block of every packet:
+ *
+ *  - Each block gets an opcode from a dense range, so dispatch is a
+ *    single jump table lookup.
+ *  - Jumps hold pointers to their targets. Programs are known to run
+ *    forwards into a RET, so there is no end-of-program check.
+ *  - Ancillary loads (SKF_AD_xxx) and division by a constant zero
+ *    are resolved.
+ *  - Absolute loads of packet data are bounds checked once. min_len is
+ *    the linear length they need, and packets shorter than that (or
+ *    with the data in fragments) are handed to the interpreter, which
+ *    checks every load. Indirect loads are still checked one by one.
+ */
+
+enum {
+	SKF_OP_RET_K, SKF_OP_RET_A,
+	SKF_OP_ADD_X, SKF_OP_ADD_K, SKF_OP_SUB_X, SKF_OP_SUB_K,
+	SKF_OP_MUL_X, SKF_OP_MUL_K, SKF_OP_DIV_X, SKF_OP_DIV_K,
+	SKF_OP_AND_X, SKF_OP_AND_K, SKF_OP_OR_X, SKF_OP_OR_K,
+	SKF_OP_LSH_X, SKF_OP_LSH_K, SKF_OP_RSH_X, SKF_OP_RSH_K, SKF_OP_NEG,
+	SKF_OP_JA, SKF_OP_JGT_K, SKF_OP_JGE_K, SKF_OP_JEQ_K, SKF_OP_JSET_K,
+	SKF_OP_JGT_X, SKF_OP_JGE_X, SKF_OP_JEQ_X, SKF_OP_JSET_X,
+	SKF_OP_LD_W_ABS, SKF_OP_LD_H_ABS, SKF_OP_LD_B_ABS,	/* Within min_len */
+	SKF_OP_LD_W_IND, SKF_OP_LD_H_IND, SKF_OP_LD_B_IND,
+	SKF_OP_LD_W_NEG, SKF_OP_LD_H_NEG, SKF_OP_LD_B_NEG,	/* SKF_NET_OFF, SKF_LL_OFF */
+	SKF_OP_LD_PROTOCOL, SKF_OP_LD_PKTTYPE, SKF_OP_LD_IFINDEX,
+	SKF_OP_LD_LEN, SKF_OP_LDX_LEN, SKF_OP_LDX_MSH,
+	SKF_OP_LD_IMM, SKF_OP_LDX_IMM, SKF_OP_LD_MEM, SKF_OP_LDX_MEM,
+	SKF_OP_ST, SKF_OP_STX, SKF_OP_TAX, SKF_OP_TXA,
+};
+
+/* The checked load of the interpreter, for the cases min_len can't cover.
+   Returns 0 and sets *A, or -1 if the filter should return 0. */
+static int sk_filter_load(struct sk_buff *skb, int k, int size, u32 *A)
+{
+	unsigned int len = skb->len - skb->data_len;
+	u8 *ptr;
+
+	if (k >= 0 && (unsigned int)(k + size) <= len) {
+		ptr = &skb->data[k];
+	} else if (k >= SKF_AD_OFF && k < 0) {
+		switch (k-SKF_AD_OFF) {
+		case SKF_AD_PROTOCOL:
+			*A = htons(skb->protocol);
+			return 0;
+		case SKF_AD_PKTTYPE:
+			*A = skb->pkt_type;
+			return 0;
+		case SKF_AD_IFINDEX:
+			*A = skb->dev->ifindex;
+			return 0;
+		}
+		return -1;
+	} else if (k < 0) {
+		if ((ptr = load_pointer(skb, k)) == NULL)
+			return -1;
+	} else {
+		u32 tmp;
+
+		if (skb_copy_bits(skb, k, &tmp, size))
+			return -1;
+		ptr = (u8 *)&tmp;
+		switch (size) {
+		case 4: *A = ntohl(tmp); break;
+		case 2: *A = ntohs(*(u16 *)ptr); break;
+		default: *A = *ptr; break;
+		}
+		return 0;
+	}
+
+	switch (size) {
+	case 4: *A = ntohl(get_unaligned((u32 *)ptr)); break;
+	case 2: *A = ntohs(get_unaligned((u16 *)ptr)); break;
+	default: *A = *ptr; break;
+	}
+	return 0;
+}
+
+/**
+ *	sk_filter_run	-	run an attached filter
+ *	@skb: buffer to run the filter on
+ *	@fp: filter to apply
+ *
+ * As sk_run_filter(), for a filter set up by sk_attach_filter().
+ * Return length to keep, 0 for none.
+ */
+
+int sk_filter_run(struct sk_buff *skb, struct sk_filter *fp)
+{
+	unsigned char *data = skb->data;
+	unsigned int len = skb->len-skb->data_len;
+	struct sk_filter_op *op = fp->ops;
+	struct sk_filter_op *f;
+	u32 A = 0;	   		/* Accumulator */
+	u32 X = 0;   			/* Index Register */
+	u32 mem[BPF_MEMWORDS];		/* Scratch Memory Store */
+
+	if (op == NULL || len < fp->min_len)
+		return sk_run_filter(skb, fp->insns, fp->len);
+
+	for (;;) {
+		f = op++;
+
+		switch (f->code) {
+		case SKF_OP_RET_K:
+			return f->k;
+		case SKF_OP_RET_A:
+			return A;
+
+		case SKF_OP_ADD_X:
+			A += X;
+			continue;
+		case SKF_OP_ADD_K:
+			A += f->k;
+			continue;
+		case SKF_OP_SUB_X:
+			A -= X;
+			continue;
+		case SKF_OP_SUB_K:
+			A -= f->k;
+			continue;
+		case SKF_OP_MUL_X:
+			A *= X;
+			continue;
+		case SKF_OP_MUL_K:
+			A *= f->k;
+			continue;
+		case SKF_OP_DIV_X:
+			if (X == 0)
+				return 0;
+			A /= X;
+			continue;
+		case SKF_OP_DIV_K:
+			A /= f->k;
+			continue;
+		case SKF_OP_AND_X:
+			A &= X;
+			continue;
+		case SKF_OP_AND_K:
+			A &= f->k;
+			continue;
+		case SKF_OP_OR_X:
+			A |= X;
+			continue;
+		case SKF_OP_OR_K:
+			A |= f->k;
+			continue;
+		case SKF_OP_LSH_X:
+			A <<= X;
+			continue;
+		case SKF_OP_LSH_K:
+			A <<= f->k;
+			continue;
+		case SKF_OP_RSH_X:
+			A >>= X;
+			continue;
+		case SKF_OP_RSH_K:
+			A >>= f->k;
+			continue;
+		case SKF_OP_NEG:
+			A = -A;
+			continue;
+
+		case SKF_OP_JA:
+			op = f->jt;
+			continue;
+		case SKF_OP_JGT_K:
+			op = (A > f->k) ? f->jt : f->jf;
+			continue;
+		case SKF_OP_JGE_K:
+			op = (A >= f->k) ? f->jt : f->jf;
+			continue;
+		case SKF_OP_JEQ_K:
+			op = (A == f->k) ? f->jt : f->jf;
+			continue;
+		case SKF_OP_JSET_K:
+			op = (A & f->k) ? f->jt : f->jf;
+			continue;
+		case SKF_OP_JGT_X:
+			op = (A > X) ? f->jt : f->jf;
+			continue;
+		case SKF_OP_JGE_X:
+			op = (A >= X) ? f->jt : f->jf;
+			continue;
+		case SKF_OP_JEQ_X:
+			op = (A == X) ? f->jt : f->jf;
+			continue;
+		case SKF_OP_JSET_X:
+			op = (A & X) ? f->jt : f->jf;
+			continue;
+
+		case SKF_OP_LD_W_ABS:
+			A = ntohl(get_unaligned((u32 *)&data[f->k]));
+			continue;
+		case SKF_OP_LD_H_ABS:
+			A = ntohs(get_unaligned((u16 *)&data[f->k]));
+			continue;
+		case SKF_OP_LD_B_ABS:
+			A = data[f->k];
+			continue;
+		case SKF_OP_LD_W_IND:
+			if (sk_filter_load(skb, X + f->k, 4, &A))
+				return 0;
+			continue;
+		case SKF_OP_LD_H_IND:
+			if (sk_filter_load(skb, X + f->k, 2, &A))
+				return 0;
+			continue;
+		case SKF_OP_LD_B_IND:
+			if (sk_filter_load(skb, X + f->k, 1, &A))
+				return 0;
+			continue;
+		case SKF_OP_LD_W_NEG:
+			if (sk_filter_load(skb, f->k, 4, &A))
+				return 0;
+			continue;
+		case SKF_OP_LD_H_NEG:
+			if (sk_filter_load(skb, f->k, 2, &A))
+				return 0;
+			continue;
+		case SKF_OP_LD_B_NEG:
+			if (sk_filter_load(skb, f->k, 1, &A))
+				return 0;
+			continue;
+		case SKF_OP_LD_PROTOCOL:
+			A = htons(skb->protocol);
+			continue;
+		case SKF_OP_LD_PKTTYPE:
+			A = skb->pkt_type;
+			continue;
+		case SKF_OP_LD_IFINDEX:
+			A = skb->dev->ifindex;
+			continue;
+		case SKF_OP_LD_LEN:
+			A = len;
+			continue;
+		case SKF_OP_LDX_LEN:
+			X = len;
+			continue;
+		case SKF_OP_LDX_MSH:
+			X = (data[f->k] & 0xf) << 2;
+			continue;
+
+		case SKF_OP_LD_IMM:
+			A = f->k;
+			continue;
+		case SKF_OP_LDX_IMM:
+			X = f->k;
+			continue;
+		case SKF_OP_LD_MEM:
+			A = mem[f->k];
+			continue;
+		case SKF_OP_LDX_MEM:
+			X = mem[f->k];
+			continue;
+		case SKF_OP_ST:
+			mem[f->k] = A;
+			continue;
+		case SKF_OP_STX:
+			mem[f->k] = X;
+			continue;
+		case SKF_OP_TAX:
+			X = A;
+			continue;
+		case SKF_OP_TXA:
+			A = X;
+			continue;
+
+		default:
+			return 0;
+		}
+	}
+}
+
+/*
+ * Translate a checked filter for sk_filter_run(). The translation is
+ * not charged to the socket's option memory, so that a filter can be
+ * as long as it could before; if there is no memory for it, or it
+ * can't be translated, fp->ops stays NULL and the filter is
+ * interpreted.
+ */
+
+static void sk_prepare_filter(struct sk_filter *fp)
+{
+	struct sk_filter_op *ops;
+	unsigned int min_len = 0;
+	int pc;
+
+	fp->ops = NULL;
+	ops = kmalloc(fp->len * sizeof(struct sk_filter_op), GFP_KERNEL);
+	if (ops == NULL)
+		return;
+
+	for (pc = 0; pc < fp->len; pc++) {
+		struct sock_filter *fentry = &fp->insns[pc];
+		struct sk_filter_op *op = &ops[pc];
+		int k = fentry->k;
+		int size = 0;
+
+		op->k = fentry->k;
+		op->jt = op->jf = NULL;
+		if (BPF_CLASS(fentry->code) == BPF_JMP) {
+			op->jt = &ops[pc + 1 + fentry->jt];
+			op->jf = &ops[pc + 1 + fentry->jf];
+		}
+
+		switch (fentry->code) {
+		case BPF_ALU|BPF_ADD|BPF_X:	op->code = SKF_OP_ADD_X; break;
+		case BPF_ALU|BPF_ADD|BPF_K:	op->code = SKF_OP_ADD_K; break;
+		case BPF_ALU|BPF_SUB|BPF_X:	op->code = SKF_OP_SUB_X; break;
+		case BPF_ALU|BPF_SUB|BPF_K:	op->code = SKF_OP_SUB_K; break;
+		case BPF_ALU|BPF_MUL|BPF_X:	op->code = SKF_OP_MUL_X; break;
+		case BPF_ALU|BPF_MUL|BPF_K:	op->code = SKF_OP_MUL_K; break;
+		case BPF_ALU|BPF_DIV|BPF_X:	op->code = SKF_OP_DIV_X; break;
+		case BPF_ALU|BPF_AND|BPF_X:	op->code = SKF_OP_AND_X; break;
+		case BPF_ALU|BPF_AND|BPF_K:	op->code = SKF_OP_AND_K; break;
+		case BPF_ALU|BPF_OR|BPF_X:	op->code = SKF_OP_OR_X; break;
+		case BPF_ALU|BPF_OR|BPF_K:	op->code = SKF_OP_OR_K; break;
+		case BPF_ALU|BPF_LSH|BPF_X:	op->code = SKF_OP_LSH_X; break;
+		case BPF_ALU|BPF_LSH|BPF_K:	op->code = SKF_OP_LSH_K; break;
+		case BPF_ALU|BPF_RSH|BPF_X:	op->code = SKF_OP_RSH_X; break;
+		case BPF_ALU|BPF_RSH|BPF_K:	op->code = SKF_OP_RSH_K; break;
+		case BPF_ALU|BPF_NEG:		op->code = SKF_OP_NEG; break;
+
+		case BPF_ALU|BPF_DIV|BPF_K:
+			if (fentry->k == 0) {
+				op->code = SKF_OP_RET_K;
+				op->k = 0;
+			} else
+				op->code = SKF_OP_DIV_K;
+			break;
+
+		case BPF_JMP|BPF_JA:
+			op->code = SKF_OP_JA;
+			op->jt = &ops[pc + 1 + fentry->k];
+			break;
+		case BPF_JMP|BPF_JGT|BPF_K:	op->code = SKF_OP_JGT_K; break;
+		case BPF_JMP|BPF_JGE|BPF_K:	op->code = SKF_OP_JGE_K; break;
+		case BPF_JMP|BPF_JEQ|BPF_K:	op->code = SKF_OP_JEQ_K; break;
+		case BPF_JMP|BPF_JSET|BPF_K:	op->code = SKF_OP_JSET_K; break;
+		case BPF_JMP|BPF_JGT|BPF_X:	op->code = SKF_OP_JGT_X; break;
+		case BPF_JMP|BPF_JGE|BPF_X:	op->code = SKF_OP_JGE_X; break;
+		case BPF_JMP|BPF_JEQ|BPF_X:	op->code = SKF_OP_JEQ_X; break;
+		case BPF_JMP|BPF_JSET|BPF_X:	op->code = SKF_OP_JSET_X; break;
+
+		case BPF_LD|BPF_W|BPF_ABS:
+			size = 4;
+			op->code = SKF_OP_LD_W_ABS;
+			break;
+		case BPF_LD|BPF_H|BPF_ABS:
+			size = 2;
+			op->code = SKF_OP_LD_H_ABS;
+			break;
+		case BPF_LD|BPF_B|BPF_ABS:
+			size = 1;
+			op->code = SKF_OP_LD_B_ABS;
+			break;
+
+		case BPF_LD|BPF_W|BPF_IND:	op->code = SKF_OP_LD_W_IND; break;
+		case BPF_LD|BPF_H|BPF_IND:	op->code = SKF_OP_LD_H_IND; break;
+		case BPF_LD|BPF_B|BPF_IND:	op->code = SKF_OP_LD_B_IND; break;
+		case BPF_LD|BPF_W|BPF_LEN:	op->code = SKF_OP_LD_LEN; break;
+		case BPF_LDX|BPF_W|BPF_LEN:	op->code = SKF_OP_LDX_LEN; break;
+
+		case BPF_LDX|BPF_B|BPF_MSH:
+			if (k < 0) {
+				/* Leave the interpreter's behaviour well alone */
+				kfree(ops);
+				return;
+			}
+			op->code = SKF_OP_LDX_MSH;
+			if (k + 1 > min_len)
+				min_len = k + 1;
+			break;
+
+		case BPF_LD|BPF_IMM:		op->code = SKF_OP_LD_IMM; break;
+		case BPF_LDX|BPF_IMM:		op->code = SKF_OP_LDX_IMM; break;
+		case BPF_LD|BPF_MEM:		op->code = SKF_OP_LD_MEM; break;
+		case BPF_LDX|BPF_MEM:		op->code = SKF_OP_LDX_MEM; break;
+		case BPF_MISC|BPF_TAX:		op->code = SKF_OP_TAX; break;
+		case BPF_MISC|BPF_TXA:		op->code = SKF_OP_TXA; break;
+		case BPF_RET|BPF_K:		op->code = SKF_OP_RET_K; break;
+		case BPF_RET|BPF_A:		op->code = SKF_OP_RET_A; break;
+		case BPF_ST:			op->code = SKF_OP_ST; break;
+		case BPF_STX:			op->code = SKF_OP_STX; break;
+
+		default:
+			/* Invalid instruction counts as RET */
+			op->code = SKF_OP_RET_K;
+			op->k = 0;
+			break;
+		}
+
+		if (!size)
+			continue;
+
+		/* An absolute load. Offsets into the packet count towards
+		   min_len; the others are resolved now if they're ancillary
+		   data, or left to sk_filter_load() */
+		if (k >= 0) {
+			if ((unsigned int)k + size > min_len)
+				min_len = k + size;
+		} else if (k >= SKF_AD_OFF) {
+			switch (k-SKF_AD_OFF) {
+			case SKF_AD_PROTOCOL:
+				op->code = SKF_OP_LD_PROTOCOL;
+				break;
+			case SKF_AD_PKTTYPE:
+				op->code = SKF_OP_LD_PKTTYPE;
+				break;
+			case SKF_AD_IFINDEX:
+				op->code = SKF_OP_LD_IFINDEX;
+				break;
+			default:
+				op->code = SKF_OP_RET_K;
+				op->k = 0;
+				break;
+			}
+		} else {
+			op->code = SKF_OP_LD_W_NEG + (op->code - SKF_OP_LD_W_ABS);
+		}
+	}
+	fp->min_len = min_len;
+	fp->ops = ops;
+}
+
 /**
  *	sk_chk_filter - verify socket filter code
  *	@filter: filter to verify
@@ -462,27 +897,42 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 {
 	struct sk_filter *fp; 
 	unsigned int fsize = sizeof(struct sock_filter) * fprog->len;
+	unsigned int charge;
 	int err;
 
 	/* Make sure new filter is there and in the right amounts. */
         if (fprog->filter == NULL || fprog->len > BPF_MAXINSNS)
                 return (-EINVAL);
 
-	fp = (struct sk_filter *)sock_kmalloc(sk, fsize+sizeof(*fp), GFP_KERNEL);
+	fp = (struct sk_filter *)kmalloc(fsize+sizeof(*fp), GFP_KERNEL);
 	if(fp == NULL)
 		return (-ENOMEM);
 
 	if (copy_from_user(fp->insns, fprog->filter, fsize)) {
-		sock_kfree_s(sk, fp, fsize+sizeof(*fp)); 
+		kfree(fp);
 		return -EFAULT;
 	}
 
 	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
+	fp->ops = NULL;
+	fp->min_len = 0;
+
+	/* Charge the option memory as sock_kmalloc() would, but only for
+	   what sk_filter_len() counts; sk_filter_release() gives it back */
+	charge = sk_filter_len(fp);
+	if (charge > sysctl_optmem_max ||
+	    atomic_read(&sk->omem_alloc)+charge >= sysctl_optmem_max) {
+		kfree(fp);
+		return (-ENOMEM);
+	}
+	atomic_add(charge, &sk->omem_alloc);
 
 	if ((err = sk_chk_filter(fp->insns, fp->len))==0) {
 		struct sk_filter *old_fp;
 
+		sk_prepare_filter(fp);
+
 		spin_lock_bh(&sk->lock.slock);
 		old_fp = sk->filter;
 		sk->filter = fp;
@@ -0,0 +1,450 @@
+/*
+ * Socket filter check and benchmark.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ *
+ * Built as a module with CONFIG_BENCH_MODULES. It attaches filters to a UDP
+ * socket with SO_ATTACH_FILTER, so they are checked and predecoded the
+ * way every other filter is, and then does two things:
+ *
+ * - It attaches CHECK_PROGRAMS random programs that sk_chk_filter()
+ *   accepts and runs each over CHECK_PACKETS random packets of random
+ *   length, through sk_run_filter() and through sk_filter_run(). Every
+ *   result must be the same. The programs first store known values in
+ *   all of the scratch memory, since the two would otherwise differ on
+ *   what is left on the stack. Then the longest filter the default
+ *   option memory limit allows is attached, to see that predecoding
+ *   doesn't shorten it.
+ *
+ * - It runs a few typical filters over a batch of synthetic Ethernet
+ *   frames BENCH_ITERATIONS times, through either runner, and reports
+ *   the packet rate of each.
+ */
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/if_ether.h>
+#include <linux/net.h>
+#include <linux/in.h>
+#include <linux/filter.h>
+#include <linux/bench.h>
+#include <net/sock.h>
+#include <asm/uaccess.h>
+
+#ifndef CONFIG_FILTER
+#error "filtertest needs CONFIG_FILTER"
+#endif
+
+#define CHECK_PROGRAMS		20000
+#define CHECK_PACKETS		4
+#define CHECK_MAXLEN		12	/* random blocks per program */
+#define BENCH_ITERATIONS	200
+#define BENCH_PACKETS		64
+
+static uint32_t seed = 0x12345678;
+
+static uint32_t rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static int attach(struct socket *sock, struct sock_filter *insns, int len)
+{
+	struct sock_fprog fprog;
+	mm_segment_t oldfs;
+	int err;
+
+	fprog.len = len;
+	fprog.filter = insns;
+	oldfs = get_fs();
+	set_fs(KERNEL_DS);
+	err = sock_setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER,
+			      (char *)&fprog, sizeof(fprog));
+	set_fs(oldfs);
+
+	return err;
+}
+
+static void detach(struct socket *sock)
+{
+	mm_segment_t oldfs;
+	int val = 0;
+
+	oldfs = get_fs();
+	set_fs(KERNEL_DS);
+	sock_setsockopt(sock, SOL_SOCKET, SO_DETACH_FILTER,
+			(char *)&val, sizeof(val));
+	set_fs(oldfs);
+}
+
+/*
+ * The check
+ */
+
+static const u16 codes[] = {
+	BPF_LD|BPF_W|BPF_ABS, BPF_LD|BPF_H|BPF_ABS, BPF_LD|BPF_B|BPF_ABS,
+	BPF_LD|BPF_W|BPF_IND, BPF_LD|BPF_H|BPF_IND, BPF_LD|BPF_B|BPF_IND,
+	BPF_LD|BPF_W|BPF_LEN, BPF_LD|BPF_IMM, BPF_LD|BPF_MEM,
+	BPF_LDX|BPF_W|BPF_LEN, BPF_LDX|BPF_B|BPF_MSH, BPF_LDX|BPF_IMM,
+	BPF_LDX|BPF_MEM, BPF_ST, BPF_STX,
+	BPF_ALU|BPF_ADD|BPF_K, BPF_ALU|BPF_ADD|BPF_X, BPF_ALU|BPF_SUB|BPF_K,
+	BPF_ALU|BPF_SUB|BPF_X, BPF_ALU|BPF_MUL|BPF_K, BPF_ALU|BPF_MUL|BPF_X,
+	BPF_ALU|BPF_DIV|BPF_K, BPF_ALU|BPF_DIV|BPF_X, BPF_ALU|BPF_AND|BPF_K,
+	BPF_ALU|BPF_AND|BPF_X, BPF_ALU|BPF_OR|BPF_K, BPF_ALU|BPF_OR|BPF_X,
+	BPF_ALU|BPF_LSH|BPF_K, BPF_ALU|BPF_LSH|BPF_X, BPF_ALU|BPF_RSH|BPF_K,
+	BPF_ALU|BPF_RSH|BPF_X, BPF_ALU|BPF_NEG,
+	BPF_JMP|BPF_JA, BPF_JMP|BPF_JEQ|BPF_K, BPF_JMP|BPF_JEQ|BPF_X,
+	BPF_JMP|BPF_JGT|BPF_K, BPF_JMP|BPF_JGT|BPF_X, BPF_JMP|BPF_JGE|BPF_K,
+	BPF_JMP|BPF_JGE|BPF_X, BPF_JMP|BPF_JSET|BPF_K, BPF_JMP|BPF_JSET|BPF_X,
+	BPF_RET|BPF_K, BPF_RET|BPF_A,
+	BPF_MISC|BPF_TAX, BPF_MISC|BPF_TXA,
+};
+
+#define NCODES (sizeof(codes) / sizeof(codes[0]))
+#define PROLOGUE (BPF_MEMWORDS * 2)
+
+static struct sock_filter prog[PROLOGUE + CHECK_MAXLEN];
+
+/* Mostly operands which mean something to the instruction */
+static u32 random_k(u16 code)
+{
+	if (BPF_CLASS(code) == BPF_LDX && BPF_MODE(code) == BPF_MSH)
+		return rnd() % 80;
+	if (BPF_MODE(code) == BPF_MEM &&
+	    (BPF_CLASS(code) == BPF_LD || BPF_CLASS(code) == BPF_LDX))
+		return rnd() % BPF_MEMWORDS;
+	if (BPF_CLASS(code) == BPF_ST || BPF_CLASS(code) == BPF_STX)
+		return rnd() % BPF_MEMWORDS;
+
+	switch (rnd() % 6) {
+	case 0:	return rnd() % 80;
+	case 1:	return rnd() % 16;
+	case 2:	return SKF_AD_OFF + 4 * (rnd() % 4);
+	case 3:	return SKF_NET_OFF + rnd() % 40;
+	case 4:	return SKF_LL_OFF + rnd() % 20;
+	}
+	return rnd();
+}
+
+static int random_prog(void)
+{
+	struct sock_filter *f;
+	int i, n;
+
+	for (i = 0; i < BPF_MEMWORDS; i++) {
+		f = &prog[i * 2];
+		f[0].code = BPF_LD|BPF_IMM;
+		f[0].jt = f[0].jf = 0;
+		f[0].k = rnd();
+		f[1].code = BPF_ST;
+		f[1].jt = f[1].jf = 0;
+		f[1].k = i;
+	}
+
+	n = rnd() % CHECK_MAXLEN + 1;
+	for (f = &prog[PROLOGUE]; f < &prog[PROLOGUE + n]; f++) {
+		f->code = codes[rnd() % NCODES];
+		f->jt = rnd() % 3;
+		f->jf = rnd() % 3;
+		f->k = random_k(f->code);
+	}
+	f[-1].code = BPF_RET | (rnd() % 2 ? BPF_A : BPF_K);
+
+	return PROLOGUE + n;
+}
+
+static struct sk_buff *random_skb(struct net_device *dev)
+{
+	struct sk_buff *skb;
+	unsigned int len = rnd() % 100;
+	unsigned char *p;
+
+	skb = alloc_skb(16 + len, GFP_KERNEL);
+	if (skb == NULL)
+		return NULL;
+	skb_reserve(skb, 16);
+	skb_put(skb, len);
+	for (p = skb->head; p < skb->end; p++)
+		*p = rnd();
+	skb->mac.raw = skb->data - ETH_HLEN;
+	skb->nh.raw = skb->data;
+	skb->protocol = rnd();
+	skb->pkt_type = rnd() % 5;
+	skb->dev = dev;
+
+	return skb;
+}
+
+static void check(struct socket *sock, struct net_device *dev)
+{
+	struct sk_filter *fp;
+	struct sk_buff *skb;
+	int i, j, n, a, b;
+	int progs = 0, runs = 0, predecoded = 0, diffs = 0;
+
+	for (i = 0; i < CHECK_PROGRAMS; i++) {
+		n = random_prog();
+		if (sk_chk_filter(prog, n) != 0)
+			continue;
+		if (attach(sock, prog, n) != 0) {
+			printk("filtertest: attaching a checked program failed\n");
+			return;
+		}
+		fp = sock->sk->filter;
+		progs++;
+
+		for (j = 0; j < CHECK_PACKETS; j++) {
+			if ((skb = random_skb(dev)) == NULL)
+				return;
+			a = sk_run_filter(skb, fp->insns, fp->len);
+			b = sk_filter_run(skb, fp);
+			runs++;
+			if (fp->ops && fp->min_len <= skb->len - skb->data_len)
+				predecoded++;
+			if (a != b && diffs++ < 4) {
+				printk("filtertest: interpreter %d, predecoded %d, on %d bytes:\n",
+				       a, b, skb->len);
+				for (n = PROLOGUE; n < fp->len; n++)
+					printk("  %04x %d %d %08x\n", fp->insns[n].code,
+					       fp->insns[n].jt, fp->insns[n].jf, fp->insns[n].k);
+			}
+			kfree_skb(skb);
+		}
+	}
+
+	printk("filtertest: %d programs, %d runs, %d predecoded, %d differ\n",
+	       progs, runs, predecoded, diffs);
+}
+
+/*
+ * The longest filter the option memory allows must still attach, and
+ * be predecoded; sk_filter_len() charges only the insns and the
+ * header up to ops, as before there was a predecoded form.
+ */
+
+extern int sysctl_optmem_max;
+
+static struct sock_filter longprog[BPF_MAXINSNS + 1];
+
+static void check_long(struct socket *sock, struct net_device *dev)
+{
+	struct sk_filter *fp;
+	struct sk_buff *skb;
+	int i, n, err, a, b, predecoded;
+
+	detach(sock);
+	n = (sysctl_optmem_max - 1 - atomic_read(&sock->sk->omem_alloc) -
+	     offsetof(struct sk_filter, ops)) / sizeof(struct sock_filter);
+	if (n > BPF_MAXINSNS)
+		n = BPF_MAXINSNS;
+
+	for (i = 0; i <= n; i++) {
+		longprog[i].code = BPF_ALU|BPF_ADD|BPF_K;
+		longprog[i].jt = longprog[i].jf = 0;
+		longprog[i].k = i;
+	}
+	longprog[n - 1].code = BPF_RET|BPF_A;
+	longprog[n].code = BPF_RET|BPF_A;
+
+	if ((err = attach(sock, longprog, n)) != 0) {
+		printk("filtertest: %d blocks don't attach, %d\n", n, err);
+		return;
+	}
+	fp = sock->sk->filter;
+	if ((skb = random_skb(dev)) == NULL)
+		return;
+	a = sk_run_filter(skb, fp->insns, fp->len);
+	b = sk_filter_run(skb, fp);
+	predecoded = fp->ops != NULL;
+	kfree_skb(skb);
+	detach(sock);
+
+	err = n < BPF_MAXINSNS ? attach(sock, longprog, n + 1) : -ENOMEM;
+	printk("filtertest: %d blocks attach%s%s, %d don't%s\n", n,
+	       predecoded ? " predecoded" : "", a == b ? "" : " but differ",
+	       n + 1, err == -ENOMEM ? "" : " (but they did)");
+}
+
+/*
+ * The benchmark
+ */
+
+/* udp dst port 68, what a DHCP client attaches */
+static struct sock_filter dhcp[] = {
+	BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 12),
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETH_P_IP, 0, 8),
+	BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 23),
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, IPPROTO_UDP, 0, 6),
+	BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 20),
+	BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x1fff, 4, 0),
+	BPF_STMT(BPF_LDX|BPF_B|BPF_MSH, 14),
+	BPF_STMT(BPF_LD|BPF_H|BPF_IND, 16),
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 68, 0, 1),
+	BPF_STMT(BPF_RET|BPF_K, 0xffff),
+	BPF_STMT(BPF_RET|BPF_K, 0),
+};
+
+/* tcp port 80 */
+static struct sock_filter http[] = {
+	BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 12),
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETH_P_IP, 0, 10),
+	BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 23),
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, IPPROTO_TCP, 0, 8),
+	BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 20),
+	BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x1fff, 6, 0),
+	BPF_STMT(BPF_LDX|BPF_B|BPF_MSH, 14),
+	BPF_STMT(BPF_LD|BPF_H|BPF_IND, 14),
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 80, 2, 0),
+	BPF_STMT(BPF_LD|BPF_H|BPF_IND, 16),
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 80, 0, 1),
+	BPF_STMT(BPF_RET|BPF_K, 0xffff),
+	BPF_STMT(BPF_RET|BPF_K, 0),
+};
+
+/* everything, the first 96 bytes */
+static struct sock_filter snap[] = {
+	BPF_STMT(BPF_RET|BPF_K, 96),
+};
+
+static struct {
+	char *name;
+	struct sock_filter *insns;
+	int len;
+} filters[] = {
+	{ "udp dst port 68", dhcp, sizeof(dhcp) / sizeof(dhcp[0]) },
+	{ "tcp port 80", http, sizeof(http) / sizeof(http[0]) },
+	{ "snaplen 96", snap, sizeof(snap) / sizeof(snap[0]) },
+};
+
+static struct sk_buff *frames[BENCH_PACKETS];
+
+/* An Ethernet frame carrying IPv4 with proto and ports, or ARP */
+static struct sk_buff *frame(struct net_device *dev, int proto, int sport, int dport)
+{
+	static const int lens[] = { 60, 64, 128, 342, 576, 1514 };
+	struct sk_buff *skb;
+	unsigned int len = lens[rnd() % (sizeof(lens) / sizeof(lens[0]))];
+	unsigned char *p;
+
+	skb = alloc_skb(len + 16, GFP_KERNEL);
+	if (skb == NULL)
+		return NULL;
+	skb_reserve(skb, 2);
+	p = skb_put(skb, len);
+	memset(p, 0, len);
+	skb->mac.raw = p;
+	skb->nh.raw = p + ETH_HLEN;
+	skb->dev = dev;
+
+	if (proto < 0) {
+		p[12] = ETH_P_ARP >> 8;
+		p[13] = ETH_P_ARP & 0xff;
+		return skb;
+	}
+	p[12] = ETH_P_IP >> 8;
+	p[13] = ETH_P_IP & 0xff;
+	p[14] = 0x45;
+	p[23] = proto;
+	p[34] = sport >> 8;
+	p[35] = sport & 0xff;
+	p[36] = dport >> 8;
+	p[37] = dport & 0xff;
+
+	return skb;
+}
+
+static int make_frames(struct net_device *dev)
+{
+	int i;
+
+	for (i = 0; i < BENCH_PACKETS; i++) {
+		switch (i % 8) {
+		case 0:	frames[i] = frame(dev, IPPROTO_UDP, 67, 68); break;
+		case 1:	frames[i] = frame(dev, IPPROTO_UDP, 1024 + i, 53); break;
+		case 2:
+		case 3:	frames[i] = frame(dev, IPPROTO_TCP, 1024 + i, 80); break;
+		case 4:
+		case 5:	frames[i] = frame(dev, IPPROTO_TCP, 80, 1024 + i); break;
+		case 6:	frames[i] = frame(dev, IPPROTO_TCP, 1024 + i, 22); break;
+		default: frames[i] = frame(dev, -1, 0, 0); break;
+		}
+		if (frames[i] == NULL)
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+/* thousands of packets per second */
+#define KPPS(usec) (BENCH_PACKETS * BENCH_ITERATIONS / ((usec) / 1000 ? (usec) / 1000 : 1))
+
+static void bench(struct socket *sock, int n)
+{
+	struct sk_filter *fp;
+	struct timeval start;
+	uint32_t iusec, pusec;
+	int i, j, a = 0, b = 0;
+
+	if (attach(sock, filters[n].insns, filters[n].len) != 0) {
+		printk("filtertest: can't attach %s\n", filters[n].name);
+		return;
+	}
+	fp = sock->sk->filter;
+
+	do_gettimeofday(&start);
+	for (i = 0; i < BENCH_ITERATIONS; i++)
+		for (j = 0; j < BENCH_PACKETS; j++)
+			a += sk_run_filter(frames[j], fp->insns, fp->len) != 0;
+	iusec = bench_usec(&start);
+
+	do_gettimeofday(&start);
+	for (i = 0; i < BENCH_ITERATIONS; i++)
+		for (j = 0; j < BENCH_PACKETS; j++)
+			b += sk_filter_run(frames[j], fp) != 0;
+	pusec = bench_usec(&start);
+
+	printk("%-16s: %2d of %d accepted, interpreter %6d kpps, predecoded %6d kpps%s\n",
+	       filters[n].name, a / BENCH_ITERATIONS, BENCH_PACKETS,
+	       KPPS(iusec), KPPS(pusec), a == b ? "" : ", results differ");
+}
+
+int init_module(void)
+{
+	struct socket *sock;
+	struct net_device *dev;
+	int i, err;
+
+	if ((dev = dev_get_by_name("lo")) == NULL) {
+		printk("filtertest: no loopback device\n");
+		return -ENODEV;
+	}
+	if ((err = sock_create(PF_INET, SOCK_DGRAM, IPPROTO_UDP, &sock)) < 0) {
+		printk("filtertest: can't create a socket, %d\n", err);
+		dev_put(dev);
+		return err;
+	}
+
+	check(sock, dev);
+	check_long(sock, dev);
+
+	if (make_frames(dev) == 0) {
+		printk("filtertest: %d frames, %d iterations\n",
+		       BENCH_PACKETS, BENCH_ITERATIONS);
+		for (i = 0; i < sizeof(filters) / sizeof(filters[0]); i++)
+			bench(sock, i);
+	}
+	for (i = 0; i < BENCH_PACKETS; i++)
+		if (frames[i])
+			kfree_skb(frames[i]);
+
+	sock_release(sock);
+	dev_put(dev);
+	return BENCH_DONE;
+}
@@ -442,7 +442,7 @@ static int packet_rcv(struct sk_buff *skb, struct net_device *dev,  struct packe
 
 		bh_lock_sock(sk);
 		if ((filter = sk->filter) != NULL)
-			res = sk_run_filter(skb, sk->filter->insns, sk->filter->len);
+			res = sk_filter_run(skb, filter);
 		bh_unlock_sock(sk);
 
 		if (res == 0)
@@ -550,7 +550,7 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,  struct pack
 
 		bh_lock_sock(sk);
 		if ((filter = sk->filter) != NULL)
-			res = sk_run_filter(skb, sk->filter->insns, sk->filter->len);
+			res = sk_filter_run(skb, filter);
 		bh_unlock_sock(sk);
 
 		if (res == 0)